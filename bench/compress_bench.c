@@ -0,0 +1,152 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Benchmark and self test of the output compression codecs, on console
+   like text and on hex output of random data, in default sized frames.
+   Usage: ttylog-bench-compress [MB to compress] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compress.h"
+
+
+/* A 3 Mbaud 8N1 port delivers 300000 bytes per second. */
+#define PORT_BYTES_PER_SEC 300000.0
+
+
+const char* progname = "ttylog-bench-compress";
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Boot log like lines, the typical capture of a chatty console. */
+static void make_text(char* buff, size_t len)
+{
+  static const char* words[] = { "usb", "eth0:", "link", "up", "timeout", "irq", "mmc0:", "new", "device",
+                                 "retry", "ok", "error", "-110", "firmware", "loaded", "speed", "100Mbps" };
+  size_t n = 0;
+  unsigned t = 0;
+
+  while(n < len)
+    {
+      char line[128];
+      int k, l = snprintf(line, sizeof(line), "[%5u.%06u] ", t / 1000000, t % 1000000);
+
+      for(k = rand() % 6 + 2; k > 0; k--)
+        {
+          l += snprintf(line + l, sizeof(line) - l, "%s %x ", words[rand() % 17], rand() % 4096);
+        }
+      line[l - 1] = '\n';
+      t += rand() % 20000;
+      if(n + l > len) { l = len - n; }
+      memcpy(buff + n, line, l);
+      n += l;
+    }
+}
+
+
+/* Hex output of random data, the worst case. */
+static void make_hex(char* buff, size_t len)
+{
+  static const char* hex = "0123456789abcdef";
+  size_t i;
+
+  for(i = 0; i + 3 <= len; i += 3)
+    {
+      unsigned char d = rand();
+      buff[i] = hex[d >> 4];
+      buff[i + 1] = hex[d & 15];
+      buff[i + 2] = (i / 3) % 16 == 15 ? '\n' : ' ';
+    }
+  for(; i < len; i++) { buff[i] = '\n'; }
+}
+
+
+static int bench(const char* codec_name, int level, const char* data_name, const char* src, size_t total)
+{
+  int codec = compress_parse(codec_name);
+  size_t frame = COMPRESS_FRAME_SIZE;
+  size_t cap = compress_bound(codec, frame);
+  char* dst = malloc(cap);
+  char* check = malloc(frame);
+  size_t done = 0, out = 0;
+  double t0, t;
+
+  if(!dst || !check) { return -1; }
+
+  /* Every frame must decode on its own. */
+  out = compress_buffer(codec, level, dst, cap, src, frame);
+  if(!out || decompress_buffer(codec, check, frame, dst, out) || memcmp(check, src, frame))
+    {
+      fprintf(stderr, "%s: round trip failed on %s\n", codec_name, data_name);
+      return -1;
+    }
+
+  out = 0;
+  t0 = now_sec();
+  while(done < total)
+    {
+      out += compress_buffer(codec, level, dst, cap, src, frame);
+      done += frame;
+    }
+  t = now_sec() - t0;
+
+  printf("%-5s level %-2d %-5s %7.1f MB/s  ratio %5.2f  %6.0f ascii or %5.0f hex 3 Mbaud ports per core\n",
+         codec_name, level, data_name, done / t / 1e6, (double)done / out,
+         done / t / PORT_BYTES_PER_SEC, done / t / (3 * PORT_BYTES_PER_SEC));
+
+  free(dst);
+  free(check);
+  return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+  static const char* codecs[] = { "gzip", "zstd", "lz4" };
+  size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 64) << 20;
+  char* text = malloc(COMPRESS_FRAME_SIZE);
+  char* hex = malloc(COMPRESS_FRAME_SIZE);
+  int err = 0, found = 0;
+  unsigned i;
+
+  if(!text || !hex) { return 1; }
+  srand(1);
+  make_text(text, COMPRESS_FRAME_SIZE);
+  make_hex(hex, COMPRESS_FRAME_SIZE);
+
+  for(i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+    {
+      if(compress_parse(codecs[i]) < 0) { continue; }
+      found++;
+      err |= bench(codecs[i], 0, "text", text, total);
+      err |= bench(codecs[i], 0, "hex", hex, total);
+      err |= bench(codecs[i], 6, "text", text, total);
+    }
+  if(!found) { printf("no compression codec built in\n"); }
+
+  free(text);
+  free(hex);
+  return err ? 1 : 0;
+}
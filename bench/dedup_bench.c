@@ -0,0 +1,384 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Benchmark and self test of the dedup stage of --dedup. Feeds status
+   lines that repeat, with and without a counter in masked columns, unique
+   lines and hex data with 0x00 and 0xFF filler through it in reads of
+   random size. The summaries are expanded back into the repeats and the
+   result must be the input, apart from the masked columns, with repeat
+   times in order. A run split over reads shorter than DEDUP_RUN_MIN must
+   still be summarized. Then reports the throughput and how much is left out.
+   Usage: ttylog-bench-dedup [MB] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ttylog.h"
+#include "dedup.h"
+
+
+#define READ_SIZE 4095
+
+/* Columns of the counter in the status lines, see make_lines(). */
+#define SEQ_COLUMNS "30-35"
+#define SEQ_OFFSET 29
+#define SEQ_LEN 6
+
+
+typedef struct
+{
+  char* buff;            /* The input again, from the output expanded. */
+  size_t len;
+  size_t size;
+  size_t out_bytes;      /* Data output and summaries. */
+  uint64_t summaries;
+  int64_t last_ns;       /* Time of the last repeat summarized. */
+  int64_t now_ns;        /* Receive time of the read being fed. */
+  int err;
+} sink_t;
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static int64_t time_ns(const rx_time_t* t)
+{
+  return (int64_t)t->mono.tv_sec * 1000000000LL + t->mono.tv_nsec;
+}
+
+
+static void put(sink_t* sink, const char* data, size_t len)
+{
+  if(sink->len + len > sink->size)
+    {
+      sink->err = 1;
+      return;
+    }
+  memcpy(sink->buff + sink->len, data, len);
+  sink->len += len;
+}
+
+
+static void emit(void* arg, const char* data, size_t len, const rx_time_t* rx_time, const dedup_repeat_t* rep)
+{
+  sink_t* sink = arg;
+  uint64_t i;
+
+  if(!rep)
+    {
+      put(sink, data, len);
+      sink->out_bytes += len;
+      return;
+    }
+
+  sink->summaries++;
+  sink->out_bytes += 64;
+  if(time_ns(&rep->first) > time_ns(&rep->last) || time_ns(&rep->first) < sink->last_ns
+     || time_ns(&rep->last) > sink->now_ns)
+    {
+      fprintf(stderr, "repeat times out of order\n");
+      sink->err = 1;
+    }
+  sink->last_ns = time_ns(&rep->last);
+
+  if(rep->byte >= 0)
+    {
+      for(i = 0; i < rep->count && sink->len < sink->size; i++) { sink->buff[sink->len++] = rep->byte; }
+      return;
+    }
+
+  /* The line repeated is the last one output. */
+  if(!sink->len || sink->buff[sink->len - 1] != '\n')
+    {
+      fprintf(stderr, "line summary not after a line\n");
+      sink->err = 1;
+      return;
+    }
+  for(i = 0; i < rep->count && !sink->err; i++)
+    {
+      const char* end = sink->buff + sink->len - 1;
+      const char* start = end;
+
+      while(start > sink->buff && start[-1] != '\n') { start--; }
+      put(sink, start, end + 1 - start);
+    }
+}
+
+
+/* Status lines repeated in runs, now and then a different or a long one. */
+static size_t make_lines(char* buff, size_t len, int counter)
+{
+  size_t i = 0;
+  int seq = 0;
+
+  while(i < len)
+    {
+      int temp = rand() % 100, rpm = rand() % 5000;
+      int n = 1 + rand() % 200, k;
+
+      if(rand() % 50 == 0)
+        {
+          size_t long_len = 5000;
+
+          if(i + long_len + 1 > len) { break; }
+          memset(buff + i, 'x', long_len);
+          i += long_len;
+          buff[i++] = '\n';
+          continue;
+        }
+
+      for(k = 0; k < n; k++)
+        {
+          char line[64];
+          int l = snprintf(line, sizeof(line), "status temp=%3d rpm=%4d seq=%06d\n", temp, rpm, counter ? seq++ % 1000000 : 0);
+
+          /* Some lines end early, where the last one went on. */
+          if(rand() % 100 == 0) { l = 12; line[l - 1] = '\n'; }
+          if(i + l > len) { return i; }
+          memcpy(buff + i, line, l);
+          i += l;
+        }
+    }
+
+  return i;
+}
+
+
+/* Lines that all differ. */
+static size_t make_unique(char* buff, size_t len)
+{
+  size_t i = 0;
+  int seq = 0;
+
+  while(i + 64 <= len) { i += sprintf(buff + i, "[%10d] usb 1-1: new high-speed USB device %d\r\n", seq++, rand()); }
+
+  return i;
+}
+
+
+/* Binary data with runs of 0x00 and 0xFF filler. */
+static size_t make_bytes(char* buff, size_t len)
+{
+  size_t i = 0;
+
+  while(i < len)
+    {
+      size_t n = 1 + rand() % 64;
+      size_t run = 1 + rand() % 5000;
+      char fill = rand() & 1 ? 0 : (char)0xff;
+
+      while(n-- && i < len) { buff[i++] = rand(); }
+      while(run-- && i < len) { buff[i++] = fill; }
+    }
+
+  return i;
+}
+
+
+/* Feed data through d in reads of random size up to read_max, or of
+   read_max, with byte times. */
+static void feed(dedup_t* d, sink_t* sink, const char* data, size_t len, size_t read_max, int random_reads)
+{
+  rx_time_t rx_time;
+  size_t off = 0;
+
+  memset(&rx_time, 0, sizeof(rx_time));
+  rx_time.mono.tv_sec = 1000;
+  rx_time.real.tv_sec = 1760000000;
+  while(off < len)
+    {
+      size_t n = random_reads ? 1 + rand() % read_max : read_max;
+
+      if(n > len - off) { n = len - off; }
+      rx_time.mono.tv_nsec += 1000000;
+      if(rx_time.mono.tv_nsec >= 1000000000)
+        {
+          rx_time.mono.tv_nsec -= 1000000000;
+          rx_time.mono.tv_sec++;
+        }
+      rx_time.real.tv_nsec = rx_time.mono.tv_nsec;
+      rx_time.byte_ns = 100;
+      rx_time.span_ns = (n - 1) * rx_time.byte_ns;
+      sink->now_ns = time_ns(&rx_time);
+      dedup_feed(d, data + off, n, &rx_time);
+      off += n;
+    }
+  dedup_flush(d);
+}
+
+
+static void blank_seq(char* buff, size_t len)
+{
+  size_t col = 0, i;
+
+  for(i = 0; i < len; i++, col++)
+    {
+      if(buff[i] == '\n') { col = -1; }
+      else if(col >= SEQ_OFFSET && col < SEQ_OFFSET + SEQ_LEN) { buff[i] = '#'; }
+    }
+}
+
+
+/* Filler arriving in reads shorter than DEDUP_RUN_MIN, between text,
+   must come out as one summary. Returns -1 on failure. */
+static int check_split(void)
+{
+  char data[80], buff[80];
+  dedup_t d;
+  sink_t sink;
+  int err = 0;
+
+  memcpy(data, "boot", 4);
+  memset(data + 4, 0, 60);
+  memcpy(data + 64, "ok", 2);
+  memset(&sink, 0, sizeof(sink));
+  sink.size = sizeof(buff);
+  sink.buff = buff;
+  dedup_init(&d, DEDUP_BYTES, NULL, 0, emit, &sink);
+  feed(&d, &sink, data, 66, 10, 0);
+  if(sink.err || sink.summaries != 1 || sink.out_bytes != 4 + 64 + 2)
+    {
+      fprintf(stderr, "split run: %llu summaries, %zu bytes output\n", (unsigned long long)sink.summaries, sink.out_bytes);
+      err = -1;
+    }
+  if(sink.len != 66 || memcmp(buff, data, 66))
+    {
+      fprintf(stderr, "split run: output expanded is not the input\n");
+      err = -1;
+    }
+  dedup_free(&d);
+
+  /* Shorter runs are held back, and all of them still come out. */
+  memset(&sink, 0, sizeof(sink));
+  sink.size = sizeof(buff);
+  sink.buff = buff;
+  dedup_init(&d, DEDUP_BYTES, NULL, 0, emit, &sink);
+  feed(&d, &sink, data, 4 + DEDUP_RUN_MIN - 1, 3, 0);
+  if(sink.err || sink.summaries || sink.len != 4 + DEDUP_RUN_MIN - 1 || memcmp(buff, data, sink.len))
+    {
+      fprintf(stderr, "short split run not output as it is\n");
+      err = -1;
+    }
+  dedup_free(&d);
+
+  return err;
+}
+
+
+/* Run one workload, check it and report it. Returns -1 on failure. */
+static int run(const char* name, int mode, const char* mask_spec, char* data, size_t len)
+{
+  dedup_t d;
+  sink_t sink;
+  uint8_t* mask = NULL;
+  size_t mask_len = 0;
+  double t0, t;
+  int err = 0;
+
+  memset(&sink, 0, sizeof(sink));
+  sink.size = len;
+  sink.buff = malloc(len);
+  if(!sink.buff || (mask_spec && dedup_parse_mask(mask_spec, &mask, &mask_len))
+     || dedup_init(&d, mode, mask, mask_len, emit, &sink))
+    {
+      fprintf(stderr, "%s: can not set up\n", name);
+      return -1;
+    }
+
+  /* Check with random reads, time with full ones. */
+  feed(&d, &sink, data, len, READ_SIZE, 1);
+  if(!sink.err && mask) { blank_seq(sink.buff, sink.len); blank_seq(data, len); }
+  if(sink.err || sink.len != len || memcmp(sink.buff, data, len))
+    {
+      fprintf(stderr, "%s: output expanded is not the input\n", name);
+      err = -1;
+    }
+  dedup_free(&d);
+
+  if(!err)
+    {
+      memset(&sink, 0, sizeof(sink));
+      sink.size = len;
+      sink.buff = realloc(sink.buff, len);
+      dedup_init(&d, mode, mask, mask_len, emit, &sink);
+      t0 = now_sec();
+      feed(&d, &sink, data, len, READ_SIZE, 0);
+      t = now_sec() - t0;
+      dedup_free(&d);
+      printf("%-16s %8.1f MB/s  %6.2f%% output  %8llu summaries\n", name, len / t / 1e6,
+             100.0 * sink.out_bytes / len, (unsigned long long)sink.summaries);
+    }
+
+  free(sink.buff);
+  free(mask);
+  return err;
+}
+
+
+int main(int argc, char* argv[])
+{
+  size_t size = (argc > 1 ? atoi(argv[1]) : 16) * 1000000UL;
+  char* data = malloc(size);
+  size_t len;
+  uint8_t* mask;
+  size_t mask_len;
+  int err = 0;
+
+  if(!size || !data)
+    {
+      fprintf(stderr, "Usage: ttylog-bench-dedup [MB]\n");
+      return 1;
+    }
+  srand(1);
+
+  if(!dedup_parse_mask("1-3,40", &mask, &mask_len) && mask_len == 40 && mask[0] && mask[2] && !mask[3] && mask[39])
+    {
+      free(mask);
+    }
+  else
+    {
+      fprintf(stderr, "mask not parsed\n");
+      err = 1;
+    }
+  if(!dedup_parse_mask("3-1", &mask, &mask_len) || !dedup_parse_mask("1,", &mask, &mask_len)
+     || !dedup_parse_mask("0", &mask, &mask_len) || !dedup_parse_mask("x", &mask, &mask_len))
+    {
+      fprintf(stderr, "invalid mask accepted\n");
+      err = 1;
+    }
+
+  err |= check_split() < 0;
+
+  len = make_lines(data, size, 0);
+  err |= run("repeated lines", DEDUP_LINES, NULL, data, len) < 0;
+  len = make_lines(data, size, 1);
+  err |= run("masked lines", DEDUP_LINES, SEQ_COLUMNS, data, len) < 0;
+  len = make_unique(data, size);
+  err |= run("unique lines", DEDUP_LINES, NULL, data, len) < 0;
+  len = make_bytes(data, size);
+  err |= run("filler bytes", DEDUP_BYTES, NULL, data, len) < 0;
+  len = make_unique(data, size);
+  err |= run("text bytes", DEDUP_BYTES, NULL, data, len) < 0;
+
+  free(data);
+  return err;
+}
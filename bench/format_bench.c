@@ -0,0 +1,147 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Benchmark and self test of the formatting kernels. Formats console like
+   data in read sized chunks with every kernel and with the generic code
+   that tests the format, timestamps and line limit at run time, checks
+   that both give the same output and reports the throughput of both.
+   Usage: ttylog-bench-format [MB per kernel] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ttylog.h"
+#include "fmtkernel.h"
+
+
+#define DATA_LEN  (1 << 20)
+#define NCHUNKS   4096
+#define LINE_LIMIT 80
+
+static const char stamp[] = "2025-10-20T21:13:53.123";
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Console text with CRLF line ends, long lines now and then and a little
+   binary noise. */
+static void fill(char* buff, size_t len)
+{
+  static const char words[] = "[    1.234567] usb 1-1: new high-speed USB device number 3 using ehci-pci";
+  size_t i = 0;
+
+  while(i < len)
+    {
+      int r = rand();
+      size_t n = r % 20 == 0 ? 300 : r % (sizeof(words) - 1);
+
+      while(n-- && i < len) { buff[i++] = r % 50 == 0 ? (char)rand() : words[n % (sizeof(words) - 1)]; }
+      if(i < len) { buff[i++] = '\r'; }
+      if(i < len) { buff[i++] = '\n'; }
+    }
+}
+
+
+/* Format all chunks, returns the output length. */
+static size_t run(char* out, const char* data, const int* chunks, int fmt, int limited, int stamped, print_kernel_t kernel)
+{
+  print_data_ctx_t ctx;
+  const char* ts = stamped ? stamp : NULL;
+  size_t ts_len = stamped ? strlen(stamp) : 0;
+  char* p = out;
+  int i, off = 0;
+
+  print_ctx_init(&ctx, fmt, limited ? LINE_LIMIT : 0, NULL);
+  for(i = 0; i < NCHUNKS && off < DATA_LEN; i++)
+    {
+      int len = chunks[i] < DATA_LEN - off ? chunks[i] : DATA_LEN - off;
+
+      if(kernel) { p = kernel(p, data + off, len, &ctx, ts, ts_len); }
+      else { p = print_kernel_generic(fmt, limited, stamped, p, data + off, len, &ctx, ts, ts_len); }
+      off += len;
+    }
+
+  return p - out;
+}
+
+
+int main(int argc, char* argv[])
+{
+  static const struct { int fmt; const char* name; } fmts[] =
+  {
+    { FMT_ACSII, "ascii" }, { FMT_RAW, "raw" }, { FMT_HEX_LC, "hex" }, { FMT_HEX_UC, "HEX" },
+  };
+  int mb = argc > 1 ? atoi(argv[1]) : 64;
+  char* data = malloc(DATA_LEN);
+  /* Hex triplets, plus a stamp for every line of the shortest chunks. */
+  size_t out_size = 3 * (size_t)DATA_LEN + (DATA_LEN / LINE_LIMIT + 2 * NCHUNKS + DATA_LEN / 2) * (sizeof(stamp) + 5);
+  char* ref = malloc(out_size);
+  char* out = malloc(out_size);
+  int chunks[NCHUNKS];
+  size_t k;
+  int i, err = 0;
+
+  if(!data || !ref || !out || mb < 1) { return 1; }
+  srand(1);
+  fill(data, DATA_LEN);
+  /* Read sizes of a busy port, mostly small. */
+  for(i = 0; i < NCHUNKS; i++) { chunks[i] = rand() % 4 ? 1 + rand() % 64 : 1 + rand() % 4096; }
+
+  printf("format limit stamp   generic MB/s   kernel MB/s  speedup\n");
+  for(k = 0; k < sizeof(fmts) / sizeof(fmts[0]); k++)
+    {
+      int limited, stamped;
+
+      for(limited = 0; limited < 2; limited++)
+        for(stamped = 0; stamped < 2; stamped++)
+          {
+            print_kernel_t kernel = print_kernel_select(fmts[k].fmt, limited, stamped);
+            size_t ref_len = run(ref, data, chunks, fmts[k].fmt, limited, stamped, NULL);
+            size_t len = run(out, data, chunks, fmts[k].fmt, limited, stamped, kernel);
+            double t0, t_generic, t_kernel;
+            int n;
+
+            if(len != ref_len || memcmp(out, ref, len))
+              {
+                fprintf(stderr, "%s limit %d stamp %d: kernel output differs\n", fmts[k].name, limited, stamped);
+                err = 1;
+                continue;
+              }
+
+            t0 = now_sec();
+            for(n = 0; n < mb; n++) { run(ref, data, chunks, fmts[k].fmt, limited, stamped, NULL); }
+            t_generic = now_sec() - t0;
+            t0 = now_sec();
+            for(n = 0; n < mb; n++) { run(out, data, chunks, fmts[k].fmt, limited, stamped, kernel); }
+            t_kernel = now_sec() - t0;
+
+            printf("%-6s %5s %5s %14.1f %13.1f %7.2fx\n", fmts[k].name, limited ? "yes" : "no", stamped ? "yes" : "no",
+                   mb * (DATA_LEN / 1e6) / t_generic, mb * (DATA_LEN / 1e6) / t_kernel, t_generic / t_kernel);
+          }
+    }
+
+  free(data);
+  free(ref);
+  free(out);
+  return err;
+}
@@ -0,0 +1,133 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Micro-benchmark and self test of the hex encoders used by the hex
+   output formats. Usage: ttylog-bench-hex [MB to encode] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hexenc.h"
+
+
+/* Line length used for the throughput runs, ttylog's default limit. */
+#define LINE_LEN 1023
+
+
+/* The per byte loop print_data() used before the vectorized encoder. */
+static char* hex_encode_reference(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space)
+{
+  static const char* hex_chars_lc = "0123456789abcdef";
+  static const char* hex_chars_uc = "0123456789ABCDEF";
+  const char* hex_chars = uppercase ? hex_chars_uc : hex_chars_lc;
+  size_t i;
+
+  for(i = 0; i < len; i++)
+    {
+      unsigned char d = src[i];
+      if (i || lead_space) { *dst++ = ' '; }
+      *dst++ = hex_chars[(d >> 4) & 0x0F];
+      *dst++ = hex_chars[d & 0x0F];
+    }
+
+  return dst;
+}
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Compare fn against the reference for all lengths up to 256. */
+static int check(const char* name, hex_encode_fn fn, const unsigned char* src)
+{
+  static char a[3 * 256 + 1], b[3 * 256 + 1];
+  size_t len;
+  int uc, lead;
+
+  for(len = 0; len <= 256; len++)
+    for(uc = 0; uc < 2; uc++)
+      for(lead = 0; lead < 2; lead++)
+        {
+          char* ea = hex_encode_reference(a, src + len % 7, len, uc, lead);
+          char* eb = fn(b, src + len % 7, len, uc, lead);
+          if(ea - a != eb - b || memcmp(a, b, ea - a))
+            {
+              fprintf(stderr, "%s: mismatch at length %zu (uppercase %d, lead space %d)\n", name, len, uc, lead);
+              return -1;
+            }
+        }
+
+  return 0;
+}
+
+
+static void bench(const char* name, hex_encode_fn fn, const unsigned char* src, size_t src_len, char* dst, size_t total)
+{
+  size_t done = 0;
+  double t0 = now_sec(), t;
+
+  while(done < total)
+    {
+      size_t off;
+      for(off = 0; off + LINE_LEN <= src_len; off += LINE_LEN)
+        {
+          fn(dst + 3 * off, src + off, LINE_LEN, 0, 0);
+        }
+      done += off;
+    }
+  t = now_sec() - t0;
+
+  printf("%-10s %8.1f MB/s in  %6.2f GB/s out\n", name, done / t / 1e6, 3.0 * done / t / 1e9);
+}
+
+
+int main(int argc, char* argv[])
+{
+  size_t src_len = (1 << 20) / LINE_LEN * LINE_LEN;
+  size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+  unsigned char* src = malloc(src_len);
+  char* dst = malloc(3 * src_len);
+  hex_encode_fn ssse3 = hex_encode_ssse3_fn();
+  hex_encode_fn avx2 = hex_encode_avx2_fn();
+  size_t i;
+  int err = 0;
+
+  if(!src || !dst) { return 1; }
+  srand(1);
+  for(i = 0; i < src_len; i++) { src[i] = rand(); }
+
+  err |= check("scalar", hex_encode_scalar, src);
+  if(ssse3) { err |= check("ssse3", ssse3, src); }
+  if(avx2) { err |= check("avx2", avx2, src); }
+  err |= check("hex_encode", hex_encode, src);
+  if(err) { return 1; }
+
+  printf("hex_encode uses %s\n", hex_encode_name());
+  bench("reference", hex_encode_reference, src, src_len, dst, total);
+  bench("scalar", hex_encode_scalar, src, src_len, dst, total);
+  if(ssse3) { bench("ssse3", ssse3, src, src_len, dst, total); }
+  if(avx2) { bench("avx2", avx2, src, src_len, dst, total); }
+
+  free(src);
+  free(dst);
+  return 0;
+}
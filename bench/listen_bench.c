@@ -0,0 +1,491 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Loopback benchmark and test of the --listen server. A generator writes
+   into the master side of a PTY as fast as it can, ttylog logs the slave
+   side in raw format to /dev/null and serves it on a loopback TCP port or
+   a Unix socket. Several clients read the stream, and a slow client with
+   a tiny receive buffer does not read at all until the end. Checks that
+   every client got the whole stream, or with the block policy that they
+   all got the same one, and with the disconnect policy that the slow client
+   got a cut short but otherwise intact stream. With -c 0 there is only the
+   slow client, for queues too small for any client to get everything.
+   Reports the throughput and CPU time of ttylog.
+   Usage: ttylog-bench-listen [options] */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+
+#define MAX_CLIENTS 64
+
+
+typedef struct
+{
+  int fd;
+  uint64_t bytes;
+  uint64_t hash;         /* FNV-1a of the received stream. */
+  int eof;
+} client_t;
+
+
+static const char* ttylog_path = "./ttylog";
+static int nclients = 4;
+static const char* policy = "drop";
+static const char* queue_size = "64k";
+static double duration = 1.0;
+static int use_unix;
+static int slow = 1;
+static double min_mbps;
+
+static client_t clients[MAX_CLIENTS + 1];   /* The slow one last. */
+static char addr[160];
+static struct sockaddr_storage sa;
+static socklen_t sa_len;
+
+/* The stream generated again to check the slow client against. */
+static char check_buff[65536];
+static size_t check_len, check_off;
+static uint64_t check_seq;
+static int check_prefix = 1;   /* The slow client got a prefix of the stream so far. */
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static uint64_t fnv(uint64_t h, const unsigned char* p, size_t n)
+{
+  size_t i;
+
+  for(i = 0; i < n; i++) { h = (h ^ p[i]) * 0x100000001b3ULL; }
+  return h;
+}
+
+
+/* Lines of varying length with a running number. */
+static size_t generate(char* buff, size_t size, uint64_t* seq)
+{
+  size_t n = 0;
+
+  while(size - n > 128)
+    {
+      int len = snprintf(buff + n, size - n, "%012llu ", (unsigned long long)*seq);
+      int pad = 20 + *seq % 90;
+
+      memset(buff + n + len, 'a' + *seq % 26, pad);
+      n += len + pad;
+      buff[n++] = '\n';
+      (*seq)++;
+    }
+
+  return n;
+}
+
+
+/* Address for ttylog and the clients, a free loopback port or a socket
+   in /tmp. */
+static int pick_addr(void)
+{
+  memset(&sa, 0, sizeof(sa));
+  if(use_unix)
+    {
+      struct sockaddr_un* un = (struct sockaddr_un*)&sa;
+
+      un->sun_family = AF_UNIX;
+      snprintf(un->sun_path, sizeof(un->sun_path), "/tmp/ttylog-bench-%d.sock", (int)getpid());
+      snprintf(addr, sizeof(addr), "unix:%s", un->sun_path);
+      sa_len = sizeof(*un);
+    }
+  else
+    {
+      struct sockaddr_in* in = (struct sockaddr_in*)&sa;
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+      in->sin_family = AF_INET;
+      in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      sa_len = sizeof(*in);
+      if(fd < 0 || bind(fd, (struct sockaddr*)in, sa_len) || getsockname(fd, (struct sockaddr*)in, &sa_len))
+        {
+          perror("socket");
+          return -1;
+        }
+      close(fd);
+      snprintf(addr, sizeof(addr), "127.0.0.1:%d", ntohs(in->sin_port));
+    }
+
+  return 0;
+}
+
+
+static int connect_client(client_t* c, int rcvbuf)
+{
+  double t0 = now_sec();
+
+  memset(c, 0, sizeof(*c));
+  c->hash = 0xcbf29ce484222325ULL;
+  for(;;)
+    {
+      c->fd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if(c->fd < 0)
+        {
+          perror("socket");
+          return -1;
+        }
+      if(rcvbuf) { setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)); }
+      if(!connect(c->fd, (struct sockaddr*)&sa, sa_len)) { break; }
+      close(c->fd);
+      if(now_sec() - t0 > 5)
+        {
+          fprintf(stderr, "cannot connect to %s\n", addr);
+          return -1;
+        }
+      usleep(10000);
+    }
+  fcntl(c->fd, F_SETFL, O_NONBLOCK);
+
+  return 0;
+}
+
+
+static void check_slow(const unsigned char* p, size_t n)
+{
+  while(n && check_prefix)
+    {
+      size_t k;
+
+      if(check_off == check_len)
+        {
+          check_len = generate(check_buff, sizeof(check_buff), &check_seq);
+          check_off = 0;
+        }
+      k = check_len - check_off < n ? check_len - check_off : n;
+      check_prefix = !memcmp(check_buff + check_off, p, k);
+      check_off += k;
+      p += k;
+      n -= k;
+    }
+}
+
+
+static void read_client(client_t* c)
+{
+  unsigned char buff[65536];
+  ssize_t n;
+
+  while((n = read(c->fd, buff, sizeof(buff))) > 0)
+    {
+      c->bytes += n;
+      c->hash = fnv(c->hash, buff, n);
+      if(c == &clients[nclients]) { check_slow(buff, n); }
+    }
+  if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) { c->eof = 1; }
+}
+
+
+static pid_t start_ttylog(const char* slave, int err_fd)
+{
+  char* argv[32];
+  int argc = 0;
+  pid_t pid;
+
+  argv[argc++] = (char*)ttylog_path;
+  argv[argc++] = "-b";
+  argv[argc++] = "115200";
+  argv[argc++] = "-F";
+  argv[argc++] = "r";
+  argv[argc++] = "-l";
+  argv[argc++] = "100000000";
+  argv[argc++] = "-d";
+  argv[argc++] = (char*)slave;
+  argv[argc++] = "-o";
+  argv[argc++] = "/dev/null";
+  argv[argc++] = "--listen";
+  argv[argc++] = addr;
+  argv[argc++] = "--listen-policy";
+  argv[argc++] = (char*)policy;
+  argv[argc++] = "--listen-queue";
+  argv[argc++] = (char*)queue_size;
+  argv[argc] = NULL;
+
+  pid = fork();
+  if(pid == 0)
+    {
+      dup2(err_fd, 2);
+      execv(ttylog_path, argv);
+      perror(ttylog_path);
+      _exit(127);
+    }
+
+  return pid;
+}
+
+
+/* Read what the first n clients have, waiting timeout ms at most. Returns
+   the number of clients still open. */
+static int poll_clients(int n, int timeout)
+{
+  struct pollfd pfd[MAX_CLIENTS + 1];
+  int i, open = 0;
+
+  for(i = 0; i < n; i++)
+    {
+      pfd[i].fd = clients[i].eof ? -1 : clients[i].fd;
+      pfd[i].events = POLLIN;
+      open += !clients[i].eof;
+    }
+  if(open && poll(pfd, n, timeout) > 0)
+    {
+      for(i = 0; i < n; i++)
+        if(pfd[i].revents) { read_client(&clients[i]); }
+    }
+
+  return open;
+}
+
+
+static void show_errors(int err_fd)
+{
+  char line[1024];
+  FILE* f;
+
+  lseek(err_fd, 0, SEEK_SET);
+  f = fdopen(dup(err_fd), "r");
+  if(!f) { return; }
+  while(fgets(line, sizeof(line), f))
+    {
+      if(!strstr(line, "error 5 while reading")) { fputs(line, stderr); }
+    }
+  fclose(f);
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ttylog-bench-listen [-T ttylog] [-c clients] [-P drop|disconnect|block] [-q queue size]\n"
+                  "                           [-t seconds] [-u] [-n] [-m min MB/s]\n"
+                  "  -u  use a Unix socket instead of loopback TCP\n"
+                  "  -n  no slow client\n"
+                  "  -c 0 only the slow client, to test a queue smaller than the blocks\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  static char buff[65536];
+  char err_name[] = "/tmp/ttylog-bench-XXXXXX";
+  struct pollfd pfd;
+  struct termios tio;
+  struct rusage ru;
+  uint64_t written = 0, whash = 0xcbf29ce484222325ULL, seq = 0;
+  size_t pending = 0, off = 0;
+  double t0, t_end, dt, cpu;
+  int master, slave, err_fd, status, i, err = 0;
+  int block = 0;
+  client_t* s = NULL;
+  client_t* first;     /* Reported, the slow client when it is the only one. */
+  pid_t pid;
+
+  for(i = 1; i < argc; i++)
+    {
+      if(!strcmp(argv[i], "-u")) { use_unix = 1; continue; }
+      if(!strcmp(argv[i], "-n")) { slow = 0; continue; }
+      if(i + 1 >= argc) { usage(); }
+      if(!strcmp(argv[i], "-T")) { ttylog_path = argv[++i]; }
+      else if(!strcmp(argv[i], "-c")) { nclients = atoi(argv[++i]); }
+      else if(!strcmp(argv[i], "-P")) { policy = argv[++i]; }
+      else if(!strcmp(argv[i], "-q")) { queue_size = argv[++i]; }
+      else if(!strcmp(argv[i], "-t")) { duration = atof(argv[++i]); }
+      else if(!strcmp(argv[i], "-m")) { min_mbps = atof(argv[++i]); }
+      else { usage(); }
+    }
+  if(nclients < !slow || nclients > MAX_CLIENTS) { usage(); }
+  block = !strcmp(policy, "block");
+
+  signal(SIGPIPE, SIG_IGN);
+  err_fd = mkstemp(err_name);
+  if(err_fd < 0 || pick_addr()) { return 1; }
+  unlink(err_name);
+
+  master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if(master < 0 || grantpt(master) || unlockpt(master)
+     || (slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0)
+    {
+      perror("posix_openpt");
+      return 1;
+    }
+  fcntl(master, F_SETFL, O_NONBLOCK);
+
+  pid = start_ttylog(ptsname(master), err_fd);
+  if(pid < 0)
+    {
+      perror("fork");
+      return 1;
+    }
+
+  /* ttylog listens before it configures the port. */
+  t0 = now_sec();
+  while(tcgetattr(slave, &tio) == 0 && (tio.c_lflag & ECHO))
+    {
+      if(now_sec() - t0 > 5)
+        {
+          fprintf(stderr, "ttylog did not start\n");
+          kill(pid, SIGTERM);
+          show_errors(err_fd);
+          return 1;
+        }
+      usleep(1000);
+    }
+  close(slave);
+
+  for(i = 0; i < nclients; i++)
+    if(connect_client(&clients[i], 0)) { return 1; }
+  if(slow)
+    {
+      s = &clients[nclients];
+      if(connect_client(s, 4096)) { return 1; }
+    }
+  first = nclients ? &clients[0] : s;
+  usleep(100000);
+
+  printf("%d clients%s over %s, policy %s, queue %s, %.1f s\n", nclients, slow ? " and a slow one" : "",
+         use_unix ? "a Unix socket" : "loopback TCP", policy, queue_size, duration);
+
+  t0 = now_sec();
+  t_end = t0 + duration;
+  while(now_sec() < t_end)
+    {
+      if(!pending)
+        {
+          pending = generate(buff, sizeof(buff), &seq);
+          off = 0;
+        }
+
+      pfd.fd = master;
+      pfd.events = POLLOUT;
+      if(poll(&pfd, 1, 10) > 0)
+        {
+          ssize_t k = write(master, buff + off, pending);
+
+          if(k > 0)
+            {
+              whash = fnv(whash, (unsigned char*)buff + off, k);
+              written += k;
+              off += k;
+              pending -= k;
+            }
+        }
+      poll_clients(nclients, 0);
+    }
+
+  /* Input still in the PTY is lost when the master closes, so wait until
+     the clients have it all, or stop making progress with the block
+     policy. */
+  t_end = now_sec() + 1;
+  while(now_sec() < t_end)
+    {
+      uint64_t before = first->bytes;
+      int behind = 0;
+
+      poll_clients(nclients, 10);
+      for(i = 0; i < nclients; i++) { behind |= !clients[i].eof && clients[i].bytes < written; }
+      if(!behind) { break; }
+      if(first->bytes != before) { t_end = now_sec() + 1; }
+    }
+  dt = now_sec() - t0;
+
+  /* ttylog exits on the hang up and closes the connections once the
+     queues are sent. */
+  close(master);
+  t_end = now_sec() + 10;
+  while(poll_clients(nclients + !!s, 100) && now_sec() < t_end) {}
+
+  if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    {
+      fprintf(stderr, "ttylog did not exit\n");
+      err = 1;
+    }
+  getrusage(RUSAGE_CHILDREN, &ru);
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+  show_errors(err_fd);
+
+  /* With the block policy ttylog may drop at capture while it waits, but
+     every client must then see the same stream. */
+  for(i = 0; i < nclients + (s && block); i++)
+    {
+      client_t* c = &clients[i];
+      uint64_t want = block ? clients[0].bytes : written;
+      uint64_t want_hash = block ? clients[0].hash : whash;
+
+      if(!c->eof || c->bytes != want || c->hash != want_hash)
+        {
+          fprintf(stderr, "client %d: %llu of %llu bytes%s%s\n", i, (unsigned long long)c->bytes,
+                  (unsigned long long)want, c->eof ? "" : ", not closed",
+                  c->bytes == want && c->hash != want_hash ? ", corrupted" : "");
+          err = 1;
+        }
+    }
+  if(!first->bytes)
+    {
+      fprintf(stderr, "no data received\n");
+      err = 1;
+    }
+  if(s && !strcmp(policy, "disconnect") && (!check_prefix || s->bytes >= written))
+    {
+      fprintf(stderr, "slow client was not disconnected\n");
+      err = 1;
+    }
+
+  printf("written    %8.1f MB, %llu lost at capture\n", written / 1e6,
+         (unsigned long long)(written - first->bytes));
+  printf("per client %8.1f MB/s\n", first->bytes / dt / 1e6);
+  printf("total      %8.1f MB/s\n", first->bytes * (nclients ? nclients : 1) / dt / 1e6);
+  printf("ttylog CPU %8.3f s, %.3f ms per MB sent\n", cpu, cpu * 1e3 / (first->bytes * (nclients ? nclients : 1) / 1e6 + 1e-9));
+  if(s)
+    {
+      printf("slow       %8.1f MB received, %s\n", s->bytes / 1e6,
+             !check_prefix ? "with gaps" : s->bytes < written ? "cut short" : "complete");
+    }
+  if(min_mbps > 0 && first->bytes / dt / 1e6 < min_mbps)
+    {
+      fprintf(stderr, "throughput below %.1f MB/s\n", min_mbps);
+      err = 1;
+    }
+
+  for(i = 0; i < nclients + !!s; i++) { close(clients[i].fd); }
+  close(err_fd);
+  return err;
+}
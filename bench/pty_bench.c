@@ -0,0 +1,741 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* End to end benchmark of ttylog on pseudo terminals. A generator writes
+   numbered lines into the master side of every PTY at the given rate, in
+   bursts of the given size, ttylog logs the slave sides into one pipe per
+   port and the output is decoded back and checked. Reports throughput,
+   CPU time of ttylog per MB, p50/p99 latency from writing the last byte of
+   a line to reading it from the output, and lost bytes. With the bin format
+   or epoch timestamps it also reports the delay from writing the first byte
+   of a line to the receive time ttylog gave it, and the jitter (standard
+   deviation) of that delay. Exits with 1 when
+   bytes were lost or corrupted, or the throughput is below -m.
+   Usage: ttylog-bench-pty [options] [-- ttylog options] */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+
+#define MAX_PORTS 64
+#define MAX_LINE 4096
+#define MAX_ARGS 256
+
+/* Size of the bin format file header and record header. */
+#define BIN_HEADER_LEN 32
+#define BIN_RECORD_LEN 24
+
+
+typedef struct
+{
+  int master;
+  int slave;            /* Kept open until ttylog has configured the PTY. */
+  int out;              /* Read end of the pipe ttylog writes this port to. */
+  int out_wr;
+
+  /* Generator. */
+  uint64_t sent;        /* Bytes written to the master. */
+  double* sent_at;      /* Time the last byte of every line was written. */
+  size_t sent_at_size;
+  double* first_at;     /* Time the first byte of every line was written. */
+  size_t first_at_size;
+  char gen_line[MAX_LINE];
+  uint64_t gen_seq;     /* Sequence number of gen_line. */
+
+  /* Decoder. */
+  int stamp_state;      /* 1 inside "[timestamp]", 2 at the space after it. */
+  char stamp[64];
+  size_t stamp_len;
+  double cur_stamp;     /* Receive time of the data being decoded, -1 if unknown. */
+  double line_stamp;    /* Receive time of the first byte of the current line. */
+  int hex_nibble;       /* Pending high nibble, -1 for none. */
+  unsigned char* bin;   /* Undecoded bin format output. */
+  size_t bin_len, bin_size;
+  int bin_header;       /* Nonzero once the file header was skipped. */
+  char line[MAX_LINE];
+  size_t line_len;
+  uint64_t received;    /* Bytes of correct lines. */
+  uint64_t bad;         /* Corrupted lines. */
+} bport_t;
+
+
+/* Settings of the runs. */
+static const char* ttylog_path = "./ttylog";
+static int nports = 1;
+static double rate = 100000;      /* Bytes per second per port, 0 for no limit. */
+static size_t burst = 64;
+static size_t line_len = 80;
+static double duration = 1.0;
+static const char* formats = "a,h,r,b";
+static const char* stamps = "none,epoch";
+static double min_mbps = 0;
+static char** extra_args;
+static int nextra;
+
+static bport_t ports[MAX_PORTS];
+static double* latencies;
+static size_t nlatencies, latencies_size;
+static double* delays;            /* From writing to the ttylog receive time. */
+static size_t ndelays, delays_size;
+static double real_offset;        /* CLOCK_REALTIME - CLOCK_MONOTONIC. */
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static double real_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void* grow(void* p, size_t* size, size_t need, size_t elem)
+{
+  size_t n = *size ? *size : 1024;
+
+  if(need <= *size) { return p; }
+  while(n < need) { n *= 2; }
+  p = realloc(p, n * elem);
+  if(!p)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  *size = n;
+  return p;
+}
+
+
+/* Line seq: "#<seq> " and letters, line_len bytes with the newline. */
+static void make_line(char* buff, uint64_t seq)
+{
+  size_t i = snprintf(buff, line_len, "#%010llu ", (unsigned long long)seq);
+
+  for(; i < line_len - 1; i++) { buff[i] = 'a' + (seq + i) % 26; }
+  buff[line_len - 1] = '\n';
+}
+
+
+/* Fill buff with the next n bytes of the stream of port. */
+static void generate(bport_t* p, char* buff, size_t n)
+{
+  uint64_t pos = p->sent;
+
+  while(n)
+    {
+      uint64_t seq = pos / line_len;
+      size_t off = pos % line_len, len = line_len - off;
+
+      if(seq != p->gen_seq) { make_line(p->gen_line, p->gen_seq = seq); }
+      if(len > n) { len = n; }
+      memcpy(buff, p->gen_line + off, len);
+      buff += len;
+      pos += len;
+      n -= len;
+    }
+}
+
+
+/* Write up to n bytes of the stream of port, returns bytes written. */
+static size_t send_port(bport_t* p, size_t n)
+{
+  char buff[65536];
+  uint64_t first, last;
+  ssize_t w;
+  double t;
+
+  if(n > sizeof(buff)) { n = sizeof(buff); }
+  generate(p, buff, n);
+  w = write(p->master, buff, n);
+  if(w <= 0) { return 0; }
+
+  t = now_sec();
+  first = (p->sent + line_len - 1) / line_len;
+  last = (p->sent + w - 1) / line_len;
+  p->first_at = grow(p->first_at, &p->first_at_size, last + 1, sizeof(double));
+  for(; first <= last; first++) { p->first_at[first] = t; }
+
+  first = p->sent / line_len;
+  p->sent += w;
+  last = p->sent / line_len;
+  p->sent_at = grow(p->sent_at, &p->sent_at_size, last + 1, sizeof(double));
+  for(; first < last; first++) { p->sent_at[first] = t; }
+
+  return w;
+}
+
+
+/* A decoded line is complete, check it and take its latency. */
+static void line_done(bport_t* p, double t)
+{
+  char expect[MAX_LINE];
+  unsigned long long seq;
+
+  if(p->line_len == line_len - 1 && sscanf(p->line, "#%llu", &seq) == 1 && seq < p->sent / line_len)
+    {
+      make_line(expect, seq);
+      if(!memcmp(expect, p->line, line_len - 1))
+        {
+          p->received += line_len;
+          latencies = grow(latencies, &latencies_size, nlatencies + 1, sizeof(double));
+          latencies[nlatencies++] = t - p->sent_at[seq];
+          if(p->line_stamp >= 0)
+            {
+              delays = grow(delays, &delays_size, ndelays + 1, sizeof(double));
+              delays[ndelays++] = p->line_stamp - p->first_at[seq];
+            }
+          p->line_len = 0;
+          return;
+        }
+    }
+
+  p->bad++;
+  p->line_len = 0;
+}
+
+
+/* Feed one byte of the data received from the PTY. */
+static void decode_data(bport_t* p, char c, double t)
+{
+  /* Only the newline ending a line of the expected length is data, others
+     were added by the line length limit or before a raw format timestamp. */
+  if(c == '\n')
+    {
+      if(p->line_len == line_len - 1) { line_done(p, t); }
+      return;
+    }
+  if(c == '#' && p->line_len) { line_done(p, t); }
+  if(!p->line_len) { p->line_stamp = p->cur_stamp; }
+  if(p->line_len < MAX_LINE) { p->line[p->line_len++] = c; }
+}
+
+
+/* Feed the output of a text format, skipping the timestamps. Data never
+   holds '[', so that always starts a timestamp. */
+static void decode_text(bport_t* p, const char* buff, size_t n, int hex, double t)
+{
+  size_t i;
+
+  for(i = 0; i < n; i++)
+    {
+      char c = buff[i];
+      int v;
+
+      if(p->stamp_state == 1)
+        {
+          if(c == ']')
+            {
+              long long sec;
+              long nsec;
+
+              /* Epoch timestamps give the receive time. */
+              p->stamp[p->stamp_len] = 0;
+              if(sscanf(p->stamp, "%lld.%9ld", &sec, &nsec) == 2 && strlen(p->stamp) == 20)
+                {
+                  p->cur_stamp = sec + nsec * 1e-9 - real_offset;
+                }
+              p->stamp_state = 2;
+            }
+          else if(p->stamp_len < sizeof(p->stamp) - 1)
+            {
+              p->stamp[p->stamp_len++] = c;
+            }
+          continue;
+        }
+      if(p->stamp_state == 2)
+        {
+          p->stamp_state = 0;
+          if(c == ' ') { continue; }
+        }
+      if(c == '[')
+        {
+          p->stamp_state = 1;
+          p->stamp_len = 0;
+          continue;
+        }
+      if(!hex)
+        {
+          decode_data(p, c, t);
+          continue;
+        }
+
+      if(c >= '0' && c <= '9') { v = c - '0'; }
+      else if(c >= 'a' && c <= 'f') { v = c - 'a' + 10; }
+      else if(c >= 'A' && c <= 'F') { v = c - 'A' + 10; }
+      else { continue; }
+      if(p->hex_nibble < 0) { p->hex_nibble = v; }
+      else
+        {
+          decode_data(p, (char)(p->hex_nibble << 4 | v), t);
+          p->hex_nibble = -1;
+        }
+    }
+}
+
+
+static uint32_t le32(const unsigned char* p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static uint64_t le64(const unsigned char* p)
+{
+  return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+
+/* Feed the output of the bin format, decoding the data records. */
+static void decode_bin(bport_t* p, const char* buff, size_t n, double t)
+{
+  size_t off = 0;
+
+  p->bin = grow(p->bin, &p->bin_size, p->bin_len + n, 1);
+  memcpy(p->bin + p->bin_len, buff, n);
+  p->bin_len += n;
+
+  for(;;)
+    {
+      const unsigned char* r = p->bin + off;
+      size_t avail = p->bin_len - off;
+      uint32_t len;
+      size_t i;
+
+      if(!p->bin_header)
+        {
+          if(avail < BIN_HEADER_LEN) { break; }
+          off += r[10] | r[11] << 8;
+          p->bin_header = 1;
+          continue;
+        }
+      if(avail < BIN_RECORD_LEN) { break; }
+      len = le32(r);
+      if(avail < BIN_RECORD_LEN + len) { break; }
+      if(r[6] == 0)
+        {
+          double stamp = le64(r + 8) * 1e-9, span = 0, step = 0;
+          size_t ext = 0;
+
+          /* Byte times: first byte span_ns before the receive time, then
+             byte_ns apart. */
+          if(r[7] & 1 && len >= 16)
+            {
+              ext = 16;
+              span = le64(r + BIN_RECORD_LEN) * 1e-9;
+              step = le32(r + BIN_RECORD_LEN + 8) * 1e-9;
+            }
+          for(i = ext; i < len; i++)
+            {
+              double d = (i - ext) * step - span;
+              p->cur_stamp = stamp + (d < 0 ? d : 0);
+              decode_data(p, r[BIN_RECORD_LEN + i], t);
+            }
+        }
+      off += BIN_RECORD_LEN + len;
+    }
+
+  memmove(p->bin, p->bin + off, p->bin_len - off);
+  p->bin_len -= off;
+}
+
+
+static void read_output(bport_t* p, char fmt)
+{
+  char buff[65536];
+  ssize_t n = read(p->out, buff, sizeof(buff));
+  double t = now_sec();
+
+  if(n <= 0)
+    {
+      if(n == 0 || errno != EAGAIN) { p->out = -1; }
+      return;
+    }
+  if(fmt == 'b') { decode_bin(p, buff, n, t); }
+  else { decode_text(p, buff, n, fmt == 'h' || fmt == 'H', t); }
+}
+
+
+static int cmp_double(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+
+static int open_ports(void)
+{
+  int i;
+
+  for(i = 0; i < nports; i++)
+    {
+      bport_t* p = &ports[i];
+      int fds[2];
+
+      memset(p, 0, sizeof(*p));
+      p->gen_seq = (uint64_t)-1;
+      p->hex_nibble = -1;
+      p->cur_stamp = -1;
+      p->line_stamp = -1;
+      p->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+      if(p->master < 0 || grantpt(p->master) || unlockpt(p->master))
+        {
+          perror("posix_openpt");
+          return -1;
+        }
+      p->slave = open(ptsname(p->master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+      if(p->slave < 0 || pipe2(fds, O_CLOEXEC))
+        {
+          perror("pty");
+          return -1;
+        }
+      p->out = fds[0];
+      p->out_wr = fds[1];
+      fcntl(p->out, F_SETFL, O_NONBLOCK);
+      fcntl(p->master, F_SETFL, O_NONBLOCK);
+    }
+
+  return 0;
+}
+
+
+static void close_ports(void)
+{
+  int i;
+
+  for(i = 0; i < nports; i++)
+    {
+      bport_t* p = &ports[i];
+      if(p->master >= 0) { close(p->master); }
+      if(p->slave >= 0) { close(p->slave); }
+      if(p->out >= 0) { close(p->out); }
+      if(p->out_wr >= 0) { close(p->out_wr); }
+      free(p->sent_at);
+      free(p->first_at);
+      free(p->bin);
+    }
+}
+
+
+/* Start ttylog on the slave sides. Its error output goes to err_fd. */
+static pid_t start_ttylog(char fmt, const char* stamp, int err_fd)
+{
+  static char names[MAX_PORTS][2][64];
+  char fmt_str[2] = { fmt, 0 };
+  char* argv[MAX_ARGS];
+  int argc = 0, i;
+  pid_t pid;
+
+  argv[argc++] = (char*)ttylog_path;
+  argv[argc++] = "-b";
+  argv[argc++] = "115200";
+  argv[argc++] = "-F";
+  argv[argc++] = fmt_str;
+  argv[argc++] = "-l";
+  argv[argc++] = "100000000";
+  if(strcmp(stamp, "none"))
+    {
+      argv[argc++] = "-s";
+      argv[argc++] = (char*)stamp;
+    }
+  for(i = 0; i < nextra && argc < MAX_ARGS - 4 * MAX_PORTS - 1; i++) { argv[argc++] = extra_args[i]; }
+  for(i = 0; i < nports; i++)
+    {
+      snprintf(names[i][0], sizeof(names[i][0]), "%s", ptsname(ports[i].master));
+      snprintf(names[i][1], sizeof(names[i][1]), "/dev/fd/%d", ports[i].out_wr);
+      argv[argc++] = "-d";
+      argv[argc++] = names[i][0];
+      argv[argc++] = "-o";
+      argv[argc++] = names[i][1];
+    }
+  argv[argc] = NULL;
+
+  pid = fork();
+  if(pid == 0)
+    {
+      for(i = 0; i < nports; i++) { fcntl(ports[i].out_wr, F_SETFD, 0); }
+      dup2(err_fd, 2);
+      execv(ttylog_path, argv);
+      perror(ttylog_path);
+      _exit(127);
+    }
+
+  return pid;
+}
+
+
+/* ttylog switches the PTYs to raw mode once it has opened them, and then
+   discards what is already queued. Give it time for that as well. */
+static int wait_ready(void)
+{
+  struct timespec settle = { 0, 100000000 };
+  double t0 = now_sec();
+  int i;
+
+  for(i = 0; i < nports; i++)
+    {
+      struct termios tio;
+
+      while(tcgetattr(ports[i].slave, &tio) == 0 && (tio.c_lflag & ECHO))
+        {
+          struct timespec ts = { 0, 1000000 };
+          if(now_sec() - t0 > 5) { return -1; }
+          nanosleep(&ts, NULL);
+        }
+      close(ports[i].slave);
+      ports[i].slave = -1;
+    }
+  nanosleep(&settle, NULL);
+
+  return 0;
+}
+
+
+/* Show what ttylog printed, without the read errors of the PTYs closed
+   at the end of the run. */
+static void show_errors(int err_fd)
+{
+  char line[1024];
+  FILE* f;
+
+  lseek(err_fd, 0, SEEK_SET);
+  f = fdopen(dup(err_fd), "r");
+  if(!f) { return; }
+  while(fgets(line, sizeof(line), f))
+    {
+      if(!strstr(line, "error 5 while reading")) { fputs(line, stderr); }
+    }
+  fclose(f);
+}
+
+
+/* Run one format and timestamp combination, returns nonzero on failure. */
+static int run(char fmt, const char* stamp)
+{
+  struct pollfd pfd[2 * MAX_PORTS];
+  struct rusage ru;
+  uint64_t sent = 0, received = 0, bad = 0;   /* Complete lines only. */
+  double t0, t_end, t_done, cpu, mb;
+  FILE* err_file = tmpfile();
+  int err_fd = err_file ? fileno(err_file) : 2;
+  int status, fail = 0, i;
+  pid_t pid;
+
+  nlatencies = 0;
+  ndelays = 0;
+  real_offset = real_sec() - now_sec();
+  if(open_ports()) { return 1; }
+  pid = start_ttylog(fmt, stamp, err_fd);
+  if(pid < 0 || wait_ready())
+    {
+      fprintf(stderr, "ttylog did not start\n");
+      if(pid > 0) { kill(pid, SIGKILL); }
+      close_ports();
+      return 1;
+    }
+  for(i = 0; i < nports; i++)
+    {
+      close(ports[i].out_wr);
+      ports[i].out_wr = -1;
+    }
+
+  /* Generate for the duration, then wait until the output has caught up. */
+  t0 = now_sec();
+  t_end = t0 + duration;
+  for(;;)
+    {
+      double t = now_sec();
+      int generating = (t < t_end);
+      int pending = 0, n = 0, timeout_ms = 100;
+
+      for(i = 0; i < nports; i++)
+        {
+          bport_t* p = &ports[i];
+
+          if(generating)
+            {
+              uint64_t due = rate > 0 ? (uint64_t)((t - t0) * rate) : p->sent + burst;
+              if(due >= p->sent + burst) { send_port(p, due - p->sent); }
+              if(rate > 0 && timeout_ms) { timeout_ms = 1; }
+              else { timeout_ms = 0; }
+            }
+          if(p->received + p->bad * line_len < p->sent / line_len * line_len) { pending = 1; }
+          if(p->out >= 0)
+            {
+              pfd[n].fd = p->out;
+              pfd[n].events = POLLIN;
+              n++;
+            }
+        }
+
+      if(!generating && !pending) { break; }
+      if(!generating && t > t_end + 5) { break; }
+      if(!generating) { timeout_ms = 100; }
+
+      if(poll(pfd, n, timeout_ms) > 0)
+        {
+          for(i = 0; i < nports; i++)
+            {
+              if(ports[i].out >= 0) { read_output(&ports[i], fmt); }
+            }
+        }
+    }
+  t_done = now_sec();
+
+  /* Hang up the PTYs, ttylog exits when all of its ports are closed. */
+  for(i = 0; i < nports; i++)
+    {
+      close(ports[i].master);
+      ports[i].master = -1;
+    }
+  for(;;)
+    {
+      int open = 0;
+      for(i = 0; i < nports; i++)
+        {
+          if(ports[i].out < 0) { continue; }
+          fcntl(ports[i].out, F_SETFL, 0);
+          read_output(&ports[i], fmt);
+          open += (ports[i].out >= 0);
+        }
+      if(!open) { break; }
+    }
+  if(wait4(pid, &status, 0, &ru) < 0) { memset(&ru, 0, sizeof(ru)); }
+  if(err_file)
+    {
+      show_errors(err_fd);
+      fclose(err_file);
+    }
+
+  for(i = 0; i < nports; i++)
+    {
+      sent += ports[i].sent / line_len * line_len;
+      received += ports[i].received;
+      bad += ports[i].bad;
+    }
+  close_ports();
+
+  mb = received / 1e6;
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+  qsort(latencies, nlatencies, sizeof(double), cmp_double);
+
+  printf("format %c  stamp %-5s %8.2f MB/s  cpu %7.1f ms/MB  p50 %8.1f us  p99 %8.1f us  lost %llu  bad lines %llu\n",
+         fmt, stamp, mb / (t_done - t0), mb > 0 ? 1000 * cpu / mb : 0.0,
+         nlatencies ? 1e6 * latencies[nlatencies / 2] : 0.0,
+         nlatencies ? 1e6 * latencies[nlatencies * 99 / 100] : 0.0,
+         (unsigned long long)(sent - received), (unsigned long long)bad);
+  if(ndelays)
+    {
+      double sum = 0, sq = 0, mean;
+      size_t k;
+
+      for(k = 0; k < ndelays; k++) { sum += delays[k]; }
+      mean = sum / ndelays;
+      for(k = 0; k < ndelays; k++) { sq += (delays[k] - mean) * (delays[k] - mean); }
+      qsort(delays, ndelays, sizeof(double), cmp_double);
+      printf("                 receive time delay p50 %8.1f us  p99 %8.1f us  jitter %8.1f us\n",
+             1e6 * delays[ndelays / 2], 1e6 * delays[ndelays * 99 / 100], 1e6 * sqrt(sq / ndelays));
+    }
+  fflush(stdout);
+
+  if(received != sent || bad) { fail = 1; }
+  if(min_mbps > 0 && mb / (t_done - t0) < min_mbps)
+    {
+      fprintf(stderr, "format %c stamp %s: throughput below %.2f MB/s\n", fmt, stamp, min_mbps);
+      fail = 1;
+    }
+  if(!WIFEXITED(status)) { fail = 1; }
+
+  return fail;
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ttylog-bench-pty [-T ttylog] [-p ports] [-r bytes/s per port, 0 for no limit] [-B burst bytes]\n"
+                  "                        [-L line length] [-t seconds] [-F formats] [-s stamps] [-m min MB/s] [-- ttylog options]\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  char fmt_list[256], stamp_list[256];
+  char* f;
+  char* save_f;
+  int err = 0, i;
+
+  for(i = 1; i < argc; i++)
+    {
+      if(!strcmp(argv[i], "--"))
+        {
+          extra_args = argv + i + 1;
+          nextra = argc - i - 1;
+          break;
+        }
+      if(i + 1 >= argc) { usage(); }
+      if(!strcmp(argv[i], "-T")) { ttylog_path = argv[++i]; }
+      else if(!strcmp(argv[i], "-p")) { nports = atoi(argv[++i]); }
+      else if(!strcmp(argv[i], "-r")) { rate = atof(argv[++i]); }
+      else if(!strcmp(argv[i], "-B")) { burst = atoi(argv[++i]); }
+      else if(!strcmp(argv[i], "-L")) { line_len = atoi(argv[++i]); }
+      else if(!strcmp(argv[i], "-t")) { duration = atof(argv[++i]); }
+      else if(!strcmp(argv[i], "-F")) { formats = argv[++i]; }
+      else if(!strcmp(argv[i], "-s")) { stamps = argv[++i]; }
+      else if(!strcmp(argv[i], "-m")) { min_mbps = atof(argv[++i]); }
+      else { usage(); }
+    }
+  if(nports < 1 || nports > MAX_PORTS || line_len < 16 || line_len > MAX_LINE || burst < 1 || rate < 0) { usage(); }
+
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d ports, %s, bursts of %zu bytes, %zu byte lines, %.1f s\n", nports,
+         rate > 0 ? "rate limited" : "no rate limit", burst, line_len, duration);
+
+  snprintf(fmt_list, sizeof(fmt_list), "%s", formats);
+  for(f = strtok_r(fmt_list, ",", &save_f); f; f = strtok_r(NULL, ",", &save_f))
+    {
+      char* s;
+      char* save_s;
+
+      snprintf(stamp_list, sizeof(stamp_list), "%s", stamps);
+      for(s = strtok_r(stamp_list, ",", &save_s); s; s = strtok_r(NULL, ",", &save_s))
+        {
+          err |= run(f[0], s);
+        }
+    }
+
+  free(latencies);
+  free(delays);
+  return err;
+}
@@ -0,0 +1,397 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Self test of ttylog --reconnect on pseudo terminals. A PTY stands in for
+   a USB serial adapter behind a /dev/serial/by-id style link: ttylog logs
+   the link, a few lines are written, then the adapter is unplugged by
+   closing the master and after the gap a new PTY is plugged in by moving a
+   new link into place. Reports how long ttylog took to reopen and set up
+   the new PTY. The lines of a new PTY are written before ttylog opens it,
+   like the boot messages of a device, and must all be logged.
+   Exits with 1 when the log misses a line, a line is out of
+   order, the reconnect markers are not there, or a reconnect took as long
+   as the retry interval, so the directory watch did not work.
+   Usage: ttylog-bench-reconnect [-T ttylog] [-n unplugs] [-g gap ms] [-- ttylog options] */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+
+#define MAX_ARGS 256
+#define LINES_PER_PLUG 10
+
+/* A reconnect this slow was found by the retry of ttylog, not the watch. */
+#define MAX_RECONNECT_SEC 0.5
+
+
+static const char* ttylog_path = "./ttylog";
+static int nunplugs = 3;
+static int gap_ms = 50;
+static char** extra_args;
+static int nextra;
+
+static char dir[64];
+static char link_path[96], new_link_path[96], log_path[96], err_path[96];
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void sleep_ms(int ms)
+{
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+
+/* Plug in a new PTY, the link to its slave is moved into place at once. */
+static int plug(void)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+  if(master < 0 || grantpt(master) || unlockpt(master))
+    {
+      perror("posix_openpt");
+      return -1;
+    }
+  unlink(new_link_path);
+  if(symlink(ptsname(master), new_link_path) || rename(new_link_path, link_path))
+    {
+      perror("link");
+      close(master);
+      return -1;
+    }
+
+  return master;
+}
+
+
+/* ttylog switches the PTY to raw mode once it has opened it, and then
+   discards what is already queued, but not when it reopens it. Returns the
+   time until raw mode, or -1 when ttylog did not get there. */
+static double wait_ready(int master, double t0, int reopen)
+{
+  struct timespec settle = { 0, 50000000 };
+  struct termios tio;
+  double t;
+
+  while(tcgetattr(master, &tio) == 0 && (tio.c_lflag & ECHO))
+    {
+      struct timespec ts = { 0, 100000 };
+      if(now_sec() - t0 > 5) { return -1; }
+      nanosleep(&ts, NULL);
+    }
+  t = now_sec() - t0;
+  if(!reopen) { nanosleep(&settle, NULL); }
+
+  return t;
+}
+
+
+static void make_line(char* buff, size_t size, int plug_no, int line)
+{
+  snprintf(buff, size, "plug %d line %d\n", plug_no, line);
+}
+
+
+/* Write the lines of plug_no, the last one is left in line. */
+static void write_lines(int master, int plug_no, char* line, size_t size)
+{
+  int k;
+
+  for(k = 0; k < LINES_PER_PLUG; k++)
+    {
+      make_line(line, size, plug_no, k);
+      if(write(master, line, strlen(line)) != (ssize_t)strlen(line)) { perror("write"); }
+    }
+}
+
+
+/* Read the whole log, NULL if there is none. */
+static char* read_log(void)
+{
+  FILE* f = fopen(log_path, "r");
+  char* data = NULL;
+  size_t len = 0, size = 0;
+
+  if(!f) { return NULL; }
+  for(;;)
+    {
+      size_t n;
+
+      if(size - len < 4096)
+        {
+          char* p = realloc(data, size += 65536);
+          if(!p)
+            {
+              free(data);
+              fclose(f);
+              return NULL;
+            }
+          data = p;
+        }
+      n = fread(data + len, 1, size - len - 1, f);
+      if(!n) { break; }
+      len += n;
+    }
+  fclose(f);
+  data[len] = 0;
+
+  return data;
+}
+
+
+/* Wait until line is in the log. */
+static int wait_logged(const char* line)
+{
+  double t0 = now_sec();
+
+  while(now_sec() - t0 < 5)
+    {
+      char* log = read_log();
+      int found = log && strstr(log, line);
+
+      free(log);
+      if(found) { return 0; }
+      sleep_ms(1);
+    }
+
+  return -1;
+}
+
+
+/* Every line in order, a marker of at least the gap after every plug but
+   the first. */
+static int check_log(void)
+{
+  char* log = read_log();
+  char* save = NULL;
+  char* line;
+  int plug_no = 0, n = 0, markers = 0, err = 0;
+
+  if(!log)
+    {
+      fprintf(stderr, "no log\n");
+      return -1;
+    }
+
+  for(line = strtok_r(log, "\n", &save); line && !err; line = strtok_r(NULL, "\n", &save))
+    {
+      char expect[64];
+      double gap;
+
+      if(sscanf(line, "--- reconnected after %lf s ---", &gap) == 1)
+        {
+          if(n != LINES_PER_PLUG || gap < gap_ms * 0.9e-3)
+            {
+              fprintf(stderr, "marker '%s' after %d lines of plug %d\n", line, n, plug_no);
+              err = 1;
+            }
+          plug_no++;
+          n = 0;
+          markers++;
+          continue;
+        }
+
+      make_line(expect, sizeof(expect), plug_no, n);
+      expect[strlen(expect) - 1] = 0;
+      if(strcmp(line, expect))
+        {
+          fprintf(stderr, "got '%s', expected '%s'\n", line, expect);
+          err = 1;
+        }
+      n++;
+    }
+
+  if(!err && (markers != nunplugs || n != LINES_PER_PLUG))
+    {
+      fprintf(stderr, "%d markers for %d unplugs, %d lines after the last\n", markers, nunplugs, n);
+      err = 1;
+    }
+
+  free(log);
+  return err ? -1 : 0;
+}
+
+
+static pid_t start_ttylog(void)
+{
+  char* argv[MAX_ARGS];
+  int argc = 0, i;
+  pid_t pid;
+
+  argv[argc++] = (char*)ttylog_path;
+  argv[argc++] = "-b";
+  argv[argc++] = "115200";
+  argv[argc++] = "--reconnect";
+  for(i = 0; i < nextra && argc < MAX_ARGS - 5; i++) { argv[argc++] = extra_args[i]; }
+  argv[argc++] = "-d";
+  argv[argc++] = link_path;
+  argv[argc++] = "-o";
+  argv[argc++] = log_path;
+  argv[argc] = NULL;
+
+  pid = fork();
+  if(pid == 0)
+    {
+      int fd = open(err_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(fd >= 0) { dup2(fd, 2); }
+      execv(ttylog_path, argv);
+      perror(ttylog_path);
+      _exit(127);
+    }
+
+  return pid;
+}
+
+
+static void show_errors(void)
+{
+  char line[1024];
+  FILE* f = fopen(err_path, "r");
+
+  if(!f) { return; }
+  while(fgets(line, sizeof(line), f)) { fputs(line, stderr); }
+  fclose(f);
+}
+
+
+static int cmp_double(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ttylog-bench-reconnect [-T ttylog] [-n unplugs] [-g gap ms] [-- ttylog options]\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  double* latency;
+  pid_t pid;
+  int master, err = 0, status, i;
+
+  for(i = 1; i < argc; i++)
+    {
+      if(!strcmp(argv[i], "--"))
+        {
+          extra_args = argv + i + 1;
+          nextra = argc - i - 1;
+          break;
+        }
+      if(i + 1 >= argc) { usage(); }
+      if(!strcmp(argv[i], "-T")) { ttylog_path = argv[++i]; }
+      else if(!strcmp(argv[i], "-n")) { nunplugs = atoi(argv[++i]); }
+      else if(!strcmp(argv[i], "-g")) { gap_ms = atoi(argv[++i]); }
+      else { usage(); }
+    }
+  if(nunplugs < 1 || gap_ms < 0) { usage(); }
+
+  latency = calloc(nunplugs, sizeof(*latency));
+  snprintf(dir, sizeof(dir), "/tmp/ttylog-reconnect-XXXXXX");
+  if(!latency || !mkdtemp(dir))
+    {
+      perror("mkdtemp");
+      return 1;
+    }
+  snprintf(link_path, sizeof(link_path), "%s/tty", dir);
+  snprintf(new_link_path, sizeof(new_link_path), "%s/tty.new", dir);
+  snprintf(log_path, sizeof(log_path), "%s/log", dir);
+  snprintf(err_path, sizeof(err_path), "%s/err", dir);
+
+  master = plug();
+  if(master < 0) { return 1; }
+  pid = start_ttylog();
+  if(pid < 0 || wait_ready(master, now_sec(), 0) < 0)
+    {
+      fprintf(stderr, "ttylog did not start\n");
+      if(pid > 0) { kill(pid, SIGKILL); }
+      show_errors();
+      return 1;
+    }
+
+  for(i = 0; !err && i <= nunplugs; i++)
+    {
+      char line[64];
+      double t0;
+
+      if(i == 0) { write_lines(master, i, line, sizeof(line)); }
+
+      /* Only what ttylog read before the unplug can be in the log. */
+      if(wait_logged(line))
+        {
+          fprintf(stderr, "plug %d: lines not logged\n", i);
+          err = 1;
+          break;
+        }
+      if(i == nunplugs) { break; }
+
+      close(master);
+      sleep_ms(gap_ms);
+      t0 = now_sec();
+      master = plug();
+
+      /* Queued before ttylog opens the new PTY, like boot messages. */
+      if(master >= 0) { write_lines(master, i + 1, line, sizeof(line)); }
+      if(master < 0 || (latency[i] = wait_ready(master, t0, 1)) < 0)
+        {
+          fprintf(stderr, "unplug %d: ttylog did not reconnect\n", i + 1);
+          err = 1;
+        }
+    }
+
+  kill(pid, SIGTERM);
+  waitpid(pid, &status, 0);
+  if(master >= 0) { close(master); }
+
+  if(!err) { err = check_log() < 0; }
+  if(!err)
+    {
+      qsort(latency, nunplugs, sizeof(double), cmp_double);
+      printf("%d unplugs, gap %d ms, reconnect p50 %8.1f us  max %8.1f us\n", nunplugs, gap_ms,
+             1e6 * latency[nunplugs / 2], 1e6 * latency[nunplugs - 1]);
+      if(latency[nunplugs - 1] >= MAX_RECONNECT_SEC)
+        {
+          fprintf(stderr, "reconnect took longer than %.1f s\n", MAX_RECONNECT_SEC);
+          err = 1;
+        }
+    }
+  if(err) { show_errors(); }
+
+  unlink(link_path);
+  unlink(log_path);
+  unlink(err_path);
+  rmdir(dir);
+  free(latency);
+  return err;
+}
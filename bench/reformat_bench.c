@@ -0,0 +1,186 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Benchmark and self test of the parallel offline formatting. Formats a
+   console like capture with reformat() in small blocks on several threads
+   and checks the output against formatting it read by read, the way ttylog
+   prints a file given with -d, for every format with and without line
+   limit and timestamps. Then reports the throughput with 1 to max jobs.
+   Usage: ttylog-bench-reformat [MB] [max jobs] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ttylog.h"
+#include "reformat.h"
+
+
+#define READ_SIZE 4095
+
+static const char stamp[] = "2025-10-20T21:13:53.123";
+
+
+typedef struct
+{
+  char* buff;
+  size_t len;
+  size_t size;
+} sink_t;
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Console text with CRLF line ends, now and then a long stretch of binary
+   data without newlines. */
+static void fill(char* buff, size_t len)
+{
+  static const char words[] = "[    1.234567] usb 1-1: new high-speed USB device number 3 using ehci-pci";
+  size_t i = 0;
+
+  while(i < len)
+    {
+      int r = rand();
+      size_t n = r % 1000 == 0 ? 200000 : r % (sizeof(words) - 1);
+
+      while(n-- && i < len) { buff[i++] = r % 1000 == 0 ? (char)(rand() | 0x80) : words[n % (sizeof(words) - 1)]; }
+      if(i < len) { buff[i++] = '\r'; }
+      if(i < len) { buff[i++] = '\n'; }
+    }
+}
+
+
+static int collect(void* arg, const char* data, size_t len)
+{
+  sink_t* sink = arg;
+
+  if(sink->len + len > sink->size) { return -1; }
+  memcpy(sink->buff + sink->len, data, len);
+  sink->len += len;
+  return 0;
+}
+
+
+static int discard(void* arg, const char* data, size_t len)
+{
+  *(size_t*)arg += len;
+  return 0;
+}
+
+
+/* Format data read by read, like print_data() does. */
+static size_t reference(char* out, const char* data, size_t len, const reformat_opts_t* opts)
+{
+  print_data_ctx_t ctx;
+  size_t ts_len = opts->time_stamp ? strlen(opts->time_stamp) : 0;
+  char* p = out;
+  size_t pos;
+
+  print_ctx_init(&ctx, opts->fmt, opts->line_len_limit, NULL);
+  for(pos = 0; pos < len; pos += READ_SIZE)
+    {
+      int n = len - pos < READ_SIZE ? len - pos : READ_SIZE;
+      p = ctx.kernel[opts->time_stamp != NULL](p, data + pos, n, &ctx, opts->time_stamp, ts_len);
+    }
+
+  return p - out;
+}
+
+
+int main(int argc, char* argv[])
+{
+  static const struct { int fmt; const char* name; } fmts[] =
+  {
+    { FMT_ACSII, "ascii" }, { FMT_RAW, "raw" }, { FMT_HEX_LC, "hex" }, { FMT_HEX_UC, "HEX" },
+  };
+  static const int limits[] = { 0, 80, 1023 };
+  size_t len = (size_t)(argc > 1 ? atoi(argv[1]) : 64) << 20;
+  int max_jobs = argc > 2 ? atoi(argv[2]) : 8;
+  char* data = malloc(len);
+  /* Hex triplets plus a timestamp for every line, at least 8 bytes long. */
+  size_t out_size = 3 * len + (len / 8 + len / READ_SIZE + 2) * (sizeof(stamp) + 5);
+  char* ref = malloc(out_size);
+  sink_t sink = { malloc(out_size), 0, out_size };
+  reformat_opts_t opts;
+  size_t k, l;
+  int stamped, jobs, err = 0;
+
+  if(!data || !ref || !sink.buff || len == 0 || max_jobs < 1) { return 1; }
+  srand(1);
+  fill(data, len);
+
+  for(k = 0; k < sizeof(fmts) / sizeof(fmts[0]); k++)
+    for(l = 0; l < sizeof(limits) / sizeof(limits[0]); l++)
+      for(stamped = 0; stamped < 2; stamped++)
+        {
+          size_t ref_len;
+
+          memset(&opts, 0, sizeof(opts));
+          opts.fmt = fmts[k].fmt;
+          opts.line_len_limit = limits[l];
+          opts.time_stamp = stamped ? stamp : NULL;
+          opts.read_size = READ_SIZE;
+          opts.block_size = 64 * 1024 + 123;
+          opts.jobs = 4;
+
+          ref_len = reference(ref, data, len, &opts);
+          sink.len = 0;
+          if(reformat(data, len, &opts, collect, &sink) || sink.len != ref_len || memcmp(sink.buff, ref, ref_len))
+            {
+              fprintf(stderr, "%s limit %d stamp %d: output differs\n", fmts[k].name, limits[l], stamped);
+              err = 1;
+            }
+        }
+  if(err) { return 1; }
+
+  printf("%zu MB, jobs:", len >> 20);
+  for(jobs = 1; jobs <= max_jobs; jobs *= 2) { printf(" %9d", jobs); }
+  printf("\n");
+
+  for(k = 0; k < sizeof(fmts) / sizeof(fmts[0]); k++)
+    for(stamped = 0; stamped < 2; stamped++)
+      {
+        printf("%-5s %-5s MB/s", fmts[k].name, stamped ? "stamp" : "");
+        for(jobs = 1; jobs <= max_jobs; jobs *= 2)
+          {
+            size_t total = 0;
+            double t0;
+
+            memset(&opts, 0, sizeof(opts));
+            opts.fmt = fmts[k].fmt;
+            opts.line_len_limit = 1023;
+            opts.time_stamp = stamped ? stamp : NULL;
+            opts.read_size = READ_SIZE;
+            opts.jobs = jobs;
+
+            t0 = now_sec();
+            reformat(data, len, &opts, discard, &total);
+            printf(" %9.1f", len / (now_sec() - t0) / 1e6);
+          }
+        printf("\n");
+      }
+
+  free(data);
+  free(ref);
+  free(sink.buff);
+  return 0;
+}
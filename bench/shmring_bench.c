@@ -0,0 +1,195 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Benchmark and self test of the shared memory ring. A producer thread
+   publishes records of varying size into a small ring as fast as it can,
+   several consumers read them in place and check every record they got,
+   one of them slow enough to be lapped. Exits with 1 when a consumer got
+   a corrupted record, missed records without noticing, or the slow one was
+   never lapped.
+   Usage: ttylog-bench-shm [MB to publish] [consumers] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmring.h"
+
+
+typedef struct
+{
+  pthread_t thread;
+  int slow;
+  shmring_reader_t r;
+  uint64_t records, bytes, bad, overwritten;
+  uint64_t first;         /* Sequence number of the first record seen. */
+} consumer_t;
+
+
+static shmring_writer_t* ring;
+static char name[64];
+static uint64_t total;
+static _Atomic int started;
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static uint32_t record_len(uint64_t seq)
+{
+  return 1 + (seq * 2654435761u >> 7) % 1500;
+}
+
+
+static unsigned char record_byte(uint64_t seq, uint32_t i)
+{
+  return (unsigned char)(seq * 31 + i);
+}
+
+
+static void* consume(void* arg)
+{
+  consumer_t* c = arg;
+  struct timespec idle = { 0, 100000 };
+  const shmring_record_t* rec;
+
+  atomic_fetch_add(&started, 1);
+  for(;;)
+    {
+      uint64_t seq;
+      const unsigned char* p;
+      uint32_t len, i;
+      int ok = 1;
+
+      rec = shmring_peek(&c->r);
+      if(!rec)
+        {
+          if(shmring_closed(&c->r) && !shmring_peek(&c->r)) { break; }
+          sched_yield();
+          continue;
+        }
+
+      seq = rec->seq;
+      len = rec->len;
+      p = shmring_payload(rec);
+      if(c->first == (uint64_t)-1) { c->first = seq; }
+      if(len != record_len(seq) || rec->port != seq % 7) { ok = 0; }
+      for(i = 0; ok && i < len; i++) { ok = p[i] == record_byte(seq, i); }
+      if(c->slow && seq % 64 == 0) { nanosleep(&idle, NULL); }
+
+      /* Only a record that was not overwritten meanwhile must be right. */
+      if(shmring_next(&c->r, rec))
+        {
+          c->overwritten++;
+          continue;
+        }
+      c->bad += !ok;
+      c->records++;
+      c->bytes += len;
+    }
+
+  return NULL;
+}
+
+
+int main(int argc, char* argv[])
+{
+  static unsigned char buff[2048];
+  size_t mb = argc > 1 ? atoi(argv[1]) : 256;
+  int nconsumers = argc > 2 ? atoi(argv[2]) : 3;
+  consumer_t* consumers = calloc(nconsumers + 1, sizeof(*consumers));
+  uint64_t seq, bytes = 0;
+  double t0, dt;
+  int i, err = 0;
+
+  if(!consumers || nconsumers < 1) { return 1; }
+  snprintf(name, sizeof(name), "/ttylog-bench-%d", (int)getpid());
+  ring = shmring_create(name, SHMRING_MIN_SIZE);
+  if(!ring)
+    {
+      perror("shmring_create");
+      return 1;
+    }
+  total = (uint64_t)mb << 20;
+
+  /* The last consumer is the slow one. */
+  for(i = 0; i <= nconsumers; i++)
+    {
+      consumers[i].slow = i == nconsumers;
+      consumers[i].first = (uint64_t)-1;
+      if(shmring_open(&consumers[i].r, name) || pthread_create(&consumers[i].thread, NULL, consume, &consumers[i]))
+        {
+          perror("consumer");
+          return 1;
+        }
+    }
+  while(atomic_load(&started) <= nconsumers) { sched_yield(); }
+
+  t0 = now_sec();
+  for(seq = 0; bytes < total; seq++)
+    {
+      shmring_record_t rec;
+      uint32_t k;
+
+      memset(&rec, 0, sizeof(rec));
+      rec.len = record_len(seq);
+      rec.port = seq % 7;
+      for(k = 0; k < rec.len; k++) { buff[k] = record_byte(seq, k); }
+      shmring_publish(ring, &rec, buff);
+      bytes += rec.len;
+    }
+  dt = now_sec() - t0;
+  shmring_destroy(ring);
+
+  printf("ring %d k, %llu records, %.1f MB\n", SHMRING_MIN_SIZE / 1024, (unsigned long long)seq, bytes / 1e6);
+  printf("publish    %8.1f MB/s, %.1f M records/s\n", bytes / dt / 1e6, seq / dt / 1e6);
+
+  for(i = 0; i <= nconsumers; i++)
+    {
+      consumer_t* c = &consumers[i];
+
+      pthread_join(c->thread, NULL);
+      printf("%s %llu records, %llu lost, %llu laps, %llu overwritten while read\n", c->slow ? "slow    " : "consumer",
+             (unsigned long long)c->records, (unsigned long long)c->r.lost_records, (unsigned long long)c->r.laps,
+             (unsigned long long)c->overwritten);
+
+      /* Every record is either read or counted as lost, the count starts
+         at the first record seen. */
+      if(c->bad || c->first + c->records + c->r.lost_records != seq)
+        {
+          fprintf(stderr, "consumer %d: %llu corrupted, %llu records missing\n", i, (unsigned long long)c->bad,
+                  (unsigned long long)(seq - c->first - c->records - c->r.lost_records));
+          err = 1;
+        }
+      if(c->slow && !c->r.laps)
+        {
+          fprintf(stderr, "slow consumer was never lapped\n");
+          err = 1;
+        }
+      shmring_close(&c->r);
+    }
+
+  free(consumers);
+  return err;
+}
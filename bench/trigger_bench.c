@@ -0,0 +1,170 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Micro-benchmark and self test of the trigger pattern matcher.
+   Usage: ttylog-bench-trigger [MB to scan] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trigger.h"
+
+
+static const char* patterns[] =
+{
+  "Kernel panic", "Oops:", "BUG:", "Assertion", "assert", "\\x00\\xff\\x00",
+  "ssert", "panic - not syncing", "Call Trace:", "watchdog: BUG: soft lockup",
+};
+#define NPATTERNS (int)(sizeof(patterns) / sizeof(patterns[0]))
+
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Console like text with the patterns planted now and then. */
+static void fill(unsigned char* buff, size_t len, char** pats, const size_t* lens)
+{
+  static const char words[] = "usb 1-1: new high-speed USB device number 3 using ehci-pci\n";
+  size_t i = 0;
+
+  while(i < len)
+    {
+      int r = rand();
+      size_t n;
+      const char* src;
+
+      if(r % 50 == 0)
+        {
+          src = pats[r / 50 % NPATTERNS];
+          n = lens[r / 50 % NPATTERNS];
+        }
+      else if(r % 50 == 1)
+        {
+          buff[i++] = rand();
+          continue;
+        }
+      else
+        {
+          src = words + r % (sizeof(words) - 1);
+          n = strlen(src);
+        }
+      if(n > len - i) { n = len - i; }
+      memcpy(buff + i, src, n);
+      i += n;
+    }
+}
+
+
+/* Offsets after a match of any pattern, the slow way. */
+static size_t naive_matches(const unsigned char* buff, size_t len, char** pats, const size_t* lens, size_t* ends)
+{
+  size_t i, n = 0;
+  int k;
+
+  for(i = 1; i <= len; i++)
+    for(k = 0; k < NPATTERNS; k++)
+      if(lens[k] <= i && !memcmp(buff + i - lens[k], pats[k], lens[k]))
+        {
+          ends[n++] = i;
+          break;
+        }
+
+  return n;
+}
+
+
+int main(int argc, char* argv[])
+{
+  size_t len = 1 << 20;
+  size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+  unsigned char* buff = malloc(len);
+  size_t* ends = malloc(len * sizeof(*ends));
+  char* pats[NPATTERNS];
+  size_t lens[NPATTERNS];
+  trigger_t* t;
+  size_t nends, i, done, found;
+  int state = 0;
+  double t0, dt;
+  int k;
+
+  if(!buff || !ends) { return 1; }
+  for(k = 0; k < NPATTERNS; k++)
+    {
+      pats[k] = malloc(strlen(patterns[k]) + 1);
+      lens[k] = trigger_parse_pattern(patterns[k], pats[k]);
+    }
+  t = trigger_create((const char* const*)pats, lens, NPATTERNS);
+  if(!t) { return 1; }
+
+  srand(1);
+  fill(buff, len, pats, lens);
+
+  /* Every match, found in odd sized pieces so they span chunk borders. */
+  nends = naive_matches(buff, len, pats, lens, ends);
+  for(i = 0, found = 0; i < len; )
+    {
+      size_t n = 1 + rand() % 97;
+      size_t at = 0;
+      long m;
+
+      if(n > len - i) { n = len - i; }
+      while((m = trigger_scan(t, &state, buff + i + at, n - at)) >= 0)
+        {
+          at += m;
+          if(found >= nends || ends[found] != i + at)
+            {
+              fprintf(stderr, "mismatch at offset %zu\n", i + at);
+              return 1;
+            }
+          found++;
+        }
+      i += n;
+    }
+  if(found != nends)
+    {
+      fprintf(stderr, "%zu of %zu matches found\n", found, nends);
+      return 1;
+    }
+
+  printf("%d patterns, %d states, %zu matches in 1 MB\n", NPATTERNS, t->nstates, nends);
+
+  t0 = now_sec();
+  for(done = 0, found = 0; done < total; done += len)
+    {
+      size_t at = 0;
+      long m;
+
+      while((m = trigger_scan(t, &state, buff + at, len - at)) >= 0)
+        {
+          at += m;
+          found++;
+        }
+    }
+  dt = now_sec() - t0;
+  printf("scan       %8.1f MB/s\n", done / dt / 1e6);
+
+  trigger_free(t);
+  for(k = 0; k < NPATTERNS; k++) { free(pats[k]); }
+  free(buff);
+  free(ends);
+  return found ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <string.h>
+#include <endian.h>
+#include <time.h>
+
+#include "binfmt.h"
+
+
+static uint64_t ts_to_ns(const struct timespec* ts)
+{
+  return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+
+void bin_write_header(output_t* out, const struct timespec* start_mono)
+{
+  bin_header_t* h = (bin_header_t*)output_reserve(out, sizeof(*h));
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, BIN_MAGIC, BIN_MAGIC_LEN);
+  h->version = htole16(BIN_VERSION);
+  h->header_len = htole16(sizeof(*h));
+  h->start_mono_ns = htole64(ts_to_ns(start_mono));
+  h->start_real_ns = htole64(ts_to_ns(&now));
+  output_add_preamble(out, (const char*)h, sizeof(*h));
+  output_commit(out, sizeof(*h));
+}
+
+
+static char* put_record(char* p, size_t len, int port, int type, int flags, const rx_time_t* rx_time)
+{
+  bin_record_t rec;
+
+  rec.len = htole32(len);
+  rec.port = htole16(port);
+  rec.type = type;
+  rec.flags = flags;
+  rec.mono_ns = htole64(ts_to_ns(&rx_time->mono));
+  rec.real_ns = htole64(ts_to_ns(&rx_time->real));
+  memcpy(p, &rec, sizeof(rec));
+
+  return p + sizeof(rec);
+}
+
+
+void bin_write_port(output_t* out, int port, const bin_port_t* settings, const char* device)
+{
+  size_t name_len = strlen(device);
+  size_t len = sizeof(bin_port_t) + name_len;
+  char* p = output_reserve(out, sizeof(bin_record_t) + len);
+  bin_port_t s = *settings;
+  rx_time_t rx_time;
+
+  rx_time_now(&rx_time);
+  s.baud = htole32(s.baud);
+  p = put_record(p, len, port, BIN_REC_PORT, 0, &rx_time);
+  memcpy(p, &s, sizeof(s));
+  memcpy(p + sizeof(s), device, name_len);
+  output_add_preamble(out, p - sizeof(bin_record_t), sizeof(bin_record_t) + len);
+  output_commit(out, sizeof(bin_record_t) + len);
+}
+
+
+void bin_write_data(output_t* out, int port, const char* data, size_t len, const rx_time_t* rx_time, int flags)
+{
+  size_t ext = 0;
+  char* p;
+
+  if(rx_time->span_ns || rx_time->byte_ns)
+    {
+      flags |= BIN_FLAG_BYTE_TIMES;
+      ext = sizeof(bin_times_t);
+    }
+
+  p = output_reserve(out, sizeof(bin_record_t) + ext + len);
+  p = put_record(p, ext + len, port, BIN_REC_DATA, flags, rx_time);
+  if(ext)
+    {
+      bin_times_t times;
+
+      times.span_ns = htole64(rx_time->span_ns);
+      times.byte_ns = htole32(rx_time->byte_ns);
+      times.reserved = 0;
+      memcpy(p, &times, sizeof(times));
+      p += sizeof(times);
+    }
+  memcpy(p, data, len);
+  output_commit(out, sizeof(bin_record_t) + ext + len);
+}
+
+
+void bin_write_gap(output_t* out, int port, int64_t gap_ns, const rx_time_t* rx_time)
+{
+  char* p = output_reserve(out, sizeof(bin_record_t) + sizeof(bin_gap_t));
+  bin_gap_t gap;
+
+  gap.gap_ns = htole64(gap_ns);
+  p = put_record(p, sizeof(gap), port, BIN_REC_GAP, 0, rx_time);
+  memcpy(p, &gap, sizeof(gap));
+  output_commit(out, sizeof(bin_record_t) + sizeof(gap));
+}
+
+
+int bin_read_header(const void* p, bin_header_t* header)
+{
+  memcpy(header, p, sizeof(*header));
+  if(memcmp(header->magic, BIN_MAGIC, BIN_MAGIC_LEN)) { return -1; }
+  header->version = le16toh(header->version);
+  header->header_len = le16toh(header->header_len);
+  header->flags = le32toh(header->flags);
+  header->start_mono_ns = le64toh(header->start_mono_ns);
+  header->start_real_ns = le64toh(header->start_real_ns);
+  if(header->version != BIN_VERSION || header->header_len < sizeof(*header)) { return -1; }
+  return 0;
+}
+
+
+void bin_read_record(const void* p, bin_record_t* rec)
+{
+  memcpy(rec, p, sizeof(*rec));
+  rec->len = le32toh(rec->len);
+  rec->port = le16toh(rec->port);
+  rec->mono_ns = le64toh(rec->mono_ns);
+  rec->real_ns = le64toh(rec->real_ns);
+}
+
+
+void bin_read_port(const void* p, bin_port_t* settings)
+{
+  memcpy(settings, p, sizeof(*settings));
+  settings->baud = le32toh(settings->baud);
+}
+
+
+void bin_read_gap(const void* p, bin_gap_t* gap)
+{
+  memcpy(gap, p, sizeof(*gap));
+  gap->gap_ns = le64toh(gap->gap_ns);
+}
+
+
+void bin_read_times(const void* p, rx_time_t* rx_time)
+{
+  bin_times_t times;
+
+  memcpy(&times, p, sizeof(times));
+  rx_time->span_ns = le64toh(times.span_ns);
+  rx_time->byte_ns = le32toh(times.byte_ns);
+}
@@ -0,0 +1,132 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_BINFMT_H_
+#define _TTYLOG_BINFMT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ttylog.h"
+#include "output.h"
+
+
+/* Binary capture format (-F bin). A file starts with a bin_header_t,
+   followed by records, each a bin_record_t and len bytes of payload.
+   All numbers are little endian. A port record describing the settings
+   of a port precedes its first data record. Files may be concatenated,
+   a reader restarts at every file header it finds. */
+
+#define BIN_MAGIC        "TTYLOGB\x01"
+#define BIN_MAGIC_LEN    8
+#define BIN_VERSION      1
+
+/* Record types. */
+enum
+{
+  BIN_REC_DATA = 0,   /* Payload is data received from the port. */
+  BIN_REC_PORT = 1,   /* Payload is a bin_port_t, followed by the device name. */
+  BIN_REC_GAP = 2,    /* Payload is a bin_gap_t, the port was reopened at the record time. */
+};
+
+/* Data record flags. */
+enum
+{
+  BIN_FLAG_BYTE_TIMES = 1,  /* Payload starts with a bin_times_t, len includes it. */
+  BIN_FLAG_FRAME = 2,       /* Payload is one frame, the time is its first byte. */
+};
+
+
+typedef struct
+{
+  char magic[BIN_MAGIC_LEN];
+  uint16_t version;
+  uint16_t header_len;     /* sizeof(bin_header_t), for later extensions. */
+  uint32_t flags;
+  uint64_t start_mono_ns;  /* Capture start, base of relative timestamps. */
+  uint64_t start_real_ns;
+} bin_header_t;
+
+
+typedef struct
+{
+  uint32_t len;            /* Payload length. */
+  uint16_t port;           /* Port id, index of -d on the command line. */
+  uint8_t type;            /* BIN_REC_*. */
+  uint8_t flags;
+  uint64_t mono_ns;        /* Receive time, CLOCK_MONOTONIC. */
+  uint64_t real_ns;        /* Receive time, CLOCK_REALTIME. */
+} bin_record_t;
+
+
+/* Estimated arrival of the bytes of a data record, see rx_time_t. */
+typedef struct
+{
+  uint64_t span_ns;        /* First byte before the receive time. */
+  uint32_t byte_ns;        /* Time between the bytes. */
+  uint32_t reserved;
+} bin_times_t;
+
+
+typedef struct
+{
+  uint32_t baud;
+  uint8_t data_bits;
+  uint8_t parity;          /* 'N', 'E', 'O', 'M' or 'S'. */
+  uint8_t stop_bits;
+  uint8_t reserved;
+} bin_port_t;
+
+
+/* Time the device of a port was gone before it was reopened, --reconnect. */
+typedef struct
+{
+  uint64_t gap_ns;
+} bin_gap_t;
+
+
+/* Write file header to out. Output must be locked. */
+void bin_write_header(output_t* out, const struct timespec* start_mono);
+
+/* Write port description. Output must be locked. */
+void bin_write_port(output_t* out, int port, const bin_port_t* settings, const char* device);
+
+/* Write data record, with the byte times of rx_time if it has them.
+   Output must be locked. */
+void bin_write_data(output_t* out, int port, const char* data, size_t len, const rx_time_t* rx_time, int flags);
+
+/* Write gap record, the device was gone for gap_ns until rx_time. Output
+   must be locked. */
+void bin_write_gap(output_t* out, int port, int64_t gap_ns, const rx_time_t* rx_time);
+
+
+/* Decode header at p, returns 0 if it is a valid file header. */
+int bin_read_header(const void* p, bin_header_t* header);
+
+/* Decode record header at p into host byte order. */
+void bin_read_record(const void* p, bin_record_t* rec);
+
+/* Decode port record payload at p. */
+void bin_read_port(const void* p, bin_port_t* settings);
+
+/* Decode gap record payload at p. */
+void bin_read_gap(const void* p, bin_gap_t* gap);
+
+/* Decode byte times at the start of the payload of a BIN_FLAG_BYTE_TIMES
+   data record into rx_time. */
+void bin_read_times(const void* p, rx_time_t* rx_time);
+
+#endif
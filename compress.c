@@ -0,0 +1,492 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "ttylog.h"
+#include "compress.h"
+
+
+/* Buffers per compressed output, one is filled by the output while the
+   others wait for or go through compression. */
+#define COMPRESS_BUFFS 4
+
+
+typedef struct
+{
+  char* buff;
+  size_t size;
+  size_t len;
+  int64_t first_ns;
+} frame_t;
+
+
+struct compress_s
+{
+  int fd;
+  int index_fd;
+  int codec;
+  int level;
+  size_t frame_size;
+  uint64_t offset;          /* Compressed bytes in the file. */
+  uint64_t raw_offset;      /* Uncompressed data bytes, preambles not counted. */
+  char* scratch;            /* Preamble and frame data, contiguous. */
+  size_t scratch_size;
+  char* out;                /* Compressed frame. */
+  size_t out_size;
+  int write_error;
+  uint64_t frames;          /* Frames written by this run. */
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  frame_t queue[COMPRESS_BUFFS];
+  int head;
+  int count;
+  frame_t free[COMPRESS_BUFFS];
+  int nfree;
+  int busy;                 /* A frame is being compressed. */
+  int stop;
+  char* preamble;
+  size_t preamble_len;
+};
+
+
+int compress_parse(const char* name)
+{
+#ifdef HAVE_ZLIB
+  if(!strcmp(name, "gzip") || !strcmp(name, "gz")) { return COMPRESS_GZIP; }
+#endif
+#ifdef HAVE_ZSTD
+  if(!strcmp(name, "zstd") || !strcmp(name, "zst")) { return COMPRESS_ZSTD; }
+#endif
+#ifdef HAVE_LZ4
+  if(!strcmp(name, "lz4")) { return COMPRESS_LZ4; }
+#endif
+  (void)name;
+  return -1;
+}
+
+
+void compress_level_range(int codec, int* min, int* max)
+{
+  *min = 0;
+  *max = 0;
+  if(codec == COMPRESS_GZIP) { *max = 9; }
+  else if(codec == COMPRESS_ZSTD) { *min = 1; *max = 22; }
+  else if(codec == COMPRESS_LZ4) { *max = 12; }
+}
+
+
+size_t compress_bound(int codec, size_t len)
+{
+  switch(codec)
+    {
+#ifdef HAVE_ZLIB
+      /* deflateBound() plus the gzip header and trailer. */
+      case COMPRESS_GZIP: return compressBound(len) + 32;
+#endif
+#ifdef HAVE_ZSTD
+      case COMPRESS_ZSTD: return ZSTD_compressBound(len);
+#endif
+#ifdef HAVE_LZ4
+      case COMPRESS_LZ4: return LZ4F_compressFrameBound(len, NULL);
+#endif
+      default: return len;
+    }
+}
+
+
+size_t compress_buffer(int codec, int level, char* dst, size_t cap, const char* src, size_t len)
+{
+  switch(codec)
+    {
+#ifdef HAVE_ZLIB
+      case COMPRESS_GZIP:
+        {
+          z_stream z;
+          size_t n;
+
+          memset(&z, 0, sizeof(z));
+          /* Window bits + 16 makes a gzip member. */
+          if(deflateInit2(&z, level ? level : Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { return 0; }
+          z.next_in = (Bytef*)src;
+          z.avail_in = len;
+          z.next_out = (Bytef*)dst;
+          z.avail_out = cap;
+          n = (deflate(&z, Z_FINISH) == Z_STREAM_END) ? z.total_out : 0;
+          deflateEnd(&z);
+          return n;
+        }
+#endif
+#ifdef HAVE_ZSTD
+      case COMPRESS_ZSTD:
+        {
+          size_t n = ZSTD_compress(dst, cap, src, len, level ? level : 1);
+          return ZSTD_isError(n) ? 0 : n;
+        }
+#endif
+#ifdef HAVE_LZ4
+      case COMPRESS_LZ4:
+        {
+          LZ4F_preferences_t prefs;
+          size_t n;
+
+          memset(&prefs, 0, sizeof(prefs));
+          prefs.compressionLevel = level;
+          prefs.frameInfo.contentSize = len;
+          n = LZ4F_compressFrame(dst, cap, src, len, &prefs);
+          return LZ4F_isError(n) ? 0 : n;
+        }
+#endif
+      default:
+        (void)level;
+        (void)dst;
+        (void)cap;
+        (void)src;
+        (void)len;
+        return 0;
+    }
+}
+
+
+int decompress_buffer(int codec, char* dst, size_t len, const char* src, size_t src_len)
+{
+  switch(codec)
+    {
+#ifdef HAVE_ZLIB
+      case COMPRESS_GZIP:
+        {
+          z_stream z;
+          int ret;
+
+          memset(&z, 0, sizeof(z));
+          if(inflateInit2(&z, 15 + 16) != Z_OK) { return -1; }
+          z.next_in = (Bytef*)src;
+          z.avail_in = src_len;
+          z.next_out = (Bytef*)dst;
+          z.avail_out = len;
+          ret = inflate(&z, Z_FINISH);
+          inflateEnd(&z);
+          return (ret == Z_STREAM_END && z.total_out == len) ? 0 : -1;
+        }
+#endif
+#ifdef HAVE_ZSTD
+      case COMPRESS_ZSTD:
+        {
+          size_t n = ZSTD_decompress(dst, len, src, src_len);
+          return (ZSTD_isError(n) || n != len) ? -1 : 0;
+        }
+#endif
+#ifdef HAVE_LZ4
+      case COMPRESS_LZ4:
+        {
+          LZ4F_dctx* ctx;
+          size_t dst_size = len;
+          size_t src_size = src_len;
+          size_t ret;
+
+          if(LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION))) { return -1; }
+          ret = LZ4F_decompress(ctx, dst, &dst_size, src, &src_size, NULL);
+          LZ4F_freeDecompressionContext(ctx);
+          return (ret != 0 || dst_size != len) ? -1 : 0;
+        }
+#endif
+      default:
+        (void)dst;
+        (void)len;
+        (void)src;
+        (void)src_len;
+        return -1;
+    }
+}
+
+
+static void write_all(compress_t* zc, int fd, const char* data, size_t len)
+{
+  while(len && !zc->write_error)
+    {
+      ssize_t n = write(fd, data, len);
+      if(n < 0)
+        {
+          if(errno == EINTR) { continue; }
+          fprintf (stderr, "%s: error %d while writing compressed output\n", progname, errno);
+          zc->write_error = 1;
+          break;
+        }
+      data += n;
+      len -= n;
+    }
+}
+
+
+/* Compress and write one frame, on the compressor thread. */
+static void compress_frame(compress_t* zc, const frame_t* frame, const char* preamble, size_t preamble_len)
+{
+  const char* src = frame->buff;
+  size_t len = frame->len;
+  size_t need = preamble_len + len;
+  size_t n;
+
+  if(preamble_len)
+    {
+      if(need > zc->scratch_size)
+        {
+          free(zc->scratch);
+          zc->scratch = malloc(need);
+          zc->scratch_size = zc->scratch ? need : 0;
+          if(!zc->scratch) { goto nomem; }
+        }
+      memcpy(zc->scratch, preamble, preamble_len);
+      memcpy(zc->scratch + preamble_len, src, len);
+      src = zc->scratch;
+      len = need;
+    }
+
+  if(compress_bound(zc->codec, len) > zc->out_size)
+    {
+      free(zc->out);
+      zc->out_size = compress_bound(zc->codec, len);
+      zc->out = malloc(zc->out_size);
+      if(!zc->out) { goto nomem; }
+    }
+
+  n = compress_buffer(zc->codec, zc->level, zc->out, zc->out_size, src, len);
+  /* Like a failed write, the rest of the output is lost. */
+  if(!n)
+    {
+      if(!zc->write_error) { fprintf (stderr, "%s: error while compressing output\n", progname); }
+      zc->write_error = 1;
+      return;
+    }
+  write_all(zc, zc->fd, zc->out, n);
+
+  if(zc->index_fd >= 0)
+    {
+      comp_index_t e;
+
+      e.offset = htole64(zc->offset);
+      e.raw_offset = htole64(zc->raw_offset);
+      e.len = htole32(n);
+      e.raw_len = htole32(frame->len);
+      e.preamble_len = htole32(preamble_len);
+      e.codec = htole32(zc->codec);
+      e.first_ns = htole64(frame->first_ns);
+      write_all(zc, zc->index_fd, (const char*)&e, sizeof(e));
+    }
+  zc->offset += n;
+  zc->raw_offset += frame->len;
+  zc->frames++;
+  return;
+
+nomem:
+  fprintf (stderr, "%s: out of memory\n", progname);
+  exit(0);
+}
+
+
+static void* compress_run(void* arg)
+{
+  compress_t* zc = arg;
+
+  pthread_mutex_lock(&zc->lock);
+  for(;;)
+    {
+      frame_t frame;
+
+      while(!zc->count && !zc->stop) { pthread_cond_wait(&zc->cond, &zc->lock); }
+      if(!zc->count) { break; }
+
+      frame = zc->queue[zc->head];
+      zc->head = (zc->head + 1) % COMPRESS_BUFFS;
+      zc->count--;
+      zc->busy = 1;
+
+      /* The first frame has the preamble in its data already. */
+      pthread_mutex_unlock(&zc->lock);
+      compress_frame(zc, &frame, zc->preamble, zc->frames ? zc->preamble_len : 0);
+      pthread_mutex_lock(&zc->lock);
+
+      zc->busy = 0;
+      frame.len = 0;
+      zc->free[zc->nfree++] = frame;
+      pthread_cond_broadcast(&zc->cond);
+    }
+  pthread_mutex_unlock(&zc->lock);
+
+  return NULL;
+}
+
+
+/* Continue the offsets of an existing compressed file and its index. */
+static void compress_resume(compress_t* zc)
+{
+  comp_index_header_t h;
+  comp_index_t e;
+  struct stat st;
+
+  if(fstat(zc->fd, &st) == 0 && S_ISREG(st.st_mode)) { zc->offset = st.st_size; }
+  if(zc->index_fd < 0 || fstat(zc->index_fd, &st)) { return; }
+
+  if(st.st_size == 0)
+    {
+      memcpy(h.magic, COMPRESS_INDEX_MAGIC, COMPRESS_INDEX_MAGIC_LEN);
+      h.version = htole32(COMPRESS_INDEX_VERSION);
+      h.entry_len = htole32(sizeof(comp_index_t));
+      write_all(zc, zc->index_fd, (const char*)&h, sizeof(h));
+    }
+  else if(st.st_size >= (off_t)(sizeof(h) + sizeof(e))
+          && pread(zc->index_fd, &e, sizeof(e), st.st_size - sizeof(e)) == sizeof(e))
+    {
+      zc->raw_offset = le64toh(e.raw_offset) + le32toh(e.raw_len);
+    }
+}
+
+
+compress_t* compress_open(int fd, const char* index_path, int codec, int level, size_t frame_size)
+{
+  compress_t* zc = calloc(1, sizeof(*zc));
+  int i;
+
+  if(!zc) { return NULL; }
+
+  zc->fd = fd;
+  zc->index_fd = -1;
+  zc->codec = codec;
+  zc->level = level;
+  zc->frame_size = frame_size;
+
+  for(i = 0; i < COMPRESS_BUFFS - 1; i++)
+    {
+      zc->free[i].buff = malloc(frame_size);
+      zc->free[i].size = frame_size;
+      if(!zc->free[i].buff) { goto fail; }
+      zc->nfree++;
+    }
+
+  if(index_path)
+    {
+      zc->index_fd = open(index_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if(zc->index_fd < 0)
+        {
+          fprintf (stderr, "%s: can not open index %s\n", progname, index_path);
+          goto fail;
+        }
+    }
+  compress_resume(zc);
+
+  pthread_mutex_init(&zc->lock, NULL);
+  pthread_cond_init(&zc->cond, NULL);
+  if(pthread_create(&zc->thread, NULL, compress_run, zc))
+    {
+      pthread_cond_destroy(&zc->cond);
+      pthread_mutex_destroy(&zc->lock);
+      goto fail;
+    }
+
+  return zc;
+
+fail:
+  for(i = 0; i < zc->nfree; i++) { free(zc->free[i].buff); }
+  if(zc->index_fd >= 0) { close(zc->index_fd); }
+  free(zc);
+  return NULL;
+}
+
+
+char* compress_submit(compress_t* zc, char* buff, size_t len, int64_t first_ns, size_t* size)
+{
+  frame_t frame;
+
+  pthread_mutex_lock(&zc->lock);
+  while(!zc->nfree) { pthread_cond_wait(&zc->cond, &zc->lock); }
+
+  frame.buff = buff;
+  frame.size = *size;
+  frame.len = len;
+  frame.first_ns = first_ns;
+  zc->queue[(zc->head + zc->count) % COMPRESS_BUFFS] = frame;
+  zc->count++;
+
+  frame = zc->free[--zc->nfree];
+  pthread_cond_broadcast(&zc->cond);
+  pthread_mutex_unlock(&zc->lock);
+
+  *size = frame.size;
+  return frame.buff;
+}
+
+
+void compress_set_preamble(compress_t* zc, const char* data, size_t len)
+{
+  char* p = malloc(len);
+
+  if(!p)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      exit(0);
+    }
+  memcpy(p, data, len);
+
+  /* Frames queued before keep the old preamble. */
+  pthread_mutex_lock(&zc->lock);
+  while(zc->count || zc->busy) { pthread_cond_wait(&zc->cond, &zc->lock); }
+  free(zc->preamble);
+  zc->preamble = p;
+  zc->preamble_len = len;
+  pthread_mutex_unlock(&zc->lock);
+}
+
+
+void compress_close(compress_t* zc)
+{
+  int i;
+
+  pthread_mutex_lock(&zc->lock);
+  zc->stop = 1;
+  pthread_cond_broadcast(&zc->cond);
+  pthread_mutex_unlock(&zc->lock);
+  pthread_join(zc->thread, NULL);
+
+  for(i = 0; i < zc->nfree; i++) { free(zc->free[i].buff); }
+  if(zc->index_fd >= 0) { close(zc->index_fd); }
+  pthread_cond_destroy(&zc->cond);
+  pthread_mutex_destroy(&zc->lock);
+  free(zc->preamble);
+  free(zc->scratch);
+  free(zc->out);
+  free(zc);
+}
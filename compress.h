@@ -0,0 +1,108 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_COMPRESS_H_
+#define _TTYLOG_COMPRESS_H_
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* Compressed output. The output is cut into frames that are compressed on
+   a background thread, each a complete gzip member, zstd frame or lz4
+   frame, so the file is a valid stream for zcat, zstdcat or lz4cat and
+   every frame can be decoded on its own. The output preamble (the bin
+   capture header and port records) is repeated at the start of every
+   frame.
+
+   Next to a compressed file "path" an index "path.idx" is written, a
+   comp_index_header_t followed by a comp_index_t per frame, so a time
+   window can be extracted without decompressing the whole file. All
+   numbers are little endian. */
+
+/* Codecs. */
+enum
+{
+  COMPRESS_NONE = 0,
+  COMPRESS_GZIP = 1,
+  COMPRESS_ZSTD = 2,
+  COMPRESS_LZ4 = 3,
+};
+
+#define COMPRESS_INDEX_MAGIC     "TTYLOGI\x01"
+#define COMPRESS_INDEX_MAGIC_LEN 8
+#define COMPRESS_INDEX_VERSION   1
+#define COMPRESS_FRAME_SIZE      (1024 * 1024)
+
+
+typedef struct
+{
+  char magic[COMPRESS_INDEX_MAGIC_LEN];
+  uint32_t version;
+  uint32_t entry_len;      /* sizeof(comp_index_t), for later extensions. */
+} comp_index_header_t;
+
+
+typedef struct
+{
+  uint64_t offset;         /* Position of the compressed frame in the file. */
+  uint64_t raw_offset;     /* Position of its data in the uncompressed output, preambles not counted. */
+  uint32_t len;            /* Compressed length. */
+  uint32_t raw_len;        /* Uncompressed data length, without the preamble. */
+  uint32_t preamble_len;   /* Preamble length at the start of the uncompressed frame. */
+  uint32_t codec;
+  uint64_t first_ns;       /* CLOCK_REALTIME of the first data in the frame, 0 if unknown. */
+} comp_index_t;
+
+
+typedef struct compress_s compress_t;
+
+
+/* Codec for name (gzip, zstd or lz4), -1 if unknown or not built in. */
+int compress_parse(const char* name);
+
+/* Levels codec accepts, 0 picks the fastest of gzip and lz4. */
+void compress_level_range(int codec, int* min, int* max);
+
+/* Largest compressed size of len bytes. */
+size_t compress_bound(int codec, size_t len);
+
+/* Compress len bytes at src into one independent frame at dst. Returns the
+   compressed length, 0 on error. */
+size_t compress_buffer(int codec, int level, char* dst, size_t cap, const char* src, size_t len);
+
+/* Decompress a frame of src_len bytes into exactly len bytes at dst.
+   Returns 0 on success. */
+int decompress_buffer(int codec, char* dst, size_t len, const char* src, size_t src_len);
+
+/* Start compressing to fd, with the index written to index_path unless it
+   is NULL. Frames are up to frame_size bytes. Returns NULL on error. */
+compress_t* compress_open(int fd, const char* index_path, int codec, int level, size_t frame_size);
+
+/* Queue len bytes at buff, received from first_ns on, as a frame. Returns
+   an empty buffer to fill next and its capacity in size, waits while all
+   buffers are in the queue. */
+char* compress_submit(compress_t* zc, char* buff, size_t len, int64_t first_ns, size_t* size);
+
+/* Set the data every frame starts with. */
+void compress_set_preamble(compress_t* zc, const char* data, size_t len);
+
+/* Compress the queued frames and stop the thread. */
+void compress_close(compress_t* zc);
+
+#endif
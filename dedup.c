@@ -0,0 +1,367 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+
+
+/* Receive time of the data from offset of the chunk received at rx_time,
+   keeping its byte times. */
+static void dedup_time_from(const rx_time_t* rx_time, size_t offset, rx_time_t* at)
+{
+  *at = *rx_time;
+  at->span_ns -= (int64_t)offset * rx_time->byte_ns;
+  if(at->span_ns < 0) { at->span_ns = 0; }
+  if(!at->span_ns) { at->byte_ns = 0; }
+}
+
+
+static void ts_sub_ns(struct timespec* ts, int64_t ns)
+{
+  int64_t t = (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec - ns;
+
+  ts->tv_sec = t / 1000000000LL;
+  ts->tv_nsec = t % 1000000000LL;
+}
+
+
+/* Arrival of byte offset of the chunk received at rx_time. */
+static void dedup_time_at(const rx_time_t* rx_time, size_t offset, rx_time_t* at)
+{
+  dedup_time_from(rx_time, offset, at);
+  ts_sub_ns(&at->mono, at->span_ns);
+  ts_sub_ns(&at->real, at->span_ns);
+  at->span_ns = 0;
+  at->byte_ns = 0;
+}
+
+
+static int64_t dedup_ns(const rx_time_t* t)
+{
+  return (int64_t)t->mono.tv_sec * 1000000000LL + t->mono.tv_nsec;
+}
+
+
+static void dedup_summarize(dedup_t* d)
+{
+  if(!d->rep.count) { return; }
+  d->emit(d->arg, NULL, 0, &d->rep.last, &d->rep);
+  d->rep.count = 0;
+}
+
+
+/* One more repeat of n lines or bytes, the last arrived at. */
+static void dedup_repeat(dedup_t* d, uint64_t n, int byte, const rx_time_t* first, const rx_time_t* last)
+{
+  if(!d->rep.count)
+    {
+      d->rep.byte = byte;
+      d->rep.first = *first;
+    }
+  d->rep.count += n;
+  d->rep.last = *last;
+  if(dedup_ns(last) - dedup_ns(&d->rep.first) >= DEDUP_REPORT_NS) { dedup_summarize(d); }
+}
+
+
+int dedup_init(dedup_t* d, int mode, const uint8_t* mask, size_t mask_len, dedup_emit_t emit, void* arg)
+{
+  memset(d, 0, sizeof(*d));
+  d->mode = mode;
+  d->mask = mask;
+  d->mask_len = mask_len;
+  d->emit = emit;
+  d->arg = arg;
+
+  if(mode == DEDUP_LINES)
+    {
+      d->prev = malloc(DEDUP_LINE_MAX);
+      d->line = malloc(DEDUP_LINE_MAX);
+      if(!d->prev || !d->line)
+        {
+          dedup_free(d);
+          return -1;
+        }
+    }
+
+  return 0;
+}
+
+
+void dedup_free(dedup_t* d)
+{
+  free(d->prev);
+  free(d->line);
+  d->prev = NULL;
+  d->line = NULL;
+  d->mode = DEDUP_OFF;
+}
+
+
+/* Bytes of data that still match the previous line from the held part of
+   the line on, up to and with the newline ending it. */
+static size_t dedup_match(const dedup_t* d, const char* data, size_t len)
+{
+  const char* prev = d->prev + d->line_len;
+  size_t n = d->prev_len - d->line_len;
+  size_t i;
+
+  if(n > len) { n = len; }
+  if(!d->mask)
+    {
+      for(i = 0; i < n && data[i] == prev[i]; i++) {}
+    }
+  else
+    {
+      size_t col = d->line_len;
+
+      /* The newline is never masked, lines of other lengths differ. */
+      for(i = 0; i < n; i++, col++)
+        {
+          if(data[i] == prev[i]) { continue; }
+          if(col >= d->mask_len || !d->mask[col] || data[i] == '\n' || prev[i] == '\n') { break; }
+        }
+    }
+
+  return i;
+}
+
+
+static void dedup_feed_lines(dedup_t* d, const char* data, size_t len, const rx_time_t* rx_time)
+{
+  size_t i = 0;
+  size_t seg = 0;     /* Start of the data not output yet. */
+  rx_time_t at;
+
+  while(i < len)
+    {
+      const char* nl;
+      size_t n;
+
+      if(d->holding)
+        {
+          n = dedup_match(d, data + i, len - i);
+          if(!d->line_len) { dedup_time_from(rx_time, i, &d->line_time); }
+          memcpy(d->line + d->line_len, data + i, n);
+          d->line_len += n;
+          i += n;
+          seg = i;
+
+          /* The whole line, newline included, is a repeat. */
+          if(d->line_len == d->prev_len)
+            {
+              rx_time_t first;
+
+              dedup_time_at(&d->line_time, 0, &first);
+              dedup_time_at(rx_time, i - 1, &at);
+              dedup_repeat(d, 1, -1, &first, &at);
+              d->line_len = 0;
+              continue;
+            }
+          if(i == len) { break; }
+
+          /* It differs, what was held back goes out after the summary. */
+          dedup_summarize(d);
+          d->emit(d->arg, d->line, d->line_len, &d->line_time, NULL);
+          d->holding = 0;
+        }
+
+      /* Output the rest of the line, keeping it for the next to compare. */
+      nl = memchr(data + i, '\n', len - i);
+      n = nl ? (size_t)(nl + 1 - (data + i)) : len - i;
+      if(!d->line_long && d->line_len + n <= DEDUP_LINE_MAX)
+        {
+          memcpy(d->line + d->line_len, data + i, n);
+          d->line_len += n;
+        }
+      else
+        {
+          d->line_long = 1;
+        }
+      i += n;
+
+      if(nl)
+        {
+          char* p = d->prev;
+
+          d->prev_len = d->line_long ? 0 : d->line_len;
+          d->prev = d->line;
+          d->line = p;
+          d->line_len = 0;
+          d->line_long = 0;
+
+          /* The next line is held back from its start on. */
+          if(d->prev_len)
+            {
+              dedup_time_from(rx_time, seg, &at);
+              d->emit(d->arg, data + seg, i - seg, &at, NULL);
+              seg = i;
+              d->holding = 1;
+            }
+        }
+    }
+
+  if(seg < len)
+    {
+      dedup_time_from(rx_time, seg, &at);
+      d->emit(d->arg, data + seg, len - seg, &at, NULL);
+    }
+}
+
+
+/* Output the short run held back from the end of the last read. */
+static void dedup_release(dedup_t* d)
+{
+  if(!d->run_len) { return; }
+  memset(d->run, d->run_byte, d->run_len);
+  d->emit(d->arg, d->run, d->run_len, &d->run_time, NULL);
+  d->run_len = 0;
+}
+
+
+static void dedup_feed_bytes(dedup_t* d, const char* data, size_t len, const rx_time_t* rx_time)
+{
+  size_t i = 0;
+  size_t seg = 0;     /* Start of the data not output yet. */
+  rx_time_t first, last;
+
+  while(i < len)
+    {
+      unsigned char c = data[i];
+      size_t j = i + 1;
+      size_t held = 0;
+
+      while(j < len && (unsigned char)data[j] == c) { j++; }
+
+      /* A run left out so far goes on, or it ended. */
+      if(d->rep.count && c == d->rep.byte)
+        {
+          dedup_time_at(rx_time, i, &first);
+          dedup_time_at(rx_time, j - 1, &last);
+          dedup_repeat(d, j - i, c, &first, &last);
+          seg = i = j;
+          continue;
+        }
+      dedup_summarize(d);
+
+      /* Only the first run of a read can go on from the bytes held back. */
+      if(d->run_len)
+        {
+          if(c == d->run_byte) { held = d->run_len; }
+          else { dedup_release(d); }
+        }
+
+      if(held + j - i >= DEDUP_RUN_MIN)
+        {
+          if(seg < i)
+            {
+              dedup_time_from(rx_time, seg, &first);
+              d->emit(d->arg, data + seg, i - seg, &first, NULL);
+            }
+          if(held) { dedup_time_at(&d->run_time, 0, &first); }
+          else { dedup_time_at(rx_time, i, &first); }
+          d->run_len = 0;
+          dedup_time_at(rx_time, j - 1, &last);
+          dedup_repeat(d, held + j - i, c, &first, &last);
+          seg = j;
+        }
+      else if(j == len)
+        {
+          /* A short run at the end is held back, the next read may go on with it. */
+          if(seg < i)
+            {
+              dedup_time_from(rx_time, seg, &first);
+              d->emit(d->arg, data + seg, i - seg, &first, NULL);
+            }
+          if(!held) { dedup_time_from(rx_time, i, &d->run_time); }
+          d->run_byte = c;
+          d->run_len = held + j - i;
+          seg = j;
+        }
+      else if(held)
+        {
+          dedup_release(d);
+        }
+      i = j;
+    }
+
+  if(seg < len)
+    {
+      dedup_time_from(rx_time, seg, &first);
+      d->emit(d->arg, data + seg, len - seg, &first, NULL);
+    }
+}
+
+
+void dedup_feed(dedup_t* d, const char* data, size_t len, const rx_time_t* rx_time)
+{
+  if(d->mode == DEDUP_LINES) { dedup_feed_lines(d, data, len, rx_time); }
+  else if(d->mode == DEDUP_BYTES) { dedup_feed_bytes(d, data, len, rx_time); }
+  else { d->emit(d->arg, data, len, rx_time, NULL); }
+}
+
+
+void dedup_flush(dedup_t* d)
+{
+  dedup_summarize(d);
+
+  /* The held part of the line goes on as a line of its own. */
+  if(d->holding && d->line_len)
+    {
+      d->emit(d->arg, d->line, d->line_len, &d->line_time, NULL);
+      d->holding = 0;
+    }
+  dedup_release(d);
+}
+
+
+int dedup_parse_mask(const char* spec, uint8_t** mask, size_t* len)
+{
+  uint8_t* m = calloc(1, DEDUP_LINE_MAX);
+  size_t n = 0;
+
+  if(!m) { return -1; }
+  for(;;)
+    {
+      char* end;
+      long from = strtol(spec, &end, 10), to = from;
+
+      if(end == spec) { break; }
+      if(*end == '-')
+        {
+          spec = end + 1;
+          to = strtol(spec, &end, 10);
+          if(end == spec) { break; }
+        }
+      if(from < 1 || to < from || to > DEDUP_LINE_MAX) { break; }
+      memset(m + from - 1, 1, to - from + 1);
+      if((size_t)to > n) { n = to; }
+
+      if(!*end)
+        {
+          *mask = m;
+          *len = n;
+          return 0;
+        }
+      if(*end != ',') { break; }
+      spec = end + 1;
+    }
+
+  free(m);
+  return -1;
+}
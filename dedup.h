@@ -0,0 +1,112 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_DEDUP_H_
+#define _TTYLOG_DEDUP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ttylog.h"
+
+
+/* Collapsing of repeated data before it is formatted, see --dedup. Lines
+   that repeat the previous line, apart from masked columns, are left out,
+   as are runs of equal bytes, and a summary is output when the repeats
+   end. Every byte is compared once as it arrives, against the byte at the
+   same column of the previous line or the byte before it, so the cost per
+   byte is the same however much repeats. A line is only held back while it
+   matches the previous one so far, and equal bytes ending a read only while
+   there are fewer than DEDUP_RUN_MIN, so runs split over reads collapse. */
+
+/* Longer lines are output as they are and never compared. */
+#define DEDUP_LINE_MAX 4096
+
+/* Shorter runs of equal bytes are output as they are. */
+#define DEDUP_RUN_MIN 16
+
+/* A run going on for this long is summarized, and a new one started. */
+#define DEDUP_REPORT_NS 60000000000LL
+
+
+/* Modes. */
+enum
+{
+  DEDUP_OFF = 0,
+  DEDUP_LINES = 1,   /* Repeated lines, for the ascii format. */
+  DEDUP_BYTES = 2,   /* Runs of equal bytes, for the hex formats. */
+};
+
+
+/* Repeats left out. */
+typedef struct
+{
+  uint64_t count;          /* Lines or bytes left out, 0 for none. */
+  int byte;                /* The repeated byte, -1 for lines. */
+  rx_time_t first;         /* Arrival of the first and the last repeat. */
+  rx_time_t last;
+} dedup_repeat_t;
+
+/* Output of the stage: data with its receive time, or a summary when rep
+   is not NULL. */
+typedef void (*dedup_emit_t)(void* arg, const char* data, size_t len, const rx_time_t* rx_time, const dedup_repeat_t* rep);
+
+
+/* State of a port, only used by the thread formatting it. */
+typedef struct
+{
+  int mode;
+  const uint8_t* mask;     /* Nonzero for columns from 0 not compared, NULL for none. */
+  size_t mask_len;
+  dedup_emit_t emit;
+  void* arg;
+
+  /* DEDUP_LINES. */
+  char* prev;              /* Last line output, with its newline. */
+  size_t prev_len;         /* 0 when there is nothing to compare with. */
+  char* line;              /* Line being received, output or held back. */
+  size_t line_len;
+  int line_long;           /* Line is longer than DEDUP_LINE_MAX. */
+  int holding;             /* Line matches prev so far and is held back. */
+  rx_time_t line_time;     /* Receive time of the held bytes. */
+
+  /* DEDUP_BYTES. */
+  char run[DEDUP_RUN_MIN - 1];  /* Run of run_byte ending the last read, held back. */
+  size_t run_len;
+  int run_byte;
+  rx_time_t run_time;      /* Receive time of the held run. */
+
+  dedup_repeat_t rep;      /* Repeats not summarized yet. */
+} dedup_t;
+
+
+/* Set up d for mode with the column mask of dedup_parse_mask(), which
+   stays owned by the caller. Returns 0, or -1 when out of memory. */
+int dedup_init(dedup_t* d, int mode, const uint8_t* mask, size_t mask_len, dedup_emit_t emit, void* arg);
+void dedup_free(dedup_t* d);
+
+/* Pass len bytes received at rx_time through d. */
+void dedup_feed(dedup_t* d, const char* data, size_t len, const rx_time_t* rx_time);
+
+/* Output the summary of the repeats so far and what is held back, before
+   a marker or at the end. */
+void dedup_flush(dedup_t* d);
+
+/* Parse columns like cut -c, "1-23,40-45" counting from 1, into a mask
+   of *len bytes. Returns 0, or -1 when spec is not valid. */
+int dedup_parse_mask(const char* spec, uint8_t** mask, size_t* len);
+
+#endif
@@ -0,0 +1,148 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "evloop.h"
+
+
+#ifdef HAVE_SYS_EPOLL_H
+
+int evloop_init(evloop_t* loop, int max_fds)
+{
+  (void)max_fds;
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  return (loop->epfd < 0) ? -1 : 0;
+}
+
+
+int evloop_add(evloop_t* loop, int fd, void* data)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = data;
+  return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+
+void evloop_del(evloop_t* loop, int fd)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+
+int evloop_wait(evloop_t* loop, void** ready, int max_ready, int timeout_ms)
+{
+  struct epoll_event events[64];
+  int i, n;
+
+  if(max_ready > 64) { max_ready = 64; }
+  do
+    {
+      n = epoll_wait(loop->epfd, events, max_ready, timeout_ms);
+    }
+  while(n < 0 && errno == EINTR);
+
+  for(i = 0; i < n; i++) { ready[i] = events[i].data.ptr; }
+  return n;
+}
+
+
+void evloop_free(evloop_t* loop)
+{
+  if(loop->epfd >= 0) { close(loop->epfd); }
+  loop->epfd = -1;
+}
+
+#else /* !HAVE_SYS_EPOLL_H */
+
+int evloop_init(evloop_t* loop, int max_fds)
+{
+  memset(loop, 0, sizeof(*loop));
+  loop->fds = calloc(max_fds, sizeof(*loop->fds));
+  loop->data = calloc(max_fds, sizeof(*loop->data));
+  loop->max_fds = max_fds;
+  return (loop->fds && loop->data) ? 0 : -1;
+}
+
+
+int evloop_add(evloop_t* loop, int fd, void* data)
+{
+  if(loop->nfds >= loop->max_fds) { return -1; }
+  loop->fds[loop->nfds].fd = fd;
+  loop->fds[loop->nfds].events = POLLIN;
+  loop->data[loop->nfds] = data;
+  loop->nfds++;
+  return 0;
+}
+
+
+void evloop_del(evloop_t* loop, int fd)
+{
+  int i;
+  for(i = 0; i < loop->nfds; i++)
+    {
+      if(loop->fds[i].fd != fd) { continue; }
+      loop->nfds--;
+      loop->fds[i] = loop->fds[loop->nfds];
+      loop->data[i] = loop->data[loop->nfds];
+      return;
+    }
+}
+
+
+int evloop_wait(evloop_t* loop, void** ready, int max_ready, int timeout_ms)
+{
+  int i, n, count = 0;
+
+  do
+    {
+      n = poll(loop->fds, loop->nfds, timeout_ms);
+    }
+  while(n < 0 && errno == EINTR);
+  if(n <= 0) { return n; }
+
+  /* Rotate the start index so busy low numbered ports can not starve the rest. */
+  for(i = 0; i < loop->nfds && count < max_ready; i++)
+    {
+      int k = (loop->next + i) % loop->nfds;
+      if(loop->fds[k].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+          ready[count++] = loop->data[k];
+        }
+    }
+  if(loop->nfds) { loop->next = (loop->next + 1) % loop->nfds; }
+
+  return count;
+}
+
+
+void evloop_free(evloop_t* loop)
+{
+  free(loop->fds);
+  free(loop->data);
+  loop->fds = NULL;
+  loop->data = NULL;
+  loop->nfds = 0;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
@@ -0,0 +1,62 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_EVLOOP_H_
+#define _TTYLOG_EVLOOP_H_
+
+#include "config.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+
+/* Readiness event loop. Uses epoll when available and falls back
+   to poll() elsewhere. Every registered fd carries a user pointer that
+   is handed back when the fd becomes readable. */
+typedef struct
+{
+#ifdef HAVE_SYS_EPOLL_H
+  int epfd;
+#else
+  struct pollfd* fds;
+  void** data;
+  int nfds;
+  int max_fds;
+  int next;     /* Round robin start index for evloop_wait(). */
+#endif
+} evloop_t;
+
+
+/* Initialize event loop for at most max_fds descriptors. Returns 0 on success. */
+int evloop_init(evloop_t* loop, int max_fds);
+
+/* Register fd for read events. Returns 0 on success. */
+int evloop_add(evloop_t* loop, int fd, void* data);
+
+/* Unregister fd. */
+void evloop_del(evloop_t* loop, int fd);
+
+/* Wait up to timeout_ms (-1 means forever) for readable fds. Stores user
+   pointers of ready fds in ready and returns their count, 0 on timeout
+   or -1 on error. */
+int evloop_wait(evloop_t* loop, void** ready, int max_ready, int timeout_ms);
+
+void evloop_free(evloop_t* loop);
+
+#endif
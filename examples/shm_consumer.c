@@ -0,0 +1,123 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* Example consumer of the shared memory ring of ttylog --shm. Prints one
+   line per received chunk, or with -r writes the data itself to stdout,
+   straight from the shared memory. Exits when ttylog does.
+   Usage: ttylog-shm-consumer [-a] [-w] [-r] [-p port] NAME */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmring.h"
+
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: ttylog-shm-consumer [-a] [-w] [-r] [-p port] NAME\n"
+                  "  -a  start with the oldest data in the ring instead of new data\n"
+                  "  -w  wait for ttylog to create the ring\n"
+                  "  -r  write the data to stdout instead of a line per chunk\n"
+                  "  -p  only chunks of this port, in --device order from 0\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  struct timespec idle = { 0, 1000000 };
+  const shmring_record_t* rec;
+  shmring_reader_t r;
+  const char* name = NULL;
+  int rewind = 0, wait = 0, raw = 0, port = -1;
+  uint64_t records = 0, bytes = 0, laps = 0;
+  int i;
+
+  for(i = 1; i < argc; i++)
+    {
+      if(!strcmp(argv[i], "-a")) { rewind = 1; }
+      else if(!strcmp(argv[i], "-w")) { wait = 1; }
+      else if(!strcmp(argv[i], "-r")) { raw = 1; }
+      else if(!strcmp(argv[i], "-p") && i + 1 < argc) { port = atoi(argv[++i]); }
+      else if(argv[i][0] != '-' && !name) { name = argv[i]; }
+      else { usage(); }
+    }
+  if(!name) { usage(); }
+
+  while(shmring_open(&r, name))
+    {
+      if(!wait || (errno != ENOENT && errno != EAGAIN))
+        {
+          fprintf(stderr, "%s: can not open %s: %s\n", argv[0], name, strerror(errno));
+          return 1;
+        }
+      nanosleep(&idle, NULL);
+    }
+  if(rewind) { shmring_rewind(&r); }
+
+  for(;;)
+    {
+      uint32_t len;
+
+      rec = shmring_peek(&r);
+      if(!rec)
+        {
+          /* Closed is checked before looking again, so nothing published
+             before it was set is missed. */
+          if(shmring_closed(&r) && !shmring_peek(&r)) { break; }
+          nanosleep(&idle, NULL);
+          continue;
+        }
+
+      len = rec->len;
+      if(port < 0 || rec->port == port)
+        {
+          if(raw)
+            {
+              if(fwrite(shmring_payload(rec), 1, len, stdout) != len) { break; }
+            }
+          else
+            {
+              printf("#%llu port %u %lld.%06lld %u bytes\n", (unsigned long long)rec->seq, rec->port,
+                     (long long)(rec->real_ns / 1000000000), (long long)(rec->real_ns % 1000000000 / 1000), len);
+            }
+        }
+
+      /* Writing out may have been too slow, then what it wrote is suspect. */
+      if(shmring_next(&r, rec))
+        {
+          fprintf(stderr, "%s: overwritten while in use\n", argv[0]);
+          continue;
+        }
+      records++;
+      bytes += len;
+
+      if(r.laps != laps)
+        {
+          fprintf(stderr, "%s: fell behind, %llu records lost so far\n", argv[0], (unsigned long long)r.lost_records);
+          laps = r.laps;
+        }
+    }
+
+  fflush(stdout);
+  fprintf(stderr, "%s: %llu records, %llu bytes, %llu lost\n", argv[0], (unsigned long long)records,
+          (unsigned long long)bytes, (unsigned long long)r.lost_records);
+  shmring_close(&r);
+  return 0;
+}
@@ -0,0 +1,215 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <string.h>
+
+#include "fmtkernel.h"
+#include "hexenc.h"
+
+
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+
+
+/* Add "[time_stamp] " prefix to p, returns end of the prefix. */
+KERNEL_INLINE char* put_stamp(char* p, const char* time_stamp, size_t ts_len)
+{
+  *p++ = '[';
+  memcpy(p, time_stamp, ts_len);
+  p += ts_len;
+  *p++ = ']';
+  *p++ = ' ';
+  return p;
+}
+
+
+/* Lines are found with memchr(), carriage returns are left out and every
+   line gets the timestamp of the chunk it starts in. A line reaching the
+   limit is continued on a new line when more follows. */
+KERNEL_INLINE char* ascii_body(char* p, const char* s, int len, print_data_ctx_t* ctx,
+                               const char* time_stamp, size_t ts_len, int limited, int stamped)
+{
+  const char* end = s + len;
+
+  while(s < end)
+    {
+      const char* nl = memchr(s, '\n', end - s);
+      const char* eol = nl ? nl : end;
+
+      while(s < eol)
+        {
+          const char* cr;
+          size_t n;
+
+          if(*s == '\r')
+            {
+              s++;
+              continue;
+            }
+          if(limited && ctx->line_len >= ctx->line_len_limit)
+            {
+              *p++ = '\n';
+              ctx->line_len = 0;
+            }
+          if(stamped && ctx->line_len == 0) { p = put_stamp(p, time_stamp, ts_len); }
+
+          n = eol - s;
+          if(limited && n > (size_t)(ctx->line_len_limit - ctx->line_len)) { n = ctx->line_len_limit - ctx->line_len; }
+          cr = memchr(s, '\r', n);
+          if(cr) { n = cr - s; }
+          memcpy(p, s, n);
+          p += n;
+          s += n;
+          ctx->line_len = limited ? ctx->line_len + (int)n : 1;
+        }
+
+      if(nl)
+        {
+          if(stamped && ctx->line_len == 0) { p = put_stamp(p, time_stamp, ts_len); }
+          *p++ = '\n';
+          ctx->line_len = 0;
+          s = nl + 1;
+        }
+    }
+
+  return p;
+}
+
+
+/* Raw and hex data start a new line at every timestamp and when the line
+   is full. */
+KERNEL_INLINE char* line_body(char* p, const char* s, int len, print_data_ctx_t* ctx,
+                              const char* time_stamp, size_t ts_len, int limited, int stamped, int hex, int upper)
+{
+  while(len)
+    {
+      int n = len;
+      int print_nl = 0;
+
+      if(stamped)
+        {
+          if(ctx->line_len != 0) { *p++ = '\n'; }
+          p = put_stamp(p, time_stamp, ts_len);
+          ctx->line_len = 0;
+        }
+
+      if(limited && n >= ctx->line_len_limit - ctx->line_len)
+        {
+          n = ctx->line_len_limit - ctx->line_len;
+          print_nl = 1;
+        }
+
+      if(hex) { p = hex_encode(p, (const unsigned char*)s, n, upper, ctx->line_len != 0); }
+      else
+        {
+          memcpy(p, s, n);
+          p += n;
+        }
+      s += n;
+      len -= n;
+
+      if(print_nl)
+        {
+          *p++ = '\n';
+          ctx->line_len = 0;
+        }
+      else
+        {
+          ctx->line_len = limited ? ctx->line_len + n : 1;
+        }
+    }
+
+  return p;
+}
+
+
+KERNEL_INLINE char* raw_body(char* p, const char* s, int len, print_data_ctx_t* ctx,
+                             const char* time_stamp, size_t ts_len, int limited, int stamped)
+{
+  return line_body(p, s, len, ctx, time_stamp, ts_len, limited, stamped, 0, 0);
+}
+
+
+KERNEL_INLINE char* hex_lc_body(char* p, const char* s, int len, print_data_ctx_t* ctx,
+                                const char* time_stamp, size_t ts_len, int limited, int stamped)
+{
+  return line_body(p, s, len, ctx, time_stamp, ts_len, limited, stamped, 1, 0);
+}
+
+
+KERNEL_INLINE char* hex_uc_body(char* p, const char* s, int len, print_data_ctx_t* ctx,
+                                const char* time_stamp, size_t ts_len, int limited, int stamped)
+{
+  return line_body(p, s, len, ctx, time_stamp, ts_len, limited, stamped, 1, 1);
+}
+
+
+/* One kernel per combination of limit and timestamps. */
+#define KERNEL(body, limited, stamped) \
+  static char* body##_##limited##stamped(char* p, const char* data, int len, print_data_ctx_t* ctx, \
+                                         const char* time_stamp, size_t ts_len) \
+  { \
+    return body(p, data, len, ctx, time_stamp, ts_len, limited, stamped); \
+  }
+
+#define KERNELS(body) \
+  KERNEL(body, 0, 0) \
+  KERNEL(body, 0, 1) \
+  KERNEL(body, 1, 0) \
+  KERNEL(body, 1, 1)
+
+#define KERNEL_ROW(body) { { body##_00, body##_01 }, { body##_10, body##_11 } }
+
+KERNELS(ascii_body)
+KERNELS(hex_lc_body)
+KERNELS(hex_uc_body)
+KERNELS(raw_body)
+
+/* Indexed by format, limit and timestamps. */
+static const print_kernel_t kernels[][2][2] =
+{
+  [FMT_ACSII] = KERNEL_ROW(ascii_body),
+  [FMT_HEX_LC] = KERNEL_ROW(hex_lc_body),
+  [FMT_HEX_UC] = KERNEL_ROW(hex_uc_body),
+  [FMT_RAW] = KERNEL_ROW(raw_body),
+};
+
+
+print_kernel_t print_kernel_select(int fmt, int limited, int stamped)
+{
+  if(fmt < 0 || fmt >= (int)(sizeof(kernels) / sizeof(kernels[0]))) { return NULL; }
+  return kernels[fmt][!!limited][!!stamped];
+}
+
+
+__attribute__((noinline))
+char* print_kernel_generic(int fmt, int limited, int stamped, char* p, const char* data, int len,
+                           print_data_ctx_t* ctx, const char* time_stamp, size_t ts_len)
+{
+  if(fmt == FMT_ACSII) { return ascii_body(p, data, len, ctx, time_stamp, ts_len, limited, stamped); }
+  return line_body(p, data, len, ctx, time_stamp, ts_len, limited, stamped, fmt != FMT_RAW, fmt == FMT_HEX_UC);
+}
+
+
+void print_ctx_init(print_data_ctx_t* ctx, int fmt, int line_len_limit, struct output_s* out)
+{
+  ctx->fmt = fmt;
+  ctx->line_len_limit = line_len_limit;
+  ctx->line_len = 0;
+  ctx->kernel[0] = print_kernel_select(fmt, line_len_limit > 0, 0);
+  ctx->kernel[1] = print_kernel_select(fmt, line_len_limit > 0, 1);
+  ctx->label = NULL;
+  ctx->out = out;
+}
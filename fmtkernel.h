@@ -0,0 +1,39 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_FMTKERNEL_H_
+#define _TTYLOG_FMTKERNEL_H_
+
+#include <stddef.h>
+
+#include "ttylog.h"
+
+
+/* Formatting kernels. There is one kernel per output format, with and
+   without timestamps and with and without a line length limit, each
+   compiled from the same body with the choices as constants, so the inner
+   loops test neither. print_ctx_init() picks the kernels of a port once.
+   The bin format is written by binfmt.c and has no kernel. */
+
+/* Kernel for format fmt, NULL for FMT_BIN. */
+print_kernel_t print_kernel_select(int fmt, int limited, int stamped);
+
+/* The same bodies with the choices tested at run time, like print_data()
+   used to, for checking and benchmarking the kernels. */
+char* print_kernel_generic(int fmt, int limited, int stamped, char* p, const char* data, int len,
+                           print_data_ctx_t* ctx, const char* time_stamp, size_t ts_len);
+
+#endif
@@ -0,0 +1,268 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "ttylog.h"
+#include "output.h"
+#include "tstamp.h"
+
+
+/* Add "[time_stamp] " prefix to p, returns end of the prefix. */
+static char* put_stamp(char* p, const char* time_stamp, size_t ts_len)
+{
+  *p++ = '[';
+  memcpy(p, time_stamp, ts_len);
+  p += ts_len;
+  *p++ = ']';
+  *p++ = ' ';
+  return p;
+}
+
+
+/* Number of newlines in data. */
+static int count_lines(const char* data, int len)
+{
+  const char* end = data + len;
+  int n = 0;
+
+  while((data = memchr(data, '\n', end - data)))
+    {
+      data++;
+      n++;
+    }
+
+  return n;
+}
+
+
+/* The label goes into the timestamp of every line, which the kernels put
+   at every line start. Returns the prefix of the lines, time_stamp when
+   ctx has no label. */
+static const char* label_stamp(char* buff, const print_data_ctx_t* ctx, const char* time_stamp)
+{
+  if(!ctx->label) { return time_stamp; }
+  if(!time_stamp) { return ctx->label; }
+  snprintf(buff, TSTAMP_MAX + PRINT_LABEL_MAX + 2, "%s %s", time_stamp, ctx->label);
+  return buff;
+}
+
+
+/* Labeled ports sharing an output take turns on lines of their own, the
+   open line of the port that printed last is ended at p. Returns the end. */
+static char* label_take_line(char* p, print_data_ctx_t* ctx)
+{
+  print_data_ctx_t* last = ctx->out->line_ctx;
+
+  if(last && last != ctx && last->line_len != 0)
+    {
+      *p++ = '\n';
+      last->line_len = 0;
+    }
+  ctx->out->line_ctx = ctx;
+  return p;
+}
+
+
+/* Function that prints line in the output format of ctx. Timestamp is optional.
+   The whole chunk is formatted into the output buffer of ctx by the kernel
+   selected for the port and committed at once, the caller must hold the
+   output lock. */
+void print_data(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, const char* time_stamp)
+{
+  char prefix[TSTAMP_MAX + PRINT_LABEL_MAX + 2];
+  size_t ts_len;
+  /* Worst case size: hex triplets plus newline, "\n[" and "] " around
+     the timestamp of every line, and the end of another port's line. */
+  int nlines = (ctx->line_len_limit ? raw_data_len / ctx->line_len_limit : 0) + 2;
+  char* buff;
+  char* p;
+
+  time_stamp = label_stamp(prefix, ctx, time_stamp);
+  ts_len = time_stamp ? strlen(time_stamp) : 0;
+  if(ctx->fmt == FMT_ACSII && time_stamp) { nlines += count_lines(raw_data, raw_data_len); }
+  buff = output_reserve(ctx->out, 1 + 3 * (size_t)raw_data_len + nlines * (ts_len + 5));
+  p = buff;
+  if(ctx->label) { p = label_take_line(p, ctx); }
+
+#ifdef DEBUG
+  fprintf(debug_file, "print_data(len=%d, line_len=%d, line_len_limit=%d)\n", raw_data_len, ctx->line_len, ctx->line_len_limit);
+  fprintf(debug_file, "data: '%.*s'\n", raw_data_len, raw_data);
+  fflush(debug_file);
+#endif // DEBUG
+
+  p = ctx->kernel[time_stamp != NULL](p, raw_data, raw_data_len, ctx, time_stamp, ts_len);
+
+#ifdef DEBUG
+  fprintf(debug_file, "workbuff: '%.*s'\n", (int)(p - buff), buff);
+  fflush(debug_file);
+#endif // DEBUG
+
+  output_commit(ctx->out, p - buff);
+}
+
+
+void print_frame(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, const char* time_stamp)
+{
+  char prefix[TSTAMP_MAX + PRINT_LABEL_MAX + 2];
+  const char* label = ctx->label;
+  size_t ts_len;
+  char* buff;
+  char* p;
+
+  /* Only the first line of the frame is labeled, like the timestamp. */
+  time_stamp = label_stamp(prefix, ctx, time_stamp);
+  ts_len = time_stamp ? strlen(time_stamp) : 0;
+  buff = output_reserve(ctx->out, ts_len + 33);
+  p = buff;
+  if(label) { p = label_take_line(p, ctx); }
+  if(ctx->line_len != 0) { *p++ = '\n'; }
+  if(time_stamp) { p = put_stamp(p, time_stamp, ts_len); }
+  p += sprintf(p, "%d: ", raw_data_len);
+  output_commit(ctx->out, p - buff);
+
+  ctx->line_len = 0;
+  ctx->label = NULL;
+  print_data(raw_data, raw_data_len, ctx, NULL);
+  ctx->label = label;
+  if(ctx->line_len != 0)
+    {
+      *(char*)output_reserve(ctx->out, 1) = '\n';
+      output_commit(ctx->out, 1);
+      ctx->line_len = 0;
+    }
+}
+
+
+/* Print note on a line of its own, between "--- " and " ---". */
+static void print_note(print_data_ctx_t* ctx, const char* note, const char* time_stamp)
+{
+  char prefix[TSTAMP_MAX + PRINT_LABEL_MAX + 2];
+  size_t ts_len, note_len = strlen(note);
+  char* buff;
+  char* p;
+
+  /* Raw output stays the bytes received. */
+  if(ctx->fmt == FMT_RAW) { return; }
+
+  time_stamp = label_stamp(prefix, ctx, time_stamp);
+  ts_len = time_stamp ? strlen(time_stamp) : 0;
+  buff = output_reserve(ctx->out, ts_len + note_len + PRINT_LABEL_MAX + 16);
+  p = buff;
+  if(ctx->label) { p = label_take_line(p, ctx); }
+  if(ctx->line_len != 0) { *p++ = '\n'; }
+  if(time_stamp) { p = put_stamp(p, time_stamp, ts_len); }
+  memcpy(p, "--- ", 4);
+  memcpy(p + 4, note, note_len);
+  memcpy(p + 4 + note_len, " ---\n", 5);
+  p += note_len + 9;
+  output_commit(ctx->out, p - buff);
+  ctx->line_len = 0;
+}
+
+
+void print_gap(print_data_ctx_t* ctx, int64_t gap_ns, const char* time_stamp)
+{
+  char note[64];
+
+  snprintf(note, sizeof(note), "reconnected after %lld.%03lld s", (long long)(gap_ns / 1000000000),
+           (long long)(gap_ns % 1000000000 / 1000000));
+  print_note(ctx, note, time_stamp);
+}
+
+
+void print_repeat(print_data_ctx_t* ctx, int byte, uint64_t count, const char* first, const char* last, const char* time_stamp)
+{
+  char note[2 * TSTAMP_MAX + 64];
+  char* p = note;
+
+  if(byte < 0) { p += sprintf(p, "last line repeated %llu times", (unsigned long long)count); }
+  else
+    {
+      p += sprintf(p, ctx->fmt == FMT_HEX_UC ? "%02X" : "%02x", byte);
+      p += sprintf(p, " repeated %llu times", (unsigned long long)count);
+    }
+  if(first) { snprintf(p, note + sizeof(note) - p, ", %s to %s", first, last); }
+  print_note(ctx, note, time_stamp);
+}
+
+
+void print_data_stamped(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, tstamp_t* ts, const rx_time_t* rx_time)
+{
+  int offset = 0;
+
+  if(!ts || (!rx_time->span_ns && !rx_time->byte_ns))
+    {
+      print_data(raw_data, raw_data_len, ctx, ts ? tstamp_format(ts, rx_time, NULL) : NULL);
+      return;
+    }
+
+  /* One call per output line. Ascii lines end at a newline, the other
+     formats start a new line for every timestamp. */
+  while(offset < raw_data_len)
+    {
+      int len = raw_data_len - offset;
+      rx_time_t at;
+
+      if(ctx->fmt == FMT_ACSII)
+        {
+          const char* nl = memchr(raw_data + offset, '\n', len);
+          if(nl) { len = nl + 1 - (raw_data + offset); }
+        }
+      else if(ctx->line_len_limit && len > ctx->line_len_limit)
+        {
+          len = ctx->line_len_limit;
+        }
+
+      rx_time_at(rx_time, offset, &at);
+      print_data(raw_data + offset, len, ctx, tstamp_format(ts, &at, NULL));
+      offset += len;
+    }
+}
+
+
+/* Take the receive time of data that was just read. */
+void rx_time_now(rx_time_t* rx_time)
+{
+  clock_gettime(CLOCK_MONOTONIC, &rx_time->mono);
+  clock_gettime(CLOCK_REALTIME, &rx_time->real);
+  rx_time->span_ns = 0;
+  rx_time->byte_ns = 0;
+}
+
+
+static void ts_add_ns(struct timespec* ts, int64_t ns)
+{
+  int64_t t = (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec + ns;
+
+  ts->tv_sec = t / 1000000000LL;
+  ts->tv_nsec = t % 1000000000LL;
+}
+
+
+void rx_time_at(const rx_time_t* rx_time, size_t offset, rx_time_t* at)
+{
+  int64_t delta = (int64_t)offset * rx_time->byte_ns - rx_time->span_ns;
+
+  *at = *rx_time;
+  if(delta > 0) { delta = 0; }
+  ts_add_ns(&at->mono, delta);
+  ts_add_ns(&at->real, delta);
+  at->span_ns = 0;
+  at->byte_ns = 0;
+}
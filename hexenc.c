@@ -0,0 +1,249 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hexenc.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HEXENC_X86 1
+#include <immintrin.h>
+#endif
+
+
+static const char hex_chars_lc[] = "0123456789abcdef";
+static const char hex_chars_uc[] = "0123456789ABCDEF";
+
+
+char* hex_encode_scalar(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space)
+{
+  const char* hex_chars = uppercase ? hex_chars_uc : hex_chars_lc;
+  size_t i;
+
+  if(!len) { return dst; }
+
+  if(lead_space) { *dst++ = ' '; }
+  *dst++ = hex_chars[src[0] >> 4];
+  *dst++ = hex_chars[src[0] & 0x0F];
+
+  for(i = 1; i < len; i++)
+    {
+      dst[0] = ' ';
+      dst[1] = hex_chars[src[i] >> 4];
+      dst[2] = hex_chars[src[i] & 0x0F];
+      dst += 3;
+    }
+
+  return dst;
+}
+
+
+#ifdef HEXENC_X86
+
+/* The SIMD encoders produce " xx" triplets. Nibbles are turned into digits
+   with a table shuffle and interleaved into "xx" pairs, then three output
+   shuffles per 16 input bytes spread the pairs over 48 characters leaving
+   a hole for the space in front of every pair. */
+
+/* Output shuffles: for output block k (16 characters) index of the pair
+   character in the low (pairs 0-7) and high (pairs 8-15) pair vector,
+   0x80 where the character comes from the other vector or is a space. */
+static uint8_t shuf_lo[3][16] __attribute__((aligned(16)));
+static uint8_t shuf_hi[3][16] __attribute__((aligned(16)));
+static uint8_t spaces[3][16] __attribute__((aligned(16)));
+
+
+static void hex_simd_init(void)
+{
+  int pos;
+
+  for(pos = 0; pos < 48; pos++)
+    {
+      int k = pos / 16, j = pos % 16;
+      int t = pos / 3, r = pos % 3;
+
+      shuf_lo[k][j] = 0x80;
+      shuf_hi[k][j] = 0x80;
+      spaces[k][j] = 0;
+
+      if(r == 0) { spaces[k][j] = ' '; }
+      else if(t < 8) { shuf_lo[k][j] = 2 * t + r - 1; }
+      else { shuf_hi[k][j] = 2 * (t - 8) + r - 1; }
+    }
+}
+
+
+__attribute__((target("ssse3")))
+static char* hex_encode_ssse3(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space)
+{
+  const __m128i table = _mm_loadu_si128((const __m128i*)(uppercase ? hex_chars_uc : hex_chars_lc));
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i s0 = _mm_load_si128((const __m128i*)shuf_lo[0]);
+  const __m128i s1l = _mm_load_si128((const __m128i*)shuf_lo[1]);
+  const __m128i s1h = _mm_load_si128((const __m128i*)shuf_hi[1]);
+  const __m128i s2 = _mm_load_si128((const __m128i*)shuf_hi[2]);
+  const __m128i sp0 = _mm_load_si128((const __m128i*)spaces[0]);
+  const __m128i sp1 = _mm_load_si128((const __m128i*)spaces[1]);
+  const __m128i sp2 = _mm_load_si128((const __m128i*)spaces[2]);
+  if(!len) { return dst; }
+
+  /* Everything below is written as " xx", so the first number is done
+     here when it should not get a space. */
+  if(!lead_space)
+    {
+      dst = hex_encode_scalar(dst, src, 1, uppercase, 0);
+      src++;
+      len--;
+    }
+
+  while(len >= 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)src);
+      __m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+      __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, nibble));
+      __m128i p0 = _mm_unpacklo_epi8(hi, lo);
+      __m128i p1 = _mm_unpackhi_epi8(hi, lo);
+
+      _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_shuffle_epi8(p0, s0), sp0));
+      _mm_storeu_si128((__m128i*)(dst + 16),
+                       _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(p0, s1l), _mm_shuffle_epi8(p1, s1h)), sp1));
+      _mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_shuffle_epi8(p1, s2), sp2));
+
+      src += 16;
+      dst += 48;
+      len -= 16;
+    }
+
+  if(len) { dst = hex_encode_scalar(dst, src, len, uppercase, 1); }
+
+  return dst;
+}
+
+
+__attribute__((target("avx2")))
+static char* hex_encode_avx2(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space)
+{
+  const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(uppercase ? hex_chars_uc : hex_chars_lc)));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i s0 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)shuf_lo[0]));
+  const __m256i s1l = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)shuf_lo[1]));
+  const __m256i s1h = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)shuf_hi[1]));
+  const __m256i s2 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)shuf_hi[2]));
+  const __m256i sp0 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)spaces[0]));
+  const __m256i sp1 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)spaces[1]));
+  const __m256i sp2 = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)spaces[2]));
+  if(!len) { return dst; }
+
+  /* Everything below is written as " xx", so the first number is done
+     here when it should not get a space. */
+  if(!lead_space)
+    {
+      dst = hex_encode_scalar(dst, src, 1, uppercase, 0);
+      src++;
+      len--;
+    }
+
+  while(len >= 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*)src);
+      __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+      __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, nibble));
+      /* Shuffles work per 128 bit lane, so lane 0 holds bytes 0-15 and
+         lane 1 bytes 16-31 all the way through. */
+      __m256i p0 = _mm256_unpacklo_epi8(hi, lo);
+      __m256i p1 = _mm256_unpackhi_epi8(hi, lo);
+      __m256i o0 = _mm256_or_si256(_mm256_shuffle_epi8(p0, s0), sp0);
+      __m256i o1 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(p0, s1l), _mm256_shuffle_epi8(p1, s1h)), sp1);
+      __m256i o2 = _mm256_or_si256(_mm256_shuffle_epi8(p1, s2), sp2);
+
+      _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(o0, o1, 0x20));
+      _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(o2, o0, 0x30));
+      _mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(o1, o2, 0x31));
+
+      src += 32;
+      dst += 96;
+      len -= 32;
+    }
+
+  if(len) { dst = hex_encode_scalar(dst, src, len, uppercase, 1); }
+
+  return dst;
+}
+
+#endif /* HEXENC_X86 */
+
+
+static hex_encode_fn hex_encode_impl = hex_encode_scalar;
+static const char* hex_encode_impl_name = "scalar";
+static pthread_once_t hex_encode_once = PTHREAD_ONCE_INIT;
+
+
+#ifdef HEXENC_X86
+static int cpu_has(int avx2)
+{
+  __builtin_cpu_init();
+  if(!__builtin_cpu_supports("ssse3")) { return 0; }
+  return avx2 ? __builtin_cpu_supports("avx2") : 1;
+}
+#endif
+
+
+static void hex_encode_select(void)
+{
+#ifdef HEXENC_X86
+  hex_simd_init();
+  if(cpu_has(0)) { hex_encode_impl = hex_encode_ssse3; hex_encode_impl_name = "ssse3"; }
+  if(cpu_has(1)) { hex_encode_impl = hex_encode_avx2; hex_encode_impl_name = "avx2"; }
+#endif
+}
+
+
+hex_encode_fn hex_encode_ssse3_fn(void)
+{
+  pthread_once(&hex_encode_once, hex_encode_select);
+#ifdef HEXENC_X86
+  if(cpu_has(0)) { return hex_encode_ssse3; }
+#endif
+  return NULL;
+}
+
+
+hex_encode_fn hex_encode_avx2_fn(void)
+{
+  pthread_once(&hex_encode_once, hex_encode_select);
+#ifdef HEXENC_X86
+  if(cpu_has(1)) { return hex_encode_avx2; }
+#endif
+  return NULL;
+}
+
+
+char* hex_encode(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space)
+{
+  /* Short runs are not worth the SIMD setup. */
+  if(len < 16) { return hex_encode_scalar(dst, src, len, uppercase, lead_space); }
+  pthread_once(&hex_encode_once, hex_encode_select);
+  return hex_encode_impl(dst, src, len, uppercase, lead_space);
+}
+
+
+const char* hex_encode_name(void)
+{
+  pthread_once(&hex_encode_once, hex_encode_select);
+  return hex_encode_impl_name;
+}
@@ -0,0 +1,42 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_HEXENC_H_
+#define _TTYLOG_HEXENC_H_
+
+#include <stddef.h>
+
+
+/* Hex encoder. Writes len bytes of src to dst as two digit hex numbers
+   separated by spaces, like "0a 1b 2c". With lead_space set a space is
+   written in front of the first number as well. Returns pointer past the
+   last written character, dst must have room for 3 * len characters. */
+typedef char* (*hex_encode_fn)(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space);
+
+
+/* Encode using the fastest implementation supported by the CPU. */
+char* hex_encode(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space);
+
+/* Name of the implementation used by hex_encode(). */
+const char* hex_encode_name(void);
+
+/* Individual implementations, for testing and benchmarking. The SIMD
+   versions are NULL when not compiled in or not supported by the CPU. */
+char* hex_encode_scalar(char* dst, const unsigned char* src, size_t len, int uppercase, int lead_space);
+hex_encode_fn hex_encode_ssse3_fn(void);
+hex_encode_fn hex_encode_avx2_fn(void);
+
+#endif
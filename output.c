@@ -0,0 +1,622 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "ttylog.h"
+#include "output.h"
+#include "server.h"
+
+
+/* Default size of the output buffer. */
+#define OUTPUT_BUFF_SIZE (64 * 1024)
+
+
+/* List of all opened outputs. Only modified during startup. */
+static output_t* outputs = NULL;
+
+static flush_policy_t flush_policy = { FLUSH_ALWAYS, 0, 0 };
+
+static rotate_policy_t rotate_policy = { 0, 0, 0 };
+
+static size_t recorder_size = 0;
+
+static int compress_codec = COMPRESS_NONE;
+static int compress_level = 0;
+static size_t compress_frame_size = COMPRESS_FRAME_SIZE;
+
+/* Flushes are deferred to output_flush_uring() in this thread. */
+static __thread int defer_flush = 0;
+
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+void output_set_policy(const flush_policy_t* policy)
+{
+  flush_policy = *policy;
+}
+
+
+void output_set_rotate(const rotate_policy_t* policy)
+{
+  rotate_policy = *policy;
+}
+
+
+void output_set_recorder(size_t size)
+{
+  recorder_size = size;
+}
+
+
+void output_set_compress(int codec, int level, size_t frame_size)
+{
+  compress_codec = codec;
+  compress_level = level;
+  compress_frame_size = frame_size;
+}
+
+
+int output_parse_policy(const char* str, flush_policy_t* policy)
+{
+  char* end;
+  long long n;
+
+  memset(policy, 0, sizeof(*policy));
+  if(!strcmp(str, "always")) { policy->policy = FLUSH_ALWAYS; return 0; }
+  if(!strcmp(str, "line")) { policy->policy = FLUSH_LINE; return 0; }
+
+  n = strtoll(str, &end, 10);
+  if(end == str || n <= 0) { return -1; }
+
+  if(!strcmp(end, "ms"))
+    {
+      policy->policy = FLUSH_TIME;
+      policy->ms = n;
+      return 0;
+    }
+
+  if(*end == 'k' || *end == 'K') { n <<= 10; end++; }
+  else if(*end == 'm' || *end == 'M') { n <<= 20; end++; }
+  if(*end) { return -1; }
+
+  policy->policy = FLUSH_BYTES;
+  policy->bytes = n;
+  return 0;
+}
+
+
+output_t* output_get(const char* path)
+{
+  output_t* out;
+
+  for(out = outputs; out; out = out->next)
+    {
+      if(!path && !out->path) { return out; }
+      if(path && out->path && !strcmp(path, out->path)) { return out; }
+    }
+
+  out = calloc(1, sizeof(*out));
+  if(!out) { return NULL; }
+
+  out->size = OUTPUT_BUFF_SIZE;
+  if(flush_policy.policy == FLUSH_BYTES && flush_policy.bytes > out->size / 2)
+    {
+      out->size = 2 * flush_policy.bytes;
+    }
+  if(compress_codec) { out->size = compress_frame_size; }
+  out->buff = malloc(out->size);
+  if(!out->buff)
+    {
+      free(out);
+      return NULL;
+    }
+
+  if(path && recorder_size)
+    {
+      out->rec = recorder_open(path, recorder_size);
+      if(!out->rec)
+        {
+          free(out->buff);
+          free(out);
+          return NULL;
+        }
+      out->fd = -1;
+      out->path = strdup(path);
+    }
+  else if(path && (rotate_policy.size || rotate_policy.interval))
+    {
+      out->rot = rotate_open(path, &rotate_policy);
+      if(!out->rot)
+        {
+          free(out->buff);
+          free(out);
+          return NULL;
+        }
+      out->fd = rotate_fd(out->rot);
+      out->path = strdup(path);
+    }
+  else if(path)
+    {
+      out->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if(out->fd < 0)
+        {
+          free(out->buff);
+          free(out);
+          return NULL;
+        }
+      out->path = strdup(path);
+    }
+  else
+    {
+      out->fd = STDOUT_FILENO;
+    }
+
+  if(compress_codec)
+    {
+      char* index_path = NULL;
+
+      if(path && (index_path = malloc(strlen(path) + 5))) { sprintf(index_path, "%s.idx", path); }
+      out->zc = compress_open(out->fd, index_path, compress_codec, compress_level, out->size);
+      free(index_path);
+      if(!out->zc)
+        {
+          if(path) { close(out->fd); }
+          free(out->path);
+          free(out->buff);
+          free(out);
+          return NULL;
+        }
+    }
+
+  atomic_init(&out->flush_at, 0);
+  pthread_mutex_init(&out->lock, NULL);
+  out->next = outputs;
+  outputs = out;
+
+#ifdef DEBUG
+  fprintf(debug_file, "Opened output %s\n", path ? path : "stdout");
+  fflush(debug_file);
+#endif // DEBUG
+
+  return out;
+}
+
+
+void output_lock(output_t* out)
+{
+  pthread_mutex_lock(&out->lock);
+}
+
+
+void output_unlock(output_t* out)
+{
+  pthread_mutex_unlock(&out->lock);
+}
+
+
+char* output_reserve(output_t* out, size_t len)
+{
+  if(out->len + len > out->size)
+    {
+      output_flush(out);
+      if(len > out->size)
+        {
+          char* buff = realloc(out->buff, len);
+          if(!buff)
+            {
+              fprintf (stderr, "%s: out of memory\n", progname);
+              exit(0);
+            }
+          out->buff = buff;
+          out->size = len;
+        }
+    }
+
+  return out->buff + out->len;
+}
+
+
+void output_commit(output_t* out, size_t len)
+{
+  const char* data = out->buff + out->len;
+  int was_empty = (out->len == 0);
+  int flush = 0;
+
+  out->len += len;
+
+  /* Nothing may linger in the buffer of a flight recorder, and copying it
+     into the mapping is cheap. */
+  if(out->rec)
+    {
+      output_flush(out);
+      return;
+    }
+
+  switch(flush_policy.policy)
+    {
+      case FLUSH_ALWAYS:
+        flush = 1;
+        break;
+
+      case FLUSH_LINE:
+        flush = (memchr(data, '\n', len) != NULL);
+        break;
+
+      case FLUSH_BYTES:
+        flush = (out->len >= flush_policy.bytes);
+        break;
+
+      case FLUSH_TIME:
+        if(was_empty && out->len)
+          {
+            atomic_store_explicit(&out->flush_at, now_ns() + flush_policy.ms * 1000000LL, memory_order_relaxed);
+          }
+        break;
+    }
+
+  /* Compressed outputs are cut into frames when the buffer is full or, with
+     a time policy, when the data gets old. */
+  if(flush && !out->zc)
+    {
+      if(defer_flush) { out->due = 1; }
+      else { output_flush(out); }
+    }
+}
+
+
+void output_defer_flush(int defer)
+{
+  defer_flush = defer;
+}
+
+
+void output_add_preamble(output_t* out, const char* data, size_t len)
+{
+  char* p = realloc(out->preamble, out->preamble_len + len);
+  if(!p)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      exit(0);
+    }
+  memcpy(p + out->preamble_len, data, len);
+  out->preamble = p;
+  out->preamble_len += len;
+
+  server_add_preamble(data, len);
+  if(out->rec) { recorder_set_preamble(out->rec, out->preamble, out->preamble_len); }
+  if(out->zc) { compress_set_preamble(out->zc, out->preamble, out->preamble_len); }
+}
+
+
+/* Write iov out with writev(), returns number of bytes written. */
+static size_t output_write(output_t* out, struct iovec* iov, int iovcnt)
+{
+  size_t total = 0;
+
+  while(iovcnt && !out->write_error)
+    {
+      ssize_t n = writev(out->fd, iov, iovcnt);
+      if(n < 0)
+        {
+          if(errno == EINTR) { continue; }
+          fprintf (stderr, "%s: error %d while writing %s\n", progname, errno, out->path ? out->path : "stdout");
+          out->write_error = 1;
+          break;
+        }
+      total += n;
+
+      /* Skip what was written. */
+      while(iovcnt && (size_t)n >= iov[0].iov_len)
+        {
+          n -= iov[0].iov_len;
+          iov[0] = iov[1];
+          iovcnt--;
+        }
+      if(iovcnt)
+        {
+          iov[0].iov_base = (char*)iov[0].iov_base + n;
+          iov[0].iov_len -= n;
+        }
+    }
+
+  return total;
+}
+
+
+/* Switch to the next segment of a rotated output when it is time. Returns 1
+   when the preamble has to be written before the data. */
+static int output_rotate(output_t* out)
+{
+  if(!out->rot || !rotate_check(out->rot, out->len)) { return 0; }
+
+  out->fd = rotate_fd(out->rot);
+  return out->preamble_len != 0;
+}
+
+
+/* Account a flush that kept the formatting thread busy for ns. */
+static void output_stall(output_t* out, int64_t ns)
+{
+  atomic_fetch_add_explicit(&out->stall_ns, ns, memory_order_relaxed);
+  if((uint64_t)ns > atomic_load_explicit(&out->stall_max_ns, memory_order_relaxed))
+    {
+      atomic_store_explicit(&out->stall_max_ns, ns, memory_order_relaxed);
+    }
+}
+
+
+/* Buffer has been written out. */
+static void output_done(output_t* out, size_t written)
+{
+  atomic_fetch_add_explicit(&out->bytes_out, written, memory_order_relaxed);
+  atomic_fetch_add_explicit(&out->flushes, 1, memory_order_relaxed);
+  if(out->rot) { rotate_written(out->rot, written); }
+  out->len = 0;
+  out->due = 0;
+  atomic_store_explicit(&out->flush_at, 0, memory_order_relaxed);
+}
+
+
+void output_flush(output_t* out)
+{
+  struct iovec iov[2];
+  int iovcnt = 0;
+  int64_t start;
+
+  if(!out->len) { return; }
+  start = now_ns();
+  server_publish(out->buff, out->len);
+
+  if(out->rec)
+    {
+      recorder_write(out->rec, out->buff, out->len);
+      output_done(out, out->len);
+      output_stall(out, now_ns() - start);
+      return;
+    }
+
+  if(out->zc)
+    {
+      size_t len = out->len;
+      out->buff = compress_submit(out->zc, out->buff, len, out->first_ns, &out->size);
+      output_done(out, len);
+      output_stall(out, now_ns() - start);
+      return;
+    }
+
+  /* A new segment starts with the preamble, written together with the data. */
+  if(output_rotate(out))
+    {
+      iov[iovcnt].iov_base = out->preamble;
+      iov[iovcnt].iov_len = out->preamble_len;
+      iovcnt++;
+    }
+  iov[iovcnt].iov_base = out->buff;
+  iov[iovcnt].iov_len = out->len;
+  iovcnt++;
+
+  output_done(out, output_write(out, iov, iovcnt));
+  output_stall(out, now_ns() - start);
+}
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/* user_data of the preamble write of an output, the data write uses the
+   plain index. */
+#define URING_PREAMBLE 0x80000000u
+
+void output_flush_uring(uring_t* ring, output_t** outs, const struct iovec* fixed, int n)
+{
+  size_t done[2 * n];   /* Preamble and data bytes written per output. */
+  char pre[n];
+  unsigned queued = 0;
+  int64_t start = now_ns();
+  int i;
+
+  memset(done, 0, sizeof(done));
+  memset(pre, 0, sizeof(pre));
+
+  /* Locked in address order, so writers sharing outputs can not deadlock. */
+  for(i = 0; i < n; i++)
+    {
+      output_t* out = outs[i];
+      struct io_uring_sqe* sqe;
+
+      output_lock(out);
+      if(!out->due || !out->len) { continue; }
+      server_publish(out->buff, out->len);
+
+      /* Both entries are there before a new segment is started, so the
+         preamble link never ends at the write of another output. Without
+         them the output is written with writev() below. */
+      if(uring_sq_space(ring) < 2 && queued) { uring_submit(ring, 0); }
+      pre[i] = output_rotate(out);
+      if(uring_sq_space(ring) < 2) { continue; }
+
+      /* Preamble of a new segment, linked so it lands before the data. */
+      if(pre[i])
+        {
+          sqe = uring_get_sqe(ring);
+          sqe->opcode = IORING_OP_WRITE;
+          sqe->flags = IOSQE_IO_LINK;
+          sqe->fd = out->fd;
+          sqe->addr = (uintptr_t)out->preamble;
+          sqe->len = out->preamble_len;
+          sqe->off = (uint64_t)-1;
+          sqe->user_data = i | URING_PREAMBLE;
+          queued++;
+        }
+
+      sqe = uring_get_sqe(ring);
+      if(fixed && fixed[i].iov_base == out->buff && out->len <= fixed[i].iov_len)
+        {
+          sqe->opcode = IORING_OP_WRITE_FIXED;
+          sqe->buf_index = i;
+        }
+      else
+        {
+          sqe->opcode = IORING_OP_WRITE;
+        }
+      sqe->fd = out->fd;
+      sqe->addr = (uintptr_t)out->buff;
+      sqe->len = out->len;
+      sqe->off = (uint64_t)-1;
+      sqe->user_data = i;
+      queued++;
+    }
+
+  if(queued && uring_submit(ring, queued) < 0) { queued = 0; }
+
+  while(queued)
+    {
+      struct io_uring_cqe* cqe = uring_peek_cqe(ring);
+      unsigned idx;
+
+      if(!cqe)
+        {
+          uring_submit(ring, 1);
+          continue;
+        }
+
+      idx = cqe->user_data & ~URING_PREAMBLE;
+      if(cqe->res > 0) { done[2 * idx + !(cqe->user_data & URING_PREAMBLE)] = cqe->res; }
+      uring_cqe_seen(ring, cqe);
+      queued--;
+    }
+
+  /* Whatever was not written in one go, because of a short write, an error
+     or a broken link, is finished with writev(). */
+  for(i = 0; i < n; i++)
+    {
+      output_t* out = outs[i];
+
+      if(out->due && out->len)
+        {
+          struct iovec iov[2];
+          int iovcnt = 0;
+          size_t written = done[2 * i] + done[2 * i + 1];
+
+          if(pre[i] && done[2 * i] < out->preamble_len)
+            {
+              iov[iovcnt].iov_base = out->preamble + done[2 * i];
+              iov[iovcnt].iov_len = out->preamble_len - done[2 * i];
+              iovcnt++;
+            }
+          if(done[2 * i + 1] < out->len)
+            {
+              iov[iovcnt].iov_base = out->buff + done[2 * i + 1];
+              iov[iovcnt].iov_len = out->len - done[2 * i + 1];
+              iovcnt++;
+            }
+          if(iovcnt) { written += output_write(out, iov, iovcnt); }
+          output_done(out, written);
+          output_stall(out, now_ns() - start);
+        }
+      output_unlock(out);
+    }
+}
+
+#else
+
+void output_flush_uring(uring_t* ring, output_t** outs, const struct iovec* fixed, int n)
+{
+  int i;
+
+  (void)ring;
+  (void)fixed;
+  for(i = 0; i < n; i++)
+    {
+      output_lock(outs[i]);
+      if(outs[i]->due) { output_flush(outs[i]); }
+      output_unlock(outs[i]);
+    }
+}
+
+#endif
+
+
+long output_tick(void)
+{
+  output_t* out;
+  int64_t now, next = 0;
+
+  if(flush_policy.policy != FLUSH_TIME) { return -1; }
+
+  now = now_ns();
+  for(out = outputs; out; out = out->next)
+    {
+      int64_t at = atomic_load_explicit(&out->flush_at, memory_order_relaxed);
+      if(!at) { continue; }
+
+      if(at <= now)
+        {
+          output_lock(out);
+          if(out->len) { output_flush(out); }
+          output_unlock(out);
+        }
+      else if(!next || at < next)
+        {
+          next = at;
+        }
+    }
+
+  if(!next) { return flush_policy.ms; }
+  return (next - now + 999999) / 1000000;
+}
+
+
+void output_close_all(void)
+{
+  output_t* out;
+
+  /* Flush first, so the background rotation is stopped only once. */
+  for(out = outputs; out; out = out->next) { output_flush(out); }
+  rotate_shutdown();
+
+  while(outputs)
+    {
+      out = outputs;
+      outputs = out->next;
+
+      if(out->zc)
+        {
+          compress_close(out->zc);
+          if(out->path) { close(out->fd); }
+        }
+      else if(out->rec) { recorder_close(out->rec); }
+      else if(out->rot) { rotate_close(out->rot); }
+      else if(out->path) { close(out->fd); }
+      free(out->preamble);
+      free(out->path);
+      free(out->buff);
+      pthread_mutex_destroy(&out->lock);
+      free(out);
+    }
+}
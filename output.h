@@ -0,0 +1,145 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_OUTPUT_H_
+#define _TTYLOG_OUTPUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "rotate.h"
+#include "recorder.h"
+#include "compress.h"
+#include "uring.h"
+
+
+/* Output flush policies. */
+enum
+{
+  FLUSH_ALWAYS = 0, /* Write out after every formatted chunk (default). */
+  FLUSH_LINE = 1,   /* Write out when a chunk completes a line. */
+  FLUSH_BYTES = 2,  /* Write out when at least flush_bytes are buffered. */
+  FLUSH_TIME = 3,   /* Write out at most flush_ms after the first buffered byte. */
+};
+
+
+typedef struct
+{
+  int policy;
+  size_t bytes;
+  long ms;
+} flush_policy_t;
+
+
+/* Output target. Formatted data is collected in one contiguous buffer and
+   written with a single write() when the flush policy says so. Ports that
+   name the same output path share one output_t, the lock keeps their
+   records from interleaving. */
+typedef struct output_s
+{
+  char* path;          /* NULL for stdout. */
+  int fd;
+  char* buff;
+  size_t len;
+  size_t size;
+  int write_error;
+  int bin_header;      /* Binary capture file header has been written. */
+  int due;             /* Flush deferred to output_flush_uring(). */
+  recorder_t* rec;     /* Flight recorder file, written instead of fd. */
+  compress_t* zc;      /* Compressor the full buffers go to, NULL if not compressed. */
+  int64_t first_ns;    /* Receive time of the first data in the buffer, for the frame index. */
+  rotate_t* rot;       /* Segments of a rotated output file, NULL if not rotated. */
+  char* preamble;      /* Data repeated at the start of every segment. */
+  size_t preamble_len;
+  _Atomic int64_t flush_at;  /* FLUSH_TIME deadline in ns, 0 when empty. */
+  struct print_data_ctx_s* line_ctx;  /* Labeled port that printed last, see print_data(). */
+
+  /* Statistics, updated with the lock held and read by the stats thread. */
+  _Atomic uint64_t bytes_out;     /* Bytes written, or handed to the recorder or compressor. */
+  _Atomic uint64_t flushes;
+  _Atomic uint64_t stall_ns;      /* Time the formatting thread spent flushing. */
+  _Atomic uint64_t stall_max_ns;
+  pthread_mutex_t lock;
+  struct output_s* next;
+} output_t;
+
+
+/* Set the flush policy, must be called before the first output_get(). */
+void output_set_policy(const flush_policy_t* policy);
+
+/* Parse flush policy: always, line, size with optional k/M suffix or time
+   with ms suffix. Returns 0 on success. */
+int output_parse_policy(const char* str, flush_policy_t* policy);
+
+/* Set rotation of output files, must be called before the first output_get(). */
+void output_set_rotate(const rotate_policy_t* policy);
+
+/* Make output files flight recorders with a ring of size bytes, 0 for
+   plain files. Must be called before the first output_get(). */
+void output_set_recorder(size_t size);
+
+/* Compress outputs with codec (COMPRESS_*) in frames of frame_size bytes.
+   Must be called before the first output_get(). */
+void output_set_compress(int codec, int level, size_t frame_size);
+
+/* Return output for path (NULL means stdout), opening it on first use. */
+output_t* output_get(const char* path);
+
+/* Take and release exclusive access to output. */
+void output_lock(output_t* out);
+void output_unlock(output_t* out);
+
+/* Return pointer to at least len free bytes of the buffer. Output must be locked. */
+char* output_reserve(output_t* out, size_t len);
+
+/* Add len bytes written to reserved space and apply the flush policy.
+   Output must be locked. */
+void output_commit(output_t* out, size_t len);
+
+/* Note the receive time of data about to be committed. Output must be locked. */
+static inline void output_note_time(output_t* out, const struct timespec* real)
+{
+  if(!out->len) { out->first_ns = (int64_t)real->tv_sec * 1000000000LL + real->tv_nsec; }
+}
+
+/* Remember len bytes at data to be repeated at the start of every new
+   segment, like file headers. Output must be locked. */
+void output_add_preamble(output_t* out, const char* data, size_t len);
+
+/* Write out buffered data. Output must be locked. */
+void output_flush(output_t* out);
+
+/* Make the flush policy only mark outputs as due in the calling thread,
+   which then writes them with output_flush_uring(). */
+void output_defer_flush(int defer);
+
+/* Write all due outputs of outs, sorted by address, with one io_uring
+   submission. Buffers that still match their entry of fixed, registered
+   at the same index, are written with WRITE_FIXED. fixed may be NULL.
+   Locks the outputs itself. */
+void output_flush_uring(uring_t* ring, output_t** outs, const struct iovec* fixed, int n);
+
+/* Flush outputs whose FLUSH_TIME deadline has passed. Returns number of
+   milliseconds until the next deadline, -1 when there is none. */
+long output_tick(void);
+
+/* Flush and close all outputs. */
+void output_close_all(void);
+
+#endif
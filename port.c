@@ -0,0 +1,424 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <termios.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+
+#if defined(__linux__)
+#include <linux/serial.h>
+#endif
+
+#include "port.h"
+#include "binfmt.h"
+
+
+/* Path of the latency timer USB serial drivers like ftdi_sio expose in
+   sysfs for the tty behind device, which may be a symlink. */
+static int latency_timer_path(const char* device, char* path, size_t size)
+{
+  char real[PATH_MAX];
+
+  if(!realpath(device, real)) { return -1; }
+  snprintf(path, size, "/sys/class/tty/%s/device/latency_timer", basename(real));
+  return 0;
+}
+
+
+static int latency_timer_read(const char* path)
+{
+  FILE* f = fopen(path, "r");
+  int ms = -1;
+
+  if(!f) { return -1; }
+  if(fscanf(f, "%d", &ms) != 1) { ms = -1; }
+  fclose(f);
+  return ms;
+}
+
+
+static int latency_timer_write(const char* path, int ms)
+{
+  FILE* f = fopen(path, "w");
+  int err;
+
+  if(!f) { return -1; }
+  fprintf(f, "%d\n", ms);
+  err = fclose(f);
+  return err ? -1 : 0;
+}
+
+
+/* Make the driver hand over received data as soon as possible: the low
+   latency flag of the serial core and the 16 ms default latency timer of
+   USB serial adapters set to 1 ms. Both are restored by port_close(). */
+static void port_set_low_latency(port_t* port)
+{
+  char path[PATH_MAX + 64];
+
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+  {
+    struct serial_struct serial;
+
+    if(ioctl(port->fd, TIOCGSERIAL, &serial) == 0)
+      {
+        int flags = serial.flags;
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if(ioctl(port->fd, TIOCSSERIAL, &serial) == 0) { port->old_serial_flags = flags; }
+      }
+  }
+#endif // defined
+
+  if(latency_timer_path(port->cfg.device, path, sizeof(path)) == 0)
+    {
+      int ms = latency_timer_read(path);
+
+      if(ms > 1)
+        {
+          if(latency_timer_write(path, 1) == 0) { port->old_latency_timer = ms; }
+          else { fprintf (stderr, "%s: can not set latency timer %s\n", progname, path); }
+        }
+    }
+}
+
+
+static void port_restore_latency(port_t* port)
+{
+  char path[PATH_MAX + 64];
+
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+  if(port->old_serial_flags >= 0)
+    {
+      struct serial_struct serial;
+
+      if(ioctl(port->fd, TIOCGSERIAL, &serial) == 0)
+        {
+          serial.flags = port->old_serial_flags;
+          ioctl(port->fd, TIOCSSERIAL, &serial);
+        }
+      port->old_serial_flags = -1;
+    }
+#endif // defined
+
+  if(port->old_latency_timer >= 0 && latency_timer_path(port->cfg.device, path, sizeof(path)) == 0)
+    {
+      latency_timer_write(path, port->old_latency_timer);
+    }
+  port->old_latency_timer = -1;
+}
+
+
+/* Time of one character on the line: start bit, data bits, parity bit
+   and stop bits. Returns 0 for an unknown baud rate. */
+static int64_t port_char_ns(const port_cfg_t* cfg)
+{
+  unsigned long baud = strtoul(cfg->baud_str, NULL, 10);
+  int bits = 1 + cfg->data_bits + (cfg->parity != 'N') + cfg->stop_bits;
+
+  return baud ? bits * 1000000000LL / baud : 0;
+}
+
+
+/* Bytes per read of serial port: what arrives at its baud rate in
+   PORT_READ_WINDOW_NS or while a read is put off, whichever is longer,
+   doubled for bursts and as a power of 2. Files, pipes and ports with an
+   unknown baud rate keep reading PORT_READ_SIZE - 1 bytes, so captured
+   files render the same (see ttylog-dump -r). */
+static size_t port_read_size(const port_t* port)
+{
+  int64_t char_ns = port_char_ns(&port->cfg);
+  int64_t window = port->coalesce_ns > PORT_READ_WINDOW_NS ? port->coalesce_ns : PORT_READ_WINDOW_NS;
+  size_t size = PORT_READ_MIN;
+
+  if(port->cfg.read_size) { return port->cfg.read_size; }
+  if(!port->serial_port || !char_ns) { return PORT_READ_SIZE - 1; }
+
+  while(size < PORT_READ_MAX && (int64_t)size * char_ns < 2 * window) { size <<= 1; }
+  return size;
+}
+
+
+void port_cfg_init(port_cfg_t* cfg)
+{
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->data_bits = 8;
+  cfg->stop_bits = 1;
+  cfg->parity = 'N';
+  cfg->rts = -1;
+  cfg->dtr = -1;
+  cfg->output_fmt = FMT_ACSII;
+  cfg->line_len_limit = PORT_LINE_LIMIT;
+}
+
+
+/* Open the device of port and apply the serial settings. A device that is
+   reopened is not reported when it can not be opened, and what it sent since
+   it came back is kept, the first thing a device says is often the most
+   interesting. */
+static int port_open_device(port_t* port, int reopen)
+{
+  const port_cfg_t* cfg = &port->cfg;
+  struct termios newtio;
+
+  int fd;
+
+  port->old_serial_flags = -1;
+  port->old_latency_timer = -1;
+  fd = open (cfg->device, O_RDONLY | O_NOCTTY);
+  if (fd < 0)
+    {
+      if(!reopen) { fprintf (stderr, "%s: invalid device %s\n", progname, cfg->device); }
+      return -1;
+    }
+
+#ifdef DEBUG
+  fprintf(debug_file, "Opened serial port %s, file descriptor %d\n", cfg->device, fd);
+  fflush(debug_file);
+#endif // DEBUG
+
+  /* Check are we connected to serial port and if yes, save current serial port settings */
+  pthread_mutex_lock(&port->fd_lock);
+  port->fd = fd;
+  port->serial_port = (0 == tcgetattr (port->fd, &port->oldtio));
+  pthread_mutex_unlock(&port->fd_lock);
+  if(!port->serial_port) { return 0; }
+
+  if(cfg->byte_times) { port->char_ns = port_char_ns(cfg); }
+
+  memset (&newtio, 0, sizeof (newtio)); /* clear struct for new port settings */
+
+#ifdef DEBUG
+  fprintf(debug_file, "Connected to real serial device, not file\n");
+  fflush(debug_file);
+#endif // DEBUG
+
+  /* Enable RTS/CTS (hardware) flow control. */
+  /* newtio.c_cflag |= CRTSCTS; */
+
+  /* Character size mask. */
+  if(cfg->data_bits == 7) { newtio.c_cflag |= CS7; }
+  else { newtio.c_cflag |= CS8; }
+
+  /* Ignore modem control lines. */
+  newtio.c_cflag |= CLOCAL;
+
+  /* Enable receiver. */
+  newtio.c_cflag |= CREAD;
+
+  /* Set stop bits. */
+  if(cfg->stop_bits == 2) { newtio.c_cflag |= CSTOPB; }
+
+  if(cfg->parity == 'E')
+    {
+      newtio.c_cflag &= ~(PARODD | CMSPAR);
+      newtio.c_cflag |= PARENB;
+    }
+  else if(cfg->parity == 'O')
+    {
+      newtio.c_cflag |= PARENB | PARODD;
+      newtio.c_cflag &= ~CMSPAR;
+    }
+  else if(cfg->parity == 'M')
+    {
+      newtio.c_cflag |= PARENB | PARODD | CMSPAR;
+    }
+  else if(cfg->parity == 'S')
+    {
+      newtio.c_cflag |= PARENB | CMSPAR;
+      newtio.c_cflag &= ~PARODD;
+    }
+
+  /* Ignore framing errors and parity errors. */
+  newtio.c_iflag |= IGNPAR;
+
+  /* Ignore BREAK condition on input. */
+  newtio.c_iflag |= IGNBRK;
+
+  newtio.c_oflag = 0;
+
+  /* Raw input for all formats, ascii lines are split and carriage returns
+     removed by print_data(), the same way for ttys, pipes and files. */
+  newtio.c_lflag = 0;
+
+  /* By default reads return whatever is there. A larger VMIN makes the
+     driver collect that many bytes, VTIME bounds the wait for them. */
+  newtio.c_cc[VTIME] = cfg->vtime;
+  newtio.c_cc[VMIN] = cfg->vmin;
+
+  /* Only truly portable method of setting speed. */
+  cfsetispeed (&newtio, cfg->baud);
+  cfsetospeed (&newtio, cfg->baud);
+
+  if(!reopen) { tcflush (port->fd, TCIFLUSH); }
+  tcsetattr (port->fd, TCSANOW, &newtio);
+
+  if(cfg->rts >= 0)
+    {
+      int flags = TIOCM_RTS;
+      if(cfg->rts) { ioctl(port->fd, TIOCMBIS, &flags); }
+      else { ioctl(port->fd, TIOCMBIC, &flags); }
+    }
+
+  if(cfg->dtr >= 0)
+    {
+      int flags = TIOCM_DTR;
+      if(cfg->dtr) { ioctl(port->fd, TIOCMBIS, &flags); }
+      else { ioctl(port->fd, TIOCMBIC, &flags); }
+    }
+
+  /* Note that not all serial drivers support the low latency flag. */
+  if(cfg->low_latency) { port_set_low_latency(port); }
+
+  /* Clear the device */
+  if(!reopen)
+    {
+      char buff[256];
+      int flags = fcntl (port->fd, F_GETFL, 0);
+      fcntl (port->fd, F_SETFL, flags | O_NONBLOCK);
+      while (read (port->fd, buff, sizeof(buff)) > 0 );
+      fcntl (port->fd, F_SETFL, flags);
+    }
+
+  return 0;
+}
+
+
+int port_open(port_t* port)
+{
+  const port_cfg_t* cfg = &port->cfg;
+
+  port->frame_len = 0;
+  port->frame_gap_ns = cfg->frame_gap_ns;
+  if(cfg->frame_gap_chars > 0) { port->frame_gap_ns = cfg->frame_gap_chars * port_char_ns(cfg); }
+
+  port->out = output_get(cfg->output_path);
+  if (port->out == NULL)
+    {
+      fprintf (stderr, "%s: can not open output %s\n", progname, cfg->output_path);
+      return -1;
+    }
+  print_ctx_init(&port->print_ctx, cfg->output_fmt, cfg->line_len_limit, port->out);
+  port->print_ctx.label = cfg->label;
+
+  if(cfg->output_fmt == FMT_BIN)
+    {
+      bin_port_t settings;
+
+      settings.baud = strtoul(cfg->baud_str, NULL, 10);
+      settings.data_bits = cfg->data_bits;
+      settings.parity = cfg->parity;
+      settings.stop_bits = cfg->stop_bits;
+      settings.reserved = 0;
+
+      output_lock(port->out);
+      if(!port->out->bin_header)
+        {
+          bin_write_header(port->out, &startup_timestamp);
+          port->out->bin_header = 1;
+        }
+      bin_write_port(port->out, port->id, &settings, cfg->device);
+      output_unlock(port->out);
+    }
+
+  pthread_mutex_init(&port->fd_lock, NULL);
+  if(port_open_device(port, 0)) { return -1; }
+
+  /* Coalescing is bounded by what the driver can hold at the baud rate. */
+  port->coalesce_ns = port->serial_port ? cfg->coalesce_ns : 0;
+  if(port->coalesce_ns && port_char_ns(cfg) && port->coalesce_ns > PORT_COALESCE_CHARS * port_char_ns(cfg))
+    {
+      port->coalesce_ns = PORT_COALESCE_CHARS * port_char_ns(cfg);
+    }
+  port->pending_ns = 0;
+  port->lost_ns = 0;
+  port->watch_wd = -1;
+  port->read_size = port_read_size(port);
+  port->raw_data = malloc(port->read_size);
+  if(!port->raw_data)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      port_close(port);
+      return -1;
+    }
+
+  return 0;
+}
+
+
+int port_reopen(port_t* port)
+{
+  port->pending_ns = 0;
+  return port_open_device(port, 1);
+}
+
+
+void port_detach(port_t* port)
+{
+  if(port->fd < 0) { return; }
+  pthread_mutex_lock(&port->fd_lock);
+  close (port->fd);
+  port->fd = -1;
+  pthread_mutex_unlock(&port->fd_lock);
+}
+
+
+void port_byte_times(port_t* port, size_t len, rx_time_t* rx_time)
+{
+  int64_t now = (int64_t)rx_time->mono.tv_sec * 1000000000LL + rx_time->mono.tv_nsec;
+  int64_t first, last;
+  int queued = 0;
+
+  if(!port->char_ns || !len) { return; }
+
+  /* Bytes still queued arrived after the ones read, and without a gap the
+     line delivers one character per character time. */
+  if(ioctl(port->fd, FIONREAD, &queued) < 0) { queued = 0; }
+  last = now - queued * port->char_ns;
+  first = last - (int64_t)(len - 1) * port->char_ns;
+
+  /* Nothing arrived before the last byte of the previous read. */
+  if(first < port->last_byte_ns + port->char_ns) { first = port->last_byte_ns + port->char_ns; }
+  if(first > last) { first = last; }
+
+  rx_time->span_ns = now - first;
+  rx_time->byte_ns = len > 1 ? (last - first) / (int64_t)(len - 1) : 0;
+  port->last_byte_ns = last;
+}
+
+
+void port_close(port_t* port)
+{
+  free (port->raw_data);
+  port->raw_data = NULL;
+  if(port->fd < 0) { return; }
+
+  if(port->serial_port)
+    {
+      port_restore_latency(port);
+      tcsetattr (port->fd, TCSANOW, &port->oldtio);
+    }
+  pthread_mutex_lock(&port->fd_lock);
+  close (port->fd);
+  port->fd = -1;
+  pthread_mutex_unlock(&port->fd_lock);
+}
@@ -0,0 +1,154 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_PORT_H_
+#define _TTYLOG_PORT_H_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <termios.h>
+#include <stdint.h>
+
+#include "ttylog.h"
+#include "output.h"
+#include "ring.h"
+#include "stats.h"
+#include "tstamp.h"
+#include "dedup.h"
+#include "trigger.h"
+#include "shmring.h"
+
+
+/* Files and pipes are read PORT_READ_SIZE - 1 bytes at a time. */
+#define PORT_READ_SIZE 4096
+
+/* Range of the read sizes chosen for serial ports, see port_open(). */
+#define PORT_READ_MIN 256
+#define PORT_READ_MAX (64 * 1024)
+
+/* A read of a serial port takes what arrives in this time at its baud
+   rate, twice that for bursts. */
+#define PORT_READ_WINDOW_NS 10000000LL
+
+/* Coalescing never leaves more characters waiting in the driver than half
+   of the 4096 byte buffer of the line discipline. */
+#define PORT_COALESCE_CHARS 2048
+
+/* Default line length limit. */
+#define PORT_LINE_LIMIT 1023
+
+/* Size of the frame buffer of --frame-gap, longer frames are split. */
+#define PORT_FRAME_SIZE 4096
+
+
+/* Per device settings, filled in from the command line. */
+typedef struct
+{
+  const char* device;
+  const char* baud_str;
+  speed_t baud;
+  int data_bits;       /* 7 or 8 data bits. */
+  int stop_bits;       /* 1 or 2 stop bits. */
+  int parity;          /* No parity (N), Even (E), Odd (O), Mark (M) or Space (S) */
+  int rts;             /* -1 leaves the line alone. */
+  int dtr;             /* -1 leaves the line alone. */
+  int output_fmt;
+  int line_len_limit;
+  int vmin;            /* Termios VMIN and VTIME (tenths of a second). */
+  int vtime;
+  int low_latency;     /* Set the driver low latency flag and the USB latency timer. */
+  int byte_times;      /* Estimate the arrival time of every byte. */
+  int read_size;       /* Bytes per read, 0 to choose from the baud rate. */
+  int64_t coalesce_ns; /* Longest time a read is put off to collect more data, 0 for none. */
+  int reconnect;       /* Wait for a serial device that went away and open it again. */
+  int dedup;           /* Collapse repeated lines or byte runs, see dedup.h. */
+  const uint8_t* dedup_mask;  /* Columns not compared, NULL for none. */
+  size_t dedup_mask_len;
+  double frame_gap_chars;   /* Idle time ending a frame in character times, */
+  int64_t frame_gap_ns;     /* or in nanoseconds, both 0 for no framing. */
+  const trigger_t* trigger;  /* Patterns that trigger output, NULL to output everything. */
+  trigger_window_t trigger_window;
+  shmring_writer_t* shm;    /* Shared memory ring of the received data, NULL for none. */
+  const char* label;        /* Put on every line, see --label, NULL for none. */
+  const char* output_path;  /* NULL means stdout. */
+} port_cfg_t;
+
+
+/* Per device runtime state. */
+typedef struct port_s
+{
+  port_cfg_t cfg;
+  int id;
+  int fd;              /* -1 while not open. */
+  pthread_mutex_t fd_lock;  /* Held while fd is opened or closed, and by the stats thread using it. */
+  int serial_port;     /* Nonzero when fd is a tty and oldtio is valid. */
+  struct termios oldtio;
+  int old_serial_flags;   /* Driver flags before --latency, -1 if not changed. */
+  int old_latency_timer;  /* USB latency timer before --latency, -1 if not changed. */
+  output_t* out;
+  print_data_ctx_t print_ctx;
+  tstamp_t tstamp;     /* Only used by the thread formatting the port. */
+  trigger_port_t trigger;  /* Only used by the thread formatting the port. */
+  dedup_t dedup;           /* Only used by the thread formatting the port. */
+  tstamp_t repeat_tstamp;  /* Times in the summaries of repeats. */
+  ring_t* ring;        /* Chunks waiting for the writer thread, NULL to print inline. */
+  port_stats_t stats;
+  int64_t char_ns;     /* Time of one character on the line with byte times, else 0. */
+  int64_t last_byte_ns;  /* Estimated arrival of the last byte read, CLOCK_MONOTONIC. */
+  size_t read_size;    /* Bytes per read. */
+  int64_t coalesce_ns; /* Longest time a read is put off, 0 when reads are never put off. */
+  int64_t pending_ns;  /* Since when a read is put off, 0 when none is. */
+  int64_t lost_ns;     /* When the device went away, 0 while it is open. */
+  int watch_wd;        /* Watch of the directory it is waited for in, -1 for none. */
+
+  /* Framing, only used by the reader of the port. */
+  int64_t frame_gap_ns;    /* Idle time ending a frame, 0 for no framing. */
+  int64_t frame_last_ns;   /* Arrival of the last byte of the frame, CLOCK_MONOTONIC. */
+  rx_time_t frame_start;   /* Arrival of the first byte of the frame. */
+  size_t frame_len;        /* Bytes in frame, 0 when no frame is open. */
+  char frame[PORT_FRAME_SIZE];
+
+  char* raw_data;      /* read_size bytes, for reads that do not go into the ring. */
+} port_t;
+
+
+/* Fill cfg with the defaults used when no option is given. */
+void port_cfg_init(port_cfg_t* cfg);
+
+/* Open the device and the output of port, apply the serial settings and
+   choose the read size. Returns 0 on success, prints a message and returns
+   -1 on failure. */
+int port_open(port_t* port);
+
+/* Open the device of port again after it went away, with the same
+   settings, keeping what it already sent. Returns 0 on success, -1 without
+   a message while it is not back. */
+int port_reopen(port_t* port);
+
+/* Close the device of port that went away, its settings need no restore
+   and the read buffer is kept for port_reopen(). */
+void port_detach(port_t* port);
+
+/* Estimate the arrival times of the len bytes just read and received at
+   rx_time from the character time, the bytes still queued in the driver
+   and the last estimate. Only the reader of the port calls this. */
+void port_byte_times(port_t* port, size_t len, rx_time_t* rx_time);
+
+/* Restore the saved serial settings, close the device and free the read
+   buffer. */
+void port_close(port_t* port);
+
+#endif
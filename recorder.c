@@ -0,0 +1,289 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ttylog.h"
+#include "recorder.h"
+
+
+struct recorder_s
+{
+  int fd;
+  char* map;
+  size_t map_len;
+  rec_header_t* h;
+  char* ring;
+  uint64_t size;
+  uint64_t pos;            /* Local copy of write_end. */
+  uint64_t seq;
+};
+
+
+#define FRAME_PAD(len) (((len) + 7) & ~(uint64_t)7)
+#define FRAME_SIZE(len) (2 * sizeof(rec_frame_t) + FRAME_PAD(len))
+
+
+static uint64_t load_cursor(const uint64_t* p, memory_order order)
+{
+  return le64toh(atomic_load_explicit((_Atomic uint64_t*)p, order));
+}
+
+
+static void store_cursor(uint64_t* p, uint64_t v, memory_order order)
+{
+  atomic_store_explicit((_Atomic uint64_t*)p, htole64(v), order);
+}
+
+
+/* Copy len bytes into the ring at cursor pos, wrapping at its end. */
+static void ring_put(recorder_t* rec, uint64_t pos, const void* data, size_t len)
+{
+  size_t off = pos % rec->size;
+  size_t first = rec->size - off;
+
+  if(first > len) { first = len; }
+  memcpy(rec->ring + off, data, first);
+  memcpy(rec->ring, (const char*)data + first, len - first);
+}
+
+
+static void ring_get(const char* ring, uint64_t size, uint64_t pos, void* data, size_t len)
+{
+  size_t off = pos % size;
+  size_t first = size - off;
+
+  if(first > len) { first = len; }
+  memcpy(data, ring + off, first);
+  memcpy((char*)data + first, ring, len - first);
+}
+
+
+recorder_t* recorder_open(const char* path, size_t size)
+{
+  recorder_t* rec = calloc(1, sizeof(*rec));
+  struct stat st;
+
+  if(!rec) { return NULL; }
+
+  size = (size + 7) & ~(size_t)7;
+  rec->size = size;
+  rec->map_len = REC_DATA_OFFSET + size;
+
+  rec->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(rec->fd < 0 || fstat(rec->fd, &st)) { goto fail; }
+
+  /* The blocks are allocated up front, a full disk can not hit later
+     writes through the mapping. */
+  if((size_t)st.st_size != rec->map_len)
+    {
+      if(ftruncate(rec->fd, 0) || posix_fallocate(rec->fd, 0, rec->map_len)) { goto fail; }
+    }
+
+  rec->map = mmap(NULL, rec->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, rec->fd, 0);
+  if(rec->map == MAP_FAILED) { goto fail; }
+  rec->h = (rec_header_t*)rec->map;
+  rec->ring = rec->map + REC_DATA_OFFSET;
+
+  if(!memcmp(rec->h->magic, REC_MAGIC, REC_MAGIC_LEN) && le64toh(rec->h->size) == size)
+    {
+      /* Continue after the last complete frame, dropping a torn one. */
+      rec->pos = load_cursor(&rec->h->write_end, memory_order_relaxed);
+      rec->seq = load_cursor(&rec->h->seq, memory_order_relaxed);
+      store_cursor(&rec->h->write_start, rec->pos, memory_order_relaxed);
+    }
+  else
+    {
+      memset(rec->h, 0, sizeof(*rec->h));
+      rec->h->version = htole32(REC_VERSION);
+      rec->h->data_offset = htole32(REC_DATA_OFFSET);
+      rec->h->size = htole64(size);
+      atomic_thread_fence(memory_order_release);
+      memcpy(rec->h->magic, REC_MAGIC, REC_MAGIC_LEN);
+    }
+  rec->h->preamble_len = 0;
+
+  return rec;
+
+fail:
+  fprintf (stderr, "%s: can not create flight recorder %s: %s\n", progname, path, strerror(errno));
+  if(rec->fd >= 0) { close(rec->fd); }
+  free(rec);
+  return NULL;
+}
+
+
+static void recorder_frame(recorder_t* rec, const char* data, uint32_t len)
+{
+  static const char pad[8];
+  rec_frame_t frame;
+  uint64_t pos = rec->pos;
+  uint64_t end = pos + FRAME_SIZE(len);
+
+  frame.len = htole32(len);
+  frame.seq = htole32((uint32_t)rec->seq);
+
+  /* Seqlock style, readers discard anything below write_start - size. */
+  store_cursor(&rec->h->write_start, end, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  ring_put(rec, pos, &frame, sizeof(frame));
+  pos += sizeof(frame);
+  ring_put(rec, pos, data, len);
+  ring_put(rec, pos + len, pad, FRAME_PAD(len) - len);
+  pos += FRAME_PAD(len);
+  ring_put(rec, pos, &frame, sizeof(frame));
+
+  rec->pos = end;
+  rec->seq++;
+  store_cursor(&rec->h->seq, rec->seq, memory_order_relaxed);
+  store_cursor(&rec->h->write_end, end, memory_order_release);
+}
+
+
+void recorder_write(recorder_t* rec, const char* data, size_t len)
+{
+  /* Keep every frame well inside the ring. */
+  size_t max = rec->size / 4;
+
+  while(len)
+    {
+      size_t n = len < max ? len : max;
+      recorder_frame(rec, data, n);
+      data += n;
+      len -= n;
+    }
+}
+
+
+void recorder_set_preamble(recorder_t* rec, const char* data, size_t len)
+{
+  if(len > REC_DATA_OFFSET - sizeof(rec_header_t))
+    {
+      fprintf (stderr, "%s: flight recorder preamble too long, not stored\n", progname);
+      return;
+    }
+
+  rec->h->preamble_len = 0;
+  atomic_thread_fence(memory_order_release);
+  memcpy(rec->map + sizeof(rec_header_t), data, len);
+  atomic_thread_fence(memory_order_release);
+  rec->h->preamble_len = htole32(len);
+}
+
+
+void recorder_close(recorder_t* rec)
+{
+  msync(rec->map, rec->map_len, MS_ASYNC);
+  munmap(rec->map, rec->map_len);
+  close(rec->fd);
+  free(rec);
+}
+
+
+char* recorder_recover(const char* path, size_t* len)
+{
+  const rec_header_t* h;
+  const char* ring;
+  char* map;
+  char* buff;
+  uint64_t size, end, start, limit, pos;
+  size_t map_len, preamble_len, dst;
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) { return NULL; }
+  if(fstat(fd, &st) || (size_t)st.st_size < REC_DATA_OFFSET + REC_MIN_SIZE)
+    {
+      close(fd);
+      errno = EINVAL;
+      return NULL;
+    }
+  map_len = st.st_size;
+  map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) { return NULL; }
+
+  h = (const rec_header_t*)map;
+  size = le64toh(h->size);
+  if(memcmp(h->magic, REC_MAGIC, REC_MAGIC_LEN) || le32toh(h->data_offset) != REC_DATA_OFFSET
+     || REC_DATA_OFFSET + size > map_len || size % 8)
+    {
+      munmap(map, map_len);
+      errno = EINVAL;
+      return NULL;
+    }
+  ring = map + REC_DATA_OFFSET;
+  preamble_len = le32toh(h->preamble_len);
+  if(preamble_len > REC_DATA_OFFSET - sizeof(rec_header_t)) { preamble_len = 0; }
+
+  /* Data of all frames fits into the ring size. */
+  buff = malloc(preamble_len + size);
+  if(!buff)
+    {
+      munmap(map, map_len);
+      return NULL;
+    }
+  memcpy(buff, map + sizeof(rec_header_t), preamble_len);
+
+  /* Walk the frames back from the write cursor, copying their data to
+     the end of buff. A frame counts once the writer is known not to have
+     touched it while it was copied. */
+  end = load_cursor(&h->write_end, memory_order_acquire);
+  dst = preamble_len + size;
+  pos = end;
+  for(;;)
+    {
+      rec_frame_t head, tail;
+      uint64_t frame_size;
+      uint32_t flen;
+
+      start = load_cursor(&h->write_start, memory_order_relaxed);
+      limit = start > size ? start - size : 0;
+      if(pos < limit || pos - limit < 2 * sizeof(rec_frame_t)) { break; }
+
+      ring_get(ring, size, pos - sizeof(tail), &tail, sizeof(tail));
+      flen = le32toh(tail.len);
+      frame_size = FRAME_SIZE(flen);
+      if(flen > size / 4 || frame_size > pos - limit) { break; }
+      ring_get(ring, size, pos - frame_size, &head, sizeof(head));
+      if(memcmp(&head, &tail, sizeof(head))) { break; }
+      ring_get(ring, size, pos - frame_size + sizeof(head), buff + dst - flen, flen);
+
+      atomic_thread_fence(memory_order_acquire);
+      start = load_cursor(&h->write_start, memory_order_relaxed);
+      if(start > size && pos - frame_size < start - size) { break; }
+
+      dst -= flen;
+      pos -= frame_size;
+    }
+
+  memmove(buff + preamble_len, buff + dst, preamble_len + size - dst);
+  *len = preamble_len + (preamble_len + size - dst);
+
+  munmap(map, map_len);
+  return buff;
+}
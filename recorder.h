@@ -0,0 +1,89 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_RECORDER_H_
+#define _TTYLOG_RECORDER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* Flight recorder output. The file is a fixed size circular buffer mapped
+   into memory, so writing is a memcpy() without system calls and what was
+   written survives a crash of ttylog, the kernel writes the pages back.
+
+   The file starts with a rec_header_t and the preamble of the output (the
+   bin capture header and port records), the ring of REC_DATA_OFFSET to
+   the end of the file follows. Every write is a frame, a rec_frame_t, the
+   data padded to 8 bytes and the rec_frame_t again, so the frames can be
+   walked back from the write cursor. All numbers are little endian.
+
+   The cursors count bytes ever written to the ring. The writer advances
+   write_start before it overwrites anything and write_end with release
+   semantics after the frame is complete, so a reader taking write_end,
+   copying and checking write_start again knows what it copied intact,
+   also while ttylog runs or after it died in the middle of a frame. */
+
+#define REC_MAGIC          "TTYLOGF\x01"
+#define REC_MAGIC_LEN      8
+#define REC_VERSION        1
+#define REC_DATA_OFFSET    16384   /* Header and preamble space. */
+#define REC_MIN_SIZE       4096
+
+
+typedef struct
+{
+  char magic[REC_MAGIC_LEN];
+  uint32_t version;
+  uint32_t data_offset;    /* Offset of the ring, REC_DATA_OFFSET. */
+  uint64_t size;           /* Size of the ring. */
+  uint32_t preamble_len;   /* Preamble follows this header. */
+  uint32_t reserved;
+  uint64_t write_start;    /* Cursor the frame being written ends at. */
+  uint64_t write_end;      /* Cursor of the end of the last complete frame. */
+  uint64_t seq;            /* Number of frames written. */
+} rec_header_t;
+
+
+typedef struct
+{
+  uint32_t len;            /* Data length, without padding. */
+  uint32_t seq;            /* Low bits of the frame number. */
+} rec_frame_t;
+
+
+typedef struct recorder_s recorder_t;
+
+
+/* Open or create recorder file path with a ring of size bytes. An existing
+   recorder of the same size is continued, so restarting ttylog does not
+   wipe what the last run recorded. Returns NULL on error. */
+recorder_t* recorder_open(const char* path, size_t size);
+
+/* Append len bytes at data as one or more frames. */
+void recorder_write(recorder_t* rec, const char* data, size_t len);
+
+/* Store the preamble, the data every recovered capture starts with. */
+void recorder_set_preamble(recorder_t* rec, const char* data, size_t len);
+
+void recorder_close(recorder_t* rec);
+
+/* Read recorder file path, also while it is written. Returns a malloc()ed
+   buffer with the preamble and the intact frames, oldest first, and its
+   length in len, or NULL on error. */
+char* recorder_recover(const char* path, size_t* len);
+
+#endif
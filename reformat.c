@@ -0,0 +1,260 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ttylog.h"
+#include "fmtkernel.h"
+#include "reformat.h"
+
+
+/* Output buffer of a block in flight. */
+typedef struct
+{
+  char* buff;
+  size_t len;
+  size_t size;
+  int done;
+} slot_t;
+
+
+typedef struct
+{
+  const char* data;
+  const reformat_opts_t* opts;
+  size_t ts_len;
+  size_t* bounds;          /* Block i is data from bounds[i] to bounds[i + 1]. */
+  size_t nblocks;
+  slot_t* slots;           /* Block i is formatted into slots[i % nslots]. */
+  size_t nslots;
+  size_t next;             /* Next block to format. */
+  size_t written;          /* Blocks passed to emit. */
+  int failed;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} reformat_t;
+
+
+/* Split data into blocks of about block_size. Returns the number of
+   blocks, with their limits in *bounds, or 0 when out of memory. */
+static size_t reformat_split(const char* data, size_t len, const reformat_opts_t* opts, size_t** bounds)
+{
+  size_t block = opts->block_size ? opts->block_size : REFORMAT_BLOCK_SIZE;
+  size_t max = len / block + 2;
+  size_t n = 0, pos = 0;
+  size_t* b;
+
+  /* Hex and raw blocks must start where a read started. */
+  if(opts->fmt != FMT_ACSII) { block = (block + opts->read_size - 1) / opts->read_size * opts->read_size; }
+
+  b = malloc((max + 1) * sizeof(*b));
+  if(!b) { return 0; }
+  b[0] = 0;
+
+  while(pos < len)
+    {
+      size_t end = len - pos > block ? pos + block : len;
+
+      /* Ascii blocks start on a new line, a block without newlines grows
+         until one comes. */
+      if(opts->fmt == FMT_ACSII && end < len)
+        {
+          const char* nl = memchr(data + end - 1, '\n', len - end + 1);
+          end = nl ? (size_t)(nl + 1 - data) : len;
+        }
+
+      b[++n] = end;
+      pos = end;
+    }
+
+  *bounds = b;
+  return n;
+}
+
+
+/* State of the formatter at the start of a block at pos, see print_data_ctx_t. */
+static int reformat_line_len(const reformat_opts_t* opts, size_t pos)
+{
+  int limit = opts->line_len_limit;
+
+  if(pos == 0 || opts->fmt == FMT_ACSII) { return 0; }
+
+  /* Every read starts a new line with its timestamp. */
+  if(opts->time_stamp) { return limit ? (int)(opts->read_size % limit) : 1; }
+  return limit ? (int)(pos % limit) : 1;
+}
+
+
+/* Format block i into slot, in read sized chunks. Returns 0 or -1 when
+   out of memory. */
+static int reformat_block(reformat_t* r, size_t i, slot_t* slot)
+{
+  const reformat_opts_t* opts = r->opts;
+  size_t pos = r->bounds[i];
+  size_t end = r->bounds[i + 1];
+  print_data_ctx_t ctx;
+  print_kernel_t kernel;
+
+  print_ctx_init(&ctx, opts->fmt, opts->line_len_limit, NULL);
+  ctx.line_len = reformat_line_len(opts, pos);
+  kernel = ctx.kernel[opts->time_stamp != NULL];
+  slot->len = 0;
+
+  while(pos < end)
+    {
+      size_t n = end - pos < opts->read_size ? end - pos : opts->read_size;
+      /* Worst case size as in print_data(). */
+      size_t nlines = (opts->line_len_limit ? n / opts->line_len_limit : 0) + 2;
+      size_t need;
+
+      if(opts->fmt == FMT_ACSII && opts->time_stamp)
+        {
+          const char* s = r->data + pos;
+          const char* e = s + n;
+
+          while((s = memchr(s, '\n', e - s)))
+            {
+              s++;
+              nlines++;
+            }
+        }
+      need = 3 * n + nlines * (r->ts_len + 5);
+
+      if(slot->len + need > slot->size)
+        {
+          size_t size = slot->size * 2 > slot->len + need ? slot->size * 2 : slot->len + need;
+          char* p = realloc(slot->buff, size);
+
+          if(!p) { return -1; }
+          slot->buff = p;
+          slot->size = size;
+        }
+
+      slot->len = kernel(slot->buff + slot->len, r->data + pos, n, &ctx, opts->time_stamp, r->ts_len) - slot->buff;
+      pos += n;
+    }
+
+  return 0;
+}
+
+
+static void* reformat_thread(void* arg)
+{
+  reformat_t* r = arg;
+
+  pthread_mutex_lock(&r->lock);
+  while(r->next < r->nblocks && !r->failed)
+    {
+      size_t i = r->next;
+      slot_t* slot = &r->slots[i % r->nslots];
+      int err;
+
+      /* The slot is still held by the block nslots before. */
+      if(i >= r->written + r->nslots)
+        {
+          pthread_cond_wait(&r->cond, &r->lock);
+          continue;
+        }
+      r->next++;
+      pthread_mutex_unlock(&r->lock);
+
+      err = reformat_block(r, i, slot);
+
+      pthread_mutex_lock(&r->lock);
+      slot->done = 1;
+      if(err) { r->failed = 1; }
+      pthread_cond_broadcast(&r->cond);
+    }
+  pthread_mutex_unlock(&r->lock);
+
+  return NULL;
+}
+
+
+int reformat(const char* data, size_t len, const reformat_opts_t* opts, reformat_emit_t emit, void* arg)
+{
+  int jobs = opts->jobs > 0 ? opts->jobs : 1;
+  pthread_t* threads;
+  reformat_t r;
+  size_t i;
+  int n, err;
+
+  memset(&r, 0, sizeof(r));
+  r.data = data;
+  r.opts = opts;
+  r.ts_len = opts->time_stamp ? strlen(opts->time_stamp) : 0;
+  r.nblocks = reformat_split(data, len, opts, &r.bounds);
+  if(!r.nblocks) { return len ? -1 : 0; }
+  if((size_t)jobs > r.nblocks) { jobs = r.nblocks; }
+
+  /* Two blocks per thread keep them busy while the oldest is written. */
+  r.nslots = 2 * jobs;
+  r.slots = calloc(r.nslots, sizeof(*r.slots));
+  threads = calloc(jobs, sizeof(*threads));
+  if(!r.slots || !threads)
+    {
+      free(r.slots);
+      free(threads);
+      free(r.bounds);
+      return -1;
+    }
+  pthread_mutex_init(&r.lock, NULL);
+  pthread_cond_init(&r.cond, NULL);
+
+  for(n = 0; n < jobs; n++)
+    {
+      if(pthread_create(&threads[n], NULL, reformat_thread, &r)) { break; }
+    }
+  if(n == 0) { r.failed = 1; }
+
+  for(i = 0; i < r.nblocks; i++)
+    {
+      slot_t* slot = &r.slots[i % r.nslots];
+
+      pthread_mutex_lock(&r.lock);
+      while(!slot->done && !r.failed) { pthread_cond_wait(&r.cond, &r.lock); }
+      err = r.failed;
+      pthread_mutex_unlock(&r.lock);
+      if(err) { break; }
+
+      err = emit(arg, slot->buff, slot->len);
+
+      pthread_mutex_lock(&r.lock);
+      slot->done = 0;
+      r.written++;
+      if(err) { r.failed = 1; }
+      pthread_cond_broadcast(&r.cond);
+      pthread_mutex_unlock(&r.lock);
+    }
+
+  /* Stop the threads when the writing stopped early. */
+  pthread_mutex_lock(&r.lock);
+  if(i < r.nblocks) { r.failed = 1; }
+  pthread_cond_broadcast(&r.cond);
+  pthread_mutex_unlock(&r.lock);
+  while(n--) { pthread_join(threads[n], NULL); }
+
+  err = r.failed ? -1 : 0;
+  for(i = 0; i < r.nslots; i++) { free(r.slots[i].buff); }
+  pthread_cond_destroy(&r.cond);
+  pthread_mutex_destroy(&r.lock);
+  free(r.slots);
+  free(threads);
+  free(r.bounds);
+  return err;
+}
@@ -0,0 +1,51 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_REFORMAT_H_
+#define _TTYLOG_REFORMAT_H_
+
+#include <stddef.h>
+
+
+/* Offline formatting of a raw capture held in memory, like an mmapped
+   file, on a pool of threads. The data is split into blocks at points
+   where the state of the formatter is known without formatting what comes
+   before: after a newline for ascii, at a multiple of the read size for
+   the other formats. The blocks are formatted in parallel and handed to
+   the caller in order. The output is the same print_data() gives for the
+   data read in chunks of read_size bytes, with time_stamp for every chunk. */
+
+typedef struct
+{
+  int fmt;                 /* FMT_ACSII, FMT_HEX_LC, FMT_HEX_UC or FMT_RAW. */
+  int line_len_limit;      /* 0 for no limit. */
+  const char* time_stamp;  /* Timestamp of every line, NULL for none. */
+  size_t read_size;        /* Chunk size of the reads being reproduced. */
+  size_t block_size;       /* Nominal block size, 0 for the default. */
+  int jobs;                /* Formatting threads. */
+} reformat_opts_t;
+
+/* Default nominal block size. */
+#define REFORMAT_BLOCK_SIZE (4 * 1024 * 1024)
+
+/* Called with the formatted blocks in order, returns 0 to go on. */
+typedef int (*reformat_emit_t)(void* arg, const char* data, size_t len);
+
+/* Format len bytes of data with opts and pass the output to emit. Returns
+   0, or -1 when emit failed or memory ran out. */
+int reformat(const char* data, size_t len, const reformat_opts_t* opts, reformat_emit_t emit, void* arg);
+
+#endif
@@ -0,0 +1,52 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+
+ring_t* ring_create(size_t size)
+{
+  ring_t* ring;
+  size_t n = 4096;
+
+  while(n < size) { n <<= 1; }
+
+  if(posix_memalign((void**)&ring, RING_CACHE_LINE, sizeof(*ring))) { return NULL; }
+  memset(ring, 0, sizeof(*ring));
+
+  if(posix_memalign((void**)&ring->buff, RING_CACHE_LINE, n))
+    {
+      free(ring);
+      return NULL;
+    }
+
+  ring->size = n;
+  ring->mask = n - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  return ring;
+}
+
+
+void ring_free(ring_t* ring)
+{
+  if(!ring) { return; }
+  free(ring->buff);
+  free(ring);
+}
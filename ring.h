@@ -0,0 +1,154 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_RING_H_
+#define _TTYLOG_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "ttylog.h"
+
+
+/* Single producer, single consumer ring of variable sized chunks.
+   The producer (capture thread) reads straight into space reserved in
+   the ring and commits it together with the receive time, the consumer
+   (writer thread) formats the chunks in order and releases them. Chunks
+   are always contiguous, a chunk that does not fit at the end of the
+   buffer is preceded by a wrap marker. */
+
+#define RING_CACHE_LINE 64
+#define RING_WRAP       0xFFFFFFFFu
+
+
+/* Header in front of every chunk payload. */
+typedef struct
+{
+  uint32_t len;         /* Payload length or RING_WRAP. */
+  uint32_t flags;
+  rx_time_t rx_time;
+} ring_chunk_t;
+
+
+typedef struct
+{
+  /* Written by the producer. */
+  _Atomic uint64_t head __attribute__((aligned(RING_CACHE_LINE)));
+  uint64_t tail_cache;      /* Producer's copy of tail. */
+
+  /* Written by the consumer. */
+  _Atomic uint64_t tail __attribute__((aligned(RING_CACHE_LINE)));
+  uint64_t head_cache;      /* Consumer's copy of head. */
+
+  size_t size __attribute__((aligned(RING_CACHE_LINE)));  /* Power of 2. */
+  size_t mask;
+  unsigned char* buff;
+} ring_t;
+
+
+/* Allocate ring with at least size bytes, rounded up to power of 2. */
+ring_t* ring_create(size_t size);
+void ring_free(ring_t* ring);
+
+
+static inline size_t ring_align(size_t len)
+{
+  return (len + 7) & ~(size_t)7;
+}
+
+
+/* Reserve contiguous space for a payload of up to len bytes.
+   Returns NULL if the ring is full. */
+static inline unsigned char* ring_reserve(ring_t* ring, size_t len)
+{
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t need = sizeof(ring_chunk_t) + ring_align(len);
+  size_t off = head & ring->mask;
+  size_t to_end = ring->size - off;
+
+  /* Account for the wrap marker when the chunk does not fit at the end. */
+  if(to_end < need) { need += to_end; }
+
+  if(head + need - ring->tail_cache > ring->size)
+    {
+      ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+      if(head + need - ring->tail_cache > ring->size) { return NULL; }
+    }
+
+  if(to_end < sizeof(ring_chunk_t) + ring_align(len))
+    {
+      ((ring_chunk_t*)(ring->buff + off))->len = RING_WRAP;
+      atomic_store_explicit(&ring->head, head + to_end, memory_order_release);
+      off = 0;
+    }
+
+  return ring->buff + off + sizeof(ring_chunk_t);
+}
+
+
+/* Publish len bytes written to the space returned by ring_reserve(). */
+static inline void ring_commit(ring_t* ring, size_t len, uint32_t flags, const rx_time_t* rx_time)
+{
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  ring_chunk_t* chunk = (ring_chunk_t*)(ring->buff + (head & ring->mask));
+
+  chunk->len = len;
+  chunk->flags = flags;
+  chunk->rx_time = *rx_time;
+  atomic_store_explicit(&ring->head, head + sizeof(ring_chunk_t) + ring_align(len), memory_order_release);
+}
+
+
+/* Return the oldest chunk or NULL if the ring is empty. */
+static inline ring_chunk_t* ring_peek(ring_t* ring)
+{
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  for(;;)
+    {
+      ring_chunk_t* chunk;
+
+      if(tail == ring->head_cache)
+        {
+          ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+          if(tail == ring->head_cache) { return NULL; }
+        }
+
+      chunk = (ring_chunk_t*)(ring->buff + (tail & ring->mask));
+      if(chunk->len != RING_WRAP) { return chunk; }
+
+      tail += ring->size - (tail & ring->mask);
+      atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+
+/* Release chunk returned by ring_peek(). */
+static inline void ring_release(ring_t* ring, ring_chunk_t* chunk)
+{
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + sizeof(ring_chunk_t) + ring_align(chunk->len), memory_order_release);
+}
+
+
+static inline const char* ring_chunk_data(const ring_chunk_t* chunk)
+{
+  return (const char*)(chunk + 1);
+}
+
+#endif
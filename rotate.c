@@ -0,0 +1,472 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "ttylog.h"
+#include "rotate.h"
+
+
+/* Closed segment, kept for the retention limit. */
+typedef struct segment_s
+{
+  char* name;
+  long long size;
+  struct segment_s* next;
+} segment_t;
+
+
+struct rotate_s
+{
+  char* pattern;
+  rotate_policy_t policy;
+
+  /* Writer side, only touched by the thread flushing the output. */
+  int fd;
+  _Atomic long long written;   /* Bytes in the current segment. */
+  time_t next_time;            /* Time of the next time based switch. */
+
+  /* Shared with the rotator thread, protected by lock. */
+  pthread_mutex_t lock;
+  int next_fd;                 /* Prepared segment, -1 while not ready. */
+  char* next_tmp;              /* Temporary name of the prepared segment. */
+  int old_fd;                  /* Segment left by the last switch, -1 for none. */
+  long long old_written;
+  char* cur_tmp;               /* Temporary name of the current segment. */
+  time_t switch_time;
+
+  /* Rotator thread only. */
+  char* cur_name;
+  long long prealloc;
+  segment_t* segments;         /* Closed segments, oldest first. */
+  segment_t** segments_tail;
+  long long segments_size;
+
+  struct rotate_s* next;
+};
+
+
+/* Rotator thread, shared by all rotated outputs. */
+static pthread_mutex_t rotator_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rotator_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t rotator;
+static int rotator_running = 0;
+static int rotator_stop = 0;
+static int rotator_pending = 0;   /* Work was queued while the rotator was busy. */
+static rotate_t* rotators = NULL;
+/* Guards the list, not rotator_lock, so writers waking the rotator never
+   wait for the file work it does while walking the list. */
+static pthread_mutex_t rotators_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static time_t next_boundary(time_t now, long interval)
+{
+  return (now / interval + 1) * interval;
+}
+
+
+/* Expand pattern for time t into a name that does not exist yet. */
+static char* segment_name(const char* pattern, time_t t)
+{
+  char name[4096];
+  char* unique;
+  struct tm tm;
+  size_t len;
+  int n;
+
+  localtime_r(&t, &tm);
+  len = strftime(name, sizeof(name) - 16, pattern, &tm);
+  if(!len) { snprintf(name, sizeof(name) - 16, "%s", pattern); }
+
+  if(access(name, F_OK)) { return strdup(name); }
+
+  unique = malloc(strlen(name) + 16);
+  if(!unique) { return NULL; }
+  for(n = 1; ; n++)
+    {
+      sprintf(unique, "%s.%d", name, n);
+      if(access(unique, F_OK)) { break; }
+    }
+
+  return unique;
+}
+
+
+static void preallocate(int fd, long long size)
+{
+#if defined(FALLOC_FL_KEEP_SIZE)
+  /* Reserve the blocks but keep the file size, so readers never see the
+     unwritten part and nothing needs to be truncated on close. */
+  if(size > 0) { fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size); }
+#else
+  (void)fd;
+  (void)size;
+#endif
+}
+
+
+/* Open and preallocate the next segment under a temporary name in the
+   directory of the current segment. */
+static void rotate_prepare(rotate_t* rot)
+{
+  char* dir_copy = strdup(rot->cur_name);
+  char* tmp;
+  int fd;
+
+  if(!dir_copy) { return; }
+  tmp = malloc(strlen(rot->cur_name) + 32);
+  if(!tmp)
+    {
+      free(dir_copy);
+      return;
+    }
+  sprintf(tmp, "%s/.ttylog-XXXXXX", dirname(dir_copy));
+  free(dir_copy);
+
+  fd = mkostemp(tmp, O_CLOEXEC);
+  if(fd < 0)
+    {
+      fprintf (stderr, "%s: can not create next segment of %s: %s\n", progname, rot->pattern, strerror(errno));
+      free(tmp);
+      return;
+    }
+  fchmod(fd, 0644);
+  preallocate(fd, rot->prealloc);
+
+  pthread_mutex_lock(&rot->lock);
+  rot->next_fd = fd;
+  rot->next_tmp = tmp;
+  pthread_mutex_unlock(&rot->lock);
+}
+
+
+/* Close the segment left by a switch and give the new one its name. */
+static void rotate_finish_switch(rotate_t* rot, int old_fd, long long old_written, char* cur_tmp, time_t switch_time)
+{
+  segment_t* seg;
+  char* name;
+
+  close(old_fd);
+
+  seg = malloc(sizeof(*seg));
+  if(seg)
+    {
+      seg->name = rot->cur_name;
+      seg->size = old_written;
+      seg->next = NULL;
+      *rot->segments_tail = seg;
+      rot->segments_tail = &seg->next;
+      rot->segments_size += old_written;
+    }
+  else
+    {
+      free(rot->cur_name);
+    }
+
+  /* Time rotation knows nothing about the size, use the last one. */
+  if(!rot->policy.size) { rot->prealloc = old_written; }
+
+  name = segment_name(rot->pattern, switch_time);
+  if(name && rename(cur_tmp, name) == 0)
+    {
+      free(cur_tmp);
+      rot->cur_name = name;
+    }
+  else
+    {
+      fprintf (stderr, "%s: can not rename segment %s\n", progname, cur_tmp);
+      free(name);
+      rot->cur_name = cur_tmp;
+    }
+
+  pthread_mutex_lock(&rot->lock);
+  rot->old_fd = -1;
+  pthread_mutex_unlock(&rot->lock);
+}
+
+
+/* Delete oldest segments until the retained size fits the limit. */
+static void rotate_retain(rotate_t* rot)
+{
+  long long current = atomic_load_explicit(&rot->written, memory_order_relaxed);
+
+  if(!rot->policy.retain) { return; }
+
+  while(rot->segments && rot->segments_size + current > rot->policy.retain)
+    {
+      segment_t* seg = rot->segments;
+
+      if(unlink(seg->name) && errno != ENOENT)
+        {
+          fprintf (stderr, "%s: can not delete segment %s\n", progname, seg->name);
+        }
+      rot->segments_size -= seg->size;
+      rot->segments = seg->next;
+      if(!rot->segments) { rot->segments_tail = &rot->segments; }
+      free(seg->name);
+      free(seg);
+    }
+}
+
+
+/* Do the pending background work of rot. */
+static void rotate_service(rotate_t* rot)
+{
+  int old_fd, need_next;
+  long long old_written;
+  char* cur_tmp;
+  time_t switch_time;
+
+  pthread_mutex_lock(&rot->lock);
+  old_fd = rot->old_fd;
+  old_written = rot->old_written;
+  cur_tmp = rot->cur_tmp;
+  switch_time = rot->switch_time;
+  rot->cur_tmp = NULL;
+  need_next = (rot->next_fd < 0);
+  pthread_mutex_unlock(&rot->lock);
+
+  if(old_fd >= 0)
+    {
+      rotate_finish_switch(rot, old_fd, old_written, cur_tmp, switch_time);
+      need_next = 1;
+    }
+  if(need_next) { rotate_prepare(rot); }
+  rotate_retain(rot);
+}
+
+
+static void* rotator_run(void* arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&rotator_lock);
+  while(!rotator_stop)
+    {
+      struct timespec ts;
+      rotate_t* rot;
+
+      rotator_pending = 0;
+      pthread_mutex_unlock(&rotator_lock);
+      pthread_mutex_lock(&rotators_lock);
+      for(rot = rotators; rot; rot = rot->next) { rotate_service(rot); }
+      pthread_mutex_unlock(&rotators_lock);
+      pthread_mutex_lock(&rotator_lock);
+
+      if(rotator_stop || rotator_pending) { continue; }
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec++;
+      pthread_cond_timedwait(&rotator_cond, &rotator_lock, &ts);
+    }
+  pthread_mutex_unlock(&rotator_lock);
+
+  return NULL;
+}
+
+
+static void rotator_wake(void)
+{
+  pthread_mutex_lock(&rotator_lock);
+  rotator_pending = 1;
+  pthread_cond_signal(&rotator_cond);
+  pthread_mutex_unlock(&rotator_lock);
+}
+
+
+void rotate_shutdown(void)
+{
+  if(!rotator_running) { return; }
+
+  pthread_mutex_lock(&rotator_lock);
+  rotator_stop = 1;
+  pthread_cond_signal(&rotator_cond);
+  pthread_mutex_unlock(&rotator_lock);
+  pthread_join(rotator, NULL);
+  rotator_running = 0;
+}
+
+
+rotate_t* rotate_open(const char* pattern, const rotate_policy_t* policy)
+{
+  rotate_t* rot = calloc(1, sizeof(*rot));
+  time_t now = time(NULL);
+
+  if(!rot) { return NULL; }
+
+  rot->pattern = strdup(pattern);
+  rot->policy = *policy;
+  rot->cur_name = segment_name(pattern, now);
+  rot->next_fd = -1;
+  rot->old_fd = -1;
+  rot->prealloc = policy->size;
+  rot->segments_tail = &rot->segments;
+  atomic_init(&rot->written, 0);
+  pthread_mutex_init(&rot->lock, NULL);
+  if(policy->interval) { rot->next_time = next_boundary(now, policy->interval); }
+
+  rot->fd = rot->cur_name ? open(rot->cur_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+  if(rot->fd < 0)
+    {
+      free(rot->cur_name);
+      free(rot->pattern);
+      free(rot);
+      return NULL;
+    }
+  preallocate(rot->fd, rot->prealloc);
+
+  /* The rotator may be walking the list for the outputs added before. */
+  pthread_mutex_lock(&rotators_lock);
+  rot->next = rotators;
+  rotators = rot;
+  pthread_mutex_unlock(&rotators_lock);
+
+  if(!rotator_running)
+    {
+      rotator_stop = 0;
+      if(pthread_create(&rotator, NULL, rotator_run, NULL) == 0) { rotator_running = 1; }
+    }
+  else
+    {
+      rotator_wake();
+    }
+
+  return rot;
+}
+
+
+int rotate_fd(const rotate_t* rot)
+{
+  return rot->fd;
+}
+
+
+int rotate_check(rotate_t* rot, size_t len)
+{
+  long long written = atomic_load_explicit(&rot->written, memory_order_relaxed);
+  time_t now = 0;
+  int due = 0;
+
+  if(!written) { return 0; }
+  if(rot->policy.size && written + (long long)len > rot->policy.size) { due = 1; }
+  if(rot->policy.interval)
+    {
+      now = time(NULL);
+      if(now >= rot->next_time) { due = 1; }
+    }
+  if(!due) { return 0; }
+
+  /* Never wait for the rotator, try again on the next write. */
+  if(pthread_mutex_trylock(&rot->lock)) { return 0; }
+  if(rot->next_fd < 0 || rot->old_fd >= 0)
+    {
+      pthread_mutex_unlock(&rot->lock);
+      return 0;
+    }
+
+  if(!now) { now = time(NULL); }
+  rot->old_fd = rot->fd;
+  rot->old_written = written;
+  rot->switch_time = now;
+  rot->fd = rot->next_fd;
+  rot->cur_tmp = rot->next_tmp;
+  rot->next_fd = -1;
+  rot->next_tmp = NULL;
+  atomic_store_explicit(&rot->written, 0, memory_order_relaxed);
+  if(rot->policy.interval) { rot->next_time = next_boundary(now, rot->policy.interval); }
+  pthread_mutex_unlock(&rot->lock);
+
+  rotator_wake();
+  return 1;
+}
+
+
+void rotate_written(rotate_t* rot, size_t len)
+{
+  atomic_fetch_add_explicit(&rot->written, len, memory_order_relaxed);
+}
+
+
+void rotate_close(rotate_t* rot)
+{
+  rotate_t** pp;
+
+  rotate_shutdown();
+
+  /* Finish a switch the rotator did not get to. */
+  if(rot->old_fd >= 0)
+    {
+      rotate_finish_switch(rot, rot->old_fd, rot->old_written, rot->cur_tmp, rot->switch_time);
+      rot->cur_tmp = NULL;
+    }
+  if(rot->next_fd >= 0)
+    {
+      close(rot->next_fd);
+      unlink(rot->next_tmp);
+    }
+  free(rot->next_tmp);
+  close(rot->fd);
+
+  while(rot->segments)
+    {
+      segment_t* seg = rot->segments;
+      rot->segments = seg->next;
+      free(seg->name);
+      free(seg);
+    }
+
+  pthread_mutex_lock(&rotators_lock);
+  for(pp = &rotators; *pp; pp = &(*pp)->next)
+    {
+      if(*pp == rot)
+        {
+          *pp = rot->next;
+          break;
+        }
+    }
+  pthread_mutex_unlock(&rotators_lock);
+
+  pthread_mutex_destroy(&rot->lock);
+  free(rot->cur_name);
+  free(rot->pattern);
+  free(rot);
+}
+
+
+long rotate_parse_interval(const char* str)
+{
+  char* end;
+  long n = strtol(str, &end, 10);
+
+  if(end == str || n <= 0) { return -1; }
+  if(*end == 's') { end++; }
+  else if(*end == 'm') { n *= 60; end++; }
+  else if(*end == 'h') { n *= 3600; end++; }
+  else if(*end == 'd') { n *= 86400; end++; }
+  if(*end) { return -1; }
+
+  return n;
+}
@@ -0,0 +1,64 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_ROTATE_H_
+#define _TTYLOG_ROTATE_H_
+
+#include <stddef.h>
+
+
+/* Output rotation settings. */
+typedef struct
+{
+  long long size;      /* Start a new segment at this many bytes, 0 for no limit. */
+  long interval;       /* Start a new segment every interval seconds, 0 for never. */
+  long long retain;    /* Delete oldest segments beyond this many bytes, 0 keeps all. */
+} rotate_policy_t;
+
+
+/* Rotated output file. The output path is a strftime() pattern expanded
+   when a segment starts. A background thread opens and preallocates the
+   next segment before it is needed and closes, renames and deletes old
+   ones, so switching segments is just swapping the file descriptor. */
+typedef struct rotate_s rotate_t;
+
+
+/* Open the first segment for pattern. Returns NULL on error. */
+rotate_t* rotate_open(const char* pattern, const rotate_policy_t* policy);
+
+/* File descriptor of the current segment. */
+int rotate_fd(const rotate_t* rot);
+
+/* Called before len bytes are written. Switches to the prepared next
+   segment when the current one is full or its time is over and returns
+   1 in that case, 0 otherwise. Never blocks, if the next segment is not
+   ready yet writing continues in the current one. The caller serializes
+   calls for one rot. */
+int rotate_check(rotate_t* rot, size_t len);
+
+/* Account len bytes written to the current segment. */
+void rotate_written(rotate_t* rot, size_t len);
+
+/* Stop the background thread, done before the outputs are closed. */
+void rotate_shutdown(void);
+
+/* Close all segments and free rot. */
+void rotate_close(rotate_t* rot);
+
+/* Parse interval with optional s, m, h or d suffix, returns -1 on error. */
+long rotate_parse_interval(const char* str);
+
+#endif
@@ -0,0 +1,630 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ttylog.h"
+#include "server.h"
+
+
+/* Blocks a client queue can hold, besides the byte limit. */
+#define CLIENT_SLOTS 256
+
+/* Blocks sent with one sendmsg(). */
+#define SEND_IOV 64
+
+
+/* Flushed output shared by the queues of all clients. */
+typedef struct
+{
+  _Atomic int refs;
+  size_t len;
+  char data[];
+} block_t;
+
+
+typedef struct client_s
+{
+  int fd;
+  block_t* q[CLIENT_SLOTS];
+  unsigned head;       /* Next free slot. */
+  unsigned tail;       /* Oldest block. */
+  size_t off;          /* Bytes of the oldest block already sent. */
+  size_t queued;       /* Bytes in the queue, not counting off. */
+  int want_out;        /* Waiting for EPOLLOUT. */
+  int eof;             /* Client shut down its sending side. */
+  int dead;            /* To be closed by the server thread. */
+  uint64_t seq;        /* Last block published to the client. */
+  struct client_s* next;
+} client_t;
+
+
+_Atomic int server_clients;
+
+static int policy;
+static size_t queue_size;
+static int listen_fd = -1;
+static int epfd = -1;
+static int wake_fd = -1;
+static char* unix_path;
+static block_t* preamble;
+static client_t* clients;
+static client_t* closed;     /* Freed after the events naming them are handled. */
+static uint64_t publish_seq;
+static pthread_t server_thread;
+static int server_running = 0;
+static _Atomic int server_stopping;
+
+/* Guards the client list and queues. The server thread holds it while
+   sending, the sends never block. */
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t server_room = PTHREAD_COND_INITIALIZER;
+
+
+static block_t* block_new(const char* data, size_t len)
+{
+  block_t* b = malloc(sizeof(*b) + len);
+
+  if(!b) { return NULL; }
+  atomic_init(&b->refs, 1);
+  b->len = len;
+  memcpy(b->data, data, len);
+  return b;
+}
+
+
+static void block_unref(block_t* b)
+{
+  if(atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1) { free(b); }
+}
+
+
+static int client_full(const client_t* c, size_t len)
+{
+  unsigned n = c->head - c->tail;
+
+  if(n == CLIENT_SLOTS) { return 1; }
+  return n && c->queued + len > queue_size;
+}
+
+
+/* Drop the oldest block that is not being sent. */
+static void client_drop_oldest(client_t* c)
+{
+  unsigned i = c->tail;
+
+  if(c->off)
+    {
+      /* Keep the partly sent block, it moves into the dropped one's slot. */
+      block_t* sending = c->q[i % CLIENT_SLOTS];
+      i++;
+      c->queued -= c->q[i % CLIENT_SLOTS]->len;
+      block_unref(c->q[i % CLIENT_SLOTS]);
+      c->q[i % CLIENT_SLOTS] = sending;
+    }
+  else
+    {
+      c->queued -= c->q[i % CLIENT_SLOTS]->len;
+      block_unref(c->q[i % CLIENT_SLOTS]);
+    }
+  c->tail++;
+}
+
+
+static void client_push(client_t* c, block_t* b)
+{
+  atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+  c->q[c->head++ % CLIENT_SLOTS] = b;
+  c->queued += b->len;
+}
+
+
+/* Drop the queue of client and mark it for closing, server lock held. */
+static void client_kill(client_t* c)
+{
+  while(c->tail != c->head) { block_unref(c->q[c->tail++ % CLIENT_SLOTS]); }
+  c->queued = 0;
+  c->off = 0;
+  c->dead = 1;
+  pthread_cond_broadcast(&server_room);
+}
+
+
+/* Disconnect client, only done by the server thread with the lock held.
+   The client is freed by server_reap(). */
+static void client_close(client_t* c)
+{
+  client_t** pp;
+
+  for(pp = &clients; *pp; pp = &(*pp)->next)
+    {
+      if(*pp == c)
+        {
+          *pp = c->next;
+          break;
+        }
+    }
+
+  client_kill(c);
+  close(c->fd);
+  c->fd = -1;
+  c->next = closed;
+  closed = c;
+  atomic_fetch_sub(&server_clients, 1);
+}
+
+
+static void server_reap(void)
+{
+  pthread_mutex_lock(&server_lock);
+  while(closed)
+    {
+      client_t* c = closed;
+      closed = c->next;
+      free(c);
+    }
+  pthread_mutex_unlock(&server_lock);
+}
+
+
+/* Update the events polled for client. */
+static void client_watch(client_t* c)
+{
+  struct epoll_event ev;
+
+  ev.events = (c->eof ? 0 : EPOLLIN) | (c->want_out ? EPOLLOUT : 0);
+  ev.data.ptr = c;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+
+/* Send as much of the queue as the socket takes. Returns -1 when the
+   client was closed. Server lock held. */
+static int client_send(client_t* c)
+{
+  if(c->dead)
+    {
+      client_close(c);
+      return -1;
+    }
+
+  while(c->tail != c->head)
+    {
+      struct iovec iov[SEND_IOV];
+      struct msghdr msg;
+      unsigned i, n = 0;
+      ssize_t sent;
+
+      for(i = c->tail; i != c->head && n < SEND_IOV; i++, n++)
+        {
+          block_t* b = c->q[i % CLIENT_SLOTS];
+          iov[n].iov_base = b->data + (n ? 0 : c->off);
+          iov[n].iov_len = b->len - (n ? 0 : c->off);
+        }
+
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = n;
+      sent = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if(sent < 0)
+        {
+          if(errno == EINTR) { continue; }
+          if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+              client_close(c);
+              return -1;
+            }
+          if(!c->want_out)
+            {
+              c->want_out = 1;
+              client_watch(c);
+            }
+          return 0;
+        }
+
+      /* Release what was sent. */
+      sent += c->off;
+      while(c->tail != c->head && (size_t)sent >= c->q[c->tail % CLIENT_SLOTS]->len)
+        {
+          block_t* b = c->q[c->tail++ % CLIENT_SLOTS];
+          sent -= b->len;
+          c->queued -= b->len;
+          block_unref(b);
+        }
+      c->off = sent;
+      pthread_cond_broadcast(&server_room);
+    }
+
+  if(c->want_out)
+    {
+      c->want_out = 0;
+      client_watch(c);
+    }
+  return 0;
+}
+
+
+static void server_accept(void)
+{
+  for(;;)
+    {
+      int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      struct epoll_event ev;
+      client_t* c;
+      int one = 1;
+
+      if(fd < 0) { return; }
+      c = calloc(1, sizeof(*c));
+      if(!c)
+        {
+          close(fd);
+          return;
+        }
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      c->fd = fd;
+      ev.events = EPOLLIN;
+      ev.data.ptr = c;
+      if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+        {
+          close(fd);
+          free(c);
+          continue;
+        }
+
+      pthread_mutex_lock(&server_lock);
+      if(preamble) { client_push(c, preamble); }
+      c->next = clients;
+      clients = c;
+      atomic_fetch_add(&server_clients, 1);
+      client_send(c);
+      pthread_mutex_unlock(&server_lock);
+    }
+}
+
+
+/* Data from a client is ignored. A client that shuts down its sending
+   side keeps receiving, until the connection fails. Server lock held. */
+static void client_input(client_t* c)
+{
+  char buff[256];
+  ssize_t n;
+
+  while((n = read(c->fd, buff, sizeof(buff))) > 0) {}
+  if(n == 0)
+    {
+      c->eof = 1;
+      client_watch(c);
+    }
+  else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+      client_close(c);
+    }
+}
+
+
+static int queues_empty(void)
+{
+  client_t* c;
+
+  for(c = clients; c; c = c->next)
+    {
+      if(c->tail != c->head) { return 0; }
+    }
+  return 1;
+}
+
+
+static void* server_run(void* arg)
+{
+  struct timespec stop_at = { 0, 0 };
+
+  (void)arg;
+  for(;;)
+    {
+      struct epoll_event evs[64];
+      int timeout_ms = -1;
+      int i, n;
+
+      /* When stopping, keep sending for a second at most. */
+      if(atomic_load(&server_stopping))
+        {
+          struct timespec now;
+          int empty;
+
+          clock_gettime(CLOCK_MONOTONIC, &now);
+          if(!stop_at.tv_sec) { stop_at = now; stop_at.tv_sec++; }
+          pthread_mutex_lock(&server_lock);
+          empty = queues_empty();
+          pthread_mutex_unlock(&server_lock);
+          if(empty || now.tv_sec > stop_at.tv_sec
+             || (now.tv_sec == stop_at.tv_sec && now.tv_nsec >= stop_at.tv_nsec)) { break; }
+          timeout_ms = 10;
+        }
+
+      n = epoll_wait(epfd, evs, 64, timeout_ms);
+      for(i = 0; i < n; i++)
+        {
+          void* p = evs[i].data.ptr;
+          client_t* c = p;
+
+          if(p == &listen_fd) { server_accept(); }
+          else if(p == &wake_fd)
+            {
+              client_t* next;
+              uint64_t v;
+
+              if(read(wake_fd, &v, sizeof(v)) < 0) {}
+              pthread_mutex_lock(&server_lock);
+              for(c = clients; c; c = next)
+                {
+                  next = c->next;
+                  if(!c->want_out || c->dead) { client_send(c); }
+                }
+              pthread_mutex_unlock(&server_lock);
+            }
+          else
+            {
+              pthread_mutex_lock(&server_lock);
+              if(c->fd >= 0 && (evs[i].events & (EPOLLHUP | EPOLLERR))) { client_close(c); }
+              if(c->fd >= 0 && (evs[i].events & EPOLLOUT)) { client_send(c); }
+              if(c->fd >= 0 && (evs[i].events & EPOLLIN)) { client_input(c); }
+              pthread_mutex_unlock(&server_lock);
+            }
+        }
+
+      /* No event of this round names a closed client any more. */
+      server_reap();
+    }
+
+  pthread_mutex_lock(&server_lock);
+  while(clients) { client_close(clients); }
+  pthread_mutex_unlock(&server_lock);
+  server_reap();
+  return NULL;
+}
+
+
+int server_parse_policy(const char* str)
+{
+  if(!strcmp(str, "drop")) { return SERVER_DROP; }
+  if(!strcmp(str, "disconnect")) { return SERVER_DISCONNECT; }
+  if(!strcmp(str, "block")) { return SERVER_BLOCK; }
+  return -1;
+}
+
+
+/* Create the listening socket for addr. */
+static int server_listen(const char* addr)
+{
+  struct addrinfo hints, *res, *ai;
+  char host[256];
+  const char* port;
+  int fd = -1;
+  int err;
+
+  if(!strncmp(addr, "unix:", 5))
+    {
+      struct sockaddr_un sun;
+
+      memset(&sun, 0, sizeof(sun));
+      sun.sun_family = AF_UNIX;
+      if(strlen(addr + 5) >= sizeof(sun.sun_path)) { return -1; }
+      strcpy(sun.sun_path, addr + 5);
+      fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if(fd < 0) { return -1; }
+      unlink(sun.sun_path);
+      if(bind(fd, (struct sockaddr*)&sun, sizeof(sun)) || listen(fd, 16))
+        {
+          close(fd);
+          return -1;
+        }
+      unix_path = strdup(sun.sun_path);
+      return fd;
+    }
+
+  /* [HOST]:PORT, HOST:PORT or PORT. */
+  port = strrchr(addr, ':');
+  if(port)
+    {
+      size_t len = port - addr;
+      if(addr[0] == '[' && len >= 2 && addr[len - 1] == ']') { addr++; len -= 2; }
+      if(len >= sizeof(host)) { return -1; }
+      memcpy(host, addr, len);
+      host[len] = 0;
+      port++;
+    }
+  else
+    {
+      host[0] = 0;
+      port = addr;
+    }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+  if(err) { return -1; }
+
+  for(ai = res; ai; ai = ai->ai_next)
+    {
+      int one = 1;
+
+      fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+      if(fd < 0) { continue; }
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0) { break; }
+      close(fd);
+      fd = -1;
+    }
+  freeaddrinfo(res);
+
+  return fd;
+}
+
+
+int server_start(const char* addr, int slow_policy, size_t max_queue)
+{
+  struct epoll_event ev;
+
+  policy = slow_policy;
+  queue_size = max_queue;
+  atomic_init(&server_clients, 0);
+  atomic_init(&server_stopping, 0);
+
+  listen_fd = server_listen(addr);
+  if(listen_fd < 0)
+    {
+      fprintf (stderr, "%s: can not listen on %s\n", progname, addr);
+      return -1;
+    }
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(epfd < 0 || wake_fd < 0)
+    {
+      fprintf (stderr, "%s: can not create server event loop\n", progname);
+      return -1;
+    }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = &listen_fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+  ev.data.ptr = &wake_fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+  if(pthread_create(&server_thread, NULL, server_run, NULL))
+    {
+      fprintf (stderr, "%s: can not start server thread\n", progname);
+      return -1;
+    }
+  server_running = 1;
+  return 0;
+}
+
+
+void server_add_preamble(const char* data, size_t len)
+{
+  block_t* b;
+
+  if(!server_running) { return; }
+
+  pthread_mutex_lock(&server_lock);
+  b = malloc(sizeof(*b) + (preamble ? preamble->len : 0) + len);
+  if(b)
+    {
+      atomic_init(&b->refs, 1);
+      b->len = 0;
+      if(preamble)
+        {
+          memcpy(b->data, preamble->data, preamble->len);
+          b->len = preamble->len;
+          block_unref(preamble);
+        }
+      memcpy(b->data + b->len, data, len);
+      b->len += len;
+      preamble = b;
+    }
+  pthread_mutex_unlock(&server_lock);
+}
+
+
+void server_publish(const char* data, size_t len)
+{
+  uint64_t one = 1;
+  client_t* c;
+  block_t* b;
+
+  if(!server_running || !atomic_load_explicit(&server_clients, memory_order_relaxed)) { return; }
+
+  /* The only copy, shared by all clients. */
+  b = block_new(data, len);
+  if(!b) { return; }
+
+  pthread_mutex_lock(&server_lock);
+  publish_seq++;
+
+  /* Waiting for a client releases the lock and the list may change, so
+     the walk starts over and skips the clients that have the block. */
+restart:
+  for(c = clients; c; c = c->next)
+    {
+      if(c->dead || c->seq == publish_seq) { continue; }
+      if(client_full(c, len))
+        {
+          if(policy == SERVER_DISCONNECT)
+            {
+              client_kill(c);
+              continue;
+            }
+          if(policy == SERVER_BLOCK && !atomic_load(&server_stopping))
+            {
+              if(write(wake_fd, &one, sizeof(one)) < 0) {}
+              pthread_cond_wait(&server_room, &server_lock);
+              goto restart;
+            }
+          /* The block being sent stays, when only it is left the new one
+             goes over the limit. */
+          while(client_full(c, len) && c->head - c->tail > (c->off ? 1u : 0u)) { client_drop_oldest(c); }
+        }
+      client_push(c, b);
+      c->seq = publish_seq;
+    }
+  pthread_mutex_unlock(&server_lock);
+  block_unref(b);
+
+  if(write(wake_fd, &one, sizeof(one)) < 0) {}
+}
+
+
+void server_stop(void)
+{
+  uint64_t one = 1;
+
+  if(!server_running) { return; }
+
+  atomic_store(&server_stopping, 1);
+  pthread_mutex_lock(&server_lock);
+  pthread_cond_broadcast(&server_room);
+  pthread_mutex_unlock(&server_lock);
+  if(write(wake_fd, &one, sizeof(one)) < 0) {}
+  pthread_join(server_thread, NULL);
+  server_running = 0;
+
+  close(listen_fd);
+  close(epfd);
+  close(wake_fd);
+  if(unix_path)
+    {
+      unlink(unix_path);
+      free(unix_path);
+    }
+  if(preamble) { block_unref(preamble); }
+}
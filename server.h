@@ -0,0 +1,65 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_SERVER_H_
+#define _TTYLOG_SERVER_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+
+/* Policies for clients that do not keep up. */
+enum
+{
+  SERVER_DROP = 0,        /* Drop the oldest queued data of the client. */
+  SERVER_DISCONNECT = 1,  /* Disconnect the client. */
+  SERVER_BLOCK = 2,       /* Wait for the client, stalls the output. */
+};
+
+/* Default limit of the data queued for one client. */
+#define SERVER_QUEUE_SIZE (1024 * 1024)
+
+
+/* Live stream server. Everything flushed to the outputs is also sent to
+   the connected TCP or Unix socket clients. Flushed data is copied once
+   into a reference counted block, the send queue of every client only
+   points to the blocks, and a single thread sends them from a
+   non-blocking epoll loop. New clients first get the output preambles,
+   so a bin stream can be decoded from any point. */
+
+/* Number of connected clients, publishing is skipped when there are none. */
+extern _Atomic int server_clients;
+
+/* Listen on addr, "unix:PATH", "HOST:PORT", "[HOST]:PORT" or "PORT", and
+   start the server thread. Returns 0 on success, prints a message and
+   returns -1 on failure. */
+int server_start(const char* addr, int policy, size_t queue_size);
+
+/* Parse a slow client policy, drop, disconnect or block. Returns -1 when
+   invalid. */
+int server_parse_policy(const char* str);
+
+/* Add data sent to every new client before the stream. */
+void server_add_preamble(const char* data, size_t len);
+
+/* Send len bytes at data to all clients. */
+void server_publish(const char* data, size_t len);
+
+/* Send what is still queued, waiting a second at most, disconnect the
+   clients and stop the server thread. */
+void server_stop(void);
+
+#endif
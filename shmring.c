@@ -0,0 +1,189 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+
+
+shmring_writer_t* shmring_create(const char* name, size_t size)
+{
+  shmring_writer_t* w;
+  size_t ring_size = SHMRING_MIN_SIZE;
+  int fd, err;
+
+  while(ring_size < size) { ring_size <<= 1; }
+
+  w = calloc(1, sizeof(*w));
+  if(!w || !(w->name = strdup(name)))
+    {
+      free(w);
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  /* Consumers of a previous ring keep their mapping, it is marked closed
+     when its producer exits. */
+  shm_unlink(name);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  w->map_len = SHMRING_HEADER_SIZE + ring_size;
+  if(fd < 0 || ftruncate(fd, w->map_len)
+     || (w->hdr = mmap(NULL, w->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0)) == MAP_FAILED)
+    {
+      err = errno;
+      if(fd >= 0)
+        {
+          close(fd);
+          shm_unlink(name);
+        }
+      free(w->name);
+      free(w);
+      errno = err;
+      return NULL;
+    }
+  close(fd);
+
+  w->data = (unsigned char*)w->hdr + SHMRING_HEADER_SIZE;
+  w->size = ring_size;
+  atomic_flag_clear(&w->lock);
+
+  w->hdr->version = SHMRING_VERSION;
+  w->hdr->header_size = SHMRING_HEADER_SIZE;
+  w->hdr->size = ring_size;
+  atomic_thread_fence(memory_order_release);
+  w->hdr->magic = SHMRING_MAGIC;
+
+  return w;
+}
+
+
+void shmring_publish(shmring_writer_t* w, shmring_record_t* rec, const void* data)
+{
+  uint64_t need = shmring_record_size(rec->len);
+  uint64_t head, off, pad, end;
+  shmring_record_t* dst;
+
+  if(need > w->size / 4) { return; }
+
+  while(atomic_flag_test_and_set_explicit(&w->lock, memory_order_acquire)) {}
+
+  head = w->head;
+  off = head & (w->size - 1);
+  pad = w->size - off < need ? w->size - off : 0;
+  end = head + pad + need;
+
+  /* Move the tail past the records about to be overwritten, and tell the
+     consumers before writing. */
+  if(end > w->size && w->tail < end - w->size)
+    {
+      while(w->tail < end - w->size)
+        {
+          uint64_t at = w->tail & (w->size - 1);
+          const shmring_record_t* old = (const shmring_record_t*)(w->data + at);
+
+          if(w->size - at < sizeof(*old) || old->len == SHMRING_PAD) { w->tail += w->size - at; }
+          else { w->tail += shmring_record_size(old->len); }
+        }
+      atomic_store_explicit(&w->hdr->tail, w->tail, memory_order_relaxed);
+      atomic_thread_fence(memory_order_release);
+    }
+
+  /* An end too short for a record header is skipped without a marker. */
+  if(pad >= sizeof(shmring_record_t))
+    {
+      dst = (shmring_record_t*)(w->data + off);
+      dst->pos = head;
+      dst->len = SHMRING_PAD;
+    }
+
+  rec->pos = head + pad;
+  rec->seq = w->seq++;
+  dst = (shmring_record_t*)(w->data + ((head + pad) & (w->size - 1)));
+  memcpy(dst, rec, sizeof(*rec));
+  memcpy(dst + 1, data, rec->len);
+
+  w->head = end;
+  atomic_store_explicit(&w->hdr->head, end, memory_order_release);
+  atomic_flag_clear_explicit(&w->lock, memory_order_release);
+}
+
+
+void shmring_destroy(shmring_writer_t* w)
+{
+  if(!w) { return; }
+
+  atomic_store_explicit(&w->hdr->closed, 1, memory_order_release);
+  munmap(w->hdr, w->map_len);
+  shm_unlink(w->name);
+  free(w->name);
+  free(w);
+}
+
+
+int shmring_open(shmring_reader_t* r, const char* name)
+{
+  const shmring_header_t* hdr;
+  struct stat st;
+  int fd;
+
+  memset(r, 0, sizeof(*r));
+  fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if(fd < 0) { return -1; }
+  if(fstat(fd, &st) || st.st_size < SHMRING_HEADER_SIZE + SHMRING_MIN_SIZE)
+    {
+      close(fd);
+      errno = EAGAIN;
+      return -1;
+    }
+
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(hdr == MAP_FAILED) { return -1; }
+
+  if(hdr->magic != SHMRING_MAGIC || hdr->version != SHMRING_VERSION
+     || hdr->header_size + hdr->size != (uint64_t)st.st_size)
+    {
+      /* Not initialized yet, or not a ring. */
+      int err = hdr->magic ? EPROTO : EAGAIN;
+
+      munmap((void*)hdr, st.st_size);
+      errno = err;
+      return -1;
+    }
+  atomic_thread_fence(memory_order_acquire);
+
+  r->hdr = hdr;
+  r->data = (const unsigned char*)hdr + hdr->header_size;
+  r->size = hdr->size;
+  r->map_len = st.st_size;
+  r->pos = atomic_load_explicit(&hdr->head, memory_order_acquire);
+  r->seq = (uint64_t)-1;
+
+  return 0;
+}
+
+
+void shmring_close(shmring_reader_t* r)
+{
+  if(r->hdr) { munmap((void*)r->hdr, r->map_len); }
+  r->hdr = NULL;
+}
@@ -0,0 +1,239 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_SHMRING_H_
+#define _TTYLOG_SHMRING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+
+/* Shared memory publication of the received data, see --shm. ttylog is
+   the only producer and writes every received chunk as a record with its
+   port, receive time and sequence number into a POSIX shared memory ring.
+   Any number of local consumers map the ring read only and read the
+   records in place. The producer never waits for them: it overwrites the
+   oldest records, and a consumer that falls a whole ring behind notices
+   it, skips to the oldest record left and counts what it lost.
+
+   Consumer loop:
+
+     shmring_reader_t r;
+     const shmring_record_t* rec;
+
+     if(shmring_open(&r, "/ttylog")) { ... }
+     for(;;)
+       {
+         if(!(rec = shmring_peek(&r))) { sleep a little or exit if shmring_closed(&r); continue; }
+         use rec and shmring_payload(rec), rec->len bytes;
+         if(shmring_next(&r, rec)) { the record was overwritten while in use, drop what was done with it; }
+       }
+*/
+
+#define SHMRING_MAGIC   0x314d48534c595454ULL   /* "TTYLSHM1" */
+#define SHMRING_VERSION 1
+#define SHMRING_HEADER_SIZE 4096   /* The records start on the next page. */
+#define SHMRING_PAD     0xFFFFFFFFu
+
+/* Default and smallest ring size. */
+#define SHMRING_SIZE     (16 * 1024 * 1024)
+#define SHMRING_MIN_SIZE (256 * 1024)
+
+
+/* Start of the shared memory object. Positions count bytes written since
+   the ring was created, the offset in the ring is the position modulo the
+   size. */
+typedef struct
+{
+  uint64_t magic;             /* Written last when the ring is created. */
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t size;              /* Bytes of records, a power of 2. */
+  _Atomic uint32_t closed;    /* Set when the producer has exited. */
+  uint32_t reserved;
+
+  _Atomic uint64_t head __attribute__((aligned(64)));  /* End of the newest record. */
+  _Atomic uint64_t tail;      /* Oldest record, data before it may be overwritten. */
+} shmring_header_t;
+
+
+/* Record header, followed by len bytes of data padded to 8 bytes. Records
+   are contiguous, one that does not fit at the end of the ring is preceded
+   by a record with len SHMRING_PAD filling the end. */
+typedef struct
+{
+  uint64_t pos;               /* Position of the record. */
+  uint64_t seq;               /* Record number, from 0, padding excluded. */
+  int64_t mono_ns;            /* Receive time, CLOCK_MONOTONIC. */
+  int64_t real_ns;            /* Receive time, CLOCK_REALTIME. */
+  int64_t span_ns;            /* Arrival of the first byte before the receive time, 0 if not estimated. */
+  uint32_t byte_ns;           /* Time between the bytes when span_ns is set. */
+  uint32_t len;
+  uint16_t port;              /* Port number, in --device order from 0. */
+  uint16_t flags;             /* 0, reserved. */
+  uint32_t reserved;
+} shmring_record_t;
+
+
+/* Producer. Publishing is serialized, so several threads can share it. */
+typedef struct
+{
+  shmring_header_t* hdr;
+  unsigned char* data;
+  uint64_t size;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t seq;
+  size_t map_len;
+  char* name;
+  atomic_flag lock;
+} shmring_writer_t;
+
+
+/* Consumer. */
+typedef struct
+{
+  const shmring_header_t* hdr;
+  const unsigned char* data;
+  uint64_t size;
+  uint64_t pos;               /* Position of the next record. */
+  uint64_t seq;               /* Sequence number expected next, -1 before the first record. */
+  uint64_t lost_records;      /* Records skipped after falling behind, from the first record read on. */
+  uint64_t laps;              /* Times the reader fell behind. */
+  size_t map_len;
+} shmring_reader_t;
+
+
+/* Create the shared memory object name, like "/ttylog", with size bytes
+   of records, replacing an existing one. Returns NULL and sets errno on
+   failure. */
+shmring_writer_t* shmring_create(const char* name, size_t size);
+
+/* Append a record. rec holds the times, port, flags and len of data, the
+   position and sequence number are set here. Data longer than a quarter of
+   the ring is not published. */
+void shmring_publish(shmring_writer_t* w, shmring_record_t* rec, const void* data);
+
+/* Mark the ring closed for the consumers, unmap and unlink it. */
+void shmring_destroy(shmring_writer_t* w);
+
+/* Map the ring name for reading, starting after the newest record.
+   Returns 0 on success, -1 with errno set when it does not exist (yet). */
+int shmring_open(shmring_reader_t* r, const char* name);
+void shmring_close(shmring_reader_t* r);
+
+/* Start again at the oldest record still in the ring. */
+static inline void shmring_rewind(shmring_reader_t* r)
+{
+  r->pos = atomic_load_explicit(&r->hdr->tail, memory_order_acquire);
+  r->seq = (uint64_t)-1;
+}
+
+
+static inline const void* shmring_payload(const shmring_record_t* rec)
+{
+  return rec + 1;
+}
+
+
+static inline uint64_t shmring_record_size(uint32_t len)
+{
+  return sizeof(shmring_record_t) + ((len + 7) & ~(uint64_t)7);
+}
+
+
+static inline int shmring_closed(const shmring_reader_t* r)
+{
+  return atomic_load_explicit(&r->hdr->closed, memory_order_acquire);
+}
+
+
+/* The reader fell a whole ring behind. */
+static inline void shmring_lapped(shmring_reader_t* r)
+{
+  r->pos = atomic_load_explicit(&r->hdr->tail, memory_order_acquire);
+  r->laps++;
+}
+
+
+/* Return the next record, or NULL when there is none yet. The record stays
+   in the ring and may be overwritten while in use, which shmring_next()
+   tells. */
+static inline const shmring_record_t* shmring_peek(shmring_reader_t* r)
+{
+  for(;;)
+    {
+      const shmring_record_t* rec;
+      uint64_t pos = r->pos;
+      uint64_t off = pos & (r->size - 1);
+      uint64_t rec_pos, seq;
+      uint32_t len;
+
+      if(pos == atomic_load_explicit(&r->hdr->head, memory_order_acquire)) { return NULL; }
+
+      /* Too short for a record, the producer skipped it. */
+      if(r->size - off < sizeof(shmring_record_t))
+        {
+          r->pos = pos + r->size - off;
+          continue;
+        }
+
+      rec = (const shmring_record_t*)(r->data + off);
+      rec_pos = rec->pos;
+      len = rec->len;
+      seq = rec->seq;
+
+      /* The header is only valid if the producer was not writing over it. */
+      atomic_thread_fence(memory_order_acquire);
+      if(atomic_load_explicit(&r->hdr->tail, memory_order_relaxed) > pos || rec_pos != pos)
+        {
+          shmring_lapped(r);
+          continue;
+        }
+
+      if(len == SHMRING_PAD)
+        {
+          r->pos = pos + r->size - off;
+          continue;
+        }
+
+      if(r->seq != (uint64_t)-1 && seq != r->seq) { r->lost_records += seq - r->seq; }
+      r->seq = seq;
+      return rec;
+    }
+}
+
+
+/* Move past rec, returned by shmring_peek(). Returns 0, or -1 when it was
+   overwritten while in use. */
+static inline int shmring_next(shmring_reader_t* r, const shmring_record_t* rec)
+{
+  uint32_t len = rec->len;
+
+  atomic_thread_fence(memory_order_acquire);
+  if(atomic_load_explicit(&r->hdr->tail, memory_order_relaxed) > r->pos)
+    {
+      shmring_lapped(r);
+      return -1;
+    }
+
+  r->pos += shmring_record_size(len);
+  r->seq++;
+  return 0;
+}
+
+#endif
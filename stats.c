@@ -0,0 +1,213 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#if defined(__linux__)
+#include <linux/serial.h>
+#endif
+
+#include "ttylog.h"
+#include "port.h"
+#include "stats.h"
+
+
+static port_t* stats_ports;
+static int stats_nports;
+static const char* stats_path;
+static long stats_interval;
+static pthread_t stats_thread;
+static int stats_running = 0;
+static _Atomic int stats_stopping;
+
+
+static void stats_print_port(FILE* f, port_t* port)
+{
+  port_stats_t* st = &port->stats;
+  uint64_t reads = atomic_load_explicit(&st->reads, memory_order_relaxed);
+  uint64_t bytes = atomic_load_explicit(&st->bytes_in, memory_order_relaxed);
+  int i;
+
+  fprintf(f, "port=%d device=%s bytes_in=%" PRIu64 " reads=%" PRIu64 " read_size=%zu read_avg=%.1f read_max=%" PRIu64 " dropped=%" PRIu64 " triggers=%" PRIu64,
+          port->id, port->cfg.device, bytes, reads, port->read_size, reads ? (double)bytes / reads : 0.0,
+          atomic_load_explicit(&st->read_max, memory_order_relaxed),
+          atomic_load_explicit(&st->dropped, memory_order_relaxed),
+          atomic_load_explicit(&st->triggers, memory_order_relaxed));
+
+  fprintf(f, " read_hist=");
+  for(i = 0; i < STATS_HIST_BUCKETS; i++)
+    {
+      fprintf(f, "%s%d:%" PRIu64, i ? "," : "", 1 << i, atomic_load_explicit(&st->read_hist[i], memory_order_relaxed));
+    }
+
+  /* The UART counts line errors even though IGNPAR and IGNBRK drop the
+     affected characters. Not every driver keeps them. The reader thread
+     closes and reopens the device, the lock keeps the fd from changing
+     under the ioctl. */
+#if defined(TIOCGICOUNT)
+  {
+    struct serial_icounter_struct ic;
+    int ok;
+
+    pthread_mutex_lock(&port->fd_lock);
+    ok = port->serial_port && port->fd >= 0 && ioctl(port->fd, TIOCGICOUNT, &ic) == 0;
+    pthread_mutex_unlock(&port->fd_lock);
+    if(ok)
+      {
+        fprintf(f, " rx=%d overrun=%d frame=%d parity=%d brk=%d buf_overrun=%d",
+                ic.rx, ic.overrun, ic.frame, ic.parity, ic.brk, ic.buf_overrun);
+      }
+  }
+#endif
+
+  fprintf(f, "\n");
+}
+
+
+static void stats_print_output(FILE* f, output_t* out)
+{
+  fprintf(f, "output=%s bytes_out=%" PRIu64 " flushes=%" PRIu64 " stall_ms=%.3f stall_max_ms=%.3f\n",
+          out->path ? out->path : "stdout",
+          atomic_load_explicit(&out->bytes_out, memory_order_relaxed),
+          atomic_load_explicit(&out->flushes, memory_order_relaxed),
+          atomic_load_explicit(&out->stall_ns, memory_order_relaxed) / 1e6,
+          atomic_load_explicit(&out->stall_max_ns, memory_order_relaxed) / 1e6);
+}
+
+
+/* One record per line, the type and its name first and then key=value
+   pairs, counters are totals since the start. */
+static void stats_print(FILE* f)
+{
+  struct timespec real, mono;
+  int i, j;
+
+  clock_gettime(CLOCK_REALTIME, &real);
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  fprintf(f, "time=%lld.%06ld uptime=%.3f\n", (long long)real.tv_sec, real.tv_nsec / 1000,
+          (mono.tv_sec - startup_timestamp.tv_sec) + (mono.tv_nsec - startup_timestamp.tv_nsec) * 1e-9);
+
+  for(i = 0; i < stats_nports; i++) { stats_print_port(f, &stats_ports[i]); }
+
+  for(i = 0; i < stats_nports; i++)
+    {
+      output_t* out = stats_ports[i].out;
+
+      for(j = 0; j < i && stats_ports[j].out != out; j++) {}
+      if(j == i) { stats_print_output(f, out); }
+    }
+}
+
+
+/* Replace the stats file, readers never see a partial one. */
+static void stats_write_file(void)
+{
+  char tmp[4096];
+  FILE* f;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+  f = fopen(tmp, "w");
+  if(!f)
+    {
+      fprintf (stderr, "%s: can not write stats file %s\n", progname, tmp);
+      return;
+    }
+  stats_print(f);
+  if(fclose(f) || rename(tmp, stats_path))
+    {
+      fprintf (stderr, "%s: can not write stats file %s\n", progname, stats_path);
+      unlink(tmp);
+    }
+}
+
+
+static void* stats_run(void* arg)
+{
+  sigset_t set;
+  (void)arg;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+
+  while(!atomic_load(&stats_stopping))
+    {
+      struct timespec ts = { stats_path ? stats_interval : 3600, 0 };
+      int sig = sigtimedwait(&set, NULL, &ts);
+
+      if(atomic_load(&stats_stopping)) { break; }
+      if(sig == SIGUSR1)
+        {
+          stats_print(stderr);
+          fflush(stderr);
+        }
+      else if(sig < 0 && errno == EAGAIN && stats_path)
+        {
+          stats_write_file();
+        }
+    }
+
+  if(stats_path) { stats_write_file(); }
+
+  return NULL;
+}
+
+
+void stats_init(void)
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+
+void stats_start(port_t* ports, int nports, const char* path, long interval)
+{
+  stats_ports = ports;
+  stats_nports = nports;
+  stats_path = path;
+  stats_interval = interval > 0 ? interval : STATS_INTERVAL;
+  atomic_init(&stats_stopping, 0);
+
+  if(pthread_create(&stats_thread, NULL, stats_run, NULL))
+    {
+      fprintf (stderr, "%s: can not create stats thread\n", progname);
+      return;
+    }
+  stats_running = 1;
+}
+
+
+void stats_stop(void)
+{
+  if(!stats_running) { return; }
+
+  atomic_store(&stats_stopping, 1);
+  pthread_kill(stats_thread, SIGUSR1);
+  pthread_join(stats_thread, NULL);
+  stats_running = 0;
+}
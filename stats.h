@@ -0,0 +1,78 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_STATS_H_
+#define _TTYLOG_STATS_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Read size histogram buckets, bucket n counts reads of 2^n up to
+   2^(n+1) - 1 bytes, the last one all larger reads, up to PORT_READ_MAX. */
+#define STATS_HIST_BUCKETS 17
+
+/* Default interval of the stats file in seconds. */
+#define STATS_INTERVAL 10
+
+
+/* Counters of a port. Only the threads reading and formatting the port
+   update them, the stats thread reads them at any time. */
+typedef struct
+{
+  _Atomic uint64_t bytes_in;
+  _Atomic uint64_t reads;
+  _Atomic uint64_t read_max;
+  _Atomic uint64_t dropped;    /* Bytes dropped because the ring was full. */
+  _Atomic uint64_t triggers;   /* Chunks with a trigger pattern match. */
+  _Atomic uint64_t read_hist[STATS_HIST_BUCKETS];
+} port_stats_t;
+
+
+struct port_s;
+
+
+/* Account a read of len bytes. */
+static inline void stats_read(port_stats_t* st, size_t len)
+{
+  int bucket = 0;
+
+  while(bucket < STATS_HIST_BUCKETS - 1 && (len >> (bucket + 1))) { bucket++; }
+
+  atomic_fetch_add_explicit(&st->bytes_in, len, memory_order_relaxed);
+  atomic_fetch_add_explicit(&st->reads, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&st->read_hist[bucket], 1, memory_order_relaxed);
+  if(len > atomic_load_explicit(&st->read_max, memory_order_relaxed))
+    {
+      atomic_store_explicit(&st->read_max, len, memory_order_relaxed);
+    }
+}
+
+
+/* Block SIGUSR1, before any thread is created so all of them inherit it
+   and only the stats thread takes the signal. */
+void stats_init(void);
+
+/* Start the stats thread for the opened ports. It prints the stats to
+   stderr on SIGUSR1 and, when path is not NULL, replaces the file at path
+   with them every interval seconds. */
+void stats_start(struct port_s* ports, int nports, const char* path, long interval);
+
+/* Write the stats file a last time and stop the stats thread. */
+void stats_stop(void);
+
+#endif
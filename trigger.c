@@ -0,0 +1,274 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trigger.h"
+
+
+static int hex_digit(char c)
+{
+  if(c >= '0' && c <= '9') { return c - '0'; }
+  if(c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+  if(c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+  return -1;
+}
+
+
+int trigger_parse_pattern(const char* str, char* out)
+{
+  char* p = out;
+
+  while(*str)
+    {
+      int hi, lo;
+
+      if(*str != '\\')
+        {
+          *p++ = *str++;
+          continue;
+        }
+
+      str++;
+      switch(*str)
+        {
+        case '\\': *p++ = '\\'; break;
+        case 'n': *p++ = '\n'; break;
+        case 'r': *p++ = '\r'; break;
+        case 't': *p++ = '\t'; break;
+        case 'x':
+          hi = hex_digit(str[1]);
+          lo = hi < 0 ? -1 : hex_digit(str[2]);
+          if(lo < 0) { return -1; }
+          *p++ = hi << 4 | lo;
+          str += 2;
+          break;
+        default:
+          return -1;
+        }
+      str++;
+    }
+
+  return p > out ? p - out : -1;
+}
+
+
+trigger_t* trigger_create(const char* const* patterns, const size_t* lens, int n)
+{
+  trigger_t* t = calloc(1, sizeof(*t));
+  int32_t* fail = NULL;
+  int32_t* queue = NULL;
+  size_t max_states = 1;
+  int head = 0, tail = 0;
+  int i, c;
+
+  for(i = 0; i < n; i++) { max_states += lens[i]; }
+
+  if(t)
+    {
+      t->next = malloc(max_states * 256 * sizeof(*t->next));
+      t->match = calloc(max_states, 1);
+      fail = calloc(max_states, sizeof(*fail));
+      queue = malloc(max_states * sizeof(*queue));
+    }
+  if(!t || !t->next || !t->match || !fail || !queue)
+    {
+      free(fail);
+      free(queue);
+      trigger_free(t);
+      return NULL;
+    }
+
+  /* Trie of the patterns, -1 for no edge. */
+  memset(t->next, 0xff, max_states * 256 * sizeof(*t->next));
+  t->nstates = 1;
+  for(i = 0; i < n; i++)
+    {
+      const unsigned char* p = (const unsigned char*)patterns[i];
+      int32_t s = 0;
+      size_t k;
+
+      for(k = 0; k < lens[i]; k++)
+        {
+          int32_t* edge = &t->next[(size_t)s * 256 + p[k]];
+          if(*edge < 0) { *edge = t->nstates++; }
+          s = *edge;
+        }
+      t->match[s] = 1;
+    }
+
+  /* Breadth first, so the row of the failure state of every state is
+     complete when the state is reached. Missing edges become the edge of
+     the failure state, which turns the trie into a full automaton. */
+  queue[tail++] = 0;
+  while(head < tail)
+    {
+      int32_t r = queue[head++];
+
+      for(c = 0; c < 256; c++)
+        {
+          int32_t* edge = &t->next[(size_t)r * 256 + c];
+          int32_t f = r ? t->next[(size_t)fail[r] * 256 + c] : 0;
+
+          if(*edge < 0)
+            {
+              *edge = f;
+              continue;
+            }
+          fail[*edge] = f;
+          t->match[*edge] |= t->match[f];
+          queue[tail++] = *edge;
+        }
+    }
+
+  free(fail);
+  free(queue);
+  return t;
+}
+
+
+void trigger_free(trigger_t* t)
+{
+  if(!t) { return; }
+  free(t->next);
+  free(t->match);
+  free(t);
+}
+
+
+static int64_t ts_to_ns(const struct timespec* ts)
+{
+  return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+
+int trigger_port_init(trigger_port_t* tp, const trigger_t* matcher, const trigger_window_t* window)
+{
+  size_t size = TRIGGER_HISTORY_SIZE;
+
+  memset(tp, 0, sizeof(*tp));
+  tp->matcher = matcher;
+  tp->window = *window;
+
+  /* Room for the chunk headers and the wrap around. */
+  if(!window->pre_ns) { size = 2 * window->pre_bytes + 65536; }
+  if(window->pre_ns || window->pre_bytes)
+    {
+      tp->history = ring_create(size);
+      if(!tp->history) { return -1; }
+    }
+
+  return 0;
+}
+
+
+void trigger_port_free(trigger_port_t* tp)
+{
+  if(tp->history) { ring_free(tp->history); }
+  tp->history = NULL;
+}
+
+
+void trigger_port_release(trigger_port_t* tp, ring_chunk_t* chunk)
+{
+  tp->held -= chunk->len;
+  ring_release(tp->history, chunk);
+}
+
+
+ring_chunk_t* trigger_port_replay(trigger_port_t* tp)
+{
+  return tp->history ? ring_peek(tp->history) : NULL;
+}
+
+
+/* Keep a chunk in the history, dropping the oldest ones that left the
+   pre-trigger window or do not leave room for it. */
+static void trigger_port_keep(trigger_port_t* tp, const char* data, size_t len, const rx_time_t* rx_time, uint32_t flags)
+{
+  ring_t* h = tp->history;
+  ring_chunk_t* chunk;
+  unsigned char* p;
+
+  if(!h) { return; }
+
+  if(tp->window.pre_ns)
+    {
+      int64_t oldest = ts_to_ns(&rx_time->mono) - tp->window.pre_ns;
+
+      while((chunk = ring_peek(h)) && ts_to_ns(&chunk->rx_time.mono) < oldest) { trigger_port_release(tp, chunk); }
+    }
+  else
+    {
+      if(len > tp->window.pre_bytes)
+        {
+          data += len - tp->window.pre_bytes;
+          len = tp->window.pre_bytes;
+        }
+      while(tp->held + len > tp->window.pre_bytes && (chunk = ring_peek(h))) { trigger_port_release(tp, chunk); }
+    }
+
+  while(!(p = ring_reserve(h, len)))
+    {
+      if(!(chunk = ring_peek(h))) { return; }
+      trigger_port_release(tp, chunk);
+    }
+
+  memcpy(p, data, len);
+  ring_commit(h, len, flags, rx_time);
+  tp->held += len;
+}
+
+
+int trigger_port_feed(trigger_port_t* tp, const char* data, size_t len, const rx_time_t* rx_time, uint32_t flags)
+{
+  const unsigned char* p = (const unsigned char*)data;
+  size_t left = len;
+  int matched = 0;
+  long k;
+
+  /* The whole chunk is scanned, so the automaton state is right for the
+     next one and a match in the post-trigger window extends it. */
+  while((k = trigger_scan(tp->matcher, &tp->state, p, left)) >= 0)
+    {
+      matched = 1;
+      p += k;
+      left -= k;
+    }
+
+  if(matched)
+    {
+      tp->active = 1;
+      tp->post_until_ns = ts_to_ns(&rx_time->mono) + tp->window.post_ns;
+      tp->post_left = tp->window.post_bytes;
+      return 2;
+    }
+
+  if(tp->active)
+    {
+      if(tp->window.post_ns ? ts_to_ns(&rx_time->mono) <= tp->post_until_ns : tp->post_left > 0)
+        {
+          tp->post_left -= len < tp->post_left ? len : tp->post_left;
+          return 1;
+        }
+      tp->active = 0;
+    }
+
+  trigger_port_keep(tp, data, len, rx_time, flags);
+  return 0;
+}
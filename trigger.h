@@ -0,0 +1,114 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_TRIGGER_H_
+#define _TTYLOG_TRIGGER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ttylog.h"
+#include "ring.h"
+
+
+/* History size of a port when the pre-trigger window is a time. */
+#define TRIGGER_HISTORY_SIZE (4 * 1024 * 1024)
+
+
+/* Multi-pattern matcher, an Aho-Corasick automaton compiled to a full
+   transition table, so the scan costs one table lookup per byte however
+   many patterns there are. Patterns are binary, the automaton is read
+   only once built and shared by all ports. */
+typedef struct
+{
+  int32_t* next;           /* nstates * 256 transitions. */
+  uint8_t* match;          /* Nonzero for states where a pattern ends. */
+  int nstates;
+} trigger_t;
+
+
+/* Trigger windows. Sizes are bytes, times nanoseconds, 0 when not used. */
+typedef struct
+{
+  size_t pre_bytes;
+  int64_t pre_ns;
+  size_t post_bytes;
+  int64_t post_ns;
+} trigger_window_t;
+
+
+/* Per port trigger state, only used by the thread formatting the port.
+   Until a pattern matches the received chunks are kept in the history,
+   the oldest dropped as they leave the pre-trigger window. On a match the
+   history and the post-trigger window are output. */
+typedef struct
+{
+  const trigger_t* matcher;  /* NULL when the port has no triggers. */
+  trigger_window_t window;
+  int state;                 /* Automaton state after the last byte. */
+  ring_t* history;           /* Chunks of the pre-trigger window. */
+  size_t held;               /* Payload bytes in history. */
+  int active;                /* In the post-trigger window. */
+  int64_t post_until_ns;     /* End of the post-trigger window, CLOCK_MONOTONIC. */
+  size_t post_left;          /* Bytes left in the post-trigger window. */
+} trigger_port_t;
+
+
+/* Decode pattern str with C style escapes (\\, \n, \r, \t, \xHH) into out
+   of size at least strlen(str). Returns the length or -1 when invalid. */
+int trigger_parse_pattern(const char* str, char* out);
+
+/* Build the matcher of n patterns. Returns NULL when out of memory. */
+trigger_t* trigger_create(const char* const* patterns, const size_t* lens, int n);
+void trigger_free(trigger_t* t);
+
+/* Scan len bytes from state. Returns the offset after the first match and
+   leaves state there, or returns -1 with state after the last byte. */
+static inline long trigger_scan(const trigger_t* t, int* state, const unsigned char* data, size_t len)
+{
+  int s = *state;
+  size_t i;
+
+  for(i = 0; i < len; i++)
+    {
+      s = t->next[(size_t)s * 256 + data[i]];
+      if(t->match[s])
+        {
+          *state = s;
+          return i + 1;
+        }
+    }
+
+  *state = s;
+  return -1;
+}
+
+/* Set up the state of a port. Returns 0 on success. */
+int trigger_port_init(trigger_port_t* tp, const trigger_t* matcher, const trigger_window_t* window);
+void trigger_port_free(trigger_port_t* tp);
+
+/* Scan a chunk received at rx_time. Returns 2 when a pattern matched in
+   it and 1 when it is in the post-trigger window, the caller then outputs
+   the history, see trigger_port_replay(), and the chunk. Otherwise the
+   chunk is added to the history and 0 is returned. */
+int trigger_port_feed(trigger_port_t* tp, const char* data, size_t len, const rx_time_t* rx_time, uint32_t flags);
+
+/* Oldest chunk of the history, NULL when empty. Release it with
+   trigger_port_release() once output. */
+ring_chunk_t* trigger_port_replay(trigger_port_t* tp);
+void trigger_port_release(trigger_port_t* tp, ring_chunk_t* chunk);
+
+#endif
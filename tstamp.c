@@ -0,0 +1,217 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "tstamp.h"
+
+
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+
+/* Write v as exactly width decimal digits, zero padded, into p. */
+static void put_digits(char* p, uint64_t v, int width)
+{
+  p += width;
+  while(width >= 2)
+    {
+      unsigned d = v % 100;
+      v /= 100;
+      p -= 2;
+      p[0] = digit_pairs[2 * d];
+      p[1] = digit_pairs[2 * d + 1];
+      width -= 2;
+    }
+  if(width) { *--p = '0' + v % 10; }
+}
+
+
+/* Write v as groups of three digits separated by dots, like 000.000.136.
+   Returns length. */
+static size_t put_dotted(char* p, uint64_t v, int groups)
+{
+  char* start = p;
+  int i;
+
+  for(i = groups - 1; i >= 0; i--)
+    {
+      put_digits(p + 4 * i, v % 1000, 3);
+      if(i) { p[4 * i - 1] = '.'; }
+      v /= 1000;
+    }
+  p += 4 * groups - 1;
+  *p = 0;
+
+  return p - start;
+}
+
+
+/* Write decimal number without padding, returns length. */
+static size_t put_number(char* p, uint64_t v)
+{
+  char tmp[24];
+  size_t n = 0;
+
+  do
+    {
+      tmp[n++] = '0' + v % 10;
+      v /= 10;
+    }
+  while(v);
+
+  for(size_t i = 0; i < n; i++) { p[i] = tmp[n - 1 - i]; }
+  return n;
+}
+
+
+/* Render date and time of the minute starting at tm, seconds are filled in
+   later at ts->sec_off. */
+static void render_minute(tstamp_t* ts, const struct tm* tm)
+{
+  static const char wday_name[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+  static const char mon_name[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  char* p = ts->buff;
+
+  if(ts->fmt == FMT_OLD)
+    {
+      /* Same layout as asctime(): "Mon Oct 20 21:13:53 2025" */
+      memcpy(p, wday_name[tm->tm_wday], 3);
+      p[3] = ' ';
+      memcpy(p + 4, mon_name[tm->tm_mon], 3);
+      p[7] = ' ';
+      if(tm->tm_mday < 10)
+        {
+          p[8] = ' ';
+          p[9] = '0' + tm->tm_mday;
+        }
+      else
+        {
+          put_digits(p + 8, tm->tm_mday, 2);
+        }
+      p[10] = ' ';
+      put_digits(p + 11, tm->tm_hour, 2);
+      p[13] = ':';
+      put_digits(p + 14, tm->tm_min, 2);
+      p[16] = ':';
+      ts->sec_off = 17;
+      p[19] = ' ';
+      ts->len = 20 + put_number(p + 20, tm->tm_year + 1900);
+    }
+  else
+    {
+      /* YYYY-MM-DDTHH:MM:SS.sss */
+      put_digits(p, tm->tm_year + 1900, 4);
+      p[4] = '-';
+      put_digits(p + 5, tm->tm_mon + 1, 2);
+      p[7] = '-';
+      put_digits(p + 8, tm->tm_mday, 2);
+      p[10] = 'T';
+      put_digits(p + 11, tm->tm_hour, 2);
+      p[13] = ':';
+      put_digits(p + 14, tm->tm_min, 2);
+      p[16] = ':';
+      ts->sec_off = 17;
+      p[19] = '.';
+      ts->len = 23;
+    }
+  ts->buff[ts->len] = 0;
+}
+
+
+void tstamp_init(tstamp_t* ts, int fmt, const struct timespec* start)
+{
+  memset(ts, 0, sizeof(*ts));
+  ts->fmt = fmt;
+  ts->start = *start;
+  ts->sec = -1;
+  ts->minute_start = -1;
+}
+
+
+/* Update the wall clock part of buff for second sec. */
+static void update_second(tstamp_t* ts, time_t sec)
+{
+  if(ts->minute_start < 0 || sec < ts->minute_start || sec >= ts->minute_start + 60)
+    {
+      struct tm tm;
+      localtime_r(&sec, &tm);
+      ts->minute_start = sec - tm.tm_sec;
+      render_minute(ts, &tm);
+    }
+
+  put_digits(ts->buff + ts->sec_off, sec - ts->minute_start, 2);
+  ts->sec = sec;
+}
+
+
+const char* tstamp_format(tstamp_t* ts, const rx_time_t* rx_time, size_t* len)
+{
+  if(ts->fmt == FMT_OLD || ts->fmt == FMT_ISO)
+    {
+      if(rx_time->real.tv_sec != ts->sec) { update_second(ts, rx_time->real.tv_sec); }
+      if(ts->fmt == FMT_ISO) { put_digits(ts->buff + 20, rx_time->real.tv_nsec / 1000000, 3); }
+    }
+  else if(ts->fmt == FMT_EPOCH)
+    {
+      /* sssssssssss.nnnnnnnnn */
+      if(rx_time->real.tv_sec != ts->sec)
+        {
+          ts->sec = rx_time->real.tv_sec;
+          ts->sec_off = put_number(ts->buff, ts->sec);
+          ts->buff[ts->sec_off] = '.';
+          ts->len = ts->sec_off + 10;
+          ts->buff[ts->len] = 0;
+        }
+      put_digits(ts->buff + ts->sec_off + 1, rx_time->real.tv_nsec, 9);
+    }
+  else
+    {
+      /* Relative time from ts->start in ns. */
+      uint64_t ns = (uint64_t)(rx_time->mono.tv_sec - ts->start.tv_sec) * 1000000000ULL
+                    + rx_time->mono.tv_nsec - ts->start.tv_nsec;
+
+      if(ts->fmt == FMT_MS) { ts->len = put_dotted(ts->buff, ns / 1000000, 3); }       /* 9 decimal digits. */
+      else if(ts->fmt == FMT_US) { ts->len = put_dotted(ts->buff, ns / 1000, 4); }     /* 12 decimal digits. */
+      else { ts->len = put_dotted(ts->buff, ns, 5); }                                   /* 15 decimal digits. */
+    }
+
+  if(len) { *len = ts->len; }
+  return ts->buff;
+}
+
+
+int tstamp_parse(const char* name)
+{
+  if (!strcmp(name, "old")) { return FMT_OLD; }
+  if (!strcmp(name, "iso")) { return FMT_ISO; }
+  if (!strcmp(name, "ms")) { return FMT_MS; }
+  if (!strcmp(name, "us")) { return FMT_US; }
+  if (!strcmp(name, "ns")) { return FMT_NS; }
+  if (!strcmp(name, "epoch")) { return FMT_EPOCH; }
+  return 0;
+}
@@ -0,0 +1,58 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_TSTAMP_H_
+#define _TTYLOG_TSTAMP_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#include "ttylog.h"
+
+
+/* Longest timestamp produced by tstamp_format(), without terminator. */
+#define TSTAMP_MAX 32
+
+
+/* Timestamp formatter. Wall clock formats keep the rendered date and time
+   of the current minute, so only the seconds and sub-second digits are
+   rendered for every timestamp and the time zone conversion is done once
+   per minute (time zone and DST changes happen on minute boundaries).
+   Each formatter belongs to one thread, there is no shared state. */
+typedef struct tstamp_s
+{
+  int fmt;
+  struct timespec start;    /* Base of the relative formats. */
+  time_t minute_start;      /* First second of the cached minute. */
+  time_t sec;               /* Second rendered into buff, -1 for none. */
+  size_t sec_off;           /* Offset of the seconds digits in buff. */
+  size_t len;
+  char buff[TSTAMP_MAX + 1];
+} tstamp_t;
+
+
+/* Initialize formatter for timestamp format fmt (FMT_OLD ... FMT_EPOCH),
+   relative formats count from start. */
+void tstamp_init(tstamp_t* ts, int fmt, const struct timespec* start);
+
+/* Format rx_time. Returns NUL terminated string owned by ts, valid until
+   the next call. Length is stored in len if not NULL. */
+const char* tstamp_format(tstamp_t* ts, const rx_time_t* rx_time, size_t* len);
+
+/* Parse timestamp format name. Returns format or 0 if not known. */
+int tstamp_parse(const char* name);
+
+#endif
@@ -0,0 +1,662 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/* ttylog-dump - render binary ttylog captures (-F bin) as text. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "ttylog.h"
+#include "output.h"
+#include "binfmt.h"
+#include "tstamp.h"
+#include "recorder.h"
+#include "compress.h"
+#include "reformat.h"
+#include "port.h"
+
+
+const char* progname = "ttylog-dump";
+
+#ifdef DEBUG
+FILE* debug_file;
+#endif // DEBUG
+
+
+/* Rendering state of one captured port. */
+typedef struct
+{
+  print_data_ctx_t print_ctx;
+  tstamp_t tstamp;
+  int known;
+  char label[PRINT_LABEL_MAX + 1];   /* Device name without directory, empty until known. */
+} dump_port_t;
+
+
+static int output_fmt = FMT_ACSII;
+static int stamp = 0;
+static int line_len_limit = 1023;
+static int only_port = -1;
+static int verbose = 0;
+static int recover = 0;
+static int raw_input = 0;
+static int labels = 0;
+static int jobs = 0;
+static int64_t since_ns = 0;          /* Time window, CLOCK_REALTIME. */
+static int64_t until_ns = INT64_MAX;
+static output_t* out;
+
+static dump_port_t* ports = NULL;
+static int nports = 0;
+static struct timespec start_mono;
+
+
+static dump_port_t* get_port(int id)
+{
+  if(id >= nports)
+    {
+      /* The output remembers the labeled port that printed last. */
+      ptrdiff_t last = out->line_ctx ? (char*)out->line_ctx - (char*)ports : -1;
+      dump_port_t* p = realloc(ports, (id + 1) * sizeof(*ports));
+      int i;
+
+      if(!p)
+        {
+          fprintf (stderr, "%s: out of memory\n", progname);
+          exit (1);
+        }
+      memset(p + nports, 0, (id + 1 - nports) * sizeof(*ports));
+      ports = p;
+      nports = id + 1;
+      if(last >= 0) { out->line_ctx = (print_data_ctx_t*)((char*)ports + last); }
+      for(i = 0; i < nports; i++)
+        {
+          if(ports[i].print_ctx.label) { ports[i].print_ctx.label = ports[i].label; }
+        }
+    }
+
+  if(!ports[id].known)
+    {
+      print_ctx_init(&ports[id].print_ctx, output_fmt, line_len_limit, out);
+      tstamp_init(&ports[id].tstamp, stamp ? stamp : FMT_OLD, &start_mono);
+      if(labels && ports[id].label[0]) { ports[id].print_ctx.label = ports[id].label; }
+      ports[id].known = 1;
+    }
+
+  return &ports[id];
+}
+
+
+static void ns_to_ts(uint64_t ns, struct timespec* ts)
+{
+  ts->tv_sec = ns / 1000000000ULL;
+  ts->tv_nsec = ns % 1000000000ULL;
+}
+
+
+/* Render one data record the way ttylog would have printed it live. */
+static void dump_data(dump_port_t* port, const char* data, size_t len, const rx_time_t* rx_time, int flags)
+{
+  if(flags & BIN_FLAG_FRAME)
+    {
+      print_frame(data, len, &port->print_ctx, stamp ? tstamp_format(&port->tstamp, rx_time, NULL) : NULL);
+      return;
+    }
+  print_data_stamped(data, len, &port->print_ctx, stamp ? &port->tstamp : NULL, rx_time);
+}
+
+
+static int dump_file(FILE* f, const char* name)
+{
+  char head[sizeof(bin_header_t)];
+  char* payload = NULL;
+  size_t payload_size = 0;
+  int have_header = 0;
+
+  for(;;)
+    {
+      bin_record_t rec;
+      size_t n = fread(head, 1, sizeof(bin_record_t), f);
+
+      if(n == 0) { break; }
+      if(n < sizeof(bin_record_t))
+        {
+          fprintf (stderr, "%s: truncated record in %s\n", progname, name);
+          break;
+        }
+
+      /* File header, at the start or where captures were concatenated. */
+      if(!memcmp(head, BIN_MAGIC, BIN_MAGIC_LEN))
+        {
+          bin_header_t header;
+
+          if(fread(head + sizeof(bin_record_t), 1, sizeof(head) - sizeof(bin_record_t), f) != sizeof(head) - sizeof(bin_record_t)
+             || bin_read_header(head, &header))
+            {
+              fprintf (stderr, "%s: invalid file header in %s\n", progname, name);
+              break;
+            }
+          /* Skip header extensions of later versions. */
+          if(header.header_len > sizeof(header)) { fseek(f, header.header_len - sizeof(header), SEEK_CUR); }
+
+          ns_to_ts(header.start_mono_ns, &start_mono);
+          for(int i = 0; i < nports; i++) { ports[i].known = 0; }
+          have_header = 1;
+          continue;
+        }
+
+      if(!have_header)
+        {
+          fprintf (stderr, "%s: %s is not a ttylog binary capture\n", progname, name);
+          break;
+        }
+
+      bin_read_record(head, &rec);
+      if(rec.len > payload_size)
+        {
+          char* p = realloc(payload, rec.len);
+          if(!p)
+            {
+              fprintf (stderr, "%s: out of memory\n", progname);
+              break;
+            }
+          payload = p;
+          payload_size = rec.len;
+        }
+      if(fread(payload, 1, rec.len, f) != rec.len)
+        {
+          fprintf (stderr, "%s: truncated record in %s\n", progname, name);
+          break;
+        }
+
+      if(only_port >= 0 && rec.port != only_port) { continue; }
+
+      if(rec.type == BIN_REC_DATA && rec.len
+         && (int64_t)rec.real_ns >= since_ns && (int64_t)rec.real_ns < until_ns)
+        {
+          rx_time_t rx_time;
+          const char* data = payload;
+          size_t len = rec.len;
+
+          ns_to_ts(rec.mono_ns, &rx_time.mono);
+          ns_to_ts(rec.real_ns, &rx_time.real);
+          rx_time.span_ns = 0;
+          rx_time.byte_ns = 0;
+          if(rec.flags & BIN_FLAG_BYTE_TIMES)
+            {
+              if(len < sizeof(bin_times_t)) { continue; }
+              bin_read_times(data, &rx_time);
+              data += sizeof(bin_times_t);
+              len -= sizeof(bin_times_t);
+            }
+          output_lock(out);
+          dump_data(get_port(rec.port), data, len, &rx_time, rec.flags);
+          output_unlock(out);
+        }
+      else if(rec.type == BIN_REC_GAP && rec.len >= sizeof(bin_gap_t)
+              && (int64_t)rec.real_ns >= since_ns && (int64_t)rec.real_ns < until_ns)
+        {
+          dump_port_t* port = get_port(rec.port);
+          rx_time_t rx_time;
+          bin_gap_t gap;
+
+          bin_read_gap(payload, &gap);
+          ns_to_ts(rec.mono_ns, &rx_time.mono);
+          ns_to_ts(rec.real_ns, &rx_time.real);
+          rx_time.span_ns = 0;
+          rx_time.byte_ns = 0;
+          output_lock(out);
+          print_gap(&port->print_ctx, gap.gap_ns, stamp ? tstamp_format(&port->tstamp, &rx_time, NULL) : NULL);
+          output_unlock(out);
+        }
+      else if(rec.type == BIN_REC_PORT && rec.len >= sizeof(bin_port_t))
+        {
+          dump_port_t* port;
+          bin_port_t s;
+
+          bin_read_port(payload, &s);
+          if(verbose)
+            {
+              fprintf (stderr, "%s: port %d: %.*s %u %u%c%u\n", progname, rec.port,
+                       (int)(rec.len - sizeof(s)), payload + sizeof(s), s.baud, s.data_bits, s.parity, s.stop_bits);
+            }
+          port = get_port(rec.port);
+          if(labels)
+            {
+              const char* name = payload + sizeof(s);
+              int len = rec.len - sizeof(s);
+              const char* slash = memrchr(name, '/', len);
+
+              if(slash)
+                {
+                  len -= slash + 1 - name;
+                  name = slash + 1;
+                }
+              if(len > PRINT_LABEL_MAX) { len = PRINT_LABEL_MAX; }
+              memcpy(port->label, name, len);
+              port->label[len] = 0;
+              port->print_ctx.label = port->label;
+            }
+        }
+    }
+
+  free(payload);
+  return 0;
+}
+
+
+/* Render data that is a bin capture, or copy it to the output. */
+static void dump_buffer(char* data, size_t len, size_t skip, const char* name)
+{
+  if(len >= BIN_MAGIC_LEN && !memcmp(data, BIN_MAGIC, BIN_MAGIC_LEN))
+    {
+      FILE* f = fmemopen(data, len, "rb");
+      if(f)
+        {
+          dump_file(f, name);
+          fclose(f);
+        }
+    }
+  else if(len > skip)
+    {
+      output_lock(out);
+      memcpy(output_reserve(out, len - skip), data + skip, len - skip);
+      output_commit(out, len - skip);
+      output_unlock(out);
+    }
+}
+
+
+/* Print the frames of compressed file name that overlap the time window,
+   found with its index. Returns -1 when name has no index. */
+static int dump_compressed(const char* name)
+{
+  char index_path[4096];
+  comp_index_header_t h;
+  comp_index_t* idx = NULL;
+  comp_index_t e;
+  size_t n = 0, i;
+  FILE* f;
+  int fd;
+
+  snprintf(index_path, sizeof(index_path), "%s.idx", name);
+  f = fopen(index_path, "rb");
+  if(!f) { return -1; }
+
+  if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, COMPRESS_INDEX_MAGIC, COMPRESS_INDEX_MAGIC_LEN)
+     || le32toh(h.entry_len) < sizeof(e))
+    {
+      fprintf (stderr, "%s: invalid index %s\n", progname, index_path);
+      fclose(f);
+      return 0;
+    }
+  while(fread(&e, sizeof(e), 1, f) == 1)
+    {
+      comp_index_t* p = realloc(idx, (n + 1) * sizeof(*idx));
+      if(!p) { break; }
+      idx = p;
+      idx[n++] = e;
+      fseek(f, le32toh(h.entry_len) - sizeof(e), SEEK_CUR);
+    }
+  fclose(f);
+
+  fd = open(name, O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    {
+      fprintf (stderr, "%s: can not open %s\n", progname, name);
+      free(idx);
+      return 0;
+    }
+
+  for(i = 0; i < n; i++)
+    {
+      int64_t first = le64toh(idx[i].first_ns);
+      int64_t next = (i + 1 < n && idx[i + 1].first_ns) ? (int64_t)le64toh(idx[i + 1].first_ns) : INT64_MAX;
+      size_t len = le32toh(idx[i].len);
+      size_t pre = le32toh(idx[i].preamble_len);
+      size_t raw = pre + le32toh(idx[i].raw_len);
+      char* src;
+      char* dst;
+
+      /* A frame holds data from its first time until the next frame's. */
+      if(first && (next <= since_ns || first >= until_ns)) { continue; }
+
+      src = malloc(len);
+      dst = malloc(raw + 1);
+      if(!src || !dst)
+        {
+          fprintf (stderr, "%s: out of memory\n", progname);
+          free(src);
+          free(dst);
+          break;
+        }
+      if(pread(fd, src, len, le64toh(idx[i].offset)) != (ssize_t)len
+         || decompress_buffer(le32toh(idx[i].codec), dst, raw, src, len))
+        {
+          fprintf (stderr, "%s: damaged frame %zu in %s\n", progname, i, name);
+        }
+      else
+        {
+          dump_buffer(dst, raw, pre, name);
+        }
+      free(src);
+      free(dst);
+    }
+
+  close(fd);
+  free(idx);
+  return 0;
+}
+
+
+/* Parse seconds since the epoch or local time YYYY-MM-DD[THH:MM[:SS]]
+   into ns, -1 on error. */
+static int64_t parse_time(const char* str)
+{
+  struct tm tm;
+  char* end;
+  double secs;
+
+  memset(&tm, 0, sizeof(tm));
+  end = strptime(str, "%Y-%m-%d", &tm);
+  if(end)
+    {
+      if(*end == 'T' || *end == ' ')
+        {
+          char* p = strptime(end + 1, "%H:%M:%S", &tm);
+          if(!p) { p = strptime(end + 1, "%H:%M", &tm); }
+          end = p;
+        }
+      if(!end || *end) { return -1; }
+      tm.tm_isdst = -1;
+      return (int64_t)mktime(&tm) * 1000000000LL;
+    }
+
+  secs = strtod(str, &end);
+  if(end == str || *end || secs < 0) { return -1; }
+  return (int64_t)(secs * 1e9);
+}
+
+
+/* Print the contents of a flight recorder. Binary captures are rendered,
+   anything else was formatted by ttylog already and is copied. */
+static void recover_file(const char* name)
+{
+  size_t len;
+  char* data = recorder_recover(name, &len);
+
+  if(!data)
+    {
+      fprintf (stderr, "%s: %s is not a flight recorder\n", progname, name);
+      return;
+    }
+
+  dump_buffer(data, len, 0, name);
+
+  free(data);
+}
+
+
+/* Write a formatted block of a raw capture. */
+static int write_block(void* arg, const char* data, size_t len)
+{
+  output_lock(out);
+  memcpy(output_reserve(out, len), data, len);
+  output_commit(out, len);
+  output_unlock(out);
+  return out->write_error ? -1 : 0;
+}
+
+
+/* Read all of fd, for raw captures that can not be mapped. */
+static char* read_all(int fd, size_t* len)
+{
+  size_t size = 0;
+  char* data = NULL;
+  ssize_t n = 1;
+
+  *len = 0;
+  while(n > 0)
+    {
+      if(*len == size)
+        {
+          char* p = realloc(data, size ? 2 * size : 1024 * 1024);
+          if(!p)
+            {
+              free(data);
+              return NULL;
+            }
+          data = p;
+          size = size ? 2 * size : 1024 * 1024;
+        }
+      n = read(fd, data + *len, size - *len);
+      if(n > 0) { *len += n; }
+    }
+
+  return data;
+}
+
+
+/* Format raw capture name the way ttylog -d name prints it, in parallel,
+   see reformat.h. Every line gets the time the formatting started. */
+static void reformat_file(const char* name)
+{
+  reformat_opts_t opts;
+  tstamp_t ts;
+  rx_time_t now;
+  struct stat st;
+  size_t len = 0;
+  char* data = NULL;
+  int mapped = 0;
+  int fd = strcmp(name, "-") ? open(name, O_RDONLY | O_CLOEXEC) : 0;
+
+  if(fd < 0)
+    {
+      fprintf (stderr, "%s: can not open %s\n", progname, name);
+      return;
+    }
+
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+      data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      mapped = data != MAP_FAILED;
+      len = mapped ? (size_t)st.st_size : 0;
+    }
+  if(!mapped) { data = read_all(fd, &len); }
+  if(fd) { close(fd); }
+  if(!data)
+    {
+      fprintf (stderr, "%s: can not read %s\n", progname, name);
+      return;
+    }
+
+  memset(&opts, 0, sizeof(opts));
+  opts.fmt = output_fmt;
+  opts.line_len_limit = line_len_limit;
+  opts.read_size = PORT_READ_SIZE - 1;
+  opts.jobs = jobs;
+  if(stamp)
+    {
+      rx_time_now(&now);
+      tstamp_init(&ts, stamp, &now.mono);
+      opts.time_stamp = tstamp_format(&ts, &now, NULL);
+    }
+
+  if(reformat(data, len, &opts, write_block, NULL))
+    {
+      fprintf (stderr, "%s: formatting %s failed\n", progname, name);
+    }
+
+  if(mapped) { munmap(data, len); }
+  else { free(data); }
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  flush_policy_t policy = { FLUSH_BYTES, 64 * 1024, 0 };
+  int nfiles = 0;
+  int i;
+
+  progname = argv[0];
+
+  for (i = 1; i < argc; i++)
+    {
+      if (!strcmp (argv[i], "-h") || !strcmp (argv[i], "--help"))
+        {
+          fprintf (stderr, "ttylog-dump version %s\n", TTYLOG_VERSION);
+          fprintf (stderr, "Usage:  ttylog-dump [-F|--format] [-s|--stamp] [-l|--limit] [-p|--port] [-v|--verbose] [-R|--recover] [-L|--labels] [-r|--raw] [-j|--jobs] [--since] [--until] [file ...]\n");
+          fprintf (stderr, " -h, --help     This help\n");
+          fprintf (stderr, " -F, --format   Set output format to one of a[scii] (default), h[ex], H[EX], r[aw].\n");
+          fprintf (stderr, " -s, --stamp    Prefix each line with datestamp (old, iso, ms, us, ns, epoch)\n");
+          fprintf (stderr, " -l, --limit    Limit line length, 0 for no limit.\n");
+          fprintf (stderr, " -p, --port     Only render the port with this id.\n");
+          fprintf (stderr, " -v, --verbose  Print the settings of the captured ports to stderr.\n");
+          fprintf (stderr, " -R, --recover  Files are flight recorders (--recorder), print what they hold.\n");
+          fprintf (stderr, " -L, --labels   Put the device name of the port on every line.\n");
+          fprintf (stderr, " -r, --raw      Files are raw captures, print them like ttylog -d FILE does.\n");
+          fprintf (stderr, " -j, --jobs     Threads formatting raw captures, default one per CPU.\n");
+          fprintf (stderr, " --since, --until  Only data received in this time window, seconds since the epoch or YYYY-MM-DDTHH:MM:SS.\n");
+          fprintf (stderr, "Reads stdin when no file is given. Compressed files are read through their index file.\n\n");
+          exit (0);
+        }
+      else if ((!strcmp (argv[i], "-F") || !strcmp (argv[i], "--format")) && i + 1 < argc)
+        {
+          int f = argv[++i][0];
+          if(f == 'a') { output_fmt = FMT_ACSII; }
+          else if(f == 'h') { output_fmt = FMT_HEX_LC; }
+          else if(f == 'H') { output_fmt = FMT_HEX_UC; }
+          else if(f == 'r') { output_fmt = FMT_RAW; }
+          else
+            {
+              fprintf (stderr, "%s: invalid output format '%s'\n", argv[0], argv[i]);
+              exit (1);
+            }
+        }
+      else if (!strcmp (argv[i], "-s") || !strcmp (argv[i], "--stamp"))
+        {
+          stamp = FMT_OLD;
+          if (i + 1 < argc && argv[i + 1][0] != '-' && tstamp_parse(argv[i + 1]))
+            {
+              stamp = tstamp_parse(argv[++i]);
+            }
+        }
+      else if ((!strcmp (argv[i], "-l") || !strcmp (argv[i], "--limit")) && i + 1 < argc)
+        {
+          line_len_limit = atoi(argv[++i]);
+          if (line_len_limit < 0 || (line_len_limit == 0 && strcmp(argv[i], "0")))
+            {
+              fprintf (stderr, "%s: invalid line length limit %s\n", argv[0], argv[i]);
+              exit (1);
+            }
+        }
+      else if ((!strcmp (argv[i], "-p") || !strcmp (argv[i], "--port")) && i + 1 < argc)
+        {
+          only_port = atoi(argv[++i]);
+        }
+      else if (!strcmp (argv[i], "-v") || !strcmp (argv[i], "--verbose"))
+        {
+          verbose = 1;
+        }
+      else if (!strcmp (argv[i], "-R") || !strcmp (argv[i], "--recover"))
+        {
+          recover = 1;
+        }
+      else if (!strcmp (argv[i], "-L") || !strcmp (argv[i], "--labels"))
+        {
+          labels = 1;
+        }
+      else if (!strcmp (argv[i], "-r") || !strcmp (argv[i], "--raw"))
+        {
+          raw_input = 1;
+        }
+      else if ((!strcmp (argv[i], "-j") || !strcmp (argv[i], "--jobs")) && i + 1 < argc)
+        {
+          jobs = atoi(argv[++i]);
+          if (jobs < 1)
+            {
+              fprintf (stderr, "%s: invalid number of jobs %s\n", argv[0], argv[i]);
+              exit (1);
+            }
+        }
+      else if ((!strcmp (argv[i], "--since") || !strcmp (argv[i], "--until")) && i + 1 < argc)
+        {
+          int64_t t = parse_time(argv[i + 1]);
+          if (t < 0)
+            {
+              fprintf (stderr, "%s: invalid time %s\n", argv[0], argv[i + 1]);
+              exit (1);
+            }
+          if (argv[i][2] == 's') { since_ns = t; }
+          else { until_ns = t; }
+          i++;
+        }
+      else if (argv[i][0] == '-' && argv[i][1])
+        {
+          fprintf (stderr, "%s: invalid option %s\n", argv[0], argv[i]);
+          exit (1);
+        }
+      else
+        {
+          argv[nfiles++ + 1] = argv[i];
+        }
+    }
+
+  output_set_policy(&policy);
+  out = output_get(NULL);
+  if (!out)
+    {
+      fprintf (stderr, "%s: out of memory\n", argv[0]);
+      exit (1);
+    }
+
+  if (!jobs) { jobs = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1; }
+
+  if (!nfiles && raw_input) { reformat_file("-"); }
+  else if (!nfiles && !recover) { dump_file(stdin, "stdin"); }
+  for (i = 1; i <= nfiles && raw_input; i++) { reformat_file(argv[i]); }
+  for (i = 1; i <= nfiles && recover && !raw_input; i++) { recover_file(argv[i]); }
+  for (i = 1; i <= nfiles && !recover && !raw_input; i++)
+    {
+      FILE* f;
+
+      if (strcmp(argv[i], "-") && dump_compressed(argv[i]) == 0) { continue; }
+
+      f = strcmp(argv[i], "-") ? fopen(argv[i], "rb") : stdin;
+      if (!f)
+        {
+          fprintf (stderr, "%s: can not open %s\n", argv[0], argv[i]);
+          continue;
+        }
+      dump_file(f, argv[i]);
+      if (f != stdin) { fclose(f); }
+    }
+
+  output_close_all();
+  free(ports);
+  return 0;
+}
@@ -34,91 +34,135 @@
 #include <time.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "config.h"
+#include "ttylog.h"
+#include "port.h"
+#include "worker.h"
+#include "output.h"
+#include "stats.h"
+#include "server.h"
+#include "shmring.h"
+#include "tstamp.h"
+#include "dedup.h"
 
-/* #define DEBUG 1 */
 
+const char* progname = "ttylog";
+struct timespec startup_timestamp;
 
-/* Constants for output format. */
-enum
-{
-  FMT_ACSII = 0,  /* Old ttylog ascii output format. */
-  FMT_HEX_LC = 1, /* HEX output using lowercase abcdef characters. */
-  FMT_HEX_UC = 2, /* HEX output using uppercase ABCDEF characters. */
-  FMT_RAW = 3,    /* Raw output format, EOL character is not added by ttylog. */
-};
+#ifdef DEBUG
+FILE* debug_file;
+#endif // DEBUG
 
 
-/* Constants for timestamp format. */
-enum
+/* Parse comma separated list of CPU numbers. Returns number of entries or -1. */
+static int parse_cpu_list(const char* str, int* cpus, int max_cpus)
 {
-  FMT_OLD = 1,  /* Old timestamp format, like Mon Oct 20 21:13:53 2025. */
-  FMT_ISO = 2,  /* ISO8601 timestamp format, YYYY-MM-DDTHH:mm:ss.sss. */
-  FMT_MS = 3,   /* Relative time in milliseconds from program start. */
-  FMT_US = 4,   /* Relative time in microseconds from program start. */
-};
+  int n = 0;
+  char* end;
 
+  while(*str)
+    {
+      long cpu = strtol(str, &end, 10);
+      if(end == str || cpu < 0 || n >= max_cpus) { return -1; }
+      cpus[n++] = (int)cpu;
+      if(*end == ',') { end++; }
+      else if(*end) { return -1; }
+      str = end;
+    }
+
+  return n;
+}
 
-typedef struct
+
+/* Parse size with optional k, M or G suffix. Returns -1 on error. */
+static long long parse_size(const char* str)
 {
-  char* work_buff;
-  int line_len_limit;
-  int line_len;
-} print_data_ctx_t;
+  char* end;
+  long long size = strtoll(str, &end, 10);
 
+  if(end == str || size < 0) { return -1; }
+  if(*end == 'k' || *end == 'K') { size <<= 10; end++; }
+  else if(*end == 'm' || *end == 'M') { size <<= 20; end++; }
+  else if(*end == 'g' || *end == 'G') { size <<= 30; end++; }
+  if(*end) { return -1; }
 
-/* Function that prints line in specified output format. Timestamp is optional.
-   Buffer should be at least 4 times the line length. */
-void print_data(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, const char* time_stamp, int fmt);
+  return size;
+}
 
 
-/* Function to create timestamp according to timestamp format fmt. */
-const char* make_timestamp(int fmt, const struct timespec* start_time);
+/* Trigger window, a time with s or ms suffix or a size. Returns -1 when
+   invalid. */
+static int parse_window(const char* str, size_t* bytes, int64_t* ns)
+{
+  size_t n = strlen(str);
+  char* end;
 
-/* Select baud rate based on user input. */
-int select_baud_rate(const char* baud_str);
+  *bytes = 0;
+  *ns = 0;
+  if(n > 1 && str[n - 1] == 's')
+    {
+      double t = strtod(str, &end);
+      if(end == str || t < 0) { return -1; }
+      if(!strcmp(end, "ms")) { *ns = t * 1000000; }
+      else if(!strcmp(end, "s")) { *ns = t * 1000000000; }
+      else { return -1; }
+      return 0;
+    }
+
+  long long size = parse_size(str);
+  if(size < 0) { return -1; }
+  *bytes = size;
+  return 0;
+}
 
-#ifdef DEBUG
-FILE* debug_file;
-#endif // DEBUG
 
 int
 main (int argc, char *argv[])
 {
-  FILE *logfile;
-  fd_set rfds;
-  int retval;
   int i;
-  speed_t baud = 0;
   int stamp = 0;
-  int fd;
-  char raw_data[1024];
-  char buffer[4 * sizeof(raw_data)];
-  char modem_device[512];
-  struct termios oldtio, newtio;
-  const char* timestr;
-  int output_fmt = FMT_ACSII;
-  const char* baud_str = NULL;
-  int data_bits = 8;  /* 7 or 8 data bits. */
-  int stop_bits = 1;  /* 1 or 2 stop bits. */
-  int parity = 'N';   /* No parity (N), Even (E), Odd (O), Mark (M) or Space (S) */
-  const char* port_mode = "8N1";
-  struct timespec startup_timestamp;
-  int rts = -1;
-  int dtr = -1;
   int timeout = 0;
-  int run_time = 0;
-  print_data_ctx_t print_data_ctx;
-
-  print_data_ctx.work_buff = buffer;
-  print_data_ctx.line_len_limit = sizeof(raw_data) - 1;
-  print_data_ctx.line_len = 0;
+  port_cfg_t defaults;
+  port_t* ports = NULL;
+  int nports = 0;
+  int ports_per_thread = 0;
+  int engine = WORKER_ENGINE_POLL;
+  int cpus[256];
+  int ncpus = 0;
+  long long ring_size = WORKER_RING_SIZE;
+  rotate_policy_t rotate_policy = { 0, 0, 0 };
+  long long recorder_size = 0;
+  int compress_codec = COMPRESS_NONE;
+  int compress_level = -1;
+  long long frame_size = COMPRESS_FRAME_SIZE;
+  const char* stats_path = NULL;
+  long stats_interval = STATS_INTERVAL;
+  int rt_priority = 0;
+  int lock_memory = 0;
+  const char* listen_addr = NULL;
+  int listen_policy = SERVER_DROP;
+  long long listen_queue = SERVER_QUEUE_SIZE;
+  const char* shm_name = NULL;
+  int64_t merge_ns = 0;
+  int verbose = 0;
+  long long shm_size = SHMRING_SIZE;
+  shmring_writer_t* shm = NULL;
+  char** trigger_patterns = NULL;
+  size_t* trigger_lens = NULL;
+  int ntriggers = 0;
+  trigger_window_t trigger_window = { 0, 10000000000LL, 0, 10000000000LL };
+  flush_policy_t flush_policy = { FLUSH_ALWAYS, 0, 0 };
+  worker_t* workers;
+  int nworkers;
+
+  progname = argv[0];
+  port_cfg_init(&defaults);
 
   clock_gettime(CLOCK_MONOTONIC, &startup_timestamp);
 
-  memset (modem_device, '\0', sizeof(modem_device));
-
 #ifdef DEBUG
   debug_file = fopen ("debug-out.txt", "a");
 #endif // DEBUG
@@ -131,21 +175,66 @@ main (int argc, char *argv[])
 
   for (i = 1; i < argc; i++)
     {
+      /* Port options given before the first -d are the defaults for all
+         devices, options given after -d apply to that device only. */
+      port_cfg_t* cfg = nports ? &ports[nports - 1].cfg : &defaults;
+
       if (!strcmp (argv[i], "-h") || !strcmp (argv[i], "--help"))
         {
           fprintf (stderr, "ttylog version %s\n", TTYLOG_VERSION);
-          fprintf (stderr, "Usage:  ttylog [-b|--baud] [-m|--mode] [-d|--device] [-s|--stamp] [-t|--timeout] [-F|--format] [-l|--limit] [--rts] [--dtr] > /path/to/logfile\n");
+          fprintf (stderr, "Usage:  ttylog [-b|--baud] [-m|--mode] [-d|--device] [-o|--output] [-f|--flush] [-s|--stamp] [-t|--timeout] [-F|--format] [-l|--limit] [--rts] [--dtr] [--ports-per-thread] [--cpus] [--ring] [--engine] [--rotate-size] [--rotate-time] [--retain] [--recorder] [--compress] [--compress-level] [--frame-size] [--stats-file] [--stats-interval] [--listen] [--listen-policy] [--listen-queue] [--shm] [--shm-size] [--latency] [--vmin] [--vtime] [--byte-times] [--frame-gap] [--label] [--read-size] [--coalesce] [--reconnect] [--dedup] [--dedup-mask] [--merge] [--trigger] [--trigger-pre] [--trigger-post] [--rt-priority] [--mlock] [--verbose] > /path/to/logfile\n");
           fprintf (stderr, " -h, --help     This help\n");
           fprintf (stderr, " -v, --version  Version number\n");
           fprintf (stderr, " -b, --baud     Baud rate\n");
           fprintf (stderr, " -m, --mode     Serial port mode (default: 8N1)\n");
-          fprintf (stderr, " -d, --device   Serial device (eg. /dev/ttyS1)\n");
-          fprintf (stderr, " -s, --stamp    Prefix each line with datestamp (old, iso, ms, us)\n");
+          fprintf (stderr, " -d, --device   Serial device (eg. /dev/ttyS1), may be repeated\n");
+          fprintf (stderr, " -o, --output   Output file (default: stdout)\n");
+          fprintf (stderr, " -f, --flush    Output flush policy: always (default), line, size (eg. 64k), time (eg. 200ms)\n");
+          fprintf (stderr, " -s, --stamp    Prefix each line with datestamp (old, iso, ms, us, ns, epoch)\n");
           fprintf (stderr, " -t, --timeout  How long to run, in seconds.\n");
-          fprintf (stderr, " -F, --format   Set output format to one of a[scii] (default), h[ex], H[EX], r[aw].\n");
-          fprintf (stderr, " -l, --limit    Limit line length.\n");
+          fprintf (stderr, " -F, --format   Set output format to one of a[scii] (default), h[ex], H[EX], r[aw], b[in].\n");
+          fprintf (stderr, " -l, --limit    Limit line length, 0 for no limit.\n");
           fprintf (stderr, " --rts          Set RTS line state (0 or 1).\n");
           fprintf (stderr, " --dtr          Set DTR line state (0 or 1).\n");
+          fprintf (stderr, " --ports-per-thread  Service every N devices from a separate thread.\n");
+          fprintf (stderr, " --cpus         Pin capture threads to CPUs (eg. 2,3).\n");
+          fprintf (stderr, " --ring         Per device buffer between reader and writer (default: 256k, 0: none).\n");
+          fprintf (stderr, " --engine       I/O engine: poll (default) or uring.\n");
+          fprintf (stderr, " --rotate-size  Start a new output file after SIZE bytes (eg. 100M).\n");
+          fprintf (stderr, " --rotate-time  Start a new output file every INTERVAL (eg. 1h, 30m, 1d).\n");
+          fprintf (stderr, " --retain       Remove oldest output files above SIZE bytes in total.\n");
+          fprintf (stderr, " --recorder     Make output files flight recorders keeping the last SIZE bytes.\n");
+          fprintf (stderr, " --compress     Compress output: gzip, zstd or lz4, as built in.\n");
+          fprintf (stderr, " --compress-level  Compression level of the codec.\n");
+          fprintf (stderr, " --frame-size   Uncompressed size of independent compressed frames (default: 1M).\n");
+          fprintf (stderr, " --stats-file   Write statistics to FILE every stats interval.\n");
+          fprintf (stderr, " --stats-interval  Seconds between stats file updates (default: 10).\n");
+          fprintf (stderr, " --listen       Serve the output to clients at [HOST:]PORT or unix:PATH.\n");
+          fprintf (stderr, " --listen-policy  Slow clients: drop (default), disconnect or block.\n");
+          fprintf (stderr, " --listen-queue Data queued per client at most (default: 1M).\n");
+          fprintf (stderr, " --shm          Publish received data to local consumers in shared memory NAME (eg. /ttylog).\n");
+          fprintf (stderr, " --shm-size     Size of the shared memory ring (default: 16M).\n");
+          fprintf (stderr, " --latency      Driver low latency flag and 1 ms USB latency timer.\n");
+          fprintf (stderr, " --vmin         Termios VMIN, bytes a read waits for (default: 0).\n");
+          fprintf (stderr, " --vtime        Termios VTIME, read timeout in tenths of a second (default: 0).\n");
+          fprintf (stderr, " --byte-times   Estimate the arrival time of every byte from the baud rate.\n");
+          fprintf (stderr, " --frame-gap    Log frames ended by an idle line, in chars (eg. 3.5) or with us/ms suffix.\n");
+          fprintf (stderr, " --label        Put NAME (eg. TX) on every line of the device.\n");
+          fprintf (stderr, " --read-size    Bytes read at once (default: from the baud rate, 4095 for files).\n");
+          fprintf (stderr, " --coalesce     Put off reads until half a read is queued, at most TIME (eg. 2ms), poll engine only.\n");
+          fprintf (stderr, " --reconnect    Wait for a serial device that went away and log it again when it is back.\n");
+          fprintf (stderr, " --dedup        Leave out repeats of the last line (ascii) or runs of a byte (hex), with a summary.\n");
+          fprintf (stderr, " --dedup-mask   Columns (eg. 1-23,40) a repeated line may differ in, implies --dedup.\n");
+          fprintf (stderr, " --merge        Log all devices in receive order, reordered within WINDOW (default: 20ms).\n");
+          fprintf (stderr, " --trigger      Only log around PATTERN (\\n, \\r, \\t, \\xHH escapes), may be repeated.\n");
+          fprintf (stderr, " --trigger-pre  Data logged before a trigger, time with s/ms suffix or size (default: 10s).\n");
+          fprintf (stderr, " --trigger-post Data logged after a trigger, time with s/ms suffix or size (default: 10s).\n");
+          fprintf (stderr, " --rt-priority  Run capture threads with SCHED_FIFO priority N (1-99).\n");
+          fprintf (stderr, " --mlock        Lock all memory to avoid page faults.\n");
+          fprintf (stderr, " --verbose      Print the read size of every device.\n");
+          fprintf (stderr, "Statistics are printed to stderr on SIGUSR1.\n");
+          fprintf (stderr, "With rotation the output file name is a strftime(3) pattern (eg. log-%%Y%%m%%d-%%H%%M%%S.txt).\n");
+          fprintf (stderr, "Options -b, -m, -o, -F, -l, --rts, --dtr, --latency, --vmin, --vtime, --byte-times, --frame-gap, --label, --read-size, --coalesce, --reconnect, --dedup and --dedup-mask given after -d apply to that device only.\n");
           fprintf (stderr, "ttylog home page: <http://ttylog.sourceforge.net/>\n\n");
           exit (0);
         }
@@ -176,11 +265,8 @@ main (int argc, char *argv[])
                 {
                   i++;
 
-                  if (!strcmp(fmt, "old")) { stamp = FMT_OLD; }
-                  else if (!strcmp(fmt, "iso")) { stamp = FMT_ISO; }
-                  else if (!strcmp(fmt, "ms")) { stamp = FMT_MS; }
-                  else if (!strcmp(fmt, "us")) { stamp = FMT_US; }
-                  else
+                  stamp = tstamp_parse(fmt);
+                  if (!stamp)
                     {
                       fprintf (stderr, "%s: invalid timestamp format '%s'\n", argv[0], fmt);
                       exit (0);
@@ -192,6 +278,20 @@ main (int argc, char *argv[])
           fflush(debug_file);
 #endif // DEBUG
         }
+      else if (!strcmp (argv[i], "-f") || !strcmp (argv[i], "--flush"))
+        {
+          /* Next token is optional. */
+          if ((i + 1) >= argc || argv[i + 1][0] == '-') { flush_policy.policy = FLUSH_ALWAYS; }
+          else
+            {
+              i++;
+              if (output_parse_policy(argv[i], &flush_policy))
+                {
+                  fprintf (stderr, "%s: invalid flush policy '%s'\n", argv[0], argv[i]);
+                  exit (0);
+                }
+            }
+        }
       else if (!strcmp (argv[i], "-b") || !strcmp (argv[i], "--baud"))
         {
           if ((i + 1) >= argc)
@@ -200,29 +300,56 @@ main (int argc, char *argv[])
               exit (0);
             }
 
-          baud_str = argv[i + 1];
+          cfg->baud_str = argv[i + 1];
           i++;
-          baud = select_baud_rate(baud_str);
+          cfg->baud = select_baud_rate(cfg->baud_str);
 #ifdef DEBUG
-          fprintf(debug_file, "Using baudrate of %d bps\n", baud);
+          fprintf(debug_file, "Using baudrate of %d bps\n", cfg->baud);
           fflush(debug_file);
 #endif // DEBUG
         }
       else if (!strcmp (argv[i], "-d") || !strcmp (argv[i], "--device"))
         {
+          port_t* p;
+
           if ((i + 1) >= argc)
             {
               fprintf (stderr, "%s: serial device is not specified\n", argv[0]);
               exit(0);
             }
 
-          strncpy (modem_device, argv[i + 1], sizeof(modem_device) - 1);
+          p = realloc (ports, (nports + 1) * sizeof(*ports));
+          if (!p)
+            {
+              fprintf (stderr, "%s: out of memory\n", argv[0]);
+              exit(0);
+            }
+          ports = p;
+          p = &ports[nports];
+          memset (p, 0, sizeof(*p));
+          p->cfg = defaults;
+          p->cfg.device = argv[i + 1];
+          p->id = nports;
+          p->fd = -1;
+          nports++;
           i++;
 #ifdef DEBUG
-          fprintf(debug_file, "Using serial port %s\n", modem_device);
+          fprintf(debug_file, "Using serial port %s\n", p->cfg.device);
           fflush(debug_file);
 #endif // DEBUG
         }
+      else if (!strcmp (argv[i], "-o") || !strcmp (argv[i], "--output"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: output file is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          cfg->output_path = argv[i + 1];
+          if (!strcmp (cfg->output_path, "-")) { cfg->output_path = NULL; }
+          i++;
+        }
       else if (!strcmp (argv[i], "-t") || !strcmp (argv[i], "--timeout"))
         {
           if ((i + 1) >= argc)
@@ -253,10 +380,11 @@ main (int argc, char *argv[])
           }
 
           int f = argv[i + 1][0];
-          if(f == 'a') output_fmt = FMT_ACSII;
-          else if(f == 'h') { output_fmt = FMT_HEX_LC; }
-          else if(f == 'H') { output_fmt = FMT_HEX_UC; }
-          else if(f == 'r') { output_fmt = FMT_RAW; }
+          if(f == 'a') cfg->output_fmt = FMT_ACSII;
+          else if(f == 'h') { cfg->output_fmt = FMT_HEX_LC; }
+          else if(f == 'H') { cfg->output_fmt = FMT_HEX_UC; }
+          else if(f == 'r') { cfg->output_fmt = FMT_RAW; }
+          else if(f == 'b') { cfg->output_fmt = FMT_BIN; }
           else
             {
               fprintf (stderr, "%s: invalid output format '%s'\n", argv[0], argv[i + 1]);
@@ -265,7 +393,7 @@ main (int argc, char *argv[])
           i++;
 
 #ifdef DEBUG
-          fprintf(debug_file, "Using output format %d s\n", output_fmt);
+          fprintf(debug_file, "Using output format %d s\n", cfg->output_fmt);
           fflush(debug_file);
 #endif // DEBUG
         }
@@ -277,8 +405,8 @@ main (int argc, char *argv[])
             exit(0);
           }
 
-          print_data_ctx.line_len_limit = atoi(argv[i + 1]);
-          if (!print_data_ctx.line_len_limit)
+          cfg->line_len_limit = atoi(argv[i + 1]);
+          if (cfg->line_len_limit < 0 || (cfg->line_len_limit == 0 && strcmp(argv[i + 1], "0")))
           {
             fprintf (stderr, "%s: invalid line length limit %s\n", argv[0], argv[i + 1]);
             exit(0);
@@ -287,12 +415,14 @@ main (int argc, char *argv[])
           i++;
 
 #ifdef DEBUG
-          fprintf(debug_file, "Using line length limit of %d bytes\n", print_data_ctx.line_len_limit);
+          fprintf(debug_file, "Using line length limit of %d bytes\n", cfg->line_len_limit);
           fflush(debug_file);
 #endif // DEBUG
         }
       else if (!strcmp (argv[i], "-m") || !strcmp (argv[i], "--mode"))
         {
+          const char* port_mode;
+
           if ((i + 1) >= argc)
           {
             fprintf (stderr, "%s: serial port mode is not specified\n", argv[0]);
@@ -302,27 +432,27 @@ main (int argc, char *argv[])
           port_mode = argv[i + 1];
           i++;
 
-          if(port_mode[0] == '7') { data_bits = 7; }
-          else if(port_mode[0] == '8') { data_bits = 8; }
+          if(port_mode[0] == '7') { cfg->data_bits = 7; }
+          else if(port_mode[0] == '8') { cfg->data_bits = 8; }
           else
             {
               fprintf (stderr, "%s: invalid serial port mode %s: invalid data bits.\n", argv[0], port_mode);
               exit(0);
             }
 
-          if(port_mode[1] == 'N') { parity = 'N'; }
-          else if(port_mode[1] == 'E') { parity = 'E'; }
-          else if(port_mode[1] == 'O') { parity = 'O'; }
-          else if(port_mode[1] == 'M') { parity = 'M'; }
-          else if(port_mode[1] == 'S') { parity = 'S'; }
+          if(port_mode[1] == 'N') { cfg->parity = 'N'; }
+          else if(port_mode[1] == 'E') { cfg->parity = 'E'; }
+          else if(port_mode[1] == 'O') { cfg->parity = 'O'; }
+          else if(port_mode[1] == 'M') { cfg->parity = 'M'; }
+          else if(port_mode[1] == 'S') { cfg->parity = 'S'; }
           else
             {
               fprintf (stderr, "%s: invalid serial port mode %s: invalid parity.\n", argv[0], port_mode);
               exit(0);
             }
 
-          if(port_mode[2] == '1') { stop_bits = 1; }
-          else if(port_mode[2] == '2') { stop_bits = 2; }
+          if(port_mode[2] == '1') { cfg->stop_bits = 1; }
+          else if(port_mode[2] == '2') { cfg->stop_bits = 2; }
           else
             {
               fprintf (stderr, "%s: invalid serial port mode %s: invalid stop bits.\n", argv[0], port_mode);
@@ -330,7 +460,7 @@ main (int argc, char *argv[])
             }
 
 #ifdef DEBUG
-          fprintf(debug_file, "Using serial port mode %s (%d data bits, %d stop bits, parity: %c\n", port_mode, data_bits, stop_bits, parity);
+          fprintf(debug_file, "Using serial port mode %s (%d data bits, %d stop bits, parity: %c\n", port_mode, cfg->data_bits, cfg->stop_bits, cfg->parity);
           fflush(debug_file);
 #endif // DEBUG
         }
@@ -343,8 +473,8 @@ main (int argc, char *argv[])
             }
 
           i++;
-          if(argv[i][0] == '0') { rts = 0; }
-          else if(argv[i][0] == '1') { rts = 1; }
+          if(argv[i][0] == '0') { cfg->rts = 0; }
+          else if(argv[i][0] == '1') { cfg->rts = 1; }
           else
             {
               fprintf (stderr, "%s: invalid RTS line state '%s'\n", argv[0], argv[i]);
@@ -352,7 +482,7 @@ main (int argc, char *argv[])
             }
 
 #ifdef DEBUG
-          fprintf(debug_file, "Using RTS value %d\n", rts);
+          fprintf(debug_file, "Using RTS value %d\n", cfg->rts);
           fflush(debug_file);
 #endif // DEBUG
         }
@@ -365,8 +495,8 @@ main (int argc, char *argv[])
             }
 
           i++;
-          if(argv[i][0] == '0') { dtr = 0; }
-          else if(argv[i][0] == '1') { dtr = 1; }
+          if(argv[i][0] == '0') { cfg->dtr = 0; }
+          else if(argv[i][0] == '1') { cfg->dtr = 1; }
           else
             {
               fprintf (stderr, "%s: invalid DTR line state '%s'\n", argv[0], argv[i]);
@@ -374,498 +504,780 @@ main (int argc, char *argv[])
             }
 
 #ifdef DEBUG
-          fprintf(debug_file, "Using DTR value %d\n", dtr);
+          fprintf(debug_file, "Using DTR value %d\n", cfg->dtr);
           fflush(debug_file);
 #endif // DEBUG
         }
-    }
-
-  if (baud_str == NULL)
-    {
-      fprintf (stderr, "%s: baud rate is not specified\n", argv[0]);
-      exit (0);
-    }
+      else if (!strcmp (argv[i], "--latency"))
+        {
+          cfg->low_latency = 1;
+        }
+      else if (!strcmp (argv[i], "--byte-times"))
+        {
+          cfg->byte_times = 1;
+        }
+      else if (!strcmp (argv[i], "--trigger"))
+        {
+          char** patterns;
+          size_t* lens;
+          int len;
 
-  if (baud == 0)
-    {
-      fprintf (stderr, "%s: invalid baud rate %s\n", argv[0], baud_str);
-      exit (0);
-    }
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: trigger pattern is not specified\n", argv[0]);
+              exit(0);
+            }
 
-  if (!modem_device[0]) {
-    fprintf (stderr, "%s: no device is set. Use %s -h for more information.\n", argv[0], argv[0]);
-    exit (0);
-  }
+          patterns = realloc (trigger_patterns, (ntriggers + 1) * sizeof(*patterns));
+          lens = realloc (trigger_lens, (ntriggers + 1) * sizeof(*lens));
+          if (patterns) { trigger_patterns = patterns; }
+          if (lens) { trigger_lens = lens; }
+          if (!patterns || !lens || !(patterns[ntriggers] = malloc (strlen (argv[i + 1]) + 1)))
+            {
+              fprintf (stderr, "%s: out of memory\n", argv[0]);
+              exit(0);
+            }
 
-  logfile = fopen (modem_device, "rb");
-  if (logfile == NULL)
-    {
-      fprintf (stderr, "%s: invalid device %s\n", argv[0], modem_device);
-      exit (0);
-    }
-  fd = fileno (logfile);
+          len = trigger_parse_pattern (argv[i + 1], patterns[ntriggers]);
+          if (len < 0)
+            {
+              fprintf (stderr, "%s: invalid trigger pattern %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          lens[ntriggers++] = len;
+          i++;
+        }
+      else if (!strcmp (argv[i], "--trigger-pre") || !strcmp (argv[i], "--trigger-post"))
+        {
+          int pre = (argv[i][11] == 'r');
+          int res;
 
-#ifdef DEBUG
-  fprintf(debug_file, "Opened serial port %s, file descriptor %d\n", modem_device, fd);
-  fflush(debug_file);
-#endif // DEBUG
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: %s value is not specified\n", argv[0], argv[i] + 2);
+              exit(0);
+            }
 
-  /* Check are we connected to serial port and if yes, save current serial port settings */
-  int serial_port = (0 == tcgetattr (fd, &oldtio));
-  if(serial_port)
-    {
-      memset (&newtio, 0, sizeof (newtio)); /* clear struct for new port settings */
+          if (pre) { res = parse_window (argv[i + 1], &trigger_window.pre_bytes, &trigger_window.pre_ns); }
+          else { res = parse_window (argv[i + 1], &trigger_window.post_bytes, &trigger_window.post_ns); }
+          if (res < 0)
+            {
+              fprintf (stderr, "%s: invalid %s value %s\n", argv[0], argv[i] + 2, argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--frame-gap"))
+        {
+          char* end;
+          double gap;
 
-#ifdef DEBUG
-      fprintf(debug_file, "Connected to real serial device, not file\n");
-      fflush(debug_file);
-#endif // DEBUG
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: frame gap is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      /* Enable RTS/CTS (hardware) flow control. */
-      /* newtio.c_cflag |= CRTSCTS; */
+          gap = strtod(argv[i + 1], &end);
+          cfg->frame_gap_chars = 0;
+          cfg->frame_gap_ns = 0;
+          if (gap > 0 && !*end) { cfg->frame_gap_chars = gap; }
+          else if (gap > 0 && !strcmp(end, "us")) { cfg->frame_gap_ns = gap * 1000; }
+          else if (gap > 0 && !strcmp(end, "ms")) { cfg->frame_gap_ns = gap * 1000000; }
+          if (!cfg->frame_gap_chars && cfg->frame_gap_ns <= 0)
+            {
+              fprintf (stderr, "%s: invalid frame gap %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--label"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: label is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      /* Character size mask. */
-      if(data_bits == 7) { newtio.c_cflag |= CS7; }
-      else { newtio.c_cflag |= CS8; }
+          cfg->label = argv[i + 1];
+          if (!cfg->label[0] || strlen(cfg->label) > PRINT_LABEL_MAX)
+            {
+              fprintf (stderr, "%s: invalid label '%s', 1 to %d characters\n", argv[0], argv[i + 1], PRINT_LABEL_MAX);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--read-size"))
+        {
+          long long size;
 
-      /* Ignore modem control lines. */
-      newtio.c_cflag |= CLOCAL;
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: read size is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      /* Enable receiver. */
-      newtio.c_cflag |= CREAD;
+          size = parse_size(argv[i + 1]);
+          if (size < 1 || size > PORT_READ_MAX)
+            {
+              fprintf (stderr, "%s: invalid read size %s, 1 to %d bytes\n", argv[0], argv[i + 1], PORT_READ_MAX);
+              exit(0);
+            }
+          cfg->read_size = size;
+          i++;
+        }
+      else if (!strcmp (argv[i], "--coalesce"))
+        {
+          char* end;
+          double t;
 
-      /* Set stop bits. */
-      if(stop_bits == 2) { newtio.c_cflag |= CSTOPB; }
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: coalesce time is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      if(parity == 'E')
-        {
-          newtio.c_cflag &= ~(PARODD | CMSPAR);
-          newtio.c_cflag |= PARENB;
+          t = strtod(argv[i + 1], &end);
+          cfg->coalesce_ns = 0;
+          if (t > 0 && !strcmp(end, "us")) { cfg->coalesce_ns = t * 1000; }
+          else if (t > 0 && !strcmp(end, "ms")) { cfg->coalesce_ns = t * 1000000; }
+          if (cfg->coalesce_ns <= 0)
+            {
+              fprintf (stderr, "%s: invalid coalesce time %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
         }
-      else if(parity == 'O')
+      else if (!strcmp (argv[i], "--reconnect"))
         {
-          newtio.c_cflag |= PARENB | PARODD;
-          newtio.c_cflag &= ~CMSPAR;
+          cfg->reconnect = 1;
         }
-      else if(parity == 'M')
+      else if (!strcmp (argv[i], "--dedup"))
         {
-          newtio.c_cflag |= PARENB | PARODD | CMSPAR;
+          cfg->dedup = 1;
         }
-      else if(parity == 'S')
+      else if (!strcmp (argv[i], "--dedup-mask"))
         {
-          newtio.c_cflag |= PARENB | CMSPAR;
-          newtio.c_cflag &= ~PARODD;
-        }
+          uint8_t* mask;
 
-      /* Ignore framing errors and parity errors. */
-      newtio.c_iflag |= IGNPAR;
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: dedup mask is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      if(output_fmt == FMT_ACSII)
+          if (dedup_parse_mask(argv[i + 1], &mask, &cfg->dedup_mask_len))
+            {
+              fprintf (stderr, "%s: invalid dedup mask %s, columns 1 to %d like 1-23,40\n", argv[0], argv[i + 1], DEDUP_LINE_MAX);
+              exit(0);
+            }
+          cfg->dedup_mask = mask;
+          cfg->dedup = 1;
+          i++;
+        }
+      else if (!strcmp (argv[i], "--verbose"))
         {
-          /* Ignore carriage return on input. */
-          newtio.c_iflag |= IGNCR;
+          verbose = 1;
         }
+      else if (!strcmp (argv[i], "--merge"))
+        {
+          /* Next token is optional. */
+          merge_ns = WORKER_MERGE_WINDOW_NS;
+          if ((i + 1) < argc && argv[i + 1][0] != '-')
+            {
+              char* end;
+              double t = strtod(argv[i + 1], &end);
+
+              merge_ns = 0;
+              if (t > 0 && !strcmp(end, "us")) { merge_ns = t * 1000; }
+              else if (t > 0 && !strcmp(end, "ms")) { merge_ns = t * 1000000; }
+              else if (t > 0 && !strcmp(end, "s")) { merge_ns = t * 1000000000; }
+              if (merge_ns <= 0)
+                {
+                  fprintf (stderr, "%s: invalid merge window %s\n", argv[0], argv[i + 1]);
+                  exit(0);
+                }
+              i++;
+            }
+        }
+      else if (!strcmp (argv[i], "--vmin") || !strcmp (argv[i], "--vtime"))
+        {
+          int n;
 
-      /* Ignore BREAK condition on input. */
-      newtio.c_iflag |= IGNBRK;
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: %s value is not specified\n", argv[0], argv[i] + 2);
+              exit(0);
+            }
 
-      newtio.c_oflag = 0;
+          n = atoi(argv[i + 1]);
+          if (n < 0 || n > 255 || (n == 0 && argv[i + 1][0] != '0'))
+            {
+              fprintf (stderr, "%s: invalid %s value %s\n", argv[0], argv[i] + 2, argv[i + 1]);
+              exit(0);
+            }
+          if (argv[i][3] == 'm') { cfg->vmin = n; }
+          else { cfg->vtime = n; }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--rt-priority"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: realtime priority is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      if(output_fmt == FMT_ACSII)
+          rt_priority = atoi(argv[i + 1]);
+          if (rt_priority < 1 || rt_priority > 99)
+            {
+              fprintf (stderr, "%s: invalid realtime priority %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--mlock"))
         {
-          /* Enable canonical mode. */
-          newtio.c_lflag = ICANON;
+          lock_memory = 1;
         }
+      else if (!strcmp (argv[i], "--ports-per-thread"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: ports per thread is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      /* Set blocking read, no timeouts. */
-      newtio.c_cc[VTIME] = 0;
-      newtio.c_cc[VMIN] = 0;
-
-      /* Only truly portable method of setting speed. */
-      cfsetispeed (&newtio, baud);
-      cfsetospeed (&newtio, baud);
+          ports_per_thread = atoi(argv[i + 1]);
+          if (ports_per_thread <= 0)
+            {
+              fprintf (stderr, "%s: invalid ports per thread %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--cpus"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: CPU list is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      tcflush (fd, TCIFLUSH);
-      tcsetattr (fd, TCSANOW, &newtio);
+          ncpus = parse_cpu_list(argv[i + 1], cpus, sizeof(cpus) / sizeof(cpus[0]));
+          if (ncpus <= 0)
+            {
+              fprintf (stderr, "%s: invalid CPU list %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--ring"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: ring buffer size is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      if(rts >= 0)
+          ring_size = parse_size(argv[i + 1]);
+          if (ring_size < 0 || (ring_size > 0 && ring_size < 2 * PORT_READ_SIZE))
+            {
+              fprintf (stderr, "%s: invalid ring buffer size %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--engine"))
         {
-          int flags = TIOCM_RTS;
-          if(rts) { ioctl(fd, TIOCMBIS, &flags); }
-          else { ioctl(fd, TIOCMBIC, &flags); }
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: I/O engine is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          if (!strcmp (argv[i + 1], "poll")) { engine = WORKER_ENGINE_POLL; }
+          else if (!strcmp (argv[i + 1], "uring")) { engine = WORKER_ENGINE_URING; }
+          else
+            {
+              fprintf (stderr, "%s: invalid I/O engine %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
         }
+      else if (!strcmp (argv[i], "--rotate-size"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: rotation size is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      if(dtr >= 0)
+          rotate_policy.size = parse_size(argv[i + 1]);
+          if (rotate_policy.size <= 0)
+            {
+              fprintf (stderr, "%s: invalid rotation size %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--retain"))
         {
-          int flags = TIOCM_DTR;
-          if(rts) { ioctl(fd, TIOCMBIS, &flags); }
-          else { ioctl(fd, TIOCMBIC, &flags); }
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: retention size is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          rotate_policy.retain = parse_size(argv[i + 1]);
+          if (rotate_policy.retain <= 0)
+            {
+              fprintf (stderr, "%s: invalid retention size %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
         }
+      else if (!strcmp (argv[i], "--recorder"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: flight recorder size is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      /* Set low latency flag. Note that not all serial drivers support this feature. */
-#if defined(ASYNC_LOW_LATENCY)
-      {
-        struct serial_struct serial;
-        ioctl(fd, TIOCGSERIAL, &serial);
-        serial.flags |= ASYNC_LOW_LATENCY;
-        ioctl(fd, TIOCSSERIAL, &serial);
-      }
-#endif // defined
+          recorder_size = parse_size(argv[i + 1]);
+          if (recorder_size < REC_MIN_SIZE)
+            {
+              fprintf (stderr, "%s: invalid flight recorder size %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--compress"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: compression is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      /* Clear the device */
-      {
-        int flags = fcntl (fd, F_GETFL, 0);
-        fcntl (fd, F_SETFL, flags | O_NONBLOCK);
-        while (fread (raw_data, 1, sizeof(raw_data), logfile) > 0 );
-        fcntl (fd, F_SETFL, flags);
-      }
-    }
+          compress_codec = compress_parse(argv[i + 1]);
+          if (compress_codec < 0)
+            {
+              fprintf (stderr, "%s: compression %s is not supported\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--compress-level"))
+        {
+          char* end;
 
-  struct timeval select_timeout;
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: compression level is not specified\n", argv[0]);
+              exit(0);
+            }
 
-  while (1)
-    {
-      FD_ZERO (&rfds);
-      FD_SET (fd, &rfds);
-      if(timeout)
+          compress_level = strtol(argv[i + 1], &end, 10);
+          if (end == argv[i + 1] || *end || compress_level < 0)
+            {
+              fprintf (stderr, "%s: invalid compression level %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--frame-size"))
         {
-          select_timeout.tv_sec = 1;
-          select_timeout.tv_usec = 0;
-          retval = select (fd + 1, &rfds, NULL, NULL, &select_timeout);
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: frame size is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          frame_size = parse_size(argv[i + 1]);
+          if (frame_size < 4096 || frame_size > 1024LL * 1024 * 1024)
+            {
+              fprintf (stderr, "%s: invalid frame size %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
         }
-      else
+      else if (!strcmp (argv[i], "--listen"))
         {
-          retval = select (fd + 1, &rfds, NULL, NULL, NULL);
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: listen address is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          listen_addr = argv[i + 1];
+          i++;
         }
+      else if (!strcmp (argv[i], "--listen-policy"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: listen policy is not specified\n", argv[0]);
+              exit(0);
+            }
 
-      if (retval > 0)
+          listen_policy = server_parse_policy (argv[i + 1]);
+          if (listen_policy < 0)
+            {
+              fprintf (stderr, "%s: invalid listen policy %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--listen-queue"))
         {
-          ssize_t len = 0;
-          if(output_fmt == FMT_ACSII)
+          if ((i + 1) >= argc)
             {
-              if (!fgets (raw_data, sizeof(raw_data), logfile))
-                {
-                  raw_data[0] = 0;
-                  if (ferror (logfile))
-                    {
-                      fprintf (stderr, "%s: error reading serial device %s\n", argv[0], modem_device);
-                      break;
-                    }
-                  /* Used with files, for testing. */
-                  if (!serial_port && feof (logfile)) { break; }
-                }
-              len = strlen(raw_data);
+              fprintf (stderr, "%s: listen queue size is not specified\n", argv[0]);
+              exit(0);
             }
-          else
+
+          listen_queue = parse_size(argv[i + 1]);
+          if (listen_queue <= 0)
             {
-              len = read (fd, raw_data, sizeof(raw_data) - 1);
-              if (len < 0)
-                {
-                  int err = errno;
-                  raw_data[0] = 0;
-                  if (err == EAGAIN || err == EWOULDBLOCK)
-                    {
-                      continue;
-                    }
-                  else
-                    {
-                      fprintf (stderr, "%s: error %d while reading serial device %s\n", argv[0], err, modem_device);
-                      break;
-                    }
-                }
-              else if(len > 0)
-                {
-                  raw_data[len] = 0;
-                }
-              else
-                {
-                  /* EOF */
-                  break;
-                }
+              fprintf (stderr, "%s: invalid listen queue size %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--shm"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: shared memory name is not specified\n", argv[0]);
+              exit(0);
             }
 
-          if(len)
+          shm_name = argv[i + 1];
+          i++;
+        }
+      else if (!strcmp (argv[i], "--shm-size"))
+        {
+          if ((i + 1) >= argc)
             {
-              if (stamp) { timestr = make_timestamp(stamp, &startup_timestamp); }
-              else { timestr = NULL; }
+              fprintf (stderr, "%s: shared memory size is not specified\n", argv[0]);
+              exit(0);
+            }
 
-              print_data(raw_data, len, &print_data_ctx, timestr, output_fmt);
+          shm_size = parse_size(argv[i + 1]);
+          if (shm_size < SHMRING_MIN_SIZE)
+            {
+              fprintf (stderr, "%s: invalid shared memory size %s, 256k at least\n", argv[0], argv[i + 1]);
+              exit(0);
             }
+          i++;
         }
-      else if (retval == 0) /* Timeout. */
+      else if (!strcmp (argv[i], "--stats-file"))
         {
-          if(timeout && (run_time >= timeout) ) break;
-          else if(timeout) { run_time++; }
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: stats file is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          stats_path = argv[i + 1];
+          i++;
         }
-      else
+      else if (!strcmp (argv[i], "--stats-interval"))
         {
-          fprintf (stderr, "%s: error in select call\n", argv[0]);
-          break;
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: stats interval is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          stats_interval = atol(argv[i + 1]);
+          if (stats_interval <= 0)
+            {
+              fprintf (stderr, "%s: invalid stats interval %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
+        }
+      else if (!strcmp (argv[i], "--rotate-time"))
+        {
+          if ((i + 1) >= argc)
+            {
+              fprintf (stderr, "%s: rotation interval is not specified\n", argv[0]);
+              exit(0);
+            }
+
+          rotate_policy.interval = rotate_parse_interval(argv[i + 1]);
+          if (rotate_policy.interval <= 0)
+            {
+              fprintf (stderr, "%s: invalid rotation interval %s\n", argv[0], argv[i + 1]);
+              exit(0);
+            }
+          i++;
         }
     }
 
-  fclose (logfile);
-  if(serial_port) { tcsetattr (fd, TCSANOW, &oldtio); }
-  return 0;
-}
+  if (!nports) {
+    fprintf (stderr, "%s: no device is set. Use %s -h for more information.\n", argv[0], argv[0]);
+    exit (0);
+  }
 
+  for (i = 0; i < nports; i++)
+    {
+      port_cfg_t* cfg = &ports[i].cfg;
 
-/* Function that prints line in specified output format. Timestamp is optional.
-   Buffer should be at least 4 times the line length. */
-void print_data(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, const char* time_stamp, int fmt)
-{
-  static const char* hex_chars_lc = "0123456789abcdef";
-  static const char* hex_chars_uc = "0123456789ABCDEF";
+      if (cfg->baud_str == NULL)
+        {
+          fprintf (stderr, "%s: baud rate is not specified\n", argv[0]);
+          exit (0);
+        }
 
-  int offset = 0;
+      if (cfg->baud == 0)
+        {
+          fprintf (stderr, "%s: invalid baud rate %s\n", argv[0], cfg->baud_str);
+          exit (0);
+        }
 
-#ifdef DEBUG
-  fprintf(debug_file, "print_data(len=%d, line_len=%d, line_len_limit=%d)\n", raw_data_len, ctx->line_len, ctx->line_len_limit);
-  fprintf(debug_file, "data: '%s'\n", raw_data);
-  fflush(debug_file);
-#endif // DEBUG
+      if ((cfg->frame_gap_chars || cfg->frame_gap_ns) && cfg->output_fmt == FMT_ACSII)
+        {
+          fprintf (stderr, "%s: frame gap needs raw, hex or bin format\n", argv[0]);
+          exit (0);
+        }
+    }
 
-  if(fmt == FMT_ACSII)
+  if (ntriggers)
     {
-      while(raw_data_len)
-        {
-          if (time_stamp) { printf ("[%s] ", time_stamp); }
+      trigger_t* matcher = trigger_create ((const char* const*)trigger_patterns, trigger_lens, ntriggers);
 
-          int print_nl = 0;
-          int len = ctx->line_len_limit - ctx->line_len;
-          if(len > raw_data_len) { len = raw_data_len; }
-          else { print_nl = 1; }
-          memcpy(ctx->work_buff, raw_data + offset, len);
-          offset += len;
-          ctx->line_len += len;
-          raw_data_len -= len;
-          if(ctx->line_len >= ctx->line_len_limit) { ctx->line_len = 0; }
+      if (!matcher)
+        {
+          fprintf (stderr, "%s: out of memory\n", argv[0]);
+          exit (0);
+        }
+      for (i = 0; i < ntriggers; i++) { free (trigger_patterns[i]); }
+      free (trigger_patterns);
+      free (trigger_lens);
 
-          if(print_nl)
-            {
-              ctx->work_buff[len] = '\n';
-              ctx->work_buff[len + 1] = 0;
-            }
-          else
-            {
-              ctx->work_buff[len] = 0;
-            }
+      for (i = 0; i < nports; i++)
+        {
+          ports[i].cfg.trigger = matcher;
+          ports[i].cfg.trigger_window = trigger_window;
+        }
+    }
 
-#ifdef DEBUG
-          fprintf(debug_file, "workbuff: '%s'\n", ctx->work_buff);
-          fflush(debug_file);
-#endif // DEBUG
+  output_set_policy (&flush_policy);
+  if (recorder_size && (rotate_policy.size || rotate_policy.interval))
+    {
+      fprintf (stderr, "%s: flight recorder output can not be rotated\n", argv[0]);
+      exit (0);
+    }
 
-          fputs (ctx->work_buff, stdout);
-          fflush(stdout);
+  /* A flight recorder is a file mapped into memory. */
+  for (i = 0; recorder_size && i < nports; i++)
+    {
+      if (!ports[i].cfg.output_path)
+        {
+          fprintf (stderr, "%s: flight recorder output needs a file, %s needs -o\n", argv[0], ports[i].cfg.device);
+          exit (0);
         }
     }
-  if(fmt == FMT_RAW)
+
+  /* Only files can be rotated, stdout is left as it is. */
+  for (i = 0; (rotate_policy.size || rotate_policy.interval) && i < nports; i++)
     {
-      while(raw_data_len)
+      if (!ports[i].cfg.output_path)
         {
-          if (time_stamp)
-            {
-              if(ctx->line_len != 0) { fputs("\n", stdout); }
-              printf ("[%s] ", time_stamp);
-              ctx->line_len = 0;
-            }
+          fprintf (stderr, "%s: stdout can not be rotated, %s needs -o\n", argv[0], ports[i].cfg.device);
+          exit (0);
+        }
+    }
 
-          int print_nl = 0;
-          int len = ctx->line_len_limit - ctx->line_len;
-          if(len > raw_data_len) { len = raw_data_len; }
-          else { print_nl = 1; }
-          memcpy(ctx->work_buff, raw_data + offset, len);
-          offset += len;
-          ctx->line_len += len;
-          raw_data_len -= len;
-          if(ctx->line_len >= ctx->line_len_limit) { ctx->line_len = 0; }
+  if (compress_codec && (recorder_size || rotate_policy.size || rotate_policy.interval))
+    {
+      fprintf (stderr, "%s: compressed output can not be rotated or a flight recorder\n", argv[0]);
+      exit (0);
+    }
 
-          if(print_nl)
-            {
-              ctx->work_buff[len] = '\n';
-              ctx->work_buff[len + 1] = 0;
-            }
-          else
-            {
-              ctx->work_buff[len] = 0;
-            }
+  if (compress_level >= 0)
+    {
+      int min, max;
 
-#ifdef DEBUG
-          fprintf(debug_file, "workbuff: '%s'\n", ctx->work_buff);
-          fflush(debug_file);
-#endif // DEBUG
+      if (!compress_codec)
+        {
+          fprintf (stderr, "%s: compression level without --compress\n", argv[0]);
+          exit (0);
+        }
+      compress_level_range(compress_codec, &min, &max);
+      if (compress_level < min || compress_level > max)
+        {
+          fprintf (stderr, "%s: invalid compression level %d, %d to %d for this codec\n", argv[0], compress_level, min, max);
+          exit (0);
+        }
+    }
 
-          fputs(ctx->work_buff, stdout);
-          fflush(stdout);
+  /* Reads are put off by the poll loop, the io_uring loop has no way to. */
+  for (i = 0; engine == WORKER_ENGINE_URING && i < nports; i++)
+    {
+      if (ports[i].cfg.coalesce_ns)
+        {
+          fprintf (stderr, "%s: --coalesce only works with the poll engine\n", argv[0]);
+          exit (0);
         }
     }
-  else if(fmt == FMT_HEX_LC || fmt == FMT_HEX_UC)
+
+  /* The merge is done by the writer thread of the one worker. */
+  if (merge_ns && (!ring_size || (ports_per_thread && ports_per_thread < nports)))
     {
-      const char* hex_chars = (fmt == FMT_HEX_LC) ? hex_chars_lc : hex_chars_uc;
-      while(raw_data_len)
-      {
-        if (time_stamp)
-          {
-            if(ctx->line_len != 0) { fputs("\n", stdout); }
-            printf ("[%s] ", time_stamp);
-            ctx->line_len = 0;
-          }
+      fprintf (stderr, "%s: --merge needs a ring and all devices serviced by one thread\n", argv[0]);
+      exit (0);
+    }
 
-        int print_nl = 0;
-        int len = ctx->line_len_limit - ctx->line_len;
-        if(len > raw_data_len) { len = raw_data_len; }
-        else { print_nl = 1; }
+  /* Merged devices are told apart by their name without a label. */
+  for (i = 0; merge_ns && i < nports; i++)
+    {
+      if (!ports[i].cfg.label)
+        {
+          const char* name = strrchr (ports[i].cfg.device, '/');
+          ports[i].cfg.label = name ? name + 1 : ports[i].cfg.device;
+        }
+    }
 
-        int buff_len = 0;
-        for(int i = 0; i < len; i++)
-          {
-              unsigned char d = raw_data[offset + i];
-              if (i || ctx->line_len) { ctx->work_buff[buff_len++] = ' '; }
-              ctx->work_buff[buff_len++] = hex_chars[(d >> 4) & 0x0F];
-              ctx->work_buff[buff_len++] = hex_chars[d & 0x0F];
-          }
+  output_set_rotate (&rotate_policy);
+  output_set_recorder (recorder_size);
+  output_set_compress (compress_codec, compress_level < 0 ? 0 : compress_level, frame_size);
 
-        if(print_nl)
-          {
-            ctx->work_buff[buff_len] = '\n';
-            ctx->work_buff[buff_len + 1] = 0;
-          }
-        else
-          {
-            ctx->work_buff[buff_len] = 0;
-          }
-        offset += len;
-        ctx->line_len += len;
-        raw_data_len -= len;
-        if(ctx->line_len >= ctx->line_len_limit) { ctx->line_len = 0; }
+  /* The clients get one stream, they could not tell several outputs apart. */
+  for (i = 1; listen_addr && i < nports; i++)
+    {
+      const char* a = ports[0].cfg.output_path;
+      const char* b = ports[i].cfg.output_path;
 
-#ifdef DEBUG
-        fprintf(debug_file, "workbuff: '%s'\n", ctx->work_buff);
-        fflush(debug_file);
-#endif // DEBUG
+      if (a != b && (!a || !b || strcmp (a, b)))
+        {
+          fprintf (stderr, "%s: --listen needs all devices logged to the same output, %s is logged to %s\n",
+                   argv[0], ports[i].cfg.device, b ? b : "stdout");
+          exit (0);
+        }
+    }
 
-        fputs(ctx->work_buff, stdout);
-        fflush(stdout);
-      }
+  /* Before any output or worker thread exists. */
+  stats_init ();
+
+  /* Before the ports are opened, which adds the bin preambles. */
+  if (listen_addr && server_start (listen_addr, listen_policy, listen_queue))
+    {
+      exit (0);
     }
-}
 
+  if (shm_name)
+    {
+      shm = shmring_create (shm_name, shm_size);
+      if (!shm)
+        {
+          fprintf (stderr, "%s: can not create shared memory %s: %s\n", argv[0], shm_name, strerror (errno));
+          exit (0);
+        }
+      for (i = 0; i < nports; i++) { ports[i].cfg.shm = shm; }
+    }
 
-/* Function to create timestamp according to timestamp format fmt. */
-const char* make_timestamp(int fmt, const struct timespec* start_time)
-{
-  char* timestr = NULL;
-  static char buffer[128];
+  for (i = 0; i < nports; i++)
+    {
+      if (port_open (&ports[i]))
+        {
+          while (i-- > 0) { port_close (&ports[i]); }
+          output_close_all ();
+          shmring_destroy (shm);
+          exit (0);
+        }
+    }
 
-  if(fmt == FMT_OLD)
+  stats_start (ports, nports, stats_path, stats_interval);
+
+  /* MCL_FUTURE also covers the rings and thread stacks still to come. */
+  if (lock_memory && mlockall (MCL_CURRENT | MCL_FUTURE))
     {
-      time_t rawtime;
-      struct tm *timeinfo;
-      time(&rawtime);
-      timeinfo = localtime(&rawtime);
-      timestr = asctime(timeinfo);
-      timestr[strlen(timestr) - 1] = 0;
+      fprintf (stderr, "%s: can not lock memory: %s\n", argv[0], strerror (errno));
     }
-  else if(fmt == FMT_ISO)
+
+  /* Split ports among the workers. Without --ports-per-thread all ports
+     are serviced from the main thread. */
+  if (!ports_per_thread) { ports_per_thread = nports; }
+  nworkers = (nports + ports_per_thread - 1) / ports_per_thread;
+  workers = calloc (nworkers, sizeof(*workers));
+  if (!workers)
     {
-      /* YYYY-MM-DDTHH:MM:SS.sss */
-      struct timespec ts;
-      struct tm TM;
-      unsigned ms;
-      ts.tv_sec = 0;
-      ts.tv_nsec = 0;
-      clock_gettime(CLOCK_REALTIME, &ts);
-      TM = *localtime(&ts.tv_sec);
-      ms = ts.tv_nsec / 1000000UL;
-      snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02d.%03d",
-            TM.tm_year + 1900, TM.tm_mon + 1, TM.tm_mday,
-            TM.tm_hour, TM.tm_min, TM.tm_sec, ms);
-
-      timestr = buffer;
+      fprintf (stderr, "%s: out of memory\n", argv[0]);
+      exit (0);
     }
-  else if(fmt == FMT_MS)
+
+  for (i = 0; i < nworkers; i++)
     {
-      /* 32-bit number of milliseconds. */
-      struct timespec ts;
-      uint64_t ms = 0;
-      ts.tv_sec = 0;
-      ts.tv_nsec = 0;
-      clock_gettime(CLOCK_MONOTONIC, &ts);
-
-      /* Subtract start time from current time. */
-      ts.tv_sec -= start_time->tv_sec;
-      ts.tv_nsec -= start_time->tv_nsec;
-      if(ts.tv_nsec < 0)
-        {
-          ts.tv_sec--;
-          ts.tv_nsec += 1000000000LL;
-        }
-
-      /* Convert to milliseconds. */
-      ms = ts.tv_nsec / 1000000UL;
-      ms += ts.tv_sec * 1000U;
-      ms %= 1000000000ULL;   /* 9 decimal digits. */
-      snprintf(buffer, sizeof(buffer), "%09" PRIu64, ms);
-
-      /* Insert dots after every 3 digits. 000000136 => 000.000.136 */
-      /*                                   012345678    01234567890 */
-      buffer[11] = 0;
-      buffer[10] = buffer[8];
-      buffer[9] = buffer[7];
-      buffer[8] = buffer[6];
-      buffer[7] = '.';
-      buffer[6] = buffer[5];
-      buffer[5] = buffer[4];
-      buffer[4] = buffer[3];
-      buffer[3] = '.';
-
-      timestr = buffer;
+      worker_t* w = &workers[i];
+      int k;
+
+      w->nports = nports - i * ports_per_thread;
+      if (w->nports > ports_per_thread) { w->nports = ports_per_thread; }
+      w->ports = calloc (w->nports, sizeof(*w->ports));
+      if (!w->ports)
+        {
+          fprintf (stderr, "%s: out of memory\n", argv[0]);
+          exit (0);
+        }
+      for (k = 0; k < w->nports; k++)
+        {
+          port_t* port = &ports[i * ports_per_thread + k];
+
+          /* The ring holds at least two reads. */
+          if (ring_size && port->read_size > (size_t)ring_size / 2) { port->read_size = ring_size / 2; }
+          if (verbose)
+            {
+              fprintf (stderr, "%s: %s: reads of %zu bytes", argv[0], port->cfg.device, port->read_size);
+              if (port->coalesce_ns) { fprintf (stderr, ", coalesced up to %lld us", (long long)(port->coalesce_ns / 1000)); }
+              fprintf (stderr, "\n");
+            }
+          w->ports[k] = port;
+        }
+
+      w->cpu = ncpus ? cpus[i % ncpus] : -1;
+      w->rt_priority = rt_priority;
+      w->stamp = stamp;
+      w->ring_size = ring_size;
+      w->engine = engine;
+      w->merge_ns = merge_ns;
+      if (timeout)
+        {
+          w->deadline = startup_timestamp;
+          w->deadline.tv_sec += timeout;
+        }
+    }
+
+  if (nworkers == 1)
+    {
+      worker_run (&workers[0]);
     }
-  else if(fmt == FMT_US)
+  else
     {
-      /* 64-bit number of microseconds. */
-      struct timespec ts;
-      uint64_t us = 0;
-      ts.tv_sec = 0;
-      ts.tv_nsec = 0;
-      clock_gettime(CLOCK_MONOTONIC, &ts);
-
-      /* Subtract start time from current time. */
-      ts.tv_sec -= start_time->tv_sec;
-      ts.tv_nsec -= start_time->tv_nsec;
-      if(ts.tv_nsec < 0)
-        {
-          ts.tv_sec--;
-          ts.tv_nsec += 1000000000LL;
-        }
-
-      /* Convert to microseconds. */
-      us = ts.tv_nsec / 1000UL;
-      us += ts.tv_sec * 1000000UL;
-      us %= 1000000000000ULL;   /* 12 decimal digits. */
-      snprintf(buffer, sizeof(buffer), "%012" PRIu64, us);
-
-      /* Insert dots after every 3 digits. 000000000136 => 000.000.000.136 */
-      /*                                   012345678901    012345678901234 */
-      buffer[15] = 0;
-      buffer[14] = buffer[11];
-      buffer[13] = buffer[10];
-      buffer[12] = buffer[9];
-      buffer[11] = '.';
-      buffer[10] = buffer[8];
-      buffer[9] = buffer[7];
-      buffer[8] = buffer[6];
-      buffer[7] = '.';
-      buffer[6] = buffer[5];
-      buffer[5] = buffer[4];
-      buffer[4] = buffer[3];
-      buffer[3] = '.';
-
-      timestr = buffer;
+      for (i = 0; i < nworkers; i++)
+        {
+          if (pthread_create (&workers[i].thread, NULL, worker_run, &workers[i]))
+            {
+              fprintf (stderr, "%s: can not create worker thread\n", argv[0]);
+              exit (0);
+            }
+        }
+      for (i = 0; i < nworkers; i++) { pthread_join (workers[i].thread, NULL); }
     }
 
-  return timestr;
+  stats_stop ();
+  for (i = 0; i < nworkers; i++) { free (workers[i].ports); }
+  free (workers);
+  if (nports) { trigger_free ((trigger_t*)ports[0].cfg.trigger); }
+  free (ports);
+  output_close_all ();
+  server_stop ();
+  shmring_destroy (shm);
+  return 0;
 }
 
 
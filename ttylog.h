@@ -0,0 +1,139 @@
+/* ttylog - serial port logger
+ Copyright (C) 1999-2002  Tibor Koleszar <oldw@debian.org>
+ Copyright (C) 2008-2018  Robert James Clay <jame@rocasa.us>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_H_
+#define _TTYLOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* #define DEBUG 1 */
+
+
+/* Constants for output format. */
+enum
+{
+  FMT_ACSII = 0,  /* Old ttylog ascii output format. */
+  FMT_HEX_LC = 1, /* HEX output using lowercase abcdef characters. */
+  FMT_HEX_UC = 2, /* HEX output using uppercase ABCDEF characters. */
+  FMT_RAW = 3,    /* Raw output format, EOL character is not added by ttylog. */
+  FMT_BIN = 4,    /* Binary capture records with receive times, see binfmt.h. */
+};
+
+
+/* Constants for timestamp format. */
+enum
+{
+  FMT_OLD = 1,  /* Old timestamp format, like Mon Oct 20 21:13:53 2025. */
+  FMT_ISO = 2,  /* ISO8601 timestamp format, YYYY-MM-DDTHH:mm:ss.sss. */
+  FMT_MS = 3,   /* Relative time in milliseconds from program start. */
+  FMT_US = 4,   /* Relative time in microseconds from program start. */
+  FMT_NS = 5,   /* Relative time in nanoseconds from program start. */
+  FMT_EPOCH = 6, /* Seconds since the Unix epoch with nanoseconds, sssssssssss.nnnnnnnnn. */
+};
+
+
+/* Receive time of a chunk of data. With byte times the bytes of the chunk
+   are estimated to have arrived from span_ns before the receive time on,
+   byte_ns apart. */
+typedef struct
+{
+  struct timespec mono;   /* CLOCK_MONOTONIC, for relative timestamps. */
+  struct timespec real;   /* CLOCK_REALTIME, for wall clock timestamps. */
+  int64_t span_ns;        /* Arrival of the first byte before the receive time, 0 if not estimated. */
+  int64_t byte_ns;        /* Time between the bytes. */
+} rx_time_t;
+
+
+struct output_s;
+struct print_data_ctx_s;
+
+/* Longest port label, see print_data_ctx_t. */
+#define PRINT_LABEL_MAX 32
+
+/* Format len bytes of data at p, with time_stamp at the start of every
+   line when not NULL. Returns the end of the output. See fmtkernel.h. */
+typedef char* (*print_kernel_t)(char* p, const char* data, int len, struct print_data_ctx_s* ctx,
+                                const char* time_stamp, size_t ts_len);
+
+typedef struct print_data_ctx_s
+{
+  int fmt;
+  int line_len_limit;          /* 0 for no limit. */
+  int line_len;                /* Without a limit only 0 at the start of a line or not. */
+  print_kernel_t kernel[2];    /* Without and with timestamps. */
+  const char* label;           /* Put after the timestamp of every line, NULL for none. */
+  struct output_s* out;
+} print_data_ctx_t;
+
+
+/* Program name used as a prefix for error messages. */
+extern const char* progname;
+
+/* Program startup time, base for relative timestamps. */
+extern struct timespec startup_timestamp;
+
+#ifdef DEBUG
+extern FILE* debug_file;
+#endif // DEBUG
+
+
+/* Set up ctx to print format fmt into out with a line length limit, 0 for
+   none, and select its kernels. The label is cleared. */
+void print_ctx_init(print_data_ctx_t* ctx, int fmt, int line_len_limit, struct output_s* out);
+
+/* Function that prints line in the output format of ctx. Timestamp is optional.
+   With a label every line is prefixed, and ports sharing the output with
+   labels start a line of their own when they take turns. The caller must
+   hold the output lock. */
+void print_data(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, const char* time_stamp);
+
+/* Print one frame on a line of its own, as "[time_stamp] len: data".
+   Frames longer than the line limit are continued on the next lines. The
+   caller must hold the output lock. */
+void print_frame(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, const char* time_stamp);
+
+/* Print the marker of a device that was gone for gap_ns and reopened, on
+   a line of its own, nothing in the raw format. The caller must hold the output lock. */
+void print_gap(print_data_ctx_t* ctx, int64_t gap_ns, const char* time_stamp);
+
+/* Print the summary of count repeats of the last line, or of byte when
+   not -1, received from first to last when not NULL, on a line of its own
+   and nothing in the raw format. The caller must hold the output lock. */
+void print_repeat(print_data_ctx_t* ctx, int byte, uint64_t count, const char* first, const char* last, const char* time_stamp);
+
+struct tstamp_s;
+
+/* Print chunk with timestamps from formatter ts, NULL for none. Chunks with
+   byte times get the estimated time of the first byte of every line. The
+   caller must hold the output lock. */
+void print_data_stamped(const char* raw_data, int raw_data_len, print_data_ctx_t* ctx, struct tstamp_s* ts, const rx_time_t* rx_time);
+
+
+/* Take the receive time of data that was just read. */
+void rx_time_now(rx_time_t* rx_time);
+
+/* Estimated arrival time of byte offset of the chunk received at rx_time. */
+void rx_time_at(const rx_time_t* rx_time, size_t offset, rx_time_t* at);
+
+
+/* Select baud rate based on user input. */
+int select_baud_rate(const char* baud_str);
+
+#endif
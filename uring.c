@@ -0,0 +1,233 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+int uring_init(uring_t* ring, unsigned entries)
+{
+  struct io_uring_params p;
+  char* sq;
+  char* cq;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = sys_io_uring_setup(entries, &p);
+  if(ring->fd < 0) { return -1; }
+
+  /* Reads and writes use the current file position of ttys, pipes and
+     O_APPEND files, which older kernels do not support. */
+  if(!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+      close(ring->fd);
+      errno = ENOTSUP;
+      return -1;
+    }
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if(ring->cq_ring_size > ring->sq_ring_size) { ring->sq_ring_size = ring->cq_ring_size; }
+      ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if(ring->sq_ring == MAP_FAILED)
+    {
+      close(ring->fd);
+      return -1;
+    }
+
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      ring->cq_ring = ring->sq_ring;
+    }
+  else
+    {
+      ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+      if(ring->cq_ring == MAP_FAILED)
+        {
+          munmap(ring->sq_ring, ring->sq_ring_size);
+          close(ring->fd);
+          return -1;
+        }
+    }
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if(ring->sqes == MAP_FAILED)
+    {
+      if(ring->cq_ring != ring->sq_ring) { munmap(ring->cq_ring, ring->cq_ring_size); }
+      munmap(ring->sq_ring, ring->sq_ring_size);
+      close(ring->fd);
+      return -1;
+    }
+
+  sq = ring->sq_ring;
+  ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+  ring->sq_entries = p.sq_entries;
+  ring->sqe_tail = *ring->sq_tail;
+
+  cq = ring->cq_ring;
+  ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+  return 0;
+}
+
+
+int uring_register_buffers(uring_t* ring, const struct iovec* iov, unsigned n)
+{
+  return sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+
+struct io_uring_sqe* uring_get_sqe(uring_t* ring)
+{
+  unsigned head = atomic_load_explicit((_Atomic unsigned*)ring->sq_head, memory_order_acquire);
+  struct io_uring_sqe* sqe;
+
+  if(ring->sqe_tail - head >= ring->sq_entries) { return NULL; }
+
+  sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+  ring->sq_array[ring->sqe_tail & *ring->sq_mask] = ring->sqe_tail & *ring->sq_mask;
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+
+unsigned uring_sq_space(uring_t* ring)
+{
+  unsigned head = atomic_load_explicit((_Atomic unsigned*)ring->sq_head, memory_order_acquire);
+
+  return ring->sq_entries - (ring->sqe_tail - head);
+}
+
+
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring)
+{
+  unsigned head = *ring->cq_head;
+
+  if(head == atomic_load_explicit((_Atomic unsigned*)ring->cq_tail, memory_order_acquire)) { return NULL; }
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+void uring_cqe_seen(uring_t* ring, struct io_uring_cqe* cqe)
+{
+  (void)cqe;
+  atomic_store_explicit((_Atomic unsigned*)ring->cq_head, *ring->cq_head + 1, memory_order_release);
+}
+
+
+int uring_submit(uring_t* ring, unsigned wait_nr)
+{
+  unsigned tail = *ring->sq_tail;
+  unsigned to_submit = ring->sqe_tail - tail;
+  int n;
+
+  atomic_store_explicit((_Atomic unsigned*)ring->sq_tail, ring->sqe_tail, memory_order_release);
+
+  do
+    {
+      n = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    }
+  while(n < 0 && errno == EINTR);
+
+  return n < 0 ? -errno : n;
+}
+
+
+void uring_free(uring_t* ring)
+{
+  munmap(ring->sqes, ring->sqes_size);
+  if(ring->cq_ring != ring->sq_ring) { munmap(ring->cq_ring, ring->cq_ring_size); }
+  munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->fd);
+}
+
+#else
+
+int uring_init(uring_t* ring, unsigned entries)
+{
+  (void)entries;
+  ring->fd = -1;
+  errno = ENOSYS;
+  return -1;
+}
+
+
+int uring_register_buffers(uring_t* ring, const struct iovec* iov, unsigned n)
+{
+  (void)ring;
+  (void)iov;
+  (void)n;
+  return -1;
+}
+
+
+int uring_submit(uring_t* ring, unsigned wait_nr)
+{
+  (void)ring;
+  (void)wait_nr;
+  return -ENOSYS;
+}
+
+
+void uring_free(uring_t* ring)
+{
+  (void)ring;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_URING_H_
+#define _TTYLOG_URING_H_
+
+#include "config.h"
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+
+/* Minimal io_uring wrapper on top of the raw system calls, so no liburing
+   is needed. The submission and completion queues are used from a single
+   thread. Without kernel support uring_init() fails and callers fall back
+   to the evloop/read()/write() path. */
+typedef struct
+{
+  int fd;
+#ifdef HAVE_LINUX_IO_URING_H
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned sqe_tail;       /* Local tail, published by uring_submit(). */
+  unsigned sq_entries;
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+#endif
+} uring_t;
+
+
+/* Set up ring with room for entries submissions. Returns 0 on success,
+   -1 when io_uring is not available. */
+int uring_init(uring_t* ring, unsigned entries);
+
+/* Register buffers for the *_FIXED operations. Returns 0 on success. */
+int uring_register_buffers(uring_t* ring, const struct iovec* iov, unsigned n);
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* Next free submission entry, cleared, or NULL when the queue is full. */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+/* Number of submission entries uring_get_sqe() can still return. */
+unsigned uring_sq_space(uring_t* ring);
+
+/* Oldest completion or NULL, release it with uring_cqe_seen(). */
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring);
+
+void uring_cqe_seen(uring_t* ring, struct io_uring_cqe* cqe);
+#endif
+
+/* Submit the queued entries and wait until at least wait_nr completions
+   are available. Returns number submitted or -errno. */
+int uring_submit(uring_t* ring, unsigned wait_nr);
+
+void uring_free(uring_t* ring);
+
+#endif
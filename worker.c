@@ -0,0 +1,1315 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include "ttylog.h"
+#include "evloop.h"
+#include "worker.h"
+#include "binfmt.h"
+#include "uring.h"
+
+
+/* How long the writer sleeps at most when there is nothing to do. */
+#define WRITER_IDLE_NS 100000000L
+
+/* Chunk flags. */
+#define CHUNK_FRAME 1   /* Chunk is one frame, its receive time that of the first byte. */
+#define CHUNK_GAP 2     /* Chunk is the int64_t time the device was gone, see --reconnect. */
+
+
+/* Output of the dedup stage of port, called with the output lock held. */
+static void worker_dedup_emit(void* arg, const char* data, size_t len, const rx_time_t* rx_time, const dedup_repeat_t* rep)
+{
+  port_t* port = arg;
+  tstamp_t* ts = port->tstamp.fmt ? &port->tstamp : NULL;
+  char first[TSTAMP_MAX + 1];
+
+  if(!rep)
+    {
+      print_data_stamped(data, len, &port->print_ctx, ts, rx_time);
+      return;
+    }
+
+  /* The formatter keeps one timestamp at a time. */
+  snprintf(first, sizeof(first), "%s", tstamp_format(&port->repeat_tstamp, &rep->first, NULL));
+  print_repeat(&port->print_ctx, rep->byte, rep->count, first, tstamp_format(&port->repeat_tstamp, &rep->last, NULL),
+               ts ? tstamp_format(ts, rx_time, NULL) : NULL);
+}
+
+
+/* Format one chunk of data to the output of port. */
+static void worker_print(worker_t* w, port_t* port, const char* data, size_t len, const rx_time_t* rx_time, uint32_t flags)
+{
+  if (flags & CHUNK_GAP)
+    {
+      int64_t gap_ns;
+
+      memcpy(&gap_ns, data, sizeof(gap_ns));
+      output_lock(port->out);
+      if (port->dedup.mode) { dedup_flush(&port->dedup); }
+      if (port->cfg.output_fmt == FMT_BIN) { bin_write_gap(port->out, port->id, gap_ns, rx_time); }
+      else { print_gap(&port->print_ctx, gap_ns, w->stamp ? tstamp_format(&port->tstamp, rx_time, NULL) : NULL); }
+      output_unlock(port->out);
+      return;
+    }
+
+  if (port->cfg.output_fmt == FMT_BIN)
+    {
+      output_lock(port->out);
+      output_note_time(port->out, &rx_time->real);
+      bin_write_data(port->out, port->id, data, len, rx_time, (flags & CHUNK_FRAME) ? BIN_FLAG_FRAME : 0);
+      output_unlock(port->out);
+      return;
+    }
+
+  output_lock(port->out);
+  output_note_time(port->out, &rx_time->real);
+  if (flags & CHUNK_FRAME)
+    {
+      print_frame(data, len, &port->print_ctx, w->stamp ? tstamp_format(&port->tstamp, rx_time, NULL) : NULL);
+    }
+  else if (port->dedup.mode)
+    {
+      dedup_feed(&port->dedup, data, len, rx_time);
+    }
+  else
+    {
+      print_data_stamped(data, len, &port->print_ctx, w->stamp ? &port->tstamp : NULL, rx_time);
+    }
+  output_unlock(port->out);
+}
+
+
+/* Output a chunk of port through its triggers, if it has them. */
+static void worker_output(worker_t* w, port_t* port, const char* data, size_t len, const rx_time_t* rx_time, uint32_t flags)
+{
+  /* Reconnects are logged whether a trigger window is open or not. */
+  if(port->trigger.matcher && !(flags & CHUNK_GAP))
+    {
+      ring_chunk_t* chunk;
+      int res = trigger_port_feed(&port->trigger, data, len, rx_time, flags);
+
+      if(!res) { return; }
+      if(res == 2) { atomic_fetch_add_explicit(&port->stats.triggers, 1, memory_order_relaxed); }
+
+      /* Pre-trigger window. */
+      while((chunk = trigger_port_replay(&port->trigger)))
+        {
+          worker_print(w, port, ring_chunk_data(chunk), chunk->len, &chunk->rx_time, chunk->flags);
+          trigger_port_release(&port->trigger, chunk);
+        }
+    }
+
+  worker_print(w, port, data, len, rx_time, flags);
+}
+
+
+/* Wake the writer if it is waiting for data. */
+static void worker_wake_writer(worker_t* w)
+{
+  /* Pairs with the fence in worker_writer_run(), either the writer sees
+     the new head or we see it sleeping. */
+  atomic_thread_fence(memory_order_seq_cst);
+  if(atomic_load_explicit(&w->writer_sleeping, memory_order_relaxed))
+    {
+      pthread_mutex_lock(&w->lock);
+      pthread_cond_signal(&w->cond);
+      pthread_mutex_unlock(&w->lock);
+    }
+}
+
+
+/* Buffer for the next read of port, space reserved in its ring or the port
+   buffer when there is no ring. */
+static char* worker_read_buffer(worker_t* w, port_t* port)
+{
+  unsigned char* p;
+
+  /* Framed data is collected in the frame buffer first. */
+  if(!port->ring || port->frame_gap_ns) { return port->raw_data; }
+
+  /* Read straight into the ring. Serial ports must be drained even when
+     the writer lags behind, files and pipes can wait for it. */
+  while(!(p = ring_reserve(port->ring, port->read_size)))
+    {
+      struct timespec ts = { 0, 100000 };
+      if(port->serial_port) { return port->raw_data; }
+      worker_wake_writer(w);
+      nanosleep(&ts, NULL);
+    }
+
+  return (char*)p;
+}
+
+
+static int64_t ts_to_ns(const struct timespec* ts)
+{
+  return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+
+/* Publish a read to the shared memory consumers, see --shm. */
+static void worker_publish(port_t* port, const char* data, size_t len, const rx_time_t* rx_time)
+{
+  shmring_record_t rec;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.mono_ns = ts_to_ns(&rx_time->mono);
+  rec.real_ns = ts_to_ns(&rx_time->real);
+  rec.span_ns = rx_time->span_ns;
+  rec.byte_ns = rx_time->byte_ns;
+  rec.len = len;
+  rec.port = port->id;
+  shmring_publish(port->cfg.shm, &rec, data);
+}
+
+
+/* Make the frame timer expire at at_ns, CLOCK_MONOTONIC, unless it is
+   already set to expire earlier. */
+static void worker_arm_frame_timer(worker_t* w, int64_t at_ns)
+{
+  struct itimerspec its;
+
+  if(w->frame_deadline_ns && w->frame_deadline_ns <= at_ns) { return; }
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = at_ns / 1000000000LL;
+  its.it_value.tv_nsec = at_ns % 1000000000LL;
+  timerfd_settime(w->frame_timer, TFD_TIMER_ABSTIME, &its, NULL);
+  w->frame_deadline_ns = at_ns;
+}
+
+
+/* Hand the open frame of port to the writer or print it. The frame is
+   copied into the ring, it can not be read there in place because the
+   frame is only complete once the line went idle. */
+static void worker_frame_end(worker_t* w, port_t* port)
+{
+  size_t len = port->frame_len;
+  unsigned char* p;
+
+  if(!len) { return; }
+  port->frame_len = 0;
+
+  if(!port->ring)
+    {
+      worker_output(w, port, port->frame, len, &port->frame_start, CHUNK_FRAME);
+    }
+  else if((p = ring_reserve(port->ring, len)))
+    {
+      memcpy(p, port->frame, len);
+      ring_commit(port->ring, len, CHUNK_FRAME, &port->frame_start);
+      worker_wake_writer(w);
+    }
+  else
+    {
+      atomic_fetch_add_explicit(&port->stats.dropped, len, memory_order_relaxed);
+    }
+}
+
+
+/* Add len bytes received at rx_time to the frame of port. A frame ends
+   when the line was idle for the frame gap before the first byte, and
+   the frame timer ends it when no byte follows in time. */
+static void worker_frame_add(worker_t* w, port_t* port, const char* data, size_t len, const rx_time_t* rx_time)
+{
+  int64_t now = ts_to_ns(&rx_time->mono);
+  size_t off = 0;
+
+  if(port->frame_len && now - rx_time->span_ns - port->frame_last_ns >= port->frame_gap_ns)
+    {
+      worker_frame_end(w, port);
+    }
+
+  while(off < len)
+    {
+      size_t n = len - off;
+
+      if(n > PORT_FRAME_SIZE - port->frame_len) { n = PORT_FRAME_SIZE - port->frame_len; }
+      if(!port->frame_len) { rx_time_at(rx_time, off, &port->frame_start); }
+      memcpy(port->frame + port->frame_len, data + off, n);
+      port->frame_len += n;
+      off += n;
+      if(port->frame_len == PORT_FRAME_SIZE) { worker_frame_end(w, port); }
+    }
+
+  port->frame_last_ns = port->char_ns ? port->last_byte_ns : now;
+  if(port->frame_len) { worker_arm_frame_timer(w, port->frame_last_ns + port->frame_gap_ns); }
+}
+
+
+/* Frame timer expired, end the frames whose gap has passed and set the
+   timer for the next one. */
+static void worker_frame_timeout(worker_t* w)
+{
+  struct timespec ts;
+  int64_t now, next = 0;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts_to_ns(&ts);
+  w->frame_deadline_ns = 0;
+
+  for(i = 0; i < w->nports; i++)
+    {
+      port_t* port = w->ports[i];
+      int64_t end = port->frame_last_ns + port->frame_gap_ns;
+
+      if(!port->frame_len) { continue; }
+      if(end <= now) { worker_frame_end(w, port); }
+      else if(!next || end < next) { next = end; }
+    }
+
+  if(next) { worker_arm_frame_timer(w, next); }
+}
+
+
+/* Hand len bytes just read into data to the writer or print them. */
+static void worker_received(worker_t* w, port_t* port, char* data, size_t len)
+{
+  rx_time_t rx_time;
+
+  rx_time_now(&rx_time);
+  port_byte_times(port, len, &rx_time);
+  stats_read(&port->stats, len);
+  if(port->cfg.shm) { worker_publish(port, data, len, &rx_time); }
+
+  if(port->frame_gap_ns)
+    {
+      worker_frame_add(w, port, data, len, &rx_time);
+    }
+  else if(!port->ring)
+    {
+      worker_output(w, port, data, len, &rx_time, 0);
+    }
+  else if(data != port->raw_data)
+    {
+      ring_commit(port->ring, len, 0, &rx_time);
+      worker_wake_writer(w);
+    }
+  else
+    {
+      atomic_fetch_add_explicit(&port->stats.dropped, len, memory_order_relaxed);
+    }
+}
+
+
+/* With --coalesce a serial port is read once half a read is queued, or
+   when the first data waited for its coalescing time. Returns 1 when the
+   read is put off, with *until lowered to the time it is due. */
+static int worker_defer_read(worker_t* w, port_t* port, int64_t* until)
+{
+  struct timespec ts;
+  int64_t now, due;
+  int queued;
+
+  if(!w->coalesce_ns || !port->coalesce_ns) { return 0; }
+  if(ioctl(port->fd, FIONREAD, &queued) < 0 || queued >= (int)(port->read_size / 2))
+    {
+      port->pending_ns = 0;
+      return 0;
+    }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts_to_ns(&ts);
+  if(!port->pending_ns) { port->pending_ns = now; }
+  due = port->pending_ns + port->coalesce_ns;
+  if(now >= due)
+    {
+      port->pending_ns = 0;
+      return 0;
+    }
+
+  if(!*until || due < *until) { *until = due; }
+  return 1;
+}
+
+
+/* Sleep until the reads put off are due, but no longer than any serial
+   port of w may go unread. */
+static void worker_coalesce(worker_t* w, int64_t until)
+{
+  struct timespec ts;
+  int64_t now;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts_to_ns(&ts);
+  if(until > now + w->coalesce_ns) { until = now + w->coalesce_ns; }
+  if(until <= now) { return; }
+
+  ts.tv_sec = until / 1000000000LL;
+  ts.tv_nsec = until % 1000000000LL;
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+
+/* Read available data from port and hand it to the writer or print it.
+   Returns -1 when the port has reached EOF or failed and should be closed. */
+static int worker_service_port(worker_t* w, port_t* port)
+{
+  char* data = worker_read_buffer(w, port);
+  ssize_t len;
+
+  len = read (port->fd, data, port->read_size);
+  if (len < 0)
+    {
+      int err = errno;
+      if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+        {
+          return 0;
+        }
+      else
+        {
+          fprintf (stderr, "%s: error %d while reading serial device %s\n", progname, err, port->cfg.device);
+          return -1;
+        }
+    }
+  else if(len == 0)
+    {
+      /* EOF */
+      return -1;
+    }
+
+  if(len) { worker_received(w, port, data, len); }
+
+  return 0;
+}
+
+
+/* Watch the directory of the device of port for it to come back, or the
+   closest parent that exists, /dev/serial/by-id goes away with the last
+   USB serial adapter. Returns 1 when a directory was watched that was not
+   before for port. */
+static int worker_watch_port(worker_t* w, port_t* port)
+{
+  char dir[PATH_MAX];
+  char* slash;
+  int wd = -1;
+
+  if(w->watch_fd < 0) { return 0; }
+
+  snprintf(dir, sizeof(dir), "%s", port->cfg.device);
+  while(wd < 0)
+    {
+      slash = strrchr(dir, '/');
+      if(!slash) { strcpy(dir, "."); }
+      else if(slash == dir) { dir[1] = 0; }
+      else { *slash = 0; }
+
+      wd = inotify_add_watch(w->watch_fd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+      if(!slash || slash == dir) { break; }
+    }
+
+  if(wd < 0 || wd == port->watch_wd) { return 0; }
+  port->watch_wd = wd;
+  return 1;
+}
+
+
+/* Add a reconnect marker to the data of port, in order with it. */
+static void worker_gap(worker_t* w, port_t* port, int64_t gap_ns, const rx_time_t* rx_time)
+{
+  unsigned char* p;
+
+  if(!port->ring)
+    {
+      worker_output(w, port, (const char*)&gap_ns, sizeof(gap_ns), rx_time, CHUNK_GAP);
+      return;
+    }
+
+  /* Nothing is read from the port meanwhile, so it can wait for the writer. */
+  while(!(p = ring_reserve(port->ring, sizeof(gap_ns))))
+    {
+      struct timespec ts = { 0, 100000 };
+      worker_wake_writer(w);
+      nanosleep(&ts, NULL);
+    }
+  memcpy(p, &gap_ns, sizeof(gap_ns));
+  ring_commit(port->ring, sizeof(gap_ns), CHUNK_GAP, rx_time);
+  worker_wake_writer(w);
+}
+
+
+/* The device of port failed or hung up. With --reconnect a serial device
+   is closed and waited for, its output and ring stay as they are. Returns
+   0 when it is waited for, -1 when the port is closed for good. */
+static int worker_port_gone(worker_t* w, port_t* port)
+{
+  struct timespec ts;
+
+  worker_frame_end(w, port);
+  if(!port->cfg.reconnect || !port->serial_port)
+    {
+      port_close(port);
+      return -1;
+    }
+
+  port_detach(port);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  port->lost_ns = ts_to_ns(&ts);
+  port->watch_wd = -1;
+  worker_watch_port(w, port);
+  if(!w->nlost++) { w->retry_ns = port->lost_ns + WORKER_RECONNECT_RETRY_NS; }
+  fprintf (stderr, "%s: device %s is gone, waiting for it\n", progname, port->cfg.device);
+  return 0;
+}
+
+
+/* Read the pending changes of the watched directories. Only that
+   something changed matters, not what. */
+static void worker_watch_read(worker_t* w)
+{
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while(read(w->watch_fd, events, sizeof(events)) > 0) {}
+}
+
+
+/* Whether the gone devices are to be tried again: their directories
+   changed or the retry interval passed. */
+static int worker_retry_due(worker_t* w, int watched)
+{
+  struct timespec ts;
+  int64_t now;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts_to_ns(&ts);
+  if(!watched && now < w->retry_ns) { return 0; }
+  w->retry_ns = now + WORKER_RECONNECT_RETRY_NS;
+  return 1;
+}
+
+
+/* Try to open the device of gone port again. A directory watched for the
+   first time may have got the device just before, so it is tried once
+   more then. Returns 0 once it is back and the marker is logged. */
+static int worker_reconnect(worker_t* w, port_t* port)
+{
+  rx_time_t rx_time;
+  int64_t gap_ns;
+
+  if(port_reopen(port) && (!worker_watch_port(w, port) || port_reopen(port))) { return -1; }
+
+  rx_time_now(&rx_time);
+  gap_ns = ts_to_ns(&rx_time.mono) - port->lost_ns;
+  port->lost_ns = 0;
+  w->nlost--;
+  worker_gap(w, port, gap_ns, &rx_time);
+  fprintf (stderr, "%s: device %s is back after %lld ms\n", progname, port->cfg.device, (long long)(gap_ns / 1000000));
+  return 0;
+}
+
+
+/* Move all queued chunks of port to its output. Returns number of chunks. */
+static int worker_drain_port(worker_t* w, port_t* port)
+{
+  ring_chunk_t* chunk;
+  int n = 0;
+
+  while((chunk = ring_peek(port->ring)))
+    {
+      worker_output(w, port, ring_chunk_data(chunk), chunk->len, &chunk->rx_time, chunk->flags);
+      ring_release(port->ring, chunk);
+      n++;
+    }
+
+  return n;
+}
+
+
+/* Arrival of the first byte of chunk, CLOCK_MONOTONIC, the merge order. */
+static int64_t chunk_time_ns(const ring_chunk_t* chunk)
+{
+  return ts_to_ns(&chunk->rx_time.mono) - chunk->rx_time.span_ns;
+}
+
+
+/* Move the queued chunks of all ports to their outputs in the order they
+   were received, see --merge. The oldest chunk goes out when every port
+   has a chunk queued, so none can still deliver an older one, or when it
+   is older than the reorder window; with flush set right away. The ports
+   are few, the oldest is found by looking at each ring. Returns the number
+   of chunks output and sets *hold_ns to the time the oldest chunk held
+   back is due, 0 when there is none. */
+static int worker_merge_ports(worker_t* w, int flush, int64_t* hold_ns)
+{
+  struct timespec ts;
+  int64_t now;
+  int n = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts_to_ns(&ts);
+  *hold_ns = 0;
+
+  for(;;)
+    {
+      port_t* oldest = NULL;
+      ring_chunk_t* chunk = NULL;
+      int64_t oldest_ns = 0;
+      int empty = 0;
+      int i;
+
+      for(i = 0; i < w->nports; i++)
+        {
+          ring_chunk_t* c = ring_peek(w->ports[i]->ring);
+          int64_t t;
+
+          if(!c)
+            {
+              empty = 1;
+              continue;
+            }
+          t = chunk_time_ns(c);
+          if(!oldest || t < oldest_ns)
+            {
+              oldest = w->ports[i];
+              chunk = c;
+              oldest_ns = t;
+            }
+        }
+
+      if(!oldest) { break; }
+      if(empty && !flush && oldest_ns + w->merge_ns > now)
+        {
+          *hold_ns = oldest_ns + w->merge_ns;
+          break;
+        }
+
+      worker_output(w, oldest, ring_chunk_data(chunk), chunk->len, &chunk->rx_time, chunk->flags);
+      ring_release(oldest->ring, chunk);
+      n++;
+    }
+
+  return n;
+}
+
+
+/* Outputs of the worker ports, without duplicates and sorted by address
+   for output_flush_uring(). Returns their count. */
+static int worker_outputs(worker_t* w, output_t** outs)
+{
+  int i, j, n = 0;
+
+  for(i = 0; i < w->nports; i++)
+    {
+      output_t* out = w->ports[i]->out;
+
+      for(j = 0; j < n && outs[j] < out; j++) {}
+      if(j < n && outs[j] == out) { continue; }
+      memmove(&outs[j + 1], &outs[j], (n - j) * sizeof(*outs));
+      outs[j] = out;
+      n++;
+    }
+
+  return n;
+}
+
+
+static void* worker_writer_run(void* arg)
+{
+  worker_t* w = arg;
+  output_t* outs[w->nports];
+  struct iovec fixed[w->nports];
+  uint64_t seen[w->nports];   /* Ring heads at the last merge pass. */
+  const struct iovec* registered = NULL;
+  uring_t ring;
+  int use_uring = 0;
+  int nouts = 0;
+  int i;
+
+  /* With io_uring the formatted output of all ports is written with one
+     submission per pass over the rings, from buffers registered once. */
+  if(w->engine == WORKER_ENGINE_URING)
+    {
+      nouts = worker_outputs(w, outs);
+      if(uring_init(&ring, 2 * nouts) == 0)
+        {
+          use_uring = 1;
+          for(i = 0; i < nouts; i++)
+            {
+              fixed[i].iov_base = outs[i]->buff;
+              fixed[i].iov_len = outs[i]->size;
+            }
+          if(uring_register_buffers(&ring, fixed, nouts) == 0) { registered = fixed; }
+          output_defer_flush(1);
+        }
+    }
+
+  for(;;)
+    {
+      int done = atomic_load(&w->done);
+      int busy = 0;
+      int64_t hold_ns = 0;
+      long tick_ms;
+
+      if(w->merge_ns)
+        {
+          for(i = 0; i < w->nports; i++) { seen[i] = atomic_load_explicit(&w->ports[i]->ring->head, memory_order_acquire); }
+          busy = worker_merge_ports(w, done, &hold_ns);
+        }
+      else
+        {
+          for(i = 0; i < w->nports; i++) { busy += worker_drain_port(w, w->ports[i]); }
+        }
+
+      tick_ms = output_tick();
+      if(use_uring) { output_flush_uring(&ring, outs, registered, nouts); }
+
+      if(busy) { continue; }
+      if(done) { break; }
+
+      /* Nothing queued, wait for the reader. */
+      pthread_mutex_lock(&w->lock);
+      atomic_store(&w->writer_sleeping, 1);
+      atomic_thread_fence(memory_order_seq_cst);
+      for(i = 0; i < w->nports && !busy; i++)
+        {
+          /* Chunks held back by the merge only count once more arrived. */
+          if(w->merge_ns) { busy = atomic_load_explicit(&w->ports[i]->ring->head, memory_order_relaxed) != seen[i]; }
+          else { busy = (ring_peek(w->ports[i]->ring) != NULL); }
+        }
+      if(hold_ns)
+        {
+          struct timespec ts;
+
+          /* Time until the oldest chunk held back is due. */
+          clock_gettime(CLOCK_MONOTONIC, &ts);
+          hold_ns -= ts_to_ns(&ts);
+          if(hold_ns <= 0) { busy = 1; }
+        }
+      if(!busy && !atomic_load(&w->done))
+        {
+          struct timespec ts;
+          long wait_ns = WRITER_IDLE_NS;
+          if(tick_ms >= 0 && tick_ms * 1000000L < wait_ns) { wait_ns = tick_ms * 1000000L; }
+          if(hold_ns > 0 && hold_ns < wait_ns) { wait_ns = hold_ns; }
+          clock_gettime(CLOCK_REALTIME, &ts);
+          ts.tv_nsec += wait_ns;
+          if(ts.tv_nsec >= 1000000000L)
+            {
+              ts.tv_sec++;
+              ts.tv_nsec -= 1000000000L;
+            }
+          pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+        }
+      atomic_store(&w->writer_sleeping, 0);
+      pthread_mutex_unlock(&w->lock);
+    }
+
+  if(use_uring)
+    {
+      output_defer_flush(0);
+      uring_free(&ring);
+    }
+
+  return NULL;
+}
+
+
+static int deadline_passed(const struct timespec* deadline)
+{
+  struct timespec now;
+
+  if(!deadline->tv_sec) { return 0; }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(now.tv_sec != deadline->tv_sec) { return now.tv_sec > deadline->tv_sec; }
+  return now.tv_nsec >= deadline->tv_nsec;
+}
+
+
+/* Create the port rings and start the writer thread. */
+static int worker_start_writer(worker_t* w)
+{
+  int i;
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  atomic_init(&w->writer_sleeping, 0);
+  atomic_init(&w->done, 0);
+
+  for(i = 0; i < w->nports; i++)
+    {
+      w->ports[i]->ring = ring_create(w->ring_size);
+      if(!w->ports[i]->ring) { return -1; }
+    }
+
+  if(pthread_create(&w->writer, NULL, worker_writer_run, w)) { return -1; }
+  return 0;
+}
+
+
+/* Let the writer finish the queued data and release the rings. */
+static void worker_stop_writer(worker_t* w)
+{
+  int i;
+
+  atomic_store(&w->done, 1);
+  pthread_mutex_lock(&w->lock);
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->writer, NULL);
+
+  for(i = 0; i < w->nports; i++)
+    {
+      port_t* port = w->ports[i];
+      uint64_t dropped = atomic_load(&port->stats.dropped);
+
+      if(dropped)
+        {
+          fprintf (stderr, "%s: %" PRIu64 " bytes from %s dropped, ring buffer full\n", progname, dropped, port->cfg.device);
+        }
+      ring_free(port->ring);
+      port->ring = NULL;
+    }
+
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+}
+
+
+/* Service the ports with epoll/poll() readiness and read(). */
+static void worker_loop_poll(worker_t* w)
+{
+  evloop_t loop;
+  void* ready[64];
+  port_t** busy;   /* Ports that can not be polled (regular files), always ready. */
+  int nbusy = 0;
+  int nopen = 0;
+  int i;
+
+  busy = calloc(w->nports, sizeof(*busy));
+  if(!busy || evloop_init(&loop, w->nports + 2))
+    {
+      fprintf (stderr, "%s: can not create event loop\n", progname);
+      free(busy);
+      return;
+    }
+
+  for(i = 0; i < w->nports; i++)
+    {
+      port_t* port = w->ports[i];
+      if(evloop_add(&loop, port->fd, port))
+        {
+          if(errno != EPERM)
+            {
+              fprintf (stderr, "%s: can not poll device %s\n", progname, port->cfg.device);
+              port_close(port);
+              continue;
+            }
+          busy[nbusy++] = port;
+        }
+      nopen++;
+    }
+
+  /* The frame timer is told apart from the ports by its user pointer. */
+  if(w->frame_timer >= 0 && evloop_add(&loop, w->frame_timer, w))
+    {
+      fprintf (stderr, "%s: can not poll frame timer\n", progname);
+    }
+  if(w->watch_fd >= 0 && evloop_add(&loop, w->watch_fd, &w->watch_fd))
+    {
+      fprintf (stderr, "%s: can not poll device directories\n", progname);
+    }
+
+  while (nopen > 0)
+    {
+      int64_t coalesce_until = 0;
+      int timeout_ms = -1;
+      int watched = 0;
+      int n;
+
+      if(nbusy) { timeout_ms = 0; }
+      else if(w->deadline.tv_sec) { timeout_ms = 1000; }
+      if(w->nlost && timeout_ms < 0) { timeout_ms = WORKER_RECONNECT_RETRY_NS / 1000000; }
+
+      /* Time based flushing of formatted output is done here when there is
+         no writer thread. */
+      if(!w->ring_size)
+        {
+          long tick_ms = output_tick();
+          if(tick_ms >= 0 && (timeout_ms < 0 || tick_ms < timeout_ms)) { timeout_ms = tick_ms; }
+        }
+
+      n = evloop_wait(&loop, ready, 64, timeout_ms);
+      if(n < 0)
+        {
+          fprintf (stderr, "%s: error in select call\n", progname);
+          break;
+        }
+
+      for(i = 0; i < n; i++)
+        {
+          port_t* port = ready[i];
+          if(ready[i] == (void*)w)
+            {
+              uint64_t expired;
+              if(read(w->frame_timer, &expired, sizeof(expired)) > 0) { worker_frame_timeout(w); }
+              continue;
+            }
+          if(ready[i] == (void*)&w->watch_fd)
+            {
+              worker_watch_read(w);
+              watched = 1;
+              continue;
+            }
+          if(worker_defer_read(w, port, &coalesce_until)) { continue; }
+          if(worker_service_port(w, port) < 0)
+            {
+              evloop_del(&loop, port->fd);
+              if(worker_port_gone(w, port)) { nopen--; }
+            }
+        }
+
+      for(i = 0; i < nbusy; i++)
+        {
+          port_t* port = busy[i];
+          if(worker_service_port(w, port) < 0)
+            {
+              if(worker_port_gone(w, port)) { nopen--; }
+              busy[i--] = busy[--nbusy];
+            }
+        }
+
+      /* Gone devices that are back go on where they left off. */
+      if(w->nlost && worker_retry_due(w, watched))
+        {
+          for(i = 0; i < w->nports; i++)
+            {
+              port_t* port = w->ports[i];
+
+              if(!port->lost_ns || worker_reconnect(w, port)) { continue; }
+              if(evloop_add(&loop, port->fd, port))
+                {
+                  if(errno != EPERM)
+                    {
+                      fprintf (stderr, "%s: can not poll device %s\n", progname, port->cfg.device);
+                      port_close(port);
+                      nopen--;
+                      continue;
+                    }
+                  busy[nbusy++] = port;
+                }
+            }
+        }
+
+      /* Ports that can not be polled are read all the time anyway. */
+      if(coalesce_until && !nbusy) { worker_coalesce(w, coalesce_until); }
+
+      if(deadline_passed(&w->deadline)) { break; }
+    }
+
+  evloop_free(&loop);
+  free(busy);
+}
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/* user_data of requests that are not port reads, which use the port index. */
+#define URING_TIMEOUT ((uint64_t)-1)
+#define URING_CANCEL ((uint64_t)-2)
+#define URING_FRAME_TIMER ((uint64_t)-3)
+#define URING_WATCH ((uint64_t)-4)
+
+
+/* Queue a wait for fd, the frame timer or the directory watch. */
+static void worker_post_poll(uring_t* ring, int fd, uint64_t tag)
+{
+  struct io_uring_sqe* sqe = uring_get_sqe(ring);
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll_events = POLLIN;
+  sqe->user_data = tag;
+}
+
+
+/* Queue a read of port i into bufs[i]. */
+static void worker_post_read(worker_t* w, uring_t* ring, int i, char** bufs)
+{
+  port_t* port = w->ports[i];
+  struct io_uring_sqe* sqe = uring_get_sqe(ring);
+
+  bufs[i] = worker_read_buffer(w, port);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = port->fd;
+  sqe->addr = (uintptr_t)bufs[i];
+  sqe->len = port->read_size;
+  sqe->off = (uint64_t)-1;
+  sqe->user_data = i;
+}
+
+
+/* Service the ports with a read posted on every one of them all the time.
+   Completed reads are handed on and reposted, and all of them go to the
+   kernel with a single io_uring_enter() per pass. Only one read is posted
+   per port, with more the data of one port could complete out of order. */
+static void worker_loop_uring(worker_t* w, uring_t* ring)
+{
+  struct __kernel_timespec ts;
+  struct io_uring_sqe* sqe;
+  struct io_uring_cqe* cqe;
+  char** bufs;      /* Buffer of the posted read, NULL when none. */
+  int timeout_posted = 0;
+  int timer_posted = 0;
+  int watch_posted = 0;
+  int nopen = 0;
+  int i;
+
+  bufs = calloc(w->nports, sizeof(*bufs));
+  if(!bufs)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      return;
+    }
+
+  for(i = 0; i < w->nports; i++)
+    {
+      worker_post_read(w, ring, i, bufs);
+      nopen++;
+    }
+  if(w->frame_timer >= 0)
+    {
+      worker_post_poll(ring, w->frame_timer, URING_FRAME_TIMER);
+      timer_posted = 1;
+    }
+  if(w->watch_fd >= 0)
+    {
+      worker_post_poll(ring, w->watch_fd, URING_WATCH);
+      watch_posted = 1;
+    }
+
+  while(nopen > 0)
+    {
+      long timeout_ms = -1;
+      int watched = 0;
+
+      if(w->deadline.tv_sec || w->nlost) { timeout_ms = 1000; }
+      if(!w->ring_size)
+        {
+          long tick_ms = output_tick();
+          if(tick_ms >= 0 && (timeout_ms < 0 || tick_ms < timeout_ms)) { timeout_ms = tick_ms; }
+        }
+
+      if(timeout_ms >= 0 && !timeout_posted)
+        {
+          ts.tv_sec = timeout_ms / 1000;
+          ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+          sqe = uring_get_sqe(ring);
+          sqe->opcode = IORING_OP_TIMEOUT;
+          sqe->addr = (uintptr_t)&ts;
+          sqe->len = 1;
+          sqe->user_data = URING_TIMEOUT;
+          timeout_posted = 1;
+        }
+
+      if(uring_submit(ring, 1) < 0)
+        {
+          fprintf (stderr, "%s: error in io_uring_enter call\n", progname);
+          break;
+        }
+
+      while((cqe = uring_peek_cqe(ring)))
+        {
+          uint64_t tag = cqe->user_data;
+          int res = cqe->res;
+          port_t* port;
+
+          uring_cqe_seen(ring, cqe);
+          if(tag == URING_TIMEOUT)
+            {
+              timeout_posted = 0;
+              continue;
+            }
+          if(tag == URING_FRAME_TIMER)
+            {
+              uint64_t expired;
+              if(read(w->frame_timer, &expired, sizeof(expired)) > 0) { worker_frame_timeout(w); }
+              worker_post_poll(ring, w->frame_timer, URING_FRAME_TIMER);
+              continue;
+            }
+          if(tag == URING_WATCH)
+            {
+              worker_watch_read(w);
+              worker_post_poll(ring, w->watch_fd, URING_WATCH);
+              watched = 1;
+              continue;
+            }
+
+          i = (int)tag;
+          port = w->ports[i];
+          if(res > 0) { worker_received(w, port, bufs[i], res); }
+          else if(res == 0 || (res != -EAGAIN && res != -EINTR))
+            {
+              /* EOF or error. */
+              if(res < 0) { fprintf (stderr, "%s: error %d while reading serial device %s\n", progname, -res, port->cfg.device); }
+              bufs[i] = NULL;
+              if(worker_port_gone(w, port)) { nopen--; }
+              continue;
+            }
+          worker_post_read(w, ring, i, bufs);
+        }
+
+      /* Gone devices that are back go on where they left off. */
+      if(w->nlost && worker_retry_due(w, watched))
+        {
+          for(i = 0; i < w->nports; i++)
+            {
+              if(w->ports[i]->lost_ns && !worker_reconnect(w, w->ports[i])) { worker_post_read(w, ring, i, bufs); }
+            }
+        }
+
+      if(deadline_passed(&w->deadline)) { break; }
+    }
+
+  /* The posted reads point into the rings, cancel them and wait until the
+     kernel is done with them before the rings go away. */
+  for(i = 0; i < w->nports; i++)
+    {
+      if(!bufs[i]) { continue; }
+      sqe = uring_get_sqe(ring);
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = i;
+      sqe->user_data = URING_CANCEL;
+    }
+  if(timeout_posted)
+    {
+      sqe = uring_get_sqe(ring);
+      sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+      sqe->addr = URING_TIMEOUT;
+      sqe->user_data = URING_CANCEL;
+    }
+  if(timer_posted)
+    {
+      sqe = uring_get_sqe(ring);
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->addr = URING_FRAME_TIMER;
+      sqe->user_data = URING_CANCEL;
+    }
+  if(watch_posted)
+    {
+      sqe = uring_get_sqe(ring);
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->addr = URING_WATCH;
+      sqe->user_data = URING_CANCEL;
+    }
+
+  for(;;)
+    {
+      int pending = timeout_posted + timer_posted + watch_posted;
+
+      for(i = 0; i < w->nports; i++) { pending += (bufs[i] != NULL); }
+      if(!pending || uring_submit(ring, 1) < 0) { break; }
+
+      while((cqe = uring_peek_cqe(ring)))
+        {
+          uint64_t tag = cqe->user_data;
+          int res = cqe->res;
+
+          uring_cqe_seen(ring, cqe);
+          if(tag == URING_TIMEOUT) { timeout_posted = 0; }
+          else if(tag == URING_FRAME_TIMER) { timer_posted = 0; }
+          else if(tag == URING_WATCH) { watch_posted = 0; }
+          else if(tag != URING_CANCEL)
+            {
+              i = (int)tag;
+              if(res > 0) { worker_received(w, w->ports[i], bufs[i], res); }
+              bufs[i] = NULL;
+            }
+        }
+    }
+
+  free(bufs);
+}
+
+
+/* Run the io_uring loop if the kernel and the ports support it. Returns -1
+   when the poll loop has to be used instead. */
+static int worker_try_uring(worker_t* w)
+{
+  uring_t ring;
+
+  if(uring_init(&ring, w->nports + 4))
+    {
+      fprintf (stderr, "%s: io_uring is not available, using poll\n", progname);
+      return -1;
+    }
+
+  worker_loop_uring(w, &ring);
+  uring_free(&ring);
+  return 0;
+}
+
+#else
+
+static int worker_try_uring(worker_t* w)
+{
+  (void)w;
+  fprintf (stderr, "%s: io_uring is not available, using poll\n", progname);
+  return -1;
+}
+
+#endif
+
+
+void* worker_run(void* arg)
+{
+  worker_t* w = arg;
+  int i;
+
+  if(w->cpu >= 0)
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(w->cpu, &set);
+      if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        {
+          fprintf (stderr, "%s: can not pin worker to CPU %d\n", progname, w->cpu);
+        }
+    }
+
+  w->frame_timer = -1;
+  w->frame_deadline_ns = 0;
+  w->watch_fd = -1;
+  w->nlost = 0;
+
+  /* The poll loop sleeps for reads put off only as long as every serial
+     port can wait, and not at all when one of them is not coalesced. */
+  w->coalesce_ns = 0;
+  for(i = 0; i < w->nports; i++)
+    {
+      port_t* port = w->ports[i];
+
+      if(!port->serial_port) { continue; }
+      if(!port->coalesce_ns)
+        {
+          w->coalesce_ns = 0;
+          break;
+        }
+      if(!w->coalesce_ns || port->coalesce_ns < w->coalesce_ns) { w->coalesce_ns = port->coalesce_ns; }
+    }
+
+  for(i = 0; i < w->nports; i++)
+    {
+      port_t* port = w->ports[i];
+      int dedup = DEDUP_OFF;
+
+      tstamp_init(&port->tstamp, w->stamp, &startup_timestamp);
+      tstamp_init(&port->repeat_tstamp, w->stamp ? w->stamp : FMT_ISO, &startup_timestamp);
+
+      /* Lines are compared in the ascii format, byte runs in hex, raw
+         and bin output stay the data received. */
+      if(port->cfg.dedup && port->cfg.output_fmt == FMT_ACSII) { dedup = DEDUP_LINES; }
+      else if(port->cfg.dedup && (port->cfg.output_fmt == FMT_HEX_LC || port->cfg.output_fmt == FMT_HEX_UC))
+        {
+          dedup = DEDUP_BYTES;
+        }
+      if(dedup_init(&port->dedup, dedup, port->cfg.dedup_mask, port->cfg.dedup_mask_len, worker_dedup_emit, port))
+        {
+          fprintf (stderr, "%s: out of memory\n", progname);
+          exit(0);
+        }
+      if(port->cfg.trigger
+         && trigger_port_init(&port->trigger, port->cfg.trigger, &port->cfg.trigger_window))
+        {
+          fprintf (stderr, "%s: out of memory\n", progname);
+          exit(0);
+        }
+      if(port->frame_gap_ns && w->frame_timer < 0)
+        {
+          w->frame_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+          if(w->frame_timer < 0)
+            {
+              fprintf (stderr, "%s: can not create frame timer\n", progname);
+              exit(0);
+            }
+        }
+
+      /* Without the watch gone devices are only tried every retry interval. */
+      if(port->cfg.reconnect && port->serial_port && w->watch_fd < 0)
+        {
+          w->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+          if(w->watch_fd < 0) { fprintf (stderr, "%s: can not watch device directories\n", progname); }
+        }
+    }
+
+  if(w->ring_size && worker_start_writer(w))
+    {
+      fprintf (stderr, "%s: can not start writer thread\n", progname);
+      exit(0);
+    }
+
+  /* Only the reader runs realtime, the writer started above keeps normal
+     scheduling, so formatting and writing never delay the next read. */
+  if(w->rt_priority)
+    {
+      struct sched_param param;
+      int err;
+
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = w->rt_priority;
+      err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      if(err)
+        {
+          fprintf (stderr, "%s: can not set realtime priority %d: %s\n", progname, w->rt_priority, strerror(err));
+        }
+    }
+
+  if(w->engine != WORKER_ENGINE_URING || worker_try_uring(w))
+    {
+      worker_loop_poll(w);
+    }
+
+  for(i = 0; i < w->nports; i++)
+    {
+      worker_frame_end(w, w->ports[i]);
+      port_close(w->ports[i]);
+    }
+
+  if(w->ring_size) { worker_stop_writer(w); }
+  if(w->frame_timer >= 0) { close(w->frame_timer); }
+  if(w->watch_fd >= 0) { close(w->watch_fd); }
+  for(i = 0; i < w->nports; i++)
+    {
+      port_t* port = w->ports[i];
+
+      trigger_port_free(&port->trigger);
+      if(port->dedup.mode)
+        {
+          output_lock(port->out);
+          dedup_flush(&port->dedup);
+          output_unlock(port->out);
+        }
+      dedup_free(&port->dedup);
+    }
+
+  return NULL;
+}
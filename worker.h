@@ -0,0 +1,89 @@
+/* ttylog - serial port logger
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef _TTYLOG_WORKER_H_
+#define _TTYLOG_WORKER_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "port.h"
+
+
+/* Default size of the per port ring. */
+#define WORKER_RING_SIZE (256 * 1024)
+
+/* Default reorder window of --merge. */
+#define WORKER_MERGE_WINDOW_NS 20000000LL
+
+/* Devices waited for with --reconnect are also tried this often, in case
+   a change of their directory was missed. */
+#define WORKER_RECONNECT_RETRY_NS 1000000000LL
+
+
+/* I/O engines. */
+enum
+{
+  WORKER_ENGINE_POLL = 0,   /* epoll/poll() readiness, read() and write(). */
+  WORKER_ENGINE_URING = 1,  /* io_uring, falls back to poll when not supported. */
+};
+
+
+/* Capture worker. Its reader services its share of the ports from one
+   event loop. With a ring size set, the reader only moves data into the
+   per port rings and a separate writer thread formats and outputs it, so
+   slow output can not stall reading the devices. With a merge window the
+   writer outputs the chunks of all ports in the order they were received. */
+typedef struct
+{
+  port_t** ports;
+  int nports;
+  int cpu;                  /* CPU to pin the reader to, -1 for no pinning. */
+  int rt_priority;          /* SCHED_FIFO priority of the reader, 0 for normal scheduling. */
+  int stamp;                /* Timestamp format, 0 for none. */
+  struct timespec deadline; /* Stop time, tv_sec == 0 for no timeout. */
+  size_t ring_size;         /* Per port ring size, 0 to format in the reader. */
+  int engine;               /* WORKER_ENGINE_*. */
+  int64_t merge_ns;         /* Reorder window of --merge, 0 to output the ports independently. */
+  int64_t coalesce_ns;      /* Longest sleep of the poll loop for reads put off, 0 for none. */
+  pthread_t thread;
+
+  /* Reader side framing, see --frame-gap. */
+  int frame_timer;          /* timerfd ending idle frames, -1 when no port is framed. */
+  int64_t frame_deadline_ns;  /* Expiry the timer is set to, 0 when not set. */
+
+  /* Reader side reconnecting, see --reconnect. */
+  int watch_fd;             /* inotify of the directories of gone devices, -1 when none reconnects. */
+  int nlost;                /* Ports waiting for their device to come back. */
+  int64_t retry_ns;         /* Next time they are tried without a directory change. */
+
+  /* Reader to writer signalling. */
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  _Atomic int writer_sleeping;
+  _Atomic int done;
+} worker_t;
+
+
+/* Run worker until all of its ports are closed or the deadline passes.
+   Usable directly or as a pthread start routine. */
+void* worker_run(void* arg);
+
+#endif